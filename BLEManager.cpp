@@ -1,32 +1,70 @@
 #include "BLEManager.h"
 #include "CRUDHandler.h"
-#include "QueueManager.h"
+#include "StreamSubscriptions.h"
 #include "MemoryManager.h"  // Include the new memory manager
+#include "BleFragmentWriter.h"
 #include <esp_heap_caps.h>
+#include <esp_gap_ble_api.h>
 #include <new>
 
+// #define DEBUG_BLE_MANAGER // Uncomment to log every received command
+
+#define BLE_DEBUG_PREFIX_BYTES 128  // Logged part of a JSON command
+
 BLEManager::BLEManager(const String& name, CRUDHandler* cmdHandler)
-  : serviceName(name), handler(cmdHandler), processing(false), streamTaskHandle(nullptr), commandBufferIndex(0) {
-  memset(commandBuffer, 0, COMMAND_BUFFER_SIZE);
-  commandQueue = xQueueCreate(20, sizeof(char*));  // Queue now holds char pointers
+  : serviceName(name), handler(cmdHandler), streamTaskHandle(nullptr), commandArena{ nullptr, 0, 0 },
+    pFlowChar(nullptr), clientConnected(false), connId(0), negotiatedMtu(BLE_DEFAULT_MTU), bytesNotified(0),
+    fragmentsSent(0), responsesSent(0), sendMicros(0), responseFlow(false), responseFailed(false),
+    responseBytes(0), responseStart(0),
+    retransmits(0), flowStalls(0), abortedResponses(0),
+    binaryNegotiated(false), compressResponses(false), deflater(nullptr),
+    compressedBody(COMMAND_BUFFER_SIZE * 4), compressedResponses(0), responseAirBytes(0) {
+  memset(slots, 0, sizeof(slots));
+  for (int i = 0; i < BLE_WORKER_COUNT; i++) {
+    workers[i].task = nullptr;
+    workers[i].binary = false;
+    workers[i].seq = 0;
+    workers[i].requestId = -1;
+    workers[i].capture = nullptr;
+    workers[i].captureVersion = 0;
+  }
+  commandQueue = xQueueCreate(20, sizeof(BleCommand));  // Queue holds pointer + length
+  sendMutex = xSemaphoreCreateMutex();
+  flowEvents = xEventGroupCreate();
 }
 
 BLEManager::~BLEManager() {
   stop();
   if (commandQueue) {
     // Purge the queue of any remaining pointers
-    char* cmd;
+    BleCommand cmd;
     while (xQueueReceive(commandQueue, &cmd, 0)) {
-      heap_caps_free(cmd);
+      heap_caps_free(cmd.data);
     }
     vQueueDelete(commandQueue);
   }
+  freeArena(commandArena);
+  for (int i = 0; i < BLE_MAX_INFLIGHT; i++) {
+    freeArena(slots[i].arena);
+  }
+  if (deflater) {
+    delete deflater;
+  }
+  if (sendMutex) {
+    vSemaphoreDelete(sendMutex);
+  }
+  if (flowEvents) {
+    vEventGroupDelete(flowEvents);
+  }
 }
 
 bool BLEManager::begin() {
   // Initialize BLE
   BLEDevice::init(serviceName.c_str());
 
+  // Offer a large MTU; the client starts the exchange and onMtuChanged reports the result
+  BLEDevice::setMTU(BLE_LOCAL_MTU);
+
   // Create BLE Server
   pServer = BLEDevice::createServer();
   pServer->setCallbacks(this);
@@ -46,6 +84,17 @@ bool BLEManager::begin() {
     BLECharacteristic::PROPERTY_NOTIFY);
   // Deskriptor 2902 ditambahkan secara otomatis oleh library
 
+  // Create Flow Control Characteristic (Write without response)
+  pFlowChar = pService->createCharacteristic(
+    FLOW_CHAR_UUID,
+    BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_WRITE_NR);
+  pFlowChar->setCallbacks(this);
+
+  // Retransmission ring for flow-controlled responses
+  if (!flow.begin()) {
+    Serial.println("WARNING: No memory for BLE retransmit ring, flow control disabled");
+  }
+
   // Start service
   pService->start();
 
@@ -57,16 +106,20 @@ bool BLEManager::begin() {
   pAdvertising->setMinPreferred(0x12);
   BLEDevice::startAdvertising();
 
-  // Create command processing task with PSRAM stack
-  xTaskCreatePinnedToCore(
-    commandProcessingTask,
-    "BLE_CMD_TASK",
-    8192,  // Increased stack size for PSRAM usage
-    this,
-    1,
-    &commandTaskHandle,
-    1  // Pin to core 1
-  );
+  // Create the command worker pool; reads run in parallel, writes alone
+  for (int i = 0; i < BLE_WORKER_COUNT; i++) {
+    char taskName[16];
+    snprintf(taskName, sizeof(taskName), "BLE_CMD_TASK_%d", i);
+    xTaskCreatePinnedToCore(
+      commandProcessingTask,
+      taskName,
+      8192,  // Increased stack size for PSRAM usage
+      this,
+      1,
+      &workers[i].task,
+      1  // Pin to core 1
+    );
+  }
 
   // Create streaming task
   xTaskCreatePinnedToCore(
@@ -83,9 +136,11 @@ bool BLEManager::begin() {
 }
 
 void BLEManager::stop() {
-  if (commandTaskHandle) {
-    vTaskDelete(commandTaskHandle);
-    commandTaskHandle = nullptr;
+  for (int i = 0; i < BLE_WORKER_COUNT; i++) {
+    if (workers[i].task) {
+      vTaskDelete(workers[i].task);
+      workers[i].task = nullptr;
+    }
   }
 
   if (streamTaskHandle) {
@@ -99,117 +154,433 @@ void BLEManager::stop() {
   }
 }
 
-void BLEManager::onConnect(BLEServer* pServer) {
+void BLEManager::onConnect(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
   Serial.println("BLE Client connected");
+  negotiatedMtu = BLE_DEFAULT_MTU;
+  connId = param->connect.conn_id;
+  flow.reset();
+  clientConnected = true;
+
+  // Ask for a short connection interval; the central may refuse or adjust it
+  pServer->updateConnParams(param->connect.remote_bda, BLE_CONN_INTERVAL_MIN, BLE_CONN_INTERVAL_MAX, 0, BLE_CONN_TIMEOUT);
+
+#ifdef SOC_BLE_50_SUPPORTED
+  // Prefer the 2M PHY; peers without it stay on 1M
+  esp_ble_gap_set_preferred_phy(param->connect.remote_bda, 0,
+                                ESP_BLE_GAP_PHY_2M_PREF_MASK, ESP_BLE_GAP_PHY_2M_PREF_MASK,
+                                ESP_BLE_GAP_PHY_OPTIONS_NO_PREF);
+#endif
+}
+
+void BLEManager::onMtuChanged(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) {
+  negotiatedMtu = param->mtu.mtu;
+  Serial.printf("BLE MTU negotiated: %u (fragment %u bytes)\n", negotiatedMtu, (unsigned)fragmentSize());
 }
 
 void BLEManager::onDisconnect(BLEServer* pServer) {
   Serial.println("BLE Client disconnected");
+  negotiatedMtu = BLE_DEFAULT_MTU;
+  clientConnected = false;
+  binaryNegotiated = false;
+  for (int i = 0; i < BLE_MAX_INFLIGHT; i++) {
+    slots[i].active = false;  // Partial commands die with the connection
+    slots[i].arena.length = 0;
+  }
+  commandArena.length = 0;
+  compressResponses = false;
+  if (flowEvents) {
+    xEventGroupSetBits(flowEvents, BIT0);  // Wake a sender waiting for credits
+  }
 
   // Stop streaming when client disconnects
-  extern CRUDHandler* crudHandler;
-  if (crudHandler) {
-    crudHandler->clearStreamDeviceId(); // Harusnya ini memanggil fungsi thread-safe
-    QueueManager* queueMgr = QueueManager::getInstance();
-    if (queueMgr) {
-      queueMgr->clearStream();
-    }
-    Serial.println("Cleared streaming on disconnect");
-  }
+  StreamSubscriptions::getInstance()->clear();
+  Serial.println("Cleared streaming on disconnect");
 
   BLEDevice::startAdvertising();  // Restart advertising
 }
 
 void BLEManager::onWrite(BLECharacteristic* pCharacteristic) {
   if (pCharacteristic == pCommandChar) {
-    String value = pCharacteristic->getValue().c_str();
-    receiveFragment(value);
+    // Raw bytes: binary requests may contain NUL
+    receiveFragment(pCharacteristic->getData(), pCharacteristic->getLength());
+  } else if (pCharacteristic == pFlowChar) {
+    flow.handleWrite(pCharacteristic->getData(), pCharacteristic->getLength());
+    xEventGroupSetBits(flowEvents, BIT0);
   }
 }
 
-void BLEManager::receiveFragment(const String& fragment) {
-  if (processing) return;
+bool BLEManager::binaryFrameComplete(const char* buffer, size_t index) {
+  if (index < BLE_MSG_HEADER_SIZE || (uint8_t)buffer[0] != BLE_BINARY_VERSION) {
+    return false;
+  }
+  uint32_t bodyLength = (uint8_t)buffer[5] | ((uint8_t)buffer[6] << 8) |
+                        ((uint8_t)buffer[7] << 16) | ((uint32_t)(uint8_t)buffer[8] << 24);
+  return index >= BLE_MSG_HEADER_SIZE + bodyLength;
+}
 
-  if (fragment == "<END>") {
-    processing = true;
-    commandBuffer[commandBufferIndex] = '\0';  // Null-terminate the command
+void BLEManager::receiveFragment(const uint8_t* data, size_t length) {
+  // Multiplexed fragment: marker, request id, then command bytes
+  if (length >= BLE_MUX_HEADER_SIZE && data[0] == BLE_MUX_MARKER) {
+    uint16_t requestId = data[1] | (data[2] << 8);
+    Reassembly& slot = slotFor(requestId);
+    slot.lastWrite = millis();
+    if (appendFragment(slot.arena, data + BLE_MUX_HEADER_SIZE, length - BLE_MUX_HEADER_SIZE, requestId)) {
+      slot.active = false;
+    }
+    return;
+  }
 
-    // Allocate a buffer in PSRAM for the complete command
-    char* cmdBuffer = (char*)heap_caps_malloc(commandBufferIndex + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-    if (cmdBuffer) {
-      strcpy(cmdBuffer, commandBuffer);
-      if (xQueueSend(commandQueue, &cmdBuffer, 0) != pdPASS) {
-        // If queue is full, free the memory we just allocated
-        heap_caps_free(cmdBuffer);
-        Serial.println("BLE command queue full, command dropped.");
-      }
-    } else {
-      Serial.println("ERROR: Failed to allocate memory for BLE command!");
+  appendFragment(commandArena, data, length, -1);
+}
+
+BLEManager::Reassembly& BLEManager::slotFor(uint16_t requestId) {
+  Reassembly* freeSlot = nullptr;
+  Reassembly* oldest = nullptr;
+  for (int i = 0; i < BLE_MAX_INFLIGHT; i++) {
+    Reassembly& slot = slots[i];
+    if (slot.active && slot.requestId == requestId) {
+      return slot;
     }
+    if (!slot.active && !freeSlot) {
+      freeSlot = &slot;
+    }
+    if (slot.active && (!oldest || (long)(slot.lastWrite - oldest->lastWrite) < 0)) {
+      oldest = &slot;
+    }
+  }
 
-    // Reset buffer
-    commandBufferIndex = 0;
-    memset(commandBuffer, 0, COMMAND_BUFFER_SIZE);
-    processing = false;
-  } else {
-    size_t fragmentLen = fragment.length();
-    if (commandBufferIndex + fragmentLen < COMMAND_BUFFER_SIZE) {
-      memcpy(commandBuffer + commandBufferIndex, fragment.c_str(), fragmentLen);
-      commandBufferIndex += fragmentLen;
-    } else {
-      Serial.println("ERROR: BLE command buffer overflow!");
-      commandBufferIndex = 0;
-      memset(commandBuffer, 0, COMMAND_BUFFER_SIZE);
-      sendError("Command too long, buffer overflow.");
+  if (!freeSlot) {
+    // Every slot is taken: the client abandoned the oldest command, which
+    // is answered with an error so it does not wait for a reply forever
+    Serial.printf("BLE request %u evicted by request %u\n", oldest->requestId, requestId);
+    rejectCommand(oldest->arena, oldest->requestId, "Too many commands in flight");
+    freeSlot = oldest;
+  }
+  freeSlot->active = true;
+  freeSlot->requestId = requestId;
+  freeSlot->arena.length = 0;
+  return *freeSlot;
+}
+
+bool BLEManager::growArena(CommandArena& arena, size_t needed) {
+  if (needed <= arena.capacity) {
+    return true;
+  }
+  if (needed > BLE_COMMAND_MAX_BYTES) {
+    return false;
+  }
+
+  size_t capacity = max(arena.capacity * 2, (size_t)BLE_COMMAND_INITIAL_BYTES);
+  while (capacity < needed) {
+    capacity *= 2;
+  }
+  capacity = min(capacity, (size_t)BLE_COMMAND_MAX_BYTES);
+
+  char* grown = (char*)heap_caps_realloc(arena.data, capacity, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!grown) {
+    grown = (char*)heap_caps_realloc(arena.data, capacity, MALLOC_CAP_8BIT);  // Fallback to internal RAM
+    if (!grown) {
+      return false;
+    }
+  }
+  arena.data = grown;
+  arena.capacity = capacity;
+  return true;
+}
+
+void BLEManager::freeArena(CommandArena& arena) {
+  if (arena.data) {
+    heap_caps_free(arena.data);
+  }
+  arena = { nullptr, 0, 0 };
+}
+
+bool BLEManager::appendFragment(CommandArena& arena, const uint8_t* data, size_t length, int32_t requestId) {
+  bool textEnd = length == 5 && memcmp(data, "<END>", 5) == 0;
+  if (!textEnd) {
+    // One spare byte for the terminator
+    if (!growArena(arena, arena.length + length + 1)) {
+      Serial.printf("ERROR: BLE command exceeds %u bytes or memory is low!\n", (unsigned)BLE_COMMAND_MAX_BYTES);
+      rejectCommand(arena, requestId, "Command too long, buffer overflow.");
+      return true;
     }
+    memcpy(arena.data + arena.length, data, length);
+    arena.length += length;
+  }
+
+  // JSON commands end with "<END>", binary ones when the header length is reached
+  if (!textEnd && !binaryFrameComplete(arena.data, arena.length)) {
+    return false;
+  }
+  if (!growArena(arena, arena.length + 1)) {
+    rejectCommand(arena, requestId, "Command too long, buffer overflow.");
+    return true;
+  }
+  arena.data[arena.length] = '\0';  // Null-terminate the command
+
+  // Hand the arena itself to a worker; the next command starts a new one
+  BleCommand cmd = { arena.data, arena.length, requestId, nullptr };
+  if (xQueueSend(commandQueue, &cmd, 0) == pdPASS) {
+    arena = { nullptr, 0, 0 };
+  } else {
+    Serial.println("BLE command queue full, command dropped.");
+    arena.length = 0;  // Keep the buffer for the next command
+  }
+  return true;
+}
+
+void BLEManager::rejectCommand(CommandArena& arena, int32_t requestId, const char* error) {
+  // Runs on the BLE callback task, which must never send: sending waits for
+  // credits that arrive on this same task. A worker answers instead, and
+  // gets the message header so it can reply in the request's encoding.
+  BleCommand cmd = { arena.data, min(arena.length, (size_t)BLE_MSG_HEADER_SIZE), requestId, error };
+  if (xQueueSend(commandQueue, &cmd, 0) == pdPASS) {
+    arena = { nullptr, 0, 0 };
+  } else {
+    Serial.printf("BLE command queue full, error not sent: %s\n", error);
+    arena.length = 0;
   }
 }
 
 void BLEManager::commandProcessingTask(void* parameter) {
   BLEManager* manager = static_cast<BLEManager*>(parameter);
-  char* command;
+  BleCommand command;
 
   while (true) {
     if (xQueueReceive(manager->commandQueue, &command, portMAX_DELAY)) {
       manager->handleCompleteCommand(command);
-      heap_caps_free(command);  // Free the memory allocated in receiveFragment
+      heap_caps_free(command.data);  // The arena handed over by appendFragment
     }
   }
 }
 
-void BLEManager::handleCompleteCommand(const char* command) {
-  Serial.printf("DEBUG: Raw JSON command: %s\n", command);
+BLEManager::CommandContext* BLEManager::currentContext() {
+  TaskHandle_t self = xTaskGetCurrentTaskHandle();
+  for (int i = 0; i < BLE_WORKER_COUNT; i++) {
+    if (workers[i].task == self) {
+      return &workers[i];
+    }
+  }
+  return nullptr;  // Streaming task or BLE callback
+}
 
-  // --- PERUBAHAN DI SINI ---
-  // Kita KEMBALI menggunakan DynamicJsonDocument HANYA untuk alokasi PSRAM
-  // karena MemoryManager.h Anda (make_psram_unique) dibuat untuk v6.
-  // Ini akan menghasilkan WARNING, tapi MENGHILANGKAN ERROR kompilasi.
-  auto doc = make_psram_unique<DynamicJsonDocument>(4096);
-  // --- AKHIR PERUBAHAN ---
+void BLEManager::handleCompleteCommand(const BleCommand& command) {
+  // The document and its pool live in PSRAM and grow with the command, so
+  // its size is bounded only by BLE_COMMAND_MAX_BYTES. The parser reads the
+  // arena in place; ArduinoJson 7 stores each distinct string once in the
+  // pool (it has no zero-copy mode).
+  auto doc = make_psram_unique<JsonDocument>(PsramAllocator::instance());
+
+  // Reply in the encoding of the request, tagged with its id
+  CommandContext* context = currentContext();
+  const uint8_t* header = (const uint8_t*)command.data;
+  context->binary = command.length >= BLE_MSG_HEADER_SIZE && header[0] == BLE_BINARY_VERSION;
+  context->seq = context->binary ? (header[3] | (header[4] << 8)) : 0;
+  context->requestId = context->binary ? -1 : command.requestId;
+  context->key = "";
+  context->capture = nullptr;
+
+  if (command.error) {
+    sendError(command.error);
+    return;
+  }
 
   if (!doc) {
     sendError("PSRAM allocation failed for JSON document.");
     return;
   }
 
-  DeserializationError error = deserializeJson(*doc, command);
+  DeserializationError error;
+  if (context->binary) {
+#ifdef DEBUG_BLE_MANAGER
+    Serial.printf("DEBUG: Binary command: seq %u, %u bytes\n", context->seq, (unsigned)command.length);
+#endif
+    if (header[1] != BLE_MSG_REQUEST || (header[2] & BLE_MSG_FLAG_DEFLATE)) {
+      sendError("Unsupported binary message type or flags");
+      return;
+    }
+    error = deserializeMsgPack(*doc, command.data + BLE_MSG_HEADER_SIZE, command.length - BLE_MSG_HEADER_SIZE);
+  } else {
+#ifdef DEBUG_BLE_MANAGER
+    // Commands run up to BLE_COMMAND_MAX_BYTES; only the start is logged
+    Serial.printf("DEBUG: JSON command, %u bytes: %.*s%s\n", (unsigned)command.length,
+                  (int)min(command.length, (size_t)BLE_DEBUG_PREFIX_BYTES), command.data,
+                  command.length > BLE_DEBUG_PREFIX_BYTES ? "..." : "");
+#endif
+    error = deserializeJson(*doc, command.data, command.length);
+  }
 
   if (error) {
-    sendError("Invalid JSON: " + String(error.c_str()));
+    sendError((context->binary ? "Invalid MessagePack: " : "Invalid JSON: ") + String(error.c_str()));
     return;
   }
 
-  if (handler) {
+  if (context->requestId < 0 && !context->binary && (*doc)["request_id"].is<uint16_t>()) {
+    context->requestId = (*doc)["request_id"].as<uint16_t>();
+  }
+
+  String op = (*doc)["op"] | "";
+  context->key = op + "/" + String((*doc)["type"] | "");
+  bool readOnly = op == "read";
+  if (readOnly) {
+    commandLock.lockRead();
+  } else {
+    commandLock.lockWrite();
+  }
+
+  if (context->key == "update/ble_protocol") {
+    handleProtocolCommand(*doc);
+  } else if (handler) {
     handler->handle(this, *doc);
   } else {
     sendError("No handler configured");
   }
+
+  if (readOnly) {
+    commandLock.unlockRead();
+  } else {
+    commandLock.unlockWrite();
+  }
+}
+
+void BLEManager::handleProtocolCommand(const JsonDocument& command) {
+  // {"op":"update","type":"ble_protocol","protocol":"binary"|"json","compression":"deflate"|"none"}
+  String protocol = command["protocol"] | "binary";
+  String compression = command["compression"] | "none";
+
+  bool compress = protocol == "binary" && compression == "deflate";
+  if (compress && !deflater) {
+    deflater = new DeflateStream(BLE_COMPRESS_WINDOW_BITS);
+    if (!deflater->isReady()) {
+      delete deflater;
+      deflater = nullptr;
+      compress = false;
+    }
+  }
+  binaryNegotiated = protocol == "binary";
+  compressResponses = compress;
+
+  // --- PERUBAHAN DI SINI ---
+  // Gunakan StaticJsonDocument untuk alokasi di stack
+  StaticJsonDocument<256> response;
+  // --- AKHIR PERUBAHAN ---
+  response["status"] = "ok";
+  response["protocol"] = binaryNegotiated ? "binary" : "json";
+  response["version"] = binaryNegotiated ? BLE_BINARY_VERSION : 1;
+  response["encoding"] = binaryNegotiated ? "msgpack" : "json";
+  response["compression"] = compressResponses ? "deflate" : "none";
+  response["compress_min_bytes"] = BLE_COMPRESS_MIN_BYTES;
+  sendResponse(response);
 }
 
 void BLEManager::sendResponse(const JsonDocument& data) {
-  String response;
-  serializeJson(data, response);
-  sendFragmented(response);
+  CommandContext* context = currentContext();
+  if (!context) {
+    sendMessage(data, false, BLE_MSG_RESPONSE, 0, "");
+    return;
+  }
+
+  PsramBuffer* capture = context->capture;
+  context->capture = nullptr;
+  if (capture && strcmp(data["status"] | "", "ok") == 0) {
+    // Successful read being cached: stamp the version and keep the body
+    JsonDocument versioned(PsramAllocator::instance());
+    versioned.set(data);
+    versioned["version"] = context->captureVersion;
+    if (context->binary) {
+      serializeMsgPack(versioned, *capture);
+    } else {
+      serializeJson(versioned, *capture);
+    }
+    if (!capture->overflowed()) {
+      sendSerialized(capture->data(), capture->size());
+      return;
+    }
+    capture->clear();  // Too large to cache
+    sendMessage(versioned, context->binary, BLE_MSG_RESPONSE, context->seq, context->key, context->requestId);
+    return;
+  }
+  sendMessage(data, context->binary, BLE_MSG_RESPONSE, context->seq, context->key, context->requestId);
+}
+
+void BLEManager::captureResponse(PsramBuffer* out, uint32_t version) {
+  CommandContext* context = currentContext();
+  if (context) {
+    context->capture = out;
+    context->captureVersion = version;
+  }
+}
+
+bool BLEManager::replyIsBinary() {
+  CommandContext* context = currentContext();
+  return context && context->binary;
+}
+
+void BLEManager::sendSerialized(const uint8_t* body, size_t length) {
+  CommandContext* context = currentContext();
+  if (context) {
+    sendBody(nullptr, body, length, context->binary, BLE_MSG_RESPONSE, context->seq, context->key, context->requestId);
+  } else {
+    sendBody(nullptr, body, length, false, BLE_MSG_RESPONSE, 0, "", -1);
+  }
+}
+
+void BLEManager::sendMessage(const JsonDocument& data, bool binary, uint8_t type, uint16_t seq, const String& statKey,
+                             int32_t requestId) {
+  sendBody(&data, nullptr, 0, binary, type, seq, statKey, requestId);
+}
+
+void BLEManager::sendBody(const JsonDocument* data, const uint8_t* raw, size_t rawLength, bool binary, uint8_t type,
+                          uint16_t seq, const String& statKey, int32_t requestId) {
+  // Serialise straight into notifications; peak memory is one fragment
+  // (plus the compressed body when deflate is used). raw is a body that
+  // was serialised earlier in the same encoding.
+  beginResponse();
+  BleFragmentWriter writer(*this, fragmentBuffer, payloadSize());
+
+  if (!binary) {
+    if (requestId >= 0) {
+      writer.tagRequestId(requestId);
+    }
+    if (data) {
+      serializeJson(*data, writer);
+    } else {
+      writer.write(raw, rawLength);
+    }
+  } else {
+    size_t bodyLength = data ? measureMsgPack(*data) : rawLength;
+    uint8_t flags = 0;
+    if (compressResponses && deflater && bodyLength >= BLE_COMPRESS_MIN_BYTES) {
+      compressedBody.clear();
+      deflater->reset(compressedBody, DeflateWrapper::ZLIB);
+      if (data) {
+        serializeMsgPack(*data, *deflater);
+      } else {
+        deflater->write(raw, rawLength);
+      }
+      if (deflater->finish() && !compressedBody.overflowed() && compressedBody.size() < bodyLength) {
+        flags |= BLE_MSG_FLAG_DEFLATE;
+        bodyLength = compressedBody.size();
+        compressedResponses++;
+      }
+    }
+
+    uint8_t header[BLE_MSG_HEADER_SIZE] = {
+      BLE_BINARY_VERSION, type, flags, (uint8_t)(seq & 0xFF), (uint8_t)(seq >> 8),
+      (uint8_t)(bodyLength & 0xFF), (uint8_t)(bodyLength >> 8), (uint8_t)(bodyLength >> 16), (uint8_t)(bodyLength >> 24)
+    };
+    writer.write(header, sizeof(header));
+    if (flags & BLE_MSG_FLAG_DEFLATE) {
+      writer.write(compressedBody.data(), compressedBody.size());
+    } else if (data) {
+      serializeMsgPack(*data, writer);
+    } else {
+      writer.write(raw, rawLength);
+    }
+  }
+
+  writer.finish();
+  endResponse(binary, statKey);
 }
 
 void BLEManager::sendError(const String& message) {
@@ -231,60 +602,275 @@ void BLEManager::sendSuccess() {
   sendResponse(doc);
 }
 
-void BLEManager::sendFragmented(const String& data) {
-  if (!pResponseChar) return;
+size_t BLEManager::fragmentSize() const {
+  // A notification carries MTU - 3 bytes of attribute value
+  size_t size = negotiatedMtu - BLE_ATT_HEADER_SIZE;
+  return size > BLE_MAX_FRAGMENT_SIZE ? BLE_MAX_FRAGMENT_SIZE : size;
+}
 
-  int i = 0;
-  while (i < data.length()) {
-    int end = i + CHUNK_SIZE;
-    if (end > data.length()) {
-      end = data.length();
+size_t BLEManager::payloadSize() const {
+  return responseFlow ? fragmentSize() - BLE_FRAME_HEADER_SIZE : fragmentSize();
+}
+
+void BLEManager::beginResponse() {
+  if (sendMutex) {
+    xSemaphoreTake(sendMutex, portMAX_DELAY);
+  }
+  // The framing is fixed for the whole response even if credits arrive midway
+  responseFlow = flow.isEnabled() && flow.isReady();
+  responseFailed = !pResponseChar || !clientConnected;
+  responseBytes = 0;
+  responseAirBytes = 0;
+  responseStart = micros();
+}
+
+bool BLEManager::sendFragment(const uint8_t* data, size_t length) {
+  if (responseFailed) {
+    return false;
+  }
+  if (!sendFrame(data, length, 0)) {
+    responseFailed = true;
+    abortedResponses++;
+    Serial.println("BLE response aborted: link stalled or disconnected");
+    return false;
+  }
+  responseBytes += length;
+  return true;
+}
+
+void BLEManager::endResponse(bool binary, const String& statKey) {
+  if (!responseFailed) {
+    if (responseFlow) {
+      // Stay until the client acks the END, so a lost tail is still resent
+      if (!sendFrame(nullptr, 0, BLE_FRAME_FLAG_END) || !waitForDrain()) {
+        abortedResponses++;
+        Serial.println("BLE response tail not acknowledged");
+      }
+    } else {
+      notifyRaw((const uint8_t*)"<END>", 5);
     }
+  }
+
+  sendMicros += micros() - responseStart;
+  bytesNotified += responseBytes;
+  responsesSent++;
 
-    String chunk = data.substring(i, end);
-    pResponseChar->setValue(chunk.c_str());
-    pResponseChar->notify();
+  AirStats& air = airStats[binary ? 1 : 0][statKey.length() ? statKey : String("other")];
+  air.count++;
+  air.bytes += responseAirBytes;
+  if (sendMutex) {
+    xSemaphoreGive(sendMutex);
+  }
+}
 
-    vTaskDelay(pdMS_TO_TICKS(FRAGMENT_DELAY_MS));
-    i = end;
+bool BLEManager::notifyRaw(const uint8_t* data, size_t length) {
+  // Send only when the controller has a free buffer, so notifications are
+  // not dropped; this replaces a fixed delay between fragments
+  unsigned long start = millis();
+  bool stalled = false;
+  while (esp_ble_get_cur_sendable_packets_num(connId) == 0) {
+    if (!clientConnected || millis() - start > BLE_SEND_TIMEOUT_MS) {
+      return false;
+    }
+    if (!stalled) {
+      flowStalls++;
+      stalled = true;
+    }
+    vTaskDelay(pdMS_TO_TICKS(1));
   }
 
-  // Send end marker
-  pResponseChar->setValue("<END>");
+  pResponseChar->setValue((uint8_t*)data, length);
   pResponseChar->notify();
+  fragmentsSent++;
+  responseAirBytes += length + BLE_ATT_HEADER_SIZE;
+  return true;
+}
+
+bool BLEManager::sendFrame(const uint8_t* data, size_t length, uint8_t flags) {
+  if (!responseFlow) {
+    return length == 0 || notifyRaw(data, length);
+  }
+
+  if (!waitForWindow()) {
+    return false;
+  }
+
+  // Keep a copy until the client's ack passes it, for NAK retransmission
+  size_t frameLength;
+  const uint8_t* frame = flow.stage(data, length, flags, frameLength);
+  return notifyRaw(frame, frameLength);
+}
+
+bool BLEManager::waitForWindow() {
+  unsigned long lastProgress = millis();
+  uint16_t lastAck = flow.ack();
+
+  while (true) {
+    serviceNaks();
+
+    if (flow.hasWindow()) {
+      return true;
+    }
+    if (!clientConnected || !flow.isEnabled()) {
+      return false;
+    }
+
+    if (flow.ack() != lastAck) {
+      lastAck = flow.ack();
+      lastProgress = millis();
+    } else if (millis() - lastProgress > BLE_SEND_TIMEOUT_MS) {
+      return false;
+    }
+    flowStalls++;
+    xEventGroupWaitBits(flowEvents, BIT0, pdTRUE, pdFALSE, pdMS_TO_TICKS(100));
+  }
+}
+
+bool BLEManager::waitForDrain() {
+  unsigned long lastProgress = millis();
+  uint16_t lastAck = flow.ack();
+
+  while (true) {
+    serviceNaks();
+
+    if (flow.drained()) {
+      return true;
+    }
+    if (!clientConnected || !flow.isEnabled()) {
+      return false;
+    }
+
+    if (flow.ack() != lastAck) {
+      lastAck = flow.ack();
+      lastProgress = millis();
+    } else if (millis() - lastProgress > BLE_SEND_TIMEOUT_MS) {
+      return false;
+    }
+    xEventGroupWaitBits(flowEvents, BIT0, pdTRUE, pdFALSE, pdMS_TO_TICKS(100));
+  }
+}
+
+void BLEManager::serviceNaks() {
+  size_t frameLength;
+  const uint8_t* frame;
+  while ((frame = flow.nextRetransmit(frameLength)) != nullptr) {
+    if (notifyRaw(frame, frameLength)) {
+      retransmits++;
+    }
+  }
+}
+
+void BLEManager::runThroughputTest(size_t size) {
+  if (size == 0 || size > BLE_THROUGHPUT_MAX_BYTES) {
+    sendError("Throughput test size must be 1.." + String(BLE_THROUGHPUT_MAX_BYTES));
+    return;
+  }
+
+  // Known pattern so the app can verify what it received
+  static const char pattern[] = "0123456789ABCDEF";
+  String payload;
+  if (!payload.reserve(size)) {
+    sendError("Not enough memory for throughput test");
+    return;
+  }
+  for (size_t i = 0; i < size; i++) {
+    payload += pattern[i % 16];
+  }
+
+  auto doc = make_psram_unique<DynamicJsonDocument>(size + 256);
+  if (!doc) {
+    sendError("PSRAM allocation failed for JSON document.");
+    return;
+  }
+  (*doc)["status"] = "ok";
+  (*doc)["type"] = "ble_throughput";
+  (*doc)["payload"] = payload;
+  payload = String();
+
+  uint64_t bytesBefore = bytesNotified;
+  uint32_t fragmentsBefore = fragmentsSent;
+  unsigned long start = micros();
+  sendResponse(*doc);
+  unsigned long elapsed = micros() - start;
+  doc.reset();
+
+  StaticJsonDocument<512> result;
+  result["status"] = "ok";
+  result["type"] = "ble_throughput_result";
+  result["payload_bytes"] = size;
+  result["bytes_sent"] = bytesNotified - bytesBefore;
+  result["fragments"] = fragmentsSent - fragmentsBefore;
+  result["elapsed_ms"] = elapsed / 1000;
+  result["bytes_per_sec"] = elapsed ? (double)(bytesNotified - bytesBefore) * 1000000.0 / elapsed : 0.0;
+  JsonObject stats = result["link"].to<JsonObject>();
+  getThroughputStats(stats);
+  sendResponse(result);
+}
+
+void BLEManager::getThroughputStats(JsonObject& stats) {
+  stats["mtu"] = negotiatedMtu;
+  stats["fragment_size"] = fragmentSize();
+  stats["flow_control"] = flow.isEnabled();
+  stats["window"] = flow.isEnabled() ? flow.window() : 0;
+  stats["retransmits"] = retransmits;
+  stats["flow_stalls"] = flowStalls;
+  stats["aborted_responses"] = abortedResponses;
+  stats["responses_sent"] = responsesSent;
+  stats["fragments_sent"] = fragmentsSent;
+  stats["bytes_sent"] = bytesNotified;
+  stats["avg_bytes_per_sec"] = sendMicros ? (double)bytesNotified * 1000000.0 / sendMicros : 0.0;
+  stats["protocol"] = binaryNegotiated ? "binary" : "json";
+  stats["compressed_responses"] = compressedResponses;
+
+  // Average bytes on air per operation, per protocol, for comparison
+  static const char* const protocolNames[] = { "json", "binary" };
+  JsonObject air = stats["bytes_on_air"].to<JsonObject>();
+  if (sendMutex) {
+    xSemaphoreTake(sendMutex, portMAX_DELAY);  // The streaming task may be adding entries
+  }
+  for (int p = 0; p < 2; p++) {
+    if (airStats[p].empty()) {
+      continue;
+    }
+    JsonObject perProtocol = air[protocolNames[p]].to<JsonObject>();
+    for (const auto& entry : airStats[p]) {
+      JsonObject op = perProtocol[entry.first].to<JsonObject>();
+      op["count"] = entry.second.count;
+      op["avg_bytes"] = entry.second.count ? (double)entry.second.bytes / entry.second.count : 0.0;
+    }
+  }
+  if (sendMutex) {
+    xSemaphoreGive(sendMutex);
+  }
 }
 
 void BLEManager::streamingTask(void* parameter) {
   BLEManager* manager = static_cast<BLEManager*>(parameter);
-  QueueManager* queueMgr = QueueManager::getInstance();
+  StreamSubscriptions* subscriptions = StreamSubscriptions::getInstance();
 
   Serial.println("BLE Streaming task started");
-  int loopCount = 0;
 
   while (true) {
-    if (queueMgr && !queueMgr->isStreamEmpty()) {
+    // Send every sample that is due; rate-limited ones set how long to sleep
+    uint32_t waitMs;
+    char* json;
+    while ((json = subscriptions->takeDue(millis(), &waitMs)) != nullptr) {
       // --- PERUBAHAN DI SINI ---
       // Gunakan StaticJsonDocument untuk alokasi di stack
       StaticJsonDocument<512> dataDoc;
       // --- AKHIR PERUBAHAN ---
-      JsonObject dataPoint = dataDoc.to<JsonObject>();
-
-      if (queueMgr->dequeueStream(dataPoint)) {
-        Serial.println("Streaming data via BLE");
-        // --- PERUBAHAN DI SINI ---
-        // Gunakan StaticJsonDocument untuk alokasi di stack
-        StaticJsonDocument<512> response;
-        // --- AKHIR PERUBAHAN ---
-        response["status"] = "data";
-        response["data"] = dataPoint;
-        manager->sendResponse(response);
-      }
-    } else {
-      loopCount++;
-      if (loopCount % 100 == 0) {
-        Serial.printf("Stream queue empty, loop count: %d\n", loopCount);
+      DeserializationError error = deserializeJson(dataDoc, json);
+      heap_caps_free(json);
+      if (error) {
+        continue;
       }
+
+      StaticJsonDocument<512> response;
+      response["status"] = "data";
+      response["data"] = dataDoc;
+      manager->sendMessage(response, manager->binaryNegotiated, BLE_MSG_STREAM, 0, "stream");
     }
-    vTaskDelay(pdMS_TO_TICKS(100));
+
+    subscriptions->waitForData(waitMs == UINT32_MAX ? portMAX_DELAY : pdMS_TO_TICKS(max(waitMs, (uint32_t)1)));
   }
 }
\ No newline at end of file
@@ -9,45 +9,193 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/queue.h>
+#include <freertos/semphr.h>
+#include <freertos/event_groups.h>
+#include <map>
+#include "BleFlowControl.h"
+#include "DeflateStream.h"
+#include "PsramBuffer.h"
+#include "RwLock.h"
 
 // BLE UUIDs
 #define SERVICE_UUID "00001830-0000-1000-8000-00805f9b34fb"
 #define COMMAND_CHAR_UUID "11111111-1111-1111-1111-111111111101"
 #define RESPONSE_CHAR_UUID "11111111-1111-1111-1111-111111111102"
+#define FLOW_CHAR_UUID "11111111-1111-1111-1111-111111111103"
 
 // Constants
-#define CHUNK_SIZE 18
-#define FRAGMENT_DELAY_MS 50
+#define BLE_LOCAL_MTU 517         // Largest ATT MTU offered to the client
+#define BLE_DEFAULT_MTU 23        // ATT MTU before the client negotiates
+#define BLE_ATT_HEADER_SIZE 3     // Notification opcode + handle
+#define BLE_SEND_TIMEOUT_MS 5000  // Give up on a response if the link makes no progress
 #define COMMAND_BUFFER_SIZE 4096  // Increased for PSRAM usage
 
+// Commands are reassembled in PSRAM buffers that grow as fragments arrive,
+// up to this budget per command (override at build time)
+#ifndef BLE_COMMAND_MAX_BYTES
+#define BLE_COMMAND_MAX_BYTES 65536
+#endif
+#define BLE_COMMAND_INITIAL_BYTES 1024
+#define BLE_THROUGHPUT_MAX_BYTES 65536
+
+// Binary message protocol (version 2). Each message starts with a 9-byte
+// header: version, type, flags, seq (u16 LE), body length (u32 LE), then a
+// MessagePack body, zlib-compressed when BLE_MSG_FLAG_DEFLATE is set.
+// Binary requests get binary responses echoing their seq; JSON text with
+// the "<END>" marker stays available to clients that do not negotiate.
+#define BLE_BINARY_VERSION 0x02
+#define BLE_MSG_HEADER_SIZE 9
+#define BLE_MSG_REQUEST 0x01
+#define BLE_MSG_RESPONSE 0x02
+#define BLE_MSG_STREAM 0x03
+#define BLE_MSG_FLAG_DEFLATE 0x01
+#define BLE_COMPRESS_MIN_BYTES 512   // Smaller bodies are never compressed
+#define BLE_COMPRESS_WINDOW_BITS 10  // 2 KB history keeps the window small
+
+// Request multiplexing. A command write may start with BLE_MUX_MARKER and a
+// request id (u16 LE); fragments of up to BLE_MAX_INFLIGHT such commands can
+// interleave. JSON responses then carry "request_id" (a JSON command may
+// also set it itself); binary responses echo the seq. Read commands run
+// concurrently on the worker pool, everything else runs alone.
+#define BLE_MUX_MARKER 0x1E
+#define BLE_MUX_HEADER_SIZE 3
+#define BLE_MAX_INFLIGHT 4
+#define BLE_WORKER_COUNT 3
+
+// Preferred connection interval in 1.25 ms units (7.5 - 15 ms), timeout in 10 ms units
+#define BLE_CONN_INTERVAL_MIN 6
+#define BLE_CONN_INTERVAL_MAX 12
+#define BLE_CONN_TIMEOUT 400
+
 class CRUDHandler;  // Forward declaration
 
 class BLEManager : public BLEServerCallbacks, public BLECharacteristicCallbacks {
+  friend class BleFragmentWriter;
+
 private:
   BLEServer* pServer;
   BLEService* pService;
   BLECharacteristic* pCommandChar;
   BLECharacteristic* pResponseChar;
+  BLECharacteristic* pFlowChar;
 
   String serviceName;
   CRUDHandler* handler;
 
   // Command processing
-  char commandBuffer[COMMAND_BUFFER_SIZE];
-  size_t commandBufferIndex;
-  bool processing;
-  QueueHandle_t commandQueue;
-  TaskHandle_t commandTaskHandle;
+  struct BleCommand {
+    char* data;
+    size_t length;
+    int32_t requestId;  // -1 when the command was not multiplexed
+    const char* error;  // Set when reassembly rejected the command; a worker replies with it
+  };
+  QueueHandle_t commandQueue;  // BleCommand items, data in PSRAM
+
+  // Growable buffer a command is reassembled in. A complete command is
+  // handed to the worker queue as is and the arena starts over empty.
+  struct CommandArena {
+    char* data;
+    size_t length;
+    size_t capacity;
+  };
+  CommandArena commandArena;  // Commands without a request id
+
+  // Reassembly of multiplexed commands, one slot per request id in flight
+  struct Reassembly {
+    bool active;
+    uint16_t requestId;
+    unsigned long lastWrite;
+    CommandArena arena;
+  };
+  Reassembly slots[BLE_MAX_INFLIGHT];
+
+  // Per-worker state of the command being handled, so sendResponse() knows
+  // how to encode and tag the reply
+  struct CommandContext {
+    TaskHandle_t task;
+    bool binary;
+    uint16_t seq;
+    int32_t requestId;
+    String key;  // "op/type", for per-operation statistics
+    PsramBuffer* capture;  // Set by captureResponse()
+    uint32_t captureVersion;
+  };
+  CommandContext workers[BLE_WORKER_COUNT];
+  RwLock commandLock;  // Shared for reads, exclusive for writes
+
+  // Binary protocol, negotiated with "update ble_protocol"
+  volatile bool binaryNegotiated;
+  volatile bool compressResponses;
+  DeflateStream* deflater;
+  PsramBuffer compressedBody;
+  uint32_t compressedResponses;
+
+  // Bytes on air (notification payloads plus ATT headers) per operation
+  struct AirStats {
+    uint32_t count;
+    uint64_t bytes;
+  };
+  std::map<String, AirStats> airStats[2];  // [0] JSON, [1] binary
+  size_t responseAirBytes;
   TaskHandle_t streamTaskHandle;
 
+  // Link parameters and notification throughput
+  volatile bool clientConnected;
+  uint16_t connId;
+  volatile uint16_t negotiatedMtu;
+  uint64_t bytesNotified;
+  uint32_t fragmentsSent;
+  uint32_t responsesSent;
+  uint64_t sendMicros;
+
+  // One response at a time on the notify characteristic
+  SemaphoreHandle_t sendMutex;
+  bool responseFlow;  // Framed with sequence numbers (flow control active)
+  bool responseFailed;
+  size_t responseBytes;
+  unsigned long responseStart;
+  uint8_t fragmentBuffer[BLE_MAX_FRAGMENT_SIZE];  // Staging for BleFragmentWriter
+
+  // Credit-based flow control; the flow characteristic feeds it from the
+  // BLE stack callback and flowEvents wakes the sender
+  BleFlowControl flow;
+  EventGroupHandle_t flowEvents;
+  uint32_t retransmits;
+  uint32_t flowStalls;
+  uint32_t abortedResponses;
+
   // FreeRTOS task functions
   static void commandProcessingTask(void* parameter);
   static void streamingTask(void* parameter);
 
   // Fragment handling
-  void receiveFragment(const String& fragment);
-  void handleCompleteCommand(const char* command);
-  void sendFragmented(const String& data);
+  void receiveFragment(const uint8_t* data, size_t length);
+  Reassembly& slotFor(uint16_t requestId);
+  bool appendFragment(CommandArena& arena, const uint8_t* data, size_t length, int32_t requestId);
+  void rejectCommand(CommandArena& arena, int32_t requestId, const char* error);
+  static bool growArena(CommandArena& arena, size_t needed);
+  static void freeArena(CommandArena& arena);
+  static bool binaryFrameComplete(const char* buffer, size_t index);
+  void handleCompleteCommand(const BleCommand& command);
+  void handleProtocolCommand(const JsonDocument& command);
+  CommandContext* currentContext();
+  void sendMessage(const JsonDocument& data, bool binary, uint8_t type, uint16_t seq, const String& statKey,
+                   int32_t requestId = -1);
+  void sendBody(const JsonDocument* data, const uint8_t* raw, size_t rawLength, bool binary, uint8_t type,
+                uint16_t seq, const String& statKey, int32_t requestId);
+  size_t fragmentSize() const;
+
+  // Response framing: beginResponse(), any number of sendFragment() calls
+  // of at most payloadSize() bytes, then endResponse()
+  size_t payloadSize() const;
+  void beginResponse();
+  bool sendFragment(const uint8_t* data, size_t length);
+  void endResponse(bool binary, const String& statKey);
+  bool sendFrame(const uint8_t* data, size_t length, uint8_t flags);
+  bool notifyRaw(const uint8_t* data, size_t length);
+  bool waitForWindow();
+  bool waitForDrain();
+  void serviceNaks();
 
 public:
   BLEManager(const String& name, CRUDHandler* cmdHandler);
@@ -58,12 +206,26 @@ public:
 
   // Response methods
   void sendResponse(const JsonDocument& data);
+
+  // Read-response caching (see CRUDHandler). After captureResponse() the
+  // next successful sendResponse() of this command gets a "version" member
+  // and its serialised body is also written to out; sendSerialized() later
+  // replays such a body, framed and tagged for the current command.
+  void captureResponse(PsramBuffer* out, uint32_t version);
+  bool replyIsBinary();
+  void sendSerialized(const uint8_t* body, size_t length);
   void sendError(const String& message);
   void sendSuccess();
 
+  // Sends a response carrying size bytes of a known pattern, then a second
+  // response with the measured notification throughput
+  void runThroughputTest(size_t size);
+  void getThroughputStats(JsonObject& stats);
+
   // BLE callbacks
-  void onConnect(BLEServer* pServer) override;
+  void onConnect(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) override;
   void onDisconnect(BLEServer* pServer) override;
+  void onMtuChanged(BLEServer* pServer, esp_ble_gatts_cb_param_t* param) override;
   void onWrite(BLECharacteristic* pCharacteristic) override;
 };
 
@@ -0,0 +1,173 @@
+#include "BatchEncoder.h"
+#include <math.h>
+
+// Column order for CSV bodies; matches the keys produced by the Modbus services
+static const char* const CSV_COLUMNS[] = {
+  "time", "device_id", "register_id", "name", "address", "datatype", "value"
+};
+
+BatchFormat BatchEncoder::parseFormat(const String& name) {
+  String lower = name;
+  lower.toLowerCase();
+  if (lower == "json_array") return BatchFormat::JSON_ARRAY;
+  if (lower == "ndjson" || lower == "jsonl") return BatchFormat::NDJSON;
+  if (lower == "csv") return BatchFormat::CSV;
+  if (lower == "line_protocol" || lower == "influx") return BatchFormat::LINE_PROTOCOL;
+  return BatchFormat::SINGLE;
+}
+
+const char* BatchEncoder::formatName(BatchFormat format) {
+  switch (format) {
+    case BatchFormat::JSON_ARRAY: return "json_array";
+    case BatchFormat::NDJSON: return "ndjson";
+    case BatchFormat::CSV: return "csv";
+    case BatchFormat::LINE_PROTOCOL: return "line_protocol";
+    default: return "single";
+  }
+}
+
+const char* BatchEncoder::contentType(BatchFormat format) {
+  switch (format) {
+    case BatchFormat::JSON_ARRAY: return "application/json";
+    case BatchFormat::NDJSON: return "application/x-ndjson";
+    case BatchFormat::CSV: return "text/csv";
+    case BatchFormat::LINE_PROTOCOL: return "text/plain; charset=utf-8";
+    default: return "application/octet-stream";
+  }
+}
+
+void BatchEncoder::writeEscaped(Print& out, const char* str, const char* specials) {
+  for (const char* p = str; *p; p++) {
+    if (strchr(specials, *p)) {
+      out.write('\\');
+    }
+    out.write((uint8_t)*p);
+  }
+}
+
+void BatchEncoder::writeCsvField(Print& out, JsonVariantConst value) {
+  if (value.isNull()) {
+    return;
+  }
+  if (!value.is<const char*>()) {
+    serializeJson(value, out);
+    return;
+  }
+
+  // RFC 4180: quote fields containing separators, quotes or line breaks
+  const char* str = value.as<const char*>();
+  if (!strpbrk(str, ",\"\r\n")) {
+    out.print(str);
+    return;
+  }
+  out.write('"');
+  for (const char* p = str; *p; p++) {
+    if (*p == '"') {
+      out.write('"');
+    }
+    out.write((uint8_t)*p);
+  }
+  out.write('"');
+}
+
+void BatchEncoder::writeLineProtocolTag(Print& out, const char* key, JsonVariantConst value) {
+  String text = value.as<String>();
+  if (text.isEmpty()) {
+    return;  // Empty tag values are not allowed
+  }
+  out.write(',');
+  out.print(key);
+  out.write('=');
+  writeEscaped(out, text.c_str(), ", =");
+}
+
+void BatchEncoder::begin(BatchFormat format, Print& out) {
+  if (format == BatchFormat::JSON_ARRAY) {
+    out.write('[');
+  } else if (format == BatchFormat::CSV) {
+    const size_t columns = sizeof(CSV_COLUMNS) / sizeof(CSV_COLUMNS[0]);
+    for (size_t i = 0; i < columns; i++) {
+      if (i) out.write(',');
+      out.print(CSV_COLUMNS[i]);
+    }
+    out.print("\r\n");
+  }
+}
+
+bool BatchEncoder::add(BatchFormat format, JsonObjectConst sample, Print& out, const char* measurement, size_t index) {
+  switch (format) {
+    case BatchFormat::JSON_ARRAY:
+      if (index) out.write(',');
+      serializeJson(sample, out);
+      break;
+
+    case BatchFormat::NDJSON:
+      serializeJson(sample, out);
+      out.write('\n');
+      break;
+
+    case BatchFormat::CSV: {
+      const size_t columns = sizeof(CSV_COLUMNS) / sizeof(CSV_COLUMNS[0]);
+      for (size_t i = 0; i < columns; i++) {
+        if (i) out.write(',');
+        writeCsvField(out, sample[CSV_COLUMNS[i]]);
+      }
+      out.print("\r\n");
+      break;
+    }
+
+    case BatchFormat::LINE_PROTOCOL: {
+      // <measurement>,device_id=..,register_id=..,name=.. value=<v> <unix seconds>
+      // The timestamp is in seconds, so the endpoint must use precision=s.
+      // A missing or failed reading has no field value, so no line at all.
+      JsonVariantConst value = sample["value"];
+      bool isBool = value.is<bool>();
+      if (!isBool && (!value.is<double>() || !isfinite(value.as<double>()))) {
+        return false;
+      }
+      writeEscaped(out, measurement, ", ");
+      writeLineProtocolTag(out, "device_id", sample["device_id"]);
+      writeLineProtocolTag(out, "register_id", sample["register_id"]);
+      writeLineProtocolTag(out, "name", sample["name"]);
+      out.print(" value=");
+      if (isBool) {
+        out.print(value.as<bool>() ? "true" : "false");
+      } else {
+        serializeJson(value, out);
+      }
+      if (sample["time"].is<unsigned long>()) {
+        out.write(' ');
+        out.print(sample["time"].as<unsigned long>());
+      }
+      out.write('\n');
+      break;
+    }
+
+    default:
+      break;
+  }
+  return true;
+}
+
+void BatchEncoder::end(BatchFormat format, Print& out) {
+  if (format == BatchFormat::JSON_ARRAY) {
+    out.write(']');
+  }
+}
+
+bool BatchEncoder::encode(BatchFormat format, JsonArrayConst samples, Print& out, const char* measurement,
+                          size_t* skipped) {
+  if (format == BatchFormat::SINGLE) {
+    return false;
+  }
+
+  begin(format, out);
+  size_t index = 0;
+  for (JsonObjectConst sample : samples) {
+    if (!add(format, sample, out, measurement, index++) && skipped) {
+      (*skipped)++;
+    }
+  }
+  end(format, out);
+  return true;
+}
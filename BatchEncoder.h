@@ -0,0 +1,44 @@
+#ifndef BATCH_ENCODER_H
+#define BATCH_ENCODER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// HTTP body layouts. SINGLE sends one sample per request using the
+// PayloadEncoder format; the others pack a batch of samples per request.
+enum class BatchFormat : uint8_t {
+  SINGLE,
+  JSON_ARRAY,
+  NDJSON,
+  CSV,
+  LINE_PROTOCOL
+};
+
+class BatchEncoder {
+private:
+  static void writeCsvField(Print& out, JsonVariantConst value);
+  static void writeLineProtocolTag(Print& out, const char* key, JsonVariantConst value);
+  static void writeEscaped(Print& out, const char* str, const char* specials);
+
+public:
+  // Accepts "json_array", "ndjson", "csv" and "line_protocol"; anything else is SINGLE
+  static BatchFormat parseFormat(const String& name);
+  static const char* formatName(BatchFormat format);
+  static const char* contentType(BatchFormat format);
+
+  // Writes the whole batch body to out. measurement is the InfluxDB
+  // measurement name used by LINE_PROTOCOL. Returns false for SINGLE.
+  // Samples add() leaves out are counted in skipped.
+  static bool encode(BatchFormat format, JsonArrayConst samples, Print& out, const char* measurement,
+                     size_t* skipped = nullptr);
+
+  // Incremental form of encode() for bodies streamed one sample at a time:
+  // begin(), then add() with index counting from 0, then end(). add()
+  // returns false for a sample it cannot represent: LINE_PROTOCOL needs a
+  // finite number or a boolean value.
+  static void begin(BatchFormat format, Print& out);
+  static bool add(BatchFormat format, JsonObjectConst sample, Print& out, const char* measurement, size_t index);
+  static void end(BatchFormat format, Print& out);
+};
+
+#endif
@@ -0,0 +1,111 @@
+#include "BleFlowControl.h"
+#include <esp_heap_caps.h>
+
+BleFlowControl::BleFlowControl()
+  : enabled(false), ackSeq(0), windowSize(0), nextSeq(0), pendingNakCount(0), ring(nullptr) {
+  portMUX_INITIALIZE(&lock);
+}
+
+BleFlowControl::~BleFlowControl() {
+  if (ring) {
+    heap_caps_free(ring);
+  }
+}
+
+bool BleFlowControl::begin() {
+  if (!ring) {
+    ring = (SentFragment*)heap_caps_calloc(BLE_RETX_SLOTS, sizeof(SentFragment), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  }
+  return ring != nullptr;
+}
+
+void BleFlowControl::reset() {
+  portENTER_CRITICAL(&lock);
+  enabled = false;
+  ackSeq = 0;
+  windowSize = 0;
+  nextSeq = 0;
+  pendingNakCount = 0;
+  portEXIT_CRITICAL(&lock);
+}
+
+void BleFlowControl::handleWrite(const uint8_t* data, size_t length) {
+  if (length < 3 || !ring) {
+    return;
+  }
+
+  portENTER_CRITICAL(&lock);
+  if (data[0] == BLE_FLOW_CREDIT && length >= 5) {
+    // The ack only moves forward and never past what was sent; stale or
+    // reordered credit packets are ignored
+    uint16_t ack = data[1] | (data[2] << 8);
+    if (!enabled || ((int16_t)(ack - ackSeq) >= 0 && (int16_t)(nextSeq - ack) >= 0)) {
+      ackSeq = ack;
+      windowSize = data[3] | (data[4] << 8);
+    }
+    enabled = true;
+  } else if (data[0] == BLE_FLOW_NAK) {
+    for (size_t i = 1; i + 1 < length && pendingNakCount < BLE_MAX_PENDING_NAKS; i += 2) {
+      pendingNaks[pendingNakCount++] = data[i] | (data[i + 1] << 8);
+    }
+  }
+  portEXIT_CRITICAL(&lock);
+}
+
+uint16_t BleFlowControl::window() const {
+  uint16_t size = windowSize;
+  return size < BLE_RETX_SLOTS ? size : BLE_RETX_SLOTS;
+}
+
+bool BleFlowControl::hasWindow() const {
+  return (uint16_t)(nextSeq - ackSeq) < window();
+}
+
+bool BleFlowControl::drained() const {
+  return ackSeq == nextSeq;
+}
+
+const uint8_t* BleFlowControl::stage(const uint8_t* data, size_t length, uint8_t flags, size_t& frameLength) {
+  // The window never exceeds the ring, so this slot was already acked
+  SentFragment& slot = ring[nextSeq % BLE_RETX_SLOTS];
+  slot.seq = nextSeq;
+  slot.length = BLE_FRAME_HEADER_SIZE + length;
+  slot.data[0] = nextSeq & 0xFF;
+  slot.data[1] = nextSeq >> 8;
+  slot.data[2] = flags;
+  if (length) {
+    memcpy(slot.data + BLE_FRAME_HEADER_SIZE, data, length);
+  }
+
+  // Publish the new seq only after the slot is filled
+  portENTER_CRITICAL(&lock);
+  nextSeq++;
+  portEXIT_CRITICAL(&lock);
+
+  frameLength = slot.length;
+  return slot.data;
+}
+
+const uint8_t* BleFlowControl::nextRetransmit(size_t& frameLength) {
+  while (true) {
+    uint16_t seq;
+    bool found = false;
+    portENTER_CRITICAL(&lock);
+    if (pendingNakCount > 0) {
+      seq = pendingNaks[--pendingNakCount];
+      found = true;
+    }
+    portEXIT_CRITICAL(&lock);
+    if (!found) {
+      return nullptr;
+    }
+
+    // Acked fragments may already be overwritten, and future ones were
+    // never sent; NAKs for either are dropped
+    const SentFragment& slot = ring[seq % BLE_RETX_SLOTS];
+    if (slot.seq == seq && (int16_t)(seq - ackSeq) >= 0 && (int16_t)(nextSeq - seq) > 0) {
+      frameLength = slot.length;
+      return slot.data;
+    }
+  }
+}
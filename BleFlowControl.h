@@ -0,0 +1,77 @@
+#ifndef BLE_FLOW_CONTROL_H
+#define BLE_FLOW_CONTROL_H
+
+#include <Arduino.h>
+#include <freertos/FreeRTOS.h>
+
+#define BLE_MAX_FRAGMENT_SIZE 512 // Maximum attribute value length
+
+// Flow control. A client opts in by writing to the flow characteristic:
+//   CREDIT: 0x01, next expected seq (u16 LE), window (u16 LE)
+//   NAK:    0x02, seq (u16 LE) [, seq ...]
+// From then on every notification starts with seq (u16 LE) and flags, and
+// the gateway never runs more than window fragments ahead of the ack.
+// Responses end with a header-only fragment flagged END instead of "<END>";
+// the client acks past it so a lost tail can be NAKed and resent.
+#define BLE_FLOW_CREDIT 0x01
+#define BLE_FLOW_NAK 0x02
+#define BLE_FRAME_HEADER_SIZE 3
+#define BLE_FRAME_FLAG_END 0x01
+#define BLE_RETX_SLOTS 32         // Sent fragments kept for retransmission (caps the window)
+#define BLE_MAX_PENDING_NAKS 16
+
+// Sender side of the credit/NAK protocol, independent of the BLE stack so
+// it can be exercised on the host. handleWrite() runs in the BLE callback;
+// everything else belongs to the one task sending the response. Sequence
+// numbers are u16 and compared modulo 2^16.
+class BleFlowControl {
+private:
+  struct SentFragment {
+    uint16_t seq;
+    uint16_t length;
+    uint8_t data[BLE_FRAME_HEADER_SIZE + BLE_MAX_FRAGMENT_SIZE];
+  };
+
+  volatile bool enabled;
+  volatile uint16_t ackSeq;      // Every fragment before this one was received
+  volatile uint16_t windowSize;  // Fragments the client accepts past ackSeq
+  uint16_t nextSeq;
+  uint16_t pendingNaks[BLE_MAX_PENDING_NAKS];
+  volatile uint8_t pendingNakCount;
+  portMUX_TYPE lock;
+  SentFragment* ring;  // PSRAM, BLE_RETX_SLOTS entries
+
+public:
+  BleFlowControl();
+  ~BleFlowControl();
+
+  // Allocates the retransmission ring; without it flow control stays off
+  bool begin();
+  bool isReady() const { return ring != nullptr; }
+
+  // Back to unframed notifications, e.g. for a new connection
+  void reset();
+
+  // A write to the flow characteristic: CREDIT or NAK
+  void handleWrite(const uint8_t* data, size_t length);
+
+  bool isEnabled() const { return enabled; }
+  uint16_t window() const;  // Effective window, capped by the ring
+  uint16_t ack() const { return ackSeq; }
+
+  // Room for another fragment inside the client's window
+  bool hasWindow() const;
+
+  // Every staged fragment has been acked
+  bool drained() const;
+
+  // Frames the next fragment, keeps it until acked, and returns the frame
+  // to notify; length must not exceed BLE_MAX_FRAGMENT_SIZE
+  const uint8_t* stage(const uint8_t* data, size_t length, uint8_t flags, size_t& frameLength);
+
+  // Pops NAKs until one names a fragment still held (sent, not yet acked)
+  // and returns that frame to resend; nullptr once none are pending
+  const uint8_t* nextRetransmit(size_t& frameLength);
+};
+
+#endif
@@ -0,0 +1,74 @@
+#include "BleFragmentWriter.h"
+#include "BLEManager.h"
+
+BleFragmentWriter::BleFragmentWriter(BLEManager& owner, uint8_t* fragmentBuffer, size_t size)
+  : manager(owner), buffer(fragmentBuffer), fragmentSize(size), used(0), failed(false),
+    requestId(-1), tagState(TagState::NONE) {}
+
+bool BleFragmentWriter::sendBuffered() {
+  if (used > 0 && !failed) {
+    failed = !manager.sendFragment(buffer, used);
+  }
+  used = 0;
+  return !failed;
+}
+
+size_t BleFragmentWriter::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+void BleFragmentWriter::tagRequestId(int32_t id) {
+  requestId = id;
+  tagState = id >= 0 ? TagState::BEFORE_OBJECT : TagState::NONE;
+}
+
+bool BleFragmentWriter::writeTagged(uint8_t b) {
+  if (tagState == TagState::BEFORE_OBJECT) {
+    append(&b, 1);
+    if (b == '{') {
+      tagState = TagState::AFTER_BRACE;
+    }
+  } else {
+    // b is the first byte of the object body; an empty object takes no comma
+    char tag[24];
+    int n = snprintf(tag, sizeof(tag), "\"request_id\":%ld%s", (long)requestId, b == '}' ? "" : ",");
+    append((const uint8_t*)tag, n);
+    append(&b, 1);
+    tagState = TagState::NONE;
+  }
+  return !failed;
+}
+
+size_t BleFragmentWriter::write(const uint8_t* data, size_t len) {
+  size_t consumed = 0;
+  while (tagState != TagState::NONE && consumed < len) {
+    if (!writeTagged(data[consumed])) {
+      return consumed;
+    }
+    consumed++;
+  }
+  return consumed + append(data + consumed, len - consumed);
+}
+
+size_t BleFragmentWriter::append(const uint8_t* data, size_t len) {
+  if (failed) {
+    return 0;  // Makes the serializer stop early once the link is gone
+  }
+
+  size_t remaining = len;
+  while (remaining > 0) {
+    size_t n = min(remaining, fragmentSize - used);
+    memcpy(buffer + used, data, n);
+    used += n;
+    data += n;
+    remaining -= n;
+    if (used == fragmentSize && !sendBuffered()) {
+      return len - remaining;
+    }
+  }
+  return len;
+}
+
+bool BleFragmentWriter::finish() {
+  return sendBuffered();
+}
@@ -0,0 +1,40 @@
+#ifndef BLE_FRAGMENT_WRITER_H
+#define BLE_FRAGMENT_WRITER_H
+
+#include <Arduino.h>
+
+class BLEManager;  // Forward declaration
+
+// Print sink that ArduinoJson serialises into directly. Bytes collect in a
+// single fragment-sized buffer that is sent as one notification whenever it
+// fills, so a response never exists in memory as a whole. Must be used
+// between BLEManager::beginResponse() and endResponse().
+class BleFragmentWriter : public Print {
+private:
+  BLEManager& manager;
+  uint8_t* buffer;
+  size_t fragmentSize;
+  size_t used;
+  bool failed;
+  int32_t requestId;  // Injected into the top-level JSON object, -1 = none
+  enum class TagState : uint8_t { NONE, BEFORE_OBJECT, AFTER_BRACE };
+  TagState tagState;
+
+  bool sendBuffered();
+  size_t append(const uint8_t* data, size_t len);
+  bool writeTagged(uint8_t b);
+
+public:
+  BleFragmentWriter(BLEManager& owner, uint8_t* fragmentBuffer, size_t size);
+
+  // Adds "request_id":id as the first member of the serialised object
+  void tagRequestId(int32_t id);
+
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t* data, size_t len) override;
+
+  // Sends the last partial fragment; returns false if any fragment failed
+  bool finish();
+};
+
+#endif
@@ -1,76 +1,228 @@
 #include "CRUDHandler.h"
 #include "BLEManager.h"
-#include "QueueManager.h"
+#include "StreamSubscriptions.h"
 #include "ModbusRtuService.h"
 #include "ModbusTcpService.h"
 #include "MemoryManager.h"  // For make_psram_unique
+#include <vector>
 
 // Make service pointers available to the handler
 extern ModbusRtuService* modbusRtuService;
 extern ModbusTcpService* modbusTcpService;
 
 CRUDHandler::CRUDHandler(ConfigManager* config, ServerConfig* serverCfg, LoggingConfig* loggingCfg)
-  : configManager(config), serverConfig(serverCfg), loggingConfig(loggingCfg), streamDeviceId("") {
-  
-  streamIdMutex = xSemaphoreCreateMutex(); // <-- TAMBAHAN
-  if (streamIdMutex == NULL) {
-      Serial.println("ERROR: Failed to create streamIdMutex!");
-  }
-  
+  : configManager(config), serverConfig(serverCfg), loggingConfig(loggingCfg),
+    configVersion(esp_random() & 0xFFFF0000) {  // A version from before a reboot is unlikely to match
   setupCommandHandlers();
 }
 
-// --- TAMBAHAN: Destructor ---
-CRUDHandler::~CRUDHandler() {
-  if (streamIdMutex) {
-    vSemaphoreDelete(streamIdMutex);
+void CRUDHandler::handle(BLEManager* manager, const JsonDocument& command) {
+  String op = command["op"] | "";
+  String type = command["type"] | "";
+
+  Serial.printf("DEBUG: Command - op: '%s', type: '%s'\n", op.c_str(), type.c_str());
+
+  if (op == "read" && readHandlers.count(type)) {
+    if (isCacheable(type)) {
+      handleCachedRead(manager, type, command);
+    } else {
+      readHandlers[type](manager, command);
+    }
+    return;
+  }
+
+  if (op == "create" && createHandlers.count(type)) {
+    createHandlers[type](manager, command);
+  } else if (op == "update" && updateHandlers.count(type)) {
+    updateHandlers[type](manager, command);
+  } else if (op == "delete" && deleteHandlers.count(type)) {
+    deleteHandlers[type](manager, command);
+  } else if (op == "batch" && batchHandlers.count(type)) {
+    batchHandlers[type](manager, command);
+  } else {
+    manager->sendError("Unsupported operation or type: " + op + "/" + type);
+    return;
   }
+
+  // Mutations run alone (BLEManager's command lock), so no read sees the
+  // new configuration with the old version
+  configVersion++;
+  responseCache.invalidate();
 }
 
-// --- TAMBAHAN: Implementasi fungsi thread-safe ---
-String CRUDHandler::getStreamDeviceId() {
-  String id = "";
-  if (xSemaphoreTake(streamIdMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-    id = streamDeviceId;
-    xSemaphoreGive(streamIdMutex);
+// One CSV row; quoted fields may hold commas and "" escapes
+static const char* readCsvRow(const char* cursor, std::vector<String>& fields) {
+  fields.clear();
+  String field;
+  bool quoted = false;
+  while (*cursor) {
+    char c = *cursor++;
+    if (quoted) {
+      if (c != '"') {
+        field += c;
+      } else if (*cursor == '"') {
+        field += '"';
+        cursor++;
+      } else {
+        quoted = false;
+      }
+    } else if (c == '"') {
+      quoted = true;
+    } else if (c == ',') {
+      field.trim();
+      fields.push_back(field);
+      field = "";
+    } else if (c == '\n') {
+      break;
+    } else if (c != '\r') {
+      field += c;
+    }
   }
-  return id;
+  field.trim();
+  fields.push_back(field);
+  return cursor;
 }
 
-void CRUDHandler::clearStreamDeviceId() {
-  if (xSemaphoreTake(streamIdMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-    streamDeviceId = "";
-    xSemaphoreGive(streamIdMutex);
+bool CRUDHandler::csvToItems(const char* csv, const String& deviceId, bool replace, JsonArray& items, String& error) {
+  std::vector<String> header;
+  std::vector<String> fields;
+  const char* cursor = csv;
+
+  while (*cursor && header.empty()) {
+    cursor = readCsvRow(cursor, header);
+    if (header.size() == 1 && header[0].isEmpty()) header.clear();
   }
+  if (header.empty()) {
+    error = "Register map has no header row";
+    return false;
+  }
+  for (String& name : header) {
+    name.toLowerCase();
+  }
+
+  if (replace) {
+    JsonObject item = items.add<JsonObject>();
+    item["op"] = "update";
+    item["type"] = "device";
+    item["device_id"] = deviceId;
+    item["config"]["registers"].to<JsonArray>();
+  }
+
+  size_t rows = 0;
+  while (*cursor) {
+    cursor = readCsvRow(cursor, fields);
+    if (fields.size() == 1 && fields[0].isEmpty()) continue;  // Blank line
+    if (++rows > CRUD_BATCH_MAX_ITEMS) {
+      error = "Register map has more than " + String(CRUD_BATCH_MAX_ITEMS) + " rows";
+      return false;
+    }
+
+    JsonObject item = items.add<JsonObject>();
+    item["type"] = "register";
+    item["device_id"] = deviceId;
+    JsonObject config = item["config"].to<JsonObject>();
+    String registerId;
+    for (size_t i = 0; i < header.size() && i < fields.size(); i++) {
+      if (header[i].isEmpty() || fields[i].isEmpty()) continue;
+      if (header[i] == "register_id") {
+        registerId = fields[i];
+      } else {
+        config[header[i]] = fields[i];
+      }
+    }
+    if (registerId.isEmpty()) {
+      item["op"] = "create";
+    } else {
+      item["op"] = "update";
+      item["register_id"] = registerId;
+    }
+  }
+
+  if (rows == 0) {
+    error = "Register map has no rows";
+    return false;
+  }
+  return true;
 }
 
-bool CRUDHandler::isStreaming() {
-  bool streaming = false;
-  if (xSemaphoreTake(streamIdMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-    streaming = !streamDeviceId.isEmpty();
-    xSemaphoreGive(streamIdMutex);
+void CRUDHandler::sendBatchResult(BLEManager* manager, bool saved, bool dryRun, JsonDocument& response) {
+  size_t failed = 0;
+  for (JsonVariantConst result : response["results"].as<JsonArrayConst>()) {
+    if (result["status"] == "error") failed++;
   }
-  return streaming;
+
+  response["status"] = failed ? "error" : "ok";
+  response["applied"] = saved;
+  response["dry_run"] = dryRun;
+  response["failed"] = failed;
+  if (saved) {
+    // One schedule rebuild for the whole batch
+    if (modbusRtuService) modbusRtuService->notifyConfigChange();
+    if (modbusTcpService) modbusTcpService->notifyConfigChange();
+  } else if (!failed && !dryRun) {
+    response["status"] = "error";
+    response["message"] = "Failed to save configuration";
+  }
+  manager->sendResponse(response);
 }
-// --- AKHIR TAMBAHAN ---
 
+bool CRUDHandler::isCacheable(const String& type) {
+  return type == "devices" || type == "devices_summary" || type == "device" || type == "registers" ||
+         type == "registers_summary" || type == "server_config" || type == "logging_config";
+}
 
-void CRUDHandler::handle(BLEManager* manager, const JsonDocument& command) {
-  String op = command["op"] | "";
-  String type = command["type"] | "";
+void CRUDHandler::handleCachedRead(BLEManager* manager, const String& type, const JsonDocument& command) {
+  uint32_t version = configVersion;
+  if (command["if_version"].is<uint32_t>() && command["if_version"].as<uint32_t>() == version) {
+    StaticJsonDocument<64> response;
+    response["status"] = "not_modified";
+    response["version"] = version;
+    manager->sendResponse(response);
+    return;
+  }
 
-  Serial.printf("DEBUG: Command - op: '%s', type: '%s'\n", op.c_str(), type.c_str());
+  String key = type + "|" + String(command["device_id"] | "") + "|" + String(command["offset"] | 0) + "|" +
+               String(command["limit"] | 0) + "|" + String(command["cursor"] | "") +
+               (manager->replyIsBinary() ? "|msgpack" : "|json");
+  std::shared_ptr<CachedResponse> cached = responseCache.get(key, version);
+  if (cached) {
+    manager->sendSerialized(cached->data, cached->length);
+    return;
+  }
 
-  if (op == "read" && readHandlers.count(type)) {
-    readHandlers[type](manager, command);
-  } else if (op == "create" && createHandlers.count(type)) {
-    createHandlers[type](manager, command);
-  } else if (op == "update" && updateHandlers.count(type)) {
-    updateHandlers[type](manager, command);
-  } else if (op == "delete" && deleteHandlers.count(type)) {
-    deleteHandlers[type](manager, command);
-  } else {
-    manager->sendError("Unsupported operation or type: " + op + "/" + type);
+  PsramBuffer body(RESPONSE_CACHE_MAX_BYTES / 2);
+  manager->captureResponse(&body, version);
+  readHandlers[type](manager, command);
+  if (body.size() > 0 && !body.overflowed()) {
+    responseCache.put(key, version, body.data(), body.size());
+  }
+}
+
+ConfigManager::Page CRUDHandler::parsePage(const JsonDocument& command, size_t defaultLimit, size_t maxLimit) {
+  ConfigManager::Page page;
+  page.limit = command["limit"] | defaultLimit;
+  if (page.limit == 0 || page.limit > maxLimit) {
+    page.limit = maxLimit;
+  }
+  page.offset = command["offset"] | 0;
+
+  // The cursor is "<offset>:<last id>"; clients treat it as opaque
+  const char* cursor = command["cursor"] | "";
+  if (*cursor) {
+    page.offset = strtoul(cursor, nullptr, 10);
+    const char* separator = strchr(cursor, ':');
+    if (separator) {
+      page.after = separator + 1;
+    }
+  }
+  return page;
+}
+
+void CRUDHandler::addPageInfo(JsonDocument& response, const ConfigManager::Page& page) {
+  response["total"] = page.total;
+  if (page.next < page.total) {
+    response["next_offset"] = page.next;
+    response["next_cursor"] = String(page.next) + ":" + page.lastId;
   }
 }
 
@@ -85,10 +237,12 @@ void CRUDHandler::setupCommandHandlers() {
   };
 
   readHandlers["devices_summary"] = [this](BLEManager* manager, const JsonDocument& command) {
-    auto response = make_psram_unique<DynamicJsonDocument>(2048); // <-- PERUBAHAN
+    ConfigManager::Page page = parsePage(command, CRUD_PAGE_DEFAULT_SUMMARIES, CRUD_PAGE_MAX_SUMMARIES);
+    auto response = make_psram_unique<DynamicJsonDocument>(256 + page.limit * 160); // <-- PERUBAHAN
     (*response)["status"] = "ok";
     JsonArray summary = (*response)["devices_summary"].to<JsonArray>(); // <-- PERUBAHAN
-    configManager->getDevicesSummary(summary);
+    configManager->getDevicesSummary(summary, page);
+    addPageInfo(*response, page);
     manager->sendResponse(*response);
   };
 
@@ -106,10 +260,12 @@ void CRUDHandler::setupCommandHandlers() {
 
   readHandlers["registers"] = [this](BLEManager* manager, const JsonDocument& command) {
     String deviceId = command["device_id"] | "";
-    auto response = make_psram_unique<DynamicJsonDocument>(4096); // <-- PERUBAHAN
+    ConfigManager::Page page = parsePage(command, CRUD_PAGE_DEFAULT_REGISTERS, CRUD_PAGE_MAX_REGISTERS);
+    auto response = make_psram_unique<DynamicJsonDocument>(256 + page.limit * 512); // <-- PERUBAHAN
     (*response)["status"] = "ok";
     JsonArray registers = (*response)["registers"].to<JsonArray>(); // <-- PERUBAHAN
-    if (configManager->listRegisters(deviceId, registers)) {
+    if (configManager->listRegisters(deviceId, registers, page)) {
+      addPageInfo(*response, page);
       manager->sendResponse(*response);
     } else {
       manager->sendError("No registers found");
@@ -118,10 +274,12 @@ void CRUDHandler::setupCommandHandlers() {
 
   readHandlers["registers_summary"] = [this](BLEManager* manager, const JsonDocument& command) {
     String deviceId = command["device_id"] | "";
-    auto response = make_psram_unique<DynamicJsonDocument>(4096); // <-- PERUBAHAN
+    ConfigManager::Page page = parsePage(command, CRUD_PAGE_DEFAULT_SUMMARIES, CRUD_PAGE_MAX_SUMMARIES);
+    auto response = make_psram_unique<DynamicJsonDocument>(256 + page.limit * 192); // <-- PERUBAHAN
     (*response)["status"] = "ok";
     JsonArray summary = (*response)["registers_summary"].to<JsonArray>(); // <-- PERUBAHAN
-    if (configManager->getRegistersSummary(deviceId, summary)) {
+    if (configManager->getRegistersSummary(deviceId, summary, page)) {
+      addPageInfo(*response, page);
       manager->sendResponse(*response);
     } else {
       manager->sendError("No registers found");
@@ -150,34 +308,81 @@ void CRUDHandler::setupCommandHandlers() {
     }
   };
 
+  readHandlers["ble_throughput"] = [this](BLEManager* manager, const JsonDocument& command) {
+    size_t size = command["size"] | 4096;
+    manager->runThroughputTest(size);
+  };
+
   readHandlers["data"] = [this](BLEManager* manager, const JsonDocument& command) {
+    // {"device_id":"D1"} streams one device (replacing other subscriptions),
+    // {"device_id":"stop"} ends streaming, and "subscribe"/"unsubscribe"
+    // arrays of {"device_id","register_id","min_interval_ms","change_only","deadband"}
+    // edit the subscription table
+    StreamSubscriptions* subscriptions = StreamSubscriptions::getInstance();
     String device = command["device_id"] | "";
-    
-    // Ambil Mutex
-    if (xSemaphoreTake(streamIdMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-      if (device == "stop") {
-        streamDeviceId = "";
-        QueueManager::getInstance()->clearStream();
-        auto response = make_psram_unique<DynamicJsonDocument>(128); // <-- PERUBAHAN
-        (*response)["status"] = "ok";
-        (*response)["message"] = "Data streaming stopped";
-        manager->sendResponse(*response);
-      } else if (!device.isEmpty()) {
-        streamDeviceId = device;
-        auto response = make_psram_unique<DynamicJsonDocument>(128); // <-- PERUBAHAN
-        (*response)["status"] = "ok";
-        (*response)["message"] = "Data streaming started for device: " + device;
-        manager->sendResponse(*response);
-      } else {
-        manager->sendError("Empty device ID");
+
+    if (device == "stop") {
+      subscriptions->clear();
+      auto response = make_psram_unique<DynamicJsonDocument>(128); // <-- PERUBAHAN
+      (*response)["status"] = "ok";
+      (*response)["message"] = "Data streaming stopped";
+      manager->sendResponse(*response);
+    } else if (command["subscribe"].is<JsonArrayConst>() || command["unsubscribe"].is<JsonArrayConst>()) {
+      for (JsonObjectConst entry : command["unsubscribe"].as<JsonArrayConst>()) {
+        subscriptions->unsubscribe(entry["device_id"] | "", entry["register_id"] | "");
+      }
+      for (JsonObjectConst entry : command["subscribe"].as<JsonArrayConst>()) {
+        uint32_t minIntervalMs = entry["min_interval_ms"] | 0;
+        float maxRateHz = entry["max_rate_hz"] | 0.0f;
+        if (maxRateHz > 0) {
+          minIntervalMs = max(minIntervalMs, (uint32_t)(1000.0f / maxRateHz));
+        }
+        if (!subscriptions->subscribe(entry["device_id"] | "", entry["register_id"] | "", minIntervalMs,
+                                      entry["change_only"] | false, entry["deadband"] | 0.0)) {
+          manager->sendError("Subscription rejected: empty device ID or table full");
+          return;
+        }
       }
-      // Lepas Mutex
-      xSemaphoreGive(streamIdMutex);
+      auto response = make_psram_unique<DynamicJsonDocument>(2048);
+      (*response)["status"] = "ok";
+      JsonArray list = (*response)["subscriptions"].to<JsonArray>();
+      subscriptions->listSubscriptions(list);
+      manager->sendResponse(*response);
+    } else if (!device.isEmpty()) {
+      subscriptions->clear();
+      subscriptions->subscribe(device, "", 0, false, 0);
+      auto response = make_psram_unique<DynamicJsonDocument>(128); // <-- PERUBAHAN
+      (*response)["status"] = "ok";
+      (*response)["message"] = "Data streaming started for device: " + device;
+      manager->sendResponse(*response);
     } else {
-      manager->sendError("Failed to lock stream resource");
+      manager->sendError("Empty device ID");
     }
   };
 
+  readHandlers["config_version"] = [this](BLEManager* manager, const JsonDocument& command) {
+    auto response = make_psram_unique<DynamicJsonDocument>(1024);
+    (*response)["status"] = "ok";
+    (*response)["version"] = configVersion;
+    JsonObject cache = (*response)["cache"].to<JsonObject>();
+    responseCache.getStats(cache);
+    JsonObject model = (*response)["model"].to<JsonObject>();
+    configManager->getModelStats(model);
+    JsonObject journal = (*response)["journal"].to<JsonObject>();
+    configManager->getJournalStats(journal);
+    manager->sendResponse(*response);
+  };
+
+  readHandlers["stream_stats"] = [this](BLEManager* manager, const JsonDocument& command) {
+    auto response = make_psram_unique<DynamicJsonDocument>(1024);
+    (*response)["status"] = "ok";
+    JsonObject stats = (*response)["stats"].to<JsonObject>();
+    StreamSubscriptions::getInstance()->getStats(stats);
+    JsonArray list = (*response)["subscriptions"].to<JsonArray>();
+    StreamSubscriptions::getInstance()->listSubscriptions(list);
+    manager->sendResponse(*response);
+  };
+
   // === CREATE HANDLERS ===
   createHandlers["device"] = [this](BLEManager* manager, const JsonDocument& command) {
     JsonObjectConst config = command["config"];
@@ -266,6 +471,37 @@ void CRUDHandler::setupCommandHandlers() {
     }
   };
 
+  // === BATCH HANDLERS ===
+  batchHandlers["config"] = [this](BLEManager* manager, const JsonDocument& command) {
+    JsonArrayConst items = command["items"];
+    if (items.size() == 0 || items.size() > CRUD_BATCH_MAX_ITEMS) {
+      manager->sendError("Batch needs 1 to " + String(CRUD_BATCH_MAX_ITEMS) + " items");
+      return;
+    }
+    bool dryRun = command["dry_run"] | false;
+    auto response = make_psram_unique<JsonDocument>(PsramAllocator::instance());
+    JsonArray results = (*response)["results"].to<JsonArray>();
+    bool saved = configManager->applyBatch(items, results, dryRun);
+    sendBatchResult(manager, saved, dryRun, *response);
+  };
+
+  batchHandlers["register_map"] = [this](BLEManager* manager, const JsonDocument& command) {
+    String deviceId = command["device_id"] | "";
+    const char* csv = command["csv"] | "";
+    auto items = make_psram_unique<JsonDocument>(PsramAllocator::instance());
+    JsonArray list = items->to<JsonArray>();
+    String error;
+    if (!csvToItems(csv, deviceId, command["replace"] | false, list, error)) {
+      manager->sendError(error);
+      return;
+    }
+    bool dryRun = command["dry_run"] | false;
+    auto response = make_psram_unique<JsonDocument>(PsramAllocator::instance());
+    JsonArray results = (*response)["results"].to<JsonArray>();
+    bool saved = configManager->applyBatch(list, results, dryRun);
+    sendBatchResult(manager, saved, dryRun, *response);
+  };
+
   // === DELETE HANDLERS ===
   deleteHandlers["device"] = [this](BLEManager* manager, const JsonDocument& command) {
     String deviceId = command["device_id"] | "";
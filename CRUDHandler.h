@@ -5,11 +5,18 @@
 #include "ConfigManager.h"
 #include "ServerConfig.h"
 #include "LoggingConfig.h"
+#include "ResponseCache.h"
 #include <map>
 #include <functional>
-// Tambahan untuk thread safety
-#include <freertos/FreeRTOS.h>
-#include <freertos/semphr.h>
+
+// Server-side page sizes for list reads; clients may ask for less
+#define CRUD_PAGE_DEFAULT_REGISTERS 25
+#define CRUD_PAGE_MAX_REGISTERS 50
+#define CRUD_PAGE_DEFAULT_SUMMARIES 50
+#define CRUD_PAGE_MAX_SUMMARIES 200
+
+// Bulk commands: items per "batch" command and rows per register map
+#define CRUD_BATCH_MAX_ITEMS 2000
 
 class BLEManager;  // Forward declaration
 
@@ -18,8 +25,11 @@ private:
   ConfigManager* configManager;
   ServerConfig* serverConfig;
   LoggingConfig* loggingConfig;
-  String streamDeviceId;
-  SemaphoreHandle_t streamIdMutex; // <-- TAMBAHAN untuk thread-safety
+
+  // Bumped by every create/update/delete; read responses carry it as
+  // "version" and a read with a matching "if_version" gets "not_modified"
+  uint32_t configVersion;
+  ResponseCache responseCache;
 
   // Define a type for our command handler functions
   using CommandHandler = std::function<void(BLEManager*, const JsonDocument&)>;
@@ -29,20 +39,29 @@ private:
   std::map<String, CommandHandler> createHandlers;
   std::map<String, CommandHandler> updateHandlers;
   std::map<String, CommandHandler> deleteHandlers;
+  std::map<String, CommandHandler> batchHandlers;
 
   // Private method to populate the handler maps
   void setupCommandHandlers();
 
+  // Paging for list reads: "offset"/"limit", or the "cursor" returned as
+  // "next_cursor" by the previous page
+  static ConfigManager::Page parsePage(const JsonDocument& command, size_t defaultLimit, size_t maxLimit);
+  static void addPageInfo(JsonDocument& response, const ConfigManager::Page& page);
+
+  // Turns a CSV register map into batch items. The header row names the
+  // register fields; a row with a register_id updates that register.
+  // `replace` clears the device's registers first.
+  static bool csvToItems(const char* csv, const String& deviceId, bool replace, JsonArray& items, String& error);
+  void sendBatchResult(BLEManager* manager, bool saved, bool dryRun, JsonDocument& response);
+
+  static bool isCacheable(const String& type);
+  void handleCachedRead(BLEManager* manager, const String& type, const JsonDocument& command);
+
 public:
   CRUDHandler(ConfigManager* config, ServerConfig* serverCfg, LoggingConfig* loggingCfg);
-  ~CRUDHandler(); // <-- TAMBAHAN
 
   void handle(BLEManager* manager, const JsonDocument& command);
-  
-  // Fungsi-fungsi ini sekarang diimplementasikan di .cpp
-  String getStreamDeviceId();
-  void clearStreamDeviceId();
-  bool isStreaming();
 };
 
 #endif
\ No newline at end of file
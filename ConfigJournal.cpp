@@ -0,0 +1,151 @@
+#include "ConfigJournal.h"
+#include "MemoryManager.h"
+#include <esp_heap_caps.h>
+#include <esp_rom_crc.h>
+
+ConfigJournal::ConfigJournal(const char* path)
+  : path(path), fileSize(0), records(0), payloadBytes(0), journalBytes(0), snapshotBytes(0),
+    appendMicros(0), maxAppendMicros(0), compactions(0), lastCompactionMs(0), lastSnapshotBytes(0),
+    replayed(0), tornRecords(0) {}
+
+uint32_t ConfigJournal::checksum(uint8_t type, const uint8_t* payload, size_t length) {
+  uint32_t crc = esp_rom_crc32_le(0, &type, 1);
+  return esp_rom_crc32_le(crc, payload, length);
+}
+
+bool ConfigJournal::open() {
+  if (file) return true;
+  file = LittleFS.open(path, "a");
+  fileSize = file ? file.size() : 0;
+  return (bool)file;
+}
+
+bool ConfigJournal::append(JournalRecordType type, const JsonDocument& record) {
+  unsigned long startedAt = micros();
+  if (!open()) {
+    Serial.println("[JOURNAL] ERROR: Cannot open journal");
+    return false;
+  }
+
+  size_t length = measureMsgPack(record);
+  uint8_t* payload = (uint8_t*)heap_caps_malloc(length, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!payload) {
+    payload = (uint8_t*)heap_caps_malloc(length, MALLOC_CAP_8BIT);
+    if (!payload) return false;
+  }
+  serializeMsgPack(record, payload, length);
+
+  RecordHeader header = { CONFIG_JOURNAL_MAGIC, type, 0, (uint32_t)length, checksum(type, payload, length) };
+  size_t written = file.write((const uint8_t*)&header, sizeof(header));
+  written += file.write(payload, length);
+  file.flush();
+  heap_caps_free(payload);
+
+  fileSize += written;
+  journalBytes += written;
+  if (written != sizeof(header) + length) {
+    // A short record would end every later replay early; the caller writes
+    // a full snapshot instead, which resets the journal
+    Serial.printf("[JOURNAL] ERROR: Short write (%d of %d bytes)\n", written, sizeof(header) + length);
+    return false;
+  }
+
+  uint32_t elapsed = micros() - startedAt;
+  records++;
+  payloadBytes += length;
+  appendMicros += elapsed;
+  if (elapsed > maxAppendMicros) maxAppendMicros = elapsed;
+  return true;
+}
+
+bool ConfigJournal::replay(const ApplyFn& apply) {
+  if (file) file.close();
+
+  File input = LittleFS.open(path, "r");
+  if (!input) {
+    fileSize = 0;
+    return true;  // No journal yet
+  }
+  size_t total = input.size();
+  if (total == 0) {
+    input.close();
+    fileSize = 0;
+    return true;
+  }
+
+  uint8_t* buffer = (uint8_t*)heap_caps_malloc(total, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!buffer) {
+    buffer = (uint8_t*)heap_caps_malloc(total, MALLOC_CAP_8BIT);
+  }
+  if (!buffer) {
+    input.close();
+    Serial.println("[JOURNAL] ERROR: No memory to replay journal");
+    return false;
+  }
+  total = input.read(buffer, total);
+  input.close();
+
+  size_t offset = 0;
+  uint32_t applied = 0;
+  bool intact = true;
+  JsonDocument doc(PsramAllocator::instance());
+
+  while (offset < total) {
+    RecordHeader header;
+    if (total - offset < sizeof(header)) {
+      intact = false;
+      break;
+    }
+    memcpy(&header, buffer + offset, sizeof(header));
+    const uint8_t* payload = buffer + offset + sizeof(header);
+    if (header.magic != CONFIG_JOURNAL_MAGIC || header.length > total - offset - sizeof(header) ||
+        checksum(header.type, payload, header.length) != header.crc) {
+      intact = false;
+      break;
+    }
+    if (deserializeMsgPack(doc, payload, header.length) == DeserializationError::Ok) {
+      apply((JournalRecordType)header.type, doc.as<JsonObjectConst>());
+      applied++;
+    }
+    offset += sizeof(header) + header.length;
+  }
+  heap_caps_free(buffer);
+
+  replayed += applied;
+  fileSize = total;
+  if (!intact) {
+    tornRecords++;
+    Serial.printf("[JOURNAL] Damaged record at offset %d of %d, dropped the tail\n", offset, total);
+  }
+  Serial.printf("[JOURNAL] Replayed %lu records (%d bytes)\n", (unsigned long)applied, offset);
+  return intact;
+}
+
+bool ConfigJournal::reset(size_t snapshotSize, uint32_t elapsedMs) {
+  if (file) file.close();
+  bool removed = !LittleFS.exists(path) || LittleFS.remove(path);
+  fileSize = 0;
+
+  compactions++;
+  snapshotBytes += snapshotSize;
+  lastSnapshotBytes = snapshotSize;
+  lastCompactionMs = elapsedMs;
+  return removed;
+}
+
+void ConfigJournal::getStats(JsonObject& stats) {
+  stats["journal_bytes"] = fileSize;
+  stats["compact_threshold"] = CONFIG_JOURNAL_COMPACT_BYTES;
+  stats["records"] = records;
+  stats["avg_append_us"] = records ? (uint32_t)(appendMicros / records) : 0;
+  stats["max_append_us"] = maxAppendMicros;
+  stats["compactions"] = compactions;
+  stats["last_compaction_ms"] = lastCompactionMs;
+  stats["last_snapshot_bytes"] = lastSnapshotBytes;
+  stats["replayed"] = replayed;
+  stats["torn_records"] = tornRecords;
+  // Bytes written to flash per byte of changed config. A full rewrite per
+  // change would cost last_snapshot_bytes for every record instead.
+  stats["bytes_written"] = journalBytes + snapshotBytes;
+  stats["write_amplification"] = payloadBytes ? (float)(journalBytes + snapshotBytes) / payloadBytes : 0.0f;
+}
@@ -0,0 +1,77 @@
+#ifndef CONFIG_JOURNAL_H
+#define CONFIG_JOURNAL_H
+
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+#include <functional>
+
+#ifndef CONFIG_JOURNAL_COMPACT_BYTES
+#define CONFIG_JOURNAL_COMPACT_BYTES 16384  // Journal size that triggers a snapshot
+#endif
+#define CONFIG_JOURNAL_MAGIC 0xC7A1
+
+enum JournalRecordType : uint8_t {
+  JOURNAL_DEVICE_PUT = 1,  // {"device": {...}}, full device state
+  JOURNAL_DEVICE_DELETE,   // {"device_id": "..."}
+  JOURNAL_REGISTER_PUT,    // {"device_id": "...", "register": {...}}
+  JOURNAL_REGISTER_DELETE  // {"device_id": "...", "register_id": "..."}
+};
+
+// Append-only log of config mutations next to the devices.bin snapshot.
+// Each record is a fixed header (magic, type, length, CRC32) followed by a
+// MessagePack payload carrying the full new state of what changed, so
+// replaying a record twice is harmless. A record cut short by a reset
+// fails its CRC and ends the replay.
+class ConfigJournal {
+private:
+  struct RecordHeader {
+    uint16_t magic;
+    uint8_t type;
+    uint8_t reserved;
+    uint32_t length;
+    uint32_t crc;  // Over the type byte and the payload
+  };
+
+  const char* path;
+  File file;
+  size_t fileSize;
+
+  uint32_t records;
+  uint64_t payloadBytes;
+  uint64_t journalBytes;
+  uint64_t snapshotBytes;
+  uint64_t appendMicros;
+  uint32_t maxAppendMicros;
+  uint32_t compactions;
+  uint32_t lastCompactionMs;
+  uint32_t lastSnapshotBytes;
+  uint32_t replayed;
+  uint32_t tornRecords;
+
+  static uint32_t checksum(uint8_t type, const uint8_t* payload, size_t length);
+  bool open();
+
+public:
+  typedef std::function<void(JournalRecordType type, JsonObjectConst record)> ApplyFn;
+
+  explicit ConfigJournal(const char* path);
+
+  bool append(JournalRecordType type, const JsonDocument& record);
+
+  // Applies every intact record in order. Returns false if the journal
+  // ended in a damaged record, which the caller should compact away.
+  bool replay(const ApplyFn& apply);
+
+  // Called once a snapshot holding every record has been written
+  bool reset(size_t snapshotSize, uint32_t elapsedMs);
+
+  size_t size() const {
+    return fileSize;
+  }
+  bool needsCompaction() const {
+    return fileSize >= CONFIG_JOURNAL_COMPACT_BYTES;
+  }
+  void getStats(JsonObject& stats);
+};
+
+#endif
@@ -2,59 +2,63 @@
 #include <esp_heap_caps.h>
 #include <new>
 #include <vector>
+#include <map>
 
 // #define DEBUG_CONFIG_MANAGER // Uncomment to enable detailed debug logs
 
 const char* ConfigManager::DEVICES_FILE = "/devices.json";
+const char* ConfigManager::DEVICES_SNAPSHOT_FILE = "/devices.bin";
+const char* ConfigManager::DEVICES_TEMP_FILE = "/devices.bin.tmp";
+const char* ConfigManager::JOURNAL_FILE = "/devices.journal";
 const char* ConfigManager::REGISTERS_FILE = "/registers.json";
 
 ConfigManager::ConfigManager()
-  : devicesCache(nullptr), registersCache(nullptr),
-    devicesCacheValid(false), registersCacheValid(false) {
-  // --- PERBAIKAN: Gunakan DynamicJsonDocument (sesuai .h) ---
-  devicesCache = (DynamicJsonDocument*)heap_caps_malloc(sizeof(DynamicJsonDocument), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-  if (devicesCache) {
-    new (devicesCache) DynamicJsonDocument(8192);
-  } else {
-    devicesCache = new DynamicJsonDocument(4096);  // Fallback
-  }
-
-  registersCache = (DynamicJsonDocument*)heap_caps_malloc(sizeof(DynamicJsonDocument), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-  if (registersCache) {
-    new (registersCache) DynamicJsonDocument(16384);
-  } else {
-    registersCache = new DynamicJsonDocument(8192);  // Fallback
-  }
-  // --- AKHIR PERBAIKAN ---
+  : snapshot(newModel(nullptr)), devicesCacheValid(false), journal(JOURNAL_FILE), compactionTask(nullptr),
+    loadMs(0), loadFormat("none"), saveMs(0), reads(0), readMicros(0), mutations(0), mutationMicros(0) {
+  cacheMutex = xSemaphoreCreateMutex();
+  writeMutex = xSemaphoreCreateMutex();
 }
 
 ConfigManager::~ConfigManager() {
-  // --- PERBAIKAN: Sesuaikan destructor (sesuai .h) ---
-  if (devicesCache) {
-    devicesCache->~DynamicJsonDocument();
-    heap_caps_free(devicesCache);
+  freeModel(snapshot.get());
+  if (compactionTask) {
+    vTaskDelete(compactionTask);
   }
-  if (registersCache) {
-    registersCache->~DynamicJsonDocument();
-    heap_caps_free(registersCache);
+  if (cacheMutex) {
+    vSemaphoreDelete(cacheMutex);
+  }
+  if (writeMutex) {
+    vSemaphoreDelete(writeMutex);
   }
-  // --- AKHIR PERBAIKAN ---
 }
 
+namespace {
+
+// Holds a FreeRTOS mutex for the rest of the scope
+class MutexLock {
+private:
+  SemaphoreHandle_t mutex;
+
+public:
+  explicit MutexLock(SemaphoreHandle_t mutex)
+    : mutex(mutex) {
+    xSemaphoreTake(mutex, portMAX_DELAY);
+  }
+  ~MutexLock() {
+    xSemaphoreGive(mutex);
+  }
+};
+
+}  // namespace
+
 bool ConfigManager::begin() {
   if (!LittleFS.begin(true)) {
     Serial.println("LittleFS Mount Failed");
     return false;
   }
 
-  if (!LittleFS.exists(DEVICES_FILE)) {
-    // --- PERBAIKAN: Gunakan StaticJsonDocument untuk alokasi di STACK ---
-    StaticJsonDocument<64> doc;
-    // --- AKHIR PERBAIKAN ---
-    doc.to<JsonObject>();
-    saveJson(DEVICES_FILE, doc);
-    Serial.println("Created empty devices file");
-  }
+  // No devices file is created here: devices.json is only read when there
+  // is one to import, and a missing snapshot is an empty config
   if (!LittleFS.exists(REGISTERS_FILE)) {
     // --- PERBAIKAN: Gunakan StaticJsonDocument untuk alokasi di STACK ---
     StaticJsonDocument<64> doc;
@@ -64,13 +68,25 @@ bool ConfigManager::begin() {
     Serial.println("Created empty registers file");
   }
 
+  // A snapshot left half written by a reset; the old one is still intact
+  if (LittleFS.exists(DEVICES_TEMP_FILE)) {
+    LittleFS.remove(DEVICES_TEMP_FILE);
+    Serial.println("Removed incomplete devices snapshot");
+  }
+
   // Initialize cache as invalid - will be loaded on first access
   devicesCacheValid = false;
-  registersCacheValid = false;
 
-  // Clear cache content
-  devicesCache->clear();
-  registersCache->clear();
+  if (!compactionTask) {
+    xTaskCreatePinnedToCore(
+      compactionTaskFn,
+      "CONFIG_COMPACT_TASK",
+      6144,
+      this,
+      1,
+      &compactionTask,
+      0);
+  }
 
   Serial.println("ConfigManager initialized - cache will be loaded on demand");
   return true;
@@ -80,6 +96,22 @@ String ConfigManager::generateId(const String& prefix) {
   return prefix + String(random(100000, 999999), HEX).substring(0, 6);
 }
 
+String ConfigManager::uniqueDeviceId(const DeviceSet& set) {
+  String deviceId;
+  do {
+    deviceId = generateId("D");
+  } while (set.indexOf(deviceId.c_str()) >= 0);
+  return deviceId;
+}
+
+String ConfigManager::uniqueRegisterId(const DeviceConfig& device) {
+  String registerId;
+  do {
+    registerId = generateId("R");
+  } while (device.findRegister(registerId.c_str()) >= 0);
+  return registerId;
+}
+
 bool ConfigManager::saveJson(const String& filename, const JsonDocument& doc) {
   File file = LittleFS.open(filename, "w");
   if (!file) return false;
@@ -113,38 +145,338 @@ bool ConfigManager::loadJson(const String& filename, JsonDocument& doc) {
   return error == DeserializationError::Ok;
 }
 
-String ConfigManager::createDevice(JsonObjectConst config) {
-  if (!loadDevicesCache()) return "";
+// Models live in PSRAM. A copy of `from` shares its devices and string
+// pool; without one the model starts empty with a pool of its own.
+ConfigModel* ConfigManager::newModel(const ConfigModel* from) {
+  ConfigModel* model = (ConfigModel*)heap_caps_malloc(sizeof(ConfigModel), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (model) {
+    from ? new (model) ConfigModel(*from) : new (model) ConfigModel();
+  } else {
+    model = from ? new ConfigModel(*from) : new ConfigModel();  // Fallback
+  }
+  return model;
+}
 
-  String deviceId = generateId("D");
-  // --- PERBAIKAN: Sintaks v7 untuk createNestedObject ---
-  JsonObject device = (*devicesCache)[deviceId].to<JsonObject>();
-  // --- AKHIR PERBAIKAN ---
+void ConfigManager::freeModel(ConfigModel* model) {
+  if (model) {
+    model->~ConfigModel();
+    heap_caps_free(model);
+  }
+}
 
-  // Copy config with proper type conversion
-  for (JsonPairConst kv : config) {
-    String key = kv.key().c_str();
-    if (key == "slave_id" || key == "port" || key == "timeout" || key == "retry_count" || key == "refresh_rate_ms" || key == "baud_rate" || key == "data_bits" || key == "stop_bits" || key == "serial_port") {
-      // Convert string numbers to integers
-      int value = kv.value().is<String>() ? kv.value().as<String>().toInt() : kv.value().as<int>();
-      device[kv.key()] = value;
-    } else {
-      device[kv.key()] = kv.value();
+// A private copy of the published model for a writer to change. Only
+// called with writeMutex held, so the model it copies stays published.
+ConfigModel* ConfigManager::stageModel() {
+  ConfigModel* next = newModel(snapshot.get());
+  next->version++;
+  return next;
+}
+
+// Makes `next` the model readers see. Returns once no reader still holds
+// the previous one, which is then freed along with every device only it
+// referenced.
+void ConfigManager::publishModel(ConfigModel* next) {
+  freeModel(snapshot.exchange(next));
+}
+
+// Writes the whole model as a new binary snapshot and empties the
+// journal. The snapshot goes to a temporary file that replaces devices.bin
+// by rename, so a reset leaves either the old snapshot plus journal or the
+// new one. An imported devices.json is removed before the journal, so it
+// is never applied again on top of a snapshot that already holds it.
+bool ConfigManager::saveDevices(const ConfigModel& model) {
+  unsigned long startedAt = millis();
+  File file = LittleFS.open(DEVICES_TEMP_FILE, "w");
+  if (!file) return false;
+
+  bool written = model.writeBinary(file);
+  size_t size = file.size();
+  file.close();
+  if (!written) {
+    Serial.println("[CONFIG] ERROR: Short write of devices snapshot");
+    LittleFS.remove(DEVICES_TEMP_FILE);
+    return false;
+  }
+  if (!LittleFS.rename(DEVICES_TEMP_FILE, DEVICES_SNAPSHOT_FILE)) {
+    Serial.println("[CONFIG] ERROR: Failed to replace devices snapshot");
+    return false;
+  }
+  if (LittleFS.exists(DEVICES_FILE)) {
+    LittleFS.remove(DEVICES_FILE);
+  }
+
+  saveMs = millis() - startedAt;
+  journal.reset(size, saveMs);
+  return true;
+}
+
+// Persists a staged change by appending it to the journal, or by writing a
+// full snapshot of `next` if that fails, then publishes `next`. If neither
+// could be written the change is dropped and readers keep the old model.
+bool ConfigManager::commitMutation(JournalRecordType type, const JsonDocument& record, ConfigModel* next,
+                                   unsigned long startedAt) {
+  bool saved = journal.append(type, record) || saveDevices(*next);
+  if (saved) {
+    publishModel(next);
+    if (journal.needsCompaction() && compactionTask) {
+      xTaskNotifyGive(compactionTask);
+    }
+  } else {
+    freeModel(next);
+  }
+  mutations++;
+  mutationMicros += micros() - startedAt;
+  return saved;
+}
+
+void ConfigManager::compactionTaskFn(void* parameter) {
+  ConfigManager* manager = static_cast<ConfigManager*>(parameter);
+  while (true) {
+    ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+    manager->compact();
+  }
+}
+
+void ConfigManager::compact() {
+  if (!loadDevicesCache()) return;
+
+  MutexLock lock(writeMutex);
+  if (journal.size() == 0) return;
+  size_t journalSize = journal.size();
+  if (saveDevices(*snapshot.get())) {
+    // Same contents in a fresh string pool: strings the journaled edits
+    // superseded are freed with the old pool once its last reader is gone
+    ConfigModel* next = newModel(snapshot.get());
+    size_t stringBytes = next->strings->bytes();
+    next->repack();
+    Serial.printf("[CONFIG] Compacted %d byte journal into snapshot in %lu ms, strings %u -> %u bytes\n",
+                  journalSize, (unsigned long)saveMs, (unsigned)stringBytes, (unsigned)next->strings->bytes());
+    publishModel(next);
+  }
+}
+
+// Replays one journal record onto the model. Every record carries the full
+// new state of what it touches, so applying one that the snapshot already
+// contains changes nothing.
+void ConfigManager::applyRecord(ConfigModel& model, JournalRecordType type, JsonObjectConst record) {
+  switch (type) {
+    case JOURNAL_DEVICE_PUT:
+      {
+        JsonObjectConst config = record["device"];
+        const char* deviceId = config["device_id"] | "";
+        if (!deviceId[0]) return;
+        DeviceConfig* device = model.find(deviceId);
+        if (!device) {
+          device = model.add(model.strings->intern(deviceId));
+        }
+        const char* internedId = device->deviceId;
+        device->resetFields();
+        device->applyJson(config, *model.strings);
+        device->deviceId = internedId;
+        break;
+      }
+    case JOURNAL_DEVICE_DELETE:
+      {
+        int index = model.indexOf(record["device_id"] | "");
+        if (index >= 0) {
+          model.remove(index);
+        }
+        break;
+      }
+    case JOURNAL_REGISTER_PUT:
+      {
+        DeviceConfig* device = model.find(record["device_id"] | "");
+        JsonObjectConst config = record["register"];
+        if (!device || !config["register_id"].is<const char*>()) return;
+        RegisterConfig reg;
+        reg.applyJson(config, *model.strings);
+        int index = device->findRegister(reg.registerId);
+        if (index >= 0) {
+          device->registers[index] = reg;
+          device->reindexRegisters();
+        } else {
+          device->addRegister(reg);
+        }
+        break;
+      }
+    case JOURNAL_REGISTER_DELETE:
+      {
+        DeviceConfig* device = model.find(record["device_id"] | "");
+        if (!device) return;
+        int index = device->findRegister(record["register_id"] | "");
+        if (index >= 0) {
+          device->removeRegister(index);
+        }
+        break;
+      }
+  }
+}
+
+void ConfigManager::addChangeListener(QueueHandle_t queue) {
+  if (queue) {
+    changeListeners.push_back(queue);
+  }
+}
+
+void ConfigManager::removeChangeListener(QueueHandle_t queue) {
+  for (auto it = changeListeners.begin(); it != changeListeners.end(); ++it) {
+    if (*it == queue) {
+      changeListeners.erase(it);
+      return;
+    }
+  }
+}
+
+// Never blocks the writer. A listener whose queue is full has missed
+// events, so its backlog is replaced by one resync.
+void ConfigManager::publishChange(ConfigChangeType type, const char* deviceId, const char* registerId) {
+  ConfigChange change = {};
+  change.type = type;
+  if (strlen(deviceId) >= CONFIG_CHANGE_ID_MAX || strlen(registerId) >= CONFIG_CHANGE_ID_MAX) {
+    change.type = CONFIG_RESYNC;
+  } else {
+    strcpy(change.deviceId, deviceId);
+    strcpy(change.registerId, registerId);
+  }
+
+  for (QueueHandle_t queue : changeListeners) {
+    if (xQueueSend(queue, &change, 0) != pdTRUE) {
+      ConfigChange resync = {};
+      resync.type = CONFIG_RESYNC;
+      xQueueReset(queue);
+      xQueueSend(queue, &resync, 0);
     }
   }
-  device["device_id"] = deviceId;
-  // --- PERBAIKAN: Sintaks v7 untuk createNestedArray ---
-  JsonArray registers = device["registers"].to<JsonArray>();
+}
+
+void ConfigManager::publishChanges(const std::vector<ConfigChange>& changes) {
+  for (const ConfigChange& change : changes) {
+    publishChange(change.type, change.deviceId, change.registerId);
+  }
+}
+
+void ConfigManager::getJournalStats(JsonObject& stats) {
+  journal.getStats(stats);
+}
+
+// Single changes applied to a staged copy of the model, one per call or
+// one for a whole batch. Each returns nullptr on
+// success or the reason the change was rejected, leaving the set as it was.
+const char* ConfigManager::stageCreateDevice(ConfigModel& set, JsonObjectConst config, DeviceConfig*& device) {
+  String deviceId = uniqueDeviceId(set);
+  device = set.add(set.strings->intern(deviceId.c_str()));
+  const char* internedId = device->deviceId;
+
+  // Registers are added one by one after the device exists
+  device->applyJson(config, *set.strings);
+  device->deviceId = internedId;
+  device->registers.clear();
+  device->reindexRegisters();
+  return nullptr;
+}
+
+const char* ConfigManager::stageUpdateDevice(ConfigModel& set, const char* deviceId, JsonObjectConst config,
+                                             DeviceConfig*& device) {
+  int index = set.indexOf(deviceId);
+  if (index < 0) return "Device not found";
+
+  // Update all fields while preserving device_id; registers are only
+  // replaced when the config carries a "registers" array
+  device = set.edit(index);
+  const char* internedId = device->deviceId;
+  device->applyJson(config, *set.strings);
+  device->deviceId = internedId;
+  return nullptr;
+}
+
+const char* ConfigManager::stageDeleteDevice(ConfigModel& set, const char* deviceId) {
+  int index = set.indexOf(deviceId);
+  if (index < 0) return "Device not found";
+  set.remove(index);
+  return nullptr;
+}
+
+const char* ConfigManager::stageCreateRegister(ConfigModel& set, const char* deviceId, JsonObjectConst config,
+                                               RegisterConfig& reg) {
+  int index = set.indexOf(deviceId);
+  if (index < 0) return "Device not found";
+
+  // Validate required fields
+  // --- PERBAIKAN: Sintaks v7 untuk containsKey ---
+  if (config["address"].isNull() || config["register_name"].isNull()) {
   // --- AKHIR PERBAIKAN ---
+    return "Missing required register fields: address or register_name";
+  }
+
+  reg = RegisterConfig();
+  reg.applyJson(config, *set.strings);
+  if (reg.address < 0) return "Invalid address";
+
+  // Check for duplicate address
+  if (set.devices[index]->findAddress(reg.address) >= 0) return "Register address already exists";
+
+  DeviceConfig* device = set.edit(index);
+  reg.registerId = set.strings->intern(uniqueRegisterId(*device).c_str());
+  device->addRegister(reg);
+  return nullptr;
+}
+
+const char* ConfigManager::stageUpdateRegister(ConfigModel& set, const char* deviceId, const char* registerId,
+                                               JsonObjectConst config, RegisterConfig& reg) {
+  int index = set.indexOf(deviceId);
+  if (index < 0) return "Device not found";
+  const DeviceConfig* current = set.devices[index].get();
+
+  int regIndex = current->findRegister(registerId);
+  if (regIndex < 0) return "Register not found";
+
+  reg = current->registers[regIndex];
+  reg.applyJson(config, *set.strings);
+  reg.registerId = current->registers[regIndex].registerId;  // Ensure register_id is preserved
+
+  // Check for duplicate address if address is being updated
+  if (reg.address != current->registers[regIndex].address) {
+    int other = current->findAddress(reg.address);
+    if (other >= 0 && other != regIndex) return "Address already exists in another register";
+  }
+
+  DeviceConfig* device = set.edit(index);
+  device->registers[regIndex] = reg;
+  device->reindexRegisters();
+  return nullptr;
+}
+
+const char* ConfigManager::stageDeleteRegister(ConfigModel& set, const char* deviceId, const char* registerId) {
+  int index = set.indexOf(deviceId);
+  if (index < 0) return "Device not found";
+
+  int regIndex = set.devices[index]->findRegister(registerId);
+  if (regIndex < 0) return "Register not found";
+
+  set.edit(index)->removeRegister(regIndex);
+  return nullptr;
+}
+
+String ConfigManager::createDevice(JsonObjectConst config) {
+  if (!loadDevicesCache()) return "";
+  MutexLock lock(writeMutex);
+  unsigned long startedAt = micros();
+
+  ConfigModel* next = stageModel();
+  DeviceConfig* device;
+  stageCreateDevice(*next, config, device);
+  String deviceId = device->deviceId;
   Serial.printf("Created device %s with empty registers array\n", deviceId.c_str());
 
-  // Save to file and keep cache valid
-  if (saveJson(DEVICES_FILE, *devicesCache)) {
+  JsonDocument record(PsramAllocator::instance());
+  device->toJson(record["device"].to<JsonObject>(), true);
+
+  // Journal the change and keep cache valid
+  if (commitMutation(JOURNAL_DEVICE_PUT, record, next, startedAt)) {
     Serial.printf("Device %s created and cache updated\n", deviceId.c_str());
+    publishChange(CONFIG_DEVICE_ADDED, deviceId.c_str());
     return deviceId;
   }
-
-  invalidateDevicesCache();
   return "";
 }
 
@@ -153,19 +485,19 @@ bool ConfigManager::readDevice(const String& deviceId, JsonObject& result) {
     Serial.println("Failed to load devices cache for readDevice");
     return false;
   }
+  unsigned long startedAt = micros();
+  ModelReader model(snapshot);
 
 #ifdef DEBUG_CONFIG_MANAGER
   Serial.printf("[DEBUG] Looking for device ID: '%s'\n", deviceId.c_str());
   Serial.printf("[DEBUG] Device ID length: %d\n", deviceId.length());
 #endif
 
-  // --- PERBAIKAN: Sintaks v7 untuk containsKey ---
-  if (!(*devicesCache)[deviceId].isNull()) {
-  // --- AKHIR PERBAIKAN ---
-    JsonObject device = (*devicesCache)[deviceId];
-    for (JsonPair kv : device) {
-      result[kv.key()] = kv.value();
-    }
+  const DeviceConfig* device = model->find(deviceId.c_str());
+  if (device) {
+    device->toJson(result, true);
+    reads++;
+    readMicros += micros() - startedAt;
 #ifdef DEBUG_CONFIG_MANAGER
     Serial.printf("Device %s read from cache\n", deviceId.c_str());
 #endif
@@ -175,9 +507,8 @@ bool ConfigManager::readDevice(const String& deviceId, JsonObject& result) {
 #ifdef DEBUG_CONFIG_MANAGER
   // Debug: Show all available keys
   Serial.printf("Device %s not found in cache. Available devices:\n", deviceId.c_str());
-  for (JsonPair kv : devicesCache->as<JsonObject>()) {
-    Serial.printf("  - '%s' (length: %d)\n",
-                  kv.key().c_str(), String(kv.key().c_str()).length());
+  for (const DevicePtr& entry : model->devices) {
+    Serial.printf("  - '%s' (length: %d)\n", entry->deviceId, strlen(entry->deviceId));
   }
 #endif
   return false;
@@ -185,62 +516,56 @@ bool ConfigManager::readDevice(const String& deviceId, JsonObject& result) {
 
 bool ConfigManager::updateDevice(const String& deviceId, JsonObjectConst config) {
   if (!loadDevicesCache()) return false;
-
-  // --- PERBAIKAN: Sintaks v7 untuk containsKey ---
-  if ((*devicesCache)[deviceId].isNull()) {
-  // --- AKHIR PERBAIKAN ---
-    Serial.printf("Device %s not found for update\n", deviceId.c_str());
+  MutexLock lock(writeMutex);
+  unsigned long startedAt = micros();
+
+  ConfigModel* next = stageModel();
+  DeviceConfig* device;
+  const char* error = stageUpdateDevice(*next, deviceId.c_str(), config, device);
+  if (error) {
+    Serial.printf("Device %s update failed: %s\n", deviceId.c_str(), error);
+    freeModel(next);
     return false;
   }
 
-  JsonObject device = (*devicesCache)[deviceId];
+  // Registers only go into the record when they were replaced
+  JsonDocument record(PsramAllocator::instance());
+  device->toJson(record["device"].to<JsonObject>(), config["registers"].is<JsonArrayConst>());
 
-  // Update device configuration while preserving device_id and registers
-  JsonArray existingRegisters = device["registers"];
-
-  // Update all config fields with proper type conversion
-  for (JsonPairConst kv : config) {
-    String key = kv.key().c_str();
-    if (key == "slave_id" || key == "port" || key == "timeout" || key == "retry_count" || key == "refresh_rate_ms" || key == "baud_rate" || key == "data_bits" || key == "stop_bits" || key == "serial_port") {
-      // Convert string numbers to integers
-      int value = kv.value().is<String>() ? kv.value().as<String>().toInt() : kv.value().as<int>();
-      device[kv.key()] = value;
-    } else {
-      device[kv.key()] = kv.value();
-    }
-  }
-
-  // Ensure device_id and registers are preserved
-  device["device_id"] = deviceId;
-  // --- PERBAIKAN: Sintaks v7 untuk containsKey ---
-  if (device["registers"].isNull()) {
-  // --- AKHIR PERBAIKAN ---
-    device["registers"] = existingRegisters;
-  }
-
-  // Save to file and keep cache valid
-  if (saveJson(DEVICES_FILE, *devicesCache)) {
+  // Journal the change and keep cache valid
+  if (commitMutation(JOURNAL_DEVICE_PUT, record, next, startedAt)) {
     Serial.printf("Device %s updated successfully\n", deviceId.c_str());
+    publishChange(CONFIG_DEVICE_MODIFIED, deviceId.c_str());
     return true;
   }
-
-  invalidateDevicesCache();
   return false;
 }
 
 bool ConfigManager::deleteDevice(const String& deviceId) {
   if (!loadDevicesCache()) return false;
+  MutexLock lock(writeMutex);
+  unsigned long startedAt = micros();
 
-  // --- PERBAIKAN: Sintaks v7 untuk containsKey ---
-  if (!(*devicesCache)[deviceId].isNull()) {
-  // --- AKHIR PERBAIKAN ---
-    devicesCache->as<JsonObject>().remove(deviceId);  // Perlu cast ke JsonObject untuk remove
-    if (saveJson(DEVICES_FILE, *devicesCache)) {
-      return true;
-    }
-    invalidateDevicesCache();
+  ConfigModel* next = stageModel();
+  if (stageDeleteDevice(*next, deviceId.c_str())) {
+    freeModel(next);
+    return false;
   }
-  return false;
+
+  JsonDocument record(PsramAllocator::instance());
+  record["device_id"] = deviceId;
+  if (!commitMutation(JOURNAL_DEVICE_DELETE, record, next, startedAt)) return false;
+  publishChange(CONFIG_DEVICE_REMOVED, deviceId.c_str());
+  return true;
+}
+
+static bool isValidDeviceId(const char* deviceId) {
+  return deviceId[0] != '\0' && strchr(deviceId, '{') == nullptr;
+}
+
+// Ids left behind by old firmware bugs, such as "{}"
+static bool isCorruptDeviceId(const char* deviceId) {
+  return !isValidDeviceId(deviceId) || strlen(deviceId) < 3;
 }
 
 void ConfigManager::listDevices(JsonArray& devices) {
@@ -248,33 +573,25 @@ void ConfigManager::listDevices(JsonArray& devices) {
     Serial.println("Failed to load devices cache for listDevices");
     return;
   }
+  ModelReader model(snapshot);
 
-  JsonObject devicesObj = devicesCache->as<JsonObject>();
   int count = 0;
 
 #ifdef DEBUG_CONFIG_MANAGER
-  Serial.printf("[DEBUG] Cache size: %d devices\n", devicesObj.size());
-#endif
-
-  for (JsonPair kv : devicesObj) {
-    const char* keyPtr = kv.key().c_str();
-    String deviceId = String(keyPtr);
-
-#ifdef DEBUG_CONFIG_MANAGER
-    Serial.printf("[DEBUG] Raw key: '%s', String ID: '%s' (len: %d)\n",
-                  keyPtr, deviceId.c_str(), deviceId.length());
+  Serial.printf("[DEBUG] Cache size: %d devices\n", model->devices.size());
 #endif
 
+  for (const DevicePtr& device : model->devices) {
     // Validate device ID before adding
-    if (deviceId.length() > 0 && deviceId != "{}" && deviceId.indexOf('{') == -1) {
-      devices.add(deviceId);
+    if (isValidDeviceId(device->deviceId)) {
+      devices.add(device->deviceId);
       count++;
 #ifdef DEBUG_CONFIG_MANAGER
-      Serial.printf("[DEBUG] Added valid device ID: '%s'\n", deviceId.c_str());
+      Serial.printf("[DEBUG] Added valid device ID: '%s'\n", device->deviceId);
 #endif
     } else {
 #ifdef DEBUG_CONFIG_MANAGER
-      Serial.printf("[DEBUG] Skipped invalid device ID: '%s'\n", deviceId.c_str());
+      Serial.printf("[DEBUG] Skipped invalid device ID: '%s'\n", device->deviceId);
 #endif
     }
   }
@@ -283,23 +600,66 @@ void ConfigManager::listDevices(JsonArray& devices) {
 #endif
 }
 
-void ConfigManager::getDevicesSummary(JsonArray& summary) {
-  // --- PERBAIKAN: Gunakan StaticJsonDocument untuk alokasi di STACK ---
-  StaticJsonDocument<4096> devices;
-  // --- AKHIR PERBAIKAN ---
-  if (!loadJson(DEVICES_FILE, devices)) return;
+// afterIndex is the index of the page cursor's entry, -1 if it is gone
+size_t ConfigManager::pageStart(int afterIndex, const Page& page) {
+  if (!page.after.isEmpty() && afterIndex >= 0) {
+    return afterIndex + 1;
+  }
+  return page.offset;  // No cursor, or its entry was deleted
+}
+
+void ConfigManager::getDevicesSummary(JsonArray& summary, Page& page) {
+  if (!loadDevicesCache()) return;
+  ModelReader model(snapshot);
 
-  for (JsonPair kv : devices.as<JsonObject>()) {
-    JsonObject device = kv.value();
+  const PsramVector<DevicePtr>& devices = model->devices;
+  size_t start = pageStart(page.after.isEmpty() ? -1 : model->indexOf(page.after.c_str()), page);
+  size_t added = 0;
+  page.total = devices.size();
+
+  for (size_t i = start; i < devices.size() && added < page.limit; i++) {
+    const DeviceConfig& device = *devices[i];
     // --- PERBAIKAN: Sintaks v7 untuk createNestedObject di Array ---
     JsonObject deviceSummary = summary.add<JsonObject>();
     // --- AKHIR PERBAIKAN ---
 
-    deviceSummary["device_id"] = kv.key();
-    deviceSummary["device_name"] = device["device_name"];
-    deviceSummary["protocol"] = device["protocol"];
-    deviceSummary["register_count"] = device["registers"].size();
+    deviceSummary["device_id"] = device.deviceId;
+    deviceSummary["device_name"] = device.deviceName;
+    deviceSummary["protocol"] = device.protocol;
+    deviceSummary["register_count"] = device.registers.size();
+    page.lastId = device.deviceId;
+    added++;
   }
+  page.next = start + added;
+}
+
+size_t ConfigManager::getRegisterCount() {
+  if (!loadDevicesCache()) return 0;
+  ModelReader model(snapshot);
+  return model->registerCount();
+}
+
+void ConfigManager::getModelStats(JsonObject& stats) {
+  if (!loadDevicesCache()) return;
+  ModelReader model(snapshot);
+
+  stats["version"] = model->version;
+  stats["devices"] = model->devices.size();
+  stats["registers"] = model->registerCount();
+  stats["strings"] = model->strings->count();
+  stats["string_bytes"] = model->strings->bytes();
+  stats["load_ms"] = loadMs;
+  stats["load_format"] = loadFormat;
+  stats["save_ms"] = saveMs;
+  stats["reads"] = reads;
+  stats["avg_read_us"] = reads ? (uint32_t)(readMicros / reads) : 0;
+  stats["mutations"] = mutations;
+  stats["avg_mutation_us"] = mutations ? (uint32_t)(mutationMicros / mutations) : 0;
+  // Time writers spent waiting for readers of the model they replaced
+  stats["published"] = snapshot.getExchanges();
+  stats["last_grace_us"] = snapshot.getLastGraceMicros();
+  stats["max_grace_us"] = snapshot.getMaxGraceMicros();
+  stats["active_readers"] = snapshot.activeReaders();
 }
 
 String ConfigManager::createRegister(const String& deviceId, JsonObjectConst config) {
@@ -318,226 +678,244 @@ String ConfigManager::createRegister(const String& deviceId, JsonObjectConst con
     Serial.println("[CREATE_REGISTER] Failed to load devices cache");
     return "";
   }
-
-  // --- PERBAIKAN: Sintaks v7 untuk containsKey ---
-  if ((*devicesCache)[deviceId].isNull()) {
-  // --- AKHIR PERBAIKAN ---
-    Serial.printf("[CREATE_REGISTER] Device %s not found in cache\n", deviceId.c_str());
+  MutexLock lock(writeMutex);
+  unsigned long startedAt = micros();
+
+  ConfigModel* next = stageModel();
+  RegisterConfig reg;
+  const char* error = stageCreateRegister(*next, deviceId.c_str(), config, reg);
+  if (error) {
+    Serial.printf("[CREATE_REGISTER] Device %s: %s\n", deviceId.c_str(), error);
+    freeModel(next);
     return "";
   }
+  String registerId = reg.registerId;
 
-  // Validate required fields
-  // --- PERBAIKAN: Sintaks v7 untuk containsKey ---
-  if (config["address"].isNull() || config["register_name"].isNull()) {
-  // --- AKHIR PERBAIKAN ---
-    Serial.println("[CREATE_REGISTER] Missing required register fields: address or register_name");
-    return "";
-  }
-
-  String registerId = generateId("R");
-  JsonObject device = (*devicesCache)[deviceId];
-
-  // Ensure registers array exists
-  // --- PERBAIKAN: Sintaks v7 untuk containsKey ---
-  if (device["registers"].isNull()) {
-    device["registers"].to<JsonArray>();  // Sintaks v7
-  // --- AKHIR PERBAIKAN ---
-    Serial.println("Created registers array for device");
-  }
+  Serial.printf("[CREATE_REGISTER] Created register %s (address: %d) for device %s\n",
+                registerId.c_str(), reg.address, deviceId.c_str());
 
-  JsonArray registers = device["registers"];
+  JsonDocument record(PsramAllocator::instance());
+  record["device_id"] = deviceId;
+  reg.toJson(record["register"].to<JsonObject>());
 
-  // Parse address - handle both string and integer formats
-  int address = 0;
-  if (config["address"].is<String>()) {
-    address = config["address"].as<String>().toInt();
-  } else {
-    address = config["address"].as<int>();
-  }
-
-  if (address < 0) {
-    Serial.printf("Invalid address: %d\n", address);
-    return "";
+  // Journal the change and keep cache valid
+  if (commitMutation(JOURNAL_REGISTER_PUT, record, next, startedAt)) {
+    Serial.println("[CREATE_REGISTER] Successfully journaled register and updated cache");
+    publishChange(CONFIG_REGISTER_ADDED, deviceId.c_str(), registerId.c_str());
+    return registerId;
   }
+  Serial.println("[CREATE_REGISTER] Failed to save devices file");
+  return "";
+}
 
-  // Check for duplicate address
-  for (JsonVariant regVar : registers) {
-    JsonObject existingReg = regVar.as<JsonObject>();
-    int existingAddress = existingReg["address"].is<String>() ? existingReg["address"].as<String>().toInt() : existingReg["address"].as<int>();
-
-    if (existingAddress == address) {
-      Serial.printf("Register address %d already exists in device %s\n", address, deviceId.c_str());
-      return "";
+bool ConfigManager::applyBatch(JsonArrayConst items, JsonArray& results, bool dryRun) {
+  if (!loadDevicesCache()) return false;
+  MutexLock lock(writeMutex);
+  unsigned long startedAt = micros();
+
+  // Shares every device with the published model until an item changes
+  // it. The batch interns into a scratch pool, so a rejected or dry-run
+  // batch leaves nothing behind; the shared devices keep pointing into the
+  // published pool, which stays alive while writeMutex is held.
+  ConfigModel* stage = stageModel();
+  stage->strings = std::allocate_shared<StringPool>(PsramStlAllocator<StringPool>());
+  std::map<String, String> refs;  // "ref" of a created device -> its id
+  std::vector<ConfigChange> changes;  // Published once the batch is saved
+  size_t index = 0;
+  size_t failed = 0;
+
+  for (JsonVariantConst entry : items) {
+    JsonObjectConst item = entry.as<JsonObjectConst>();
+    JsonObject result = results.add<JsonObject>();
+    result["index"] = index++;
+
+    String op = item["op"] | "";
+    String type = item["type"] | "";
+    String deviceId = item["device_id"] | "";
+    if (deviceId.isEmpty() && item["device_ref"].is<const char*>()) {
+      auto ref = refs.find(item["device_ref"].as<const char*>());
+      if (ref != refs.end()) deviceId = ref->second;
+    }
+    String registerId = item["register_id"] | "";
+    JsonObjectConst config = item["config"];
+    const char* error = nullptr;
+    ConfigChange change = {};
+
+    if (type == "device") {
+      DeviceConfig* device;
+      if (op == "create") {
+        error = stageCreateDevice(*stage, config, device);
+        if (!error) {
+          result["device_id"] = device->deviceId;
+          if (item["ref"].is<const char*>()) refs[item["ref"].as<const char*>()] = device->deviceId;
+          deviceId = device->deviceId;
+        }
+        change.type = CONFIG_DEVICE_ADDED;
+      } else if (op == "update") {
+        error = stageUpdateDevice(*stage, deviceId.c_str(), config, device);
+        change.type = CONFIG_DEVICE_MODIFIED;
+      } else if (op == "delete") {
+        error = stageDeleteDevice(*stage, deviceId.c_str());
+        change.type = CONFIG_DEVICE_REMOVED;
+      } else {
+        error = "Unsupported operation";
+      }
+    } else if (type == "register") {
+      RegisterConfig reg;
+      if (op == "create") {
+        error = stageCreateRegister(*stage, deviceId.c_str(), config, reg);
+        if (!error) {
+          result["register_id"] = reg.registerId;
+          registerId = reg.registerId;
+        }
+        change.type = CONFIG_REGISTER_ADDED;
+      } else if (op == "update") {
+        error = stageUpdateRegister(*stage, deviceId.c_str(), registerId.c_str(), config, reg);
+        change.type = CONFIG_REGISTER_MODIFIED;
+      } else if (op == "delete") {
+        error = stageDeleteRegister(*stage, deviceId.c_str(), registerId.c_str());
+        change.type = CONFIG_REGISTER_REMOVED;
+      } else {
+        error = "Unsupported operation";
+      }
+    } else {
+      error = "Unsupported type";
     }
-  }
-
-  Serial.printf("[CREATE_REGISTER] Registers array size before: %d\n", registers.size());
 
-  // --- PERBAIKAN: Sintaks v7 untuk createNestedObject di Array ---
-  JsonObject newRegister = registers.add<JsonObject>();
-  // --- AKHIR PERBAIKAN ---
-  for (JsonPairConst kv : config) {
-    String key = kv.key().c_str();
-    if (key == "address") {
-      // Always store address as integer
-      newRegister[kv.key()] = address;
-    } else if (key == "function_code" || key == "refresh_rate_ms") {
-      // Convert string numbers to integers
-      int value = kv.value().is<String>() ? kv.value().as<String>().toInt() : kv.value().as<int>();
-      newRegister[kv.key()] = value;
+    if (error) {
+      result["status"] = "error";
+      result["error"] = error;
+      failed++;
     } else {
-      newRegister[kv.key()] = kv.value();
+      result["status"] = "ok";
+      if (deviceId.length() >= CONFIG_CHANGE_ID_MAX || registerId.length() >= CONFIG_CHANGE_ID_MAX) {
+        change.type = CONFIG_RESYNC;
+      } else {
+        strcpy(change.deviceId, deviceId.c_str());
+        if (type == "register") strcpy(change.registerId, registerId.c_str());
+      }
+      changes.push_back(change);
     }
   }
-  newRegister["register_id"] = registerId;
-
-  Serial.printf("[CREATE_REGISTER] Registers array size after: %d\n", registers.size());
-  Serial.printf("[CREATE_REGISTER] Created register %s (address: %d) for device %s\n", registerId.c_str(), address, deviceId.c_str());
 
-  // Debug: Print the new register content
-  Serial.println("[CREATE_REGISTER] New register content:");
-  for (JsonPair kv : newRegister) {
-    Serial.printf("  %s: %s\n", kv.key().c_str(), kv.value().as<String>().c_str());
+  if (failed || dryRun) {
+    // The stage is dropped; ids handed out above were never created
+    if (failed) {
+      for (JsonObject result : results) {
+        if (result["status"] == "ok") {
+          result["status"] = "not_applied";
+          result.remove("device_id");
+          result.remove("register_id");
+        }
+      }
+    }
+    Serial.printf("[BATCH] %d items checked, %d rejected, nothing applied\n", index, failed);
+    freeModel(stage);
+    return false;
   }
 
-  // Save to file and keep cache valid
-  if (saveJson(DEVICES_FILE, *devicesCache)) {
-    Serial.println("[CREATE_REGISTER] Successfully saved devices file and updated cache");
-    return registerId;
+  // One snapshot and one published model for the whole batch, with its
+  // strings moved out of the scratch pool into one of its own
+  stage->repack();
+  bool saved = saveDevices(*stage);
+  if (saved) {
+    publishModel(stage);
+    publishChanges(changes);
   } else {
-    Serial.println("[CREATE_REGISTER] Failed to save devices file");
-    invalidateDevicesCache();
+    freeModel(stage);
   }
-  return "";
+  mutations++;
+  mutationMicros += micros() - startedAt;
+  Serial.printf("[BATCH] Applied %d items in %lu ms\n", index, (unsigned long)((micros() - startedAt) / 1000));
+  return saved;
 }
 
 bool ConfigManager::listRegisters(const String& deviceId, JsonArray& registers) {
+  Page page;
+  return listRegisters(deviceId, registers, page);
+}
+
+bool ConfigManager::listRegisters(const String& deviceId, JsonArray& registers, Page& page) {
   if (!loadDevicesCache()) {
     Serial.println("Failed to load devices cache for listRegisters");
     return false;
   }
+  ModelReader model(snapshot);
 
-  // --- PERBAIKAN: Sintaks v7 untuk containsKey ---
-  if (!(*devicesCache)[deviceId].isNull()) {
-  // --- AKHIR PERBAIKAN ---
-    JsonObject device = (*devicesCache)[deviceId];
-    // --- PERBAIKAN: Sintaks v7 untuk containsKey/is<T> ---
-    if (device["registers"].is<JsonArray>()) {
-    // --- AKHIR PERBAIKAN ---
-      JsonArray deviceRegisters = device["registers"];
-      Serial.printf("Device %s has %d registers in cache\n", deviceId.c_str(), deviceRegisters.size());
-      for (JsonVariant reg : deviceRegisters) {
-        registers.add(reg);
-      }
-      return true;
-    } else {
-      Serial.printf("Device %s has no registers array\n", deviceId.c_str());
-    }
-  } else {
+  const DeviceConfig* device = model->find(deviceId.c_str());
+  if (!device) {
     Serial.printf("Device %s not found in cache\n", deviceId.c_str());
+    return false;
   }
-  return false;
+
+  const PsramVector<RegisterConfig>& deviceRegisters = device->registers;
+  size_t start = pageStart(page.after.isEmpty() ? -1 : device->findRegister(page.after.c_str()), page);
+  size_t added = 0;
+  page.total = deviceRegisters.size();
+  for (size_t i = start; i < deviceRegisters.size() && added < page.limit; i++) {
+    deviceRegisters[i].toJson(registers.add<JsonObject>());
+    page.lastId = deviceRegisters[i].registerId ? deviceRegisters[i].registerId : "";
+    added++;
+  }
+  page.next = start + added;
+  return true;
 }
 
-bool ConfigManager::getRegistersSummary(const String& deviceId, JsonArray& summary) {
+bool ConfigManager::getRegistersSummary(const String& deviceId, JsonArray& summary, Page& page) {
   if (!loadDevicesCache()) {
     Serial.println("Failed to load devices cache for getRegistersSummary");
     return false;
   }
+  ModelReader model(snapshot);
 
-  // --- PERBAIKAN: Sintaks v7 untuk containsKey ---
-  if (!(*devicesCache)[deviceId].isNull()) {
-  // --- AKHIR PERBAIKAN ---
-    JsonObject device = (*devicesCache)[deviceId];
-    // --- PERBAIKAN: Sintaks v7 untuk containsKey/is<T> ---
-    if (device["registers"].is<JsonArray>()) {
+  const DeviceConfig* device = model->find(deviceId.c_str());
+  if (!device) return false;
+
+  const PsramVector<RegisterConfig>& registers = device->registers;
+  size_t start = pageStart(page.after.isEmpty() ? -1 : device->findRegister(page.after.c_str()), page);
+  size_t added = 0;
+  page.total = registers.size();
+  for (size_t i = start; i < registers.size() && added < page.limit; i++) {
+    const RegisterConfig& reg = registers[i];
+    // --- PERBAIKAN: Sintaks v7 untuk createNestedObject di Array ---
+    JsonObject regSummary = summary.add<JsonObject>();
     // --- AKHIR PERBAIKAN ---
-      JsonArray registers = device["registers"];
-      for (JsonVariant reg : registers) {
-        // --- PERBAIKAN: Sintaks v7 untuk createNestedObject di Array ---
-        JsonObject regSummary = summary.add<JsonObject>();
-        // --- AKHIR PERBAIKAN ---
-        regSummary["register_id"] = reg["register_id"];
-        regSummary["register_name"] = reg["register_name"];
-        regSummary["address"] = reg["address"];
-        regSummary["data_type"] = reg["data_type"];
-        regSummary["description"] = reg["description"];
-      }
-      return true;
-    }
+    regSummary["register_id"] = reg.registerId;
+    regSummary["register_name"] = reg.registerName;
+    regSummary["address"] = reg.address;
+    regSummary["data_type"] = reg.dataType;
+    regSummary["description"] = reg.description;
+    page.lastId = reg.registerId ? reg.registerId : "";
+    added++;
   }
-  return false;
+  page.next = start + added;
+  return true;
 }
 
 bool ConfigManager::updateRegister(const String& deviceId, const String& registerId, JsonObjectConst config) {
   if (!loadDevicesCache()) return false;
-
-  // --- PERBAIKAN: Sintaks v7 untuk containsKey ---
-  if ((*devicesCache)[deviceId].isNull()) {
-  // --- AKHIR PERBAIKAN ---
-    Serial.printf("Device %s not found for register update\n", deviceId.c_str());
+  MutexLock lock(writeMutex);
+  unsigned long startedAt = micros();
+
+  ConfigModel* next = stageModel();
+  RegisterConfig reg;
+  const char* error = stageUpdateRegister(*next, deviceId.c_str(), registerId.c_str(), config, reg);
+  if (error) {
+    Serial.printf("Register %s update in device %s failed: %s\n", registerId.c_str(), deviceId.c_str(), error);
+    freeModel(next);
     return false;
   }
 
-  JsonObject device = (*devicesCache)[deviceId];
-  // --- PERBAIKAN: Sintaks v7 untuk containsKey ---
-  if (device["registers"].isNull()) {
-  // --- AKHIR PERBAIKAN ---
-    Serial.printf("No registers found for device %s\n", deviceId.c_str());
-    return false;
-  }
-
-  JsonArray registers = device["registers"];
-  for (JsonVariant regVar : registers) {
-    JsonObject reg = regVar.as<JsonObject>();
-    if (reg["register_id"] == registerId) {
-      // Check for duplicate address if address is being updated
-      // --- PERBAIKAN: Sintaks v7 untuk containsKey ---
-      if (!config["address"].isNull()) {
-      // --- AKHIR PERBAIKAN ---
-        int newAddress = config["address"].is<String>() ? config["address"].as<String>().toInt() : config["address"].as<int>();
-
-        int currentAddress = reg["address"].is<String>() ? reg["address"].as<String>().toInt() : reg["address"].as<int>();
-
-        if (newAddress != currentAddress) {
-          for (JsonVariant otherRegVar : registers) {
-            JsonObject otherReg = otherRegVar.as<JsonObject>();
-            if (otherReg["register_id"] != registerId) {
-              int otherAddress = otherReg["address"].is<String>() ? otherReg["address"].as<String>().toInt() : otherReg["address"].as<int>();
-
-              if (otherAddress == newAddress) {
-                Serial.printf("Address %d already exists in another register\n", newAddress);
-                return false;
-              }
-            }
-          }
-        }
-      }
+  JsonDocument record(PsramAllocator::instance());
+  record["device_id"] = deviceId;
+  reg.toJson(record["register"].to<JsonObject>());
 
-      // Update register configuration while preserving register_id
-      for (JsonPairConst kv : config) {
-        String key = kv.key().c_str();
-        if (key == "address" || key == "function_code" || key == "refresh_rate_ms") {
-          int value = kv.value().is<String>() ? kv.value().as<String>().toInt() : kv.value().as<int>();
-          reg[kv.key()] = value;
-        } else {
-          reg[kv.key()] = kv.value();
-        }
-      }
-      reg["register_id"] = registerId;  // Ensure register_id is preserved
-
-      // Save to file and keep cache valid
-      if (saveJson(DEVICES_FILE, *devicesCache)) {
-        Serial.printf("Register %s updated successfully\n", registerId.c_str());
-        return true;
-      }
-
-      invalidateDevicesCache();
-      return false;
-    }
+  // Journal the change and keep cache valid
+  if (commitMutation(JOURNAL_REGISTER_PUT, record, next, startedAt)) {
+    Serial.printf("Register %s updated successfully\n", registerId.c_str());
+    publishChange(CONFIG_REGISTER_MODIFIED, deviceId.c_str(), registerId.c_str());
+    return true;
   }
-
-  Serial.printf("Register %s not found in device %s\n", registerId.c_str(), deviceId.c_str());
   return false;
 }
 
@@ -546,39 +924,27 @@ bool ConfigManager::deleteRegister(const String& deviceId, const String& registe
     Serial.println("Failed to load devices cache for deleteRegister");
     return false;
   }
-
-  // --- PERBAIKAN: Sintaks v7 untuk containsKey ---
-  if ((*devicesCache)[deviceId].isNull()) {
-  // --- AKHIR PERBAIKAN ---
-    Serial.printf("Device %s not found for register deletion\n", deviceId.c_str());
+  MutexLock lock(writeMutex);
+  unsigned long startedAt = micros();
+
+  ConfigModel* next = stageModel();
+  const char* error = stageDeleteRegister(*next, deviceId.c_str(), registerId.c_str());
+  if (error) {
+    Serial.printf("Register %s deletion in device %s failed: %s\n", registerId.c_str(), deviceId.c_str(), error);
+    freeModel(next);
     return false;
   }
 
-  JsonObject device = (*devicesCache)[deviceId];
-  // --- PERBAIKAN: Sintaks v7 untuk containsKey ---
-  if (device["registers"].isNull()) {
-  // --- AKHIR PERBAIKAN ---
-    Serial.printf("No registers found for device %s\n", deviceId.c_str());
-    return false;
-  }
-
-  JsonArray registers = device["registers"];
-  for (int i = 0; i < registers.size(); i++) {
-    if (registers[i]["register_id"] == registerId) {
-      registers.remove(i);
-
-      // Save to file and keep cache valid
-      if (saveJson(DEVICES_FILE, *devicesCache)) {
-        Serial.printf("Register %s deleted successfully\n", registerId.c_str());
-        return true;
-      }
+  JsonDocument record(PsramAllocator::instance());
+  record["device_id"] = deviceId;
+  record["register_id"] = registerId;
 
-      invalidateDevicesCache();
-      return false;
-    }
+  // Journal the change and keep cache valid
+  if (commitMutation(JOURNAL_REGISTER_DELETE, record, next, startedAt)) {
+    Serial.printf("Register %s deleted successfully\n", registerId.c_str());
+    publishChange(CONFIG_REGISTER_REMOVED, deviceId.c_str(), registerId.c_str());
+    return true;
   }
-
-  Serial.printf("Register %s not found in device %s\n", registerId.c_str(), deviceId.c_str());
   return false;
 }
 
@@ -588,170 +954,156 @@ bool ConfigManager::loadDevicesCache() {
     return true;
   }
 
-  Serial.println("[CACHE] Loading devices cache from file...");
+  // Several read commands may miss at once; only the first one reloads
+  xSemaphoreTake(cacheMutex, portMAX_DELAY);
+  bool loaded = devicesCacheValid || readDevicesFile();
+  xSemaphoreGive(cacheMutex);
+  return loaded;
+}
 
-  // If the file doesn't exist, create an empty JSON object in the cache and exit.
-  if (!LittleFS.exists(DEVICES_FILE)) {
-    Serial.println("Devices file not found. Initializing empty cache.");
-    devicesCache->clear();
-    devicesCache->to<JsonObject>();
-    devicesCacheValid = true;
-    return true;
+bool ConfigManager::readDevicesFile() {
+  Serial.println("[CACHE] Loading devices cache from file...");
+  unsigned long startedAt = millis();
+
+  // The file is loaded into a new model with its own string pool, which
+  // replaces the published one; readers of the old model keep it until
+  // they let go. Writers wait, so no mutation is lost between the two.
+  MutexLock lock(writeMutex);
+  ConfigModel* next = newModel(nullptr);
+  next->version = snapshot.get()->version + 1;
+
+  // A devices.json on the filesystem is an import, written by an older
+  // firmware or put there by hand. It is parsed into a temporary PSRAM
+  // document, converted and then replaced by a binary snapshot. Otherwise
+  // the binary snapshot is read as is. A missing snapshot is an empty one;
+  // the journal may still hold devices.
+  bool parsed = true;
+  bool imported = false;
+  if (LittleFS.exists(DEVICES_FILE)) {
+    JsonDocument doc(PsramAllocator::instance());
+    parsed = loadJson(DEVICES_FILE, doc);
+    if (parsed) {
+      next->loadJson(doc.as<JsonObjectConst>());
+      imported = true;
+      loadFormat = "json";
+    }
+  } else if (LittleFS.exists(DEVICES_SNAPSHOT_FILE)) {
+    File file = LittleFS.open(DEVICES_SNAPSHOT_FILE, "r");
+    parsed = file && next->loadBinary(file, file.size());
+    file.close();
+    loadFormat = "binary";
+  } else {
+    Serial.println("Devices snapshot not found. Starting from an empty snapshot.");
+    loadFormat = "none";
   }
 
-  // Clear the cache before loading new data from the file.
-  devicesCache->clear();
-
-  // Attempt to load and parse the JSON from the file.
-  if (loadJson(DEVICES_FILE, *devicesCache)) {
+  if (parsed) {
+    // Mutations made since the snapshot was written
+    bool intact = journal.replay([this, next](JournalRecordType type, JsonObjectConst record) {
+      applyRecord(*next, type, record);
+    });
+    if (imported || !intact || journal.needsCompaction()) {
+      // Fold the import and journal into a fresh snapshot now, which also
+      // drops a record left half written by a reset
+      saveDevices(*next);
+    }
+    size_t deviceCount = next->devices.size();
+    size_t registerCount = next->registerCount();
+    size_t stringCount = next->strings->count();
+    publishModel(next);
     devicesCacheValid = true;
-    Serial.printf("Devices cache loaded successfully. Found %d devices.\n", devicesCache->as<JsonObject>().size());
+    loadMs = millis() - startedAt;
+    publishChange(CONFIG_RESYNC);
+    Serial.printf("Devices cache loaded successfully. Found %d devices, %d registers, %d strings in %lu ms.\n",
+                  deviceCount, registerCount, stringCount, (unsigned long)loadMs);
     return true;
   }
 
   // If parsing fails, log the error and create an empty cache to ensure stable operation.
-  Serial.println("ERROR: Failed to parse devices.json. Initializing empty cache to prevent data corruption.");
-  devicesCache->clear();
-  devicesCache->to<JsonObject>();
+  Serial.printf("ERROR: Failed to load devices %s. Initializing empty cache to prevent data corruption.\n", loadFormat);
+  publishModel(next);
   devicesCacheValid = true;  // Mark as valid to prevent repeated failed parsing attempts.
+  publishChange(CONFIG_RESYNC);
   return false;              // Indicate that loading failed.
 }
 
-bool ConfigManager::loadRegistersCache() {
-  if (registersCacheValid) return true;
-
-  // Check if file exists
-  if (!LittleFS.exists(REGISTERS_FILE)) {
-    Serial.println("Registers file does not exist, creating empty cache");
-    registersCache->clear();
-    registersCache->to<JsonObject>();
-    registersCacheValid = true;
-    return true;
-  }
-
-  registersCache->clear();
-
-  if (loadJson(REGISTERS_FILE, *registersCache)) {
-    registersCacheValid = true;
-    return true;
-  }
-  return false;
-}
-
 void ConfigManager::invalidateDevicesCache() {
   devicesCacheValid = false;
 }
 
-void ConfigManager::invalidateRegistersCache() {
-  registersCacheValid = false;
-}
-
 void ConfigManager::refreshCache() {
   Serial.println("[CACHE] Forcing cache refresh...");
 
   // Force invalidate
   devicesCacheValid = false;
-  registersCacheValid = false;
-
-  // Clear cache content
-  devicesCache->clear();
-  registersCache->clear();
 
-  // Reload from files
+  // Reload from file
   bool devicesLoaded = loadDevicesCache();
-  bool registersLoaded = loadRegistersCache();
 
-  Serial.printf("[CACHE] Refresh complete - Devices: %s, Registers: %s\n",
-                devicesLoaded ? "OK" : "FAIL",
-                registersLoaded ? "OK" : "FAIL");
+  Serial.printf("[CACHE] Refresh complete - Devices: %s\n", devicesLoaded ? "OK" : "FAIL");
 }
 
 void ConfigManager::debugDevicesFile() {
   Serial.println("=== DEBUG DEVICES FILE ===");
 
-  if (!LittleFS.exists(DEVICES_FILE)) {
-    Serial.println("Devices file does not exist");
-    return;
-  }
-
-  File file = LittleFS.open(DEVICES_FILE, "r");
-  if (!file) {
-    Serial.println("Failed to open devices file");
-    return;
+  const char* files[] = { DEVICES_SNAPSHOT_FILE, JOURNAL_FILE, DEVICES_FILE };
+  for (const char* path : files) {
+    File file = LittleFS.exists(path) ? LittleFS.open(path, "r") : File();
+    if (file) {
+      Serial.printf("%s: %d bytes\n", path, file.size());
+      file.close();
+    } else {
+      Serial.printf("%s: not present\n", path);
+    }
   }
 
-  Serial.printf("File size: %d bytes\n", file.size());
-  Serial.println("File content:");
-
-  while (file.available()) {
-    Serial.write(file.read());
+#ifdef DEBUG_CONFIG_MANAGER
+  // Exported from the model; printing a large config takes seconds
+  if (loadDevicesCache()) {
+    ModelReader model(snapshot);
+    Serial.println("Devices as JSON:");
+    model->writeJson(Serial);
+    Serial.println();
   }
-  Serial.println();
+#endif
 
-  file.close();
   Serial.println("=== END DEBUG ===");
 }
 
 void ConfigManager::fixCorruptDeviceIds() {
   Serial.println("=== FIXING CORRUPT DEVICE IDS ===");
 
-  // --- PERBAIKAN: Gunakan StaticJsonDocument untuk alokasi di STACK ---
-  StaticJsonDocument<8192> originalDoc;
-  // --- AKHIR PERBAIKAN ---
-  if (!loadJson(DEVICES_FILE, originalDoc)) {
-    Serial.println("Failed to load devices file for fixing");
+  if (!loadDevicesCache()) {
+    Serial.println("Failed to load devices for fixing");
     return;
   }
-
-  // --- PERBAIKAN: Gunakan StaticJsonDocument untuk alokasi di STACK ---
-  StaticJsonDocument<8192> fixedDoc;
-  // --- AKHIR PERBAIKAN ---
-  JsonObject fixedDevices = fixedDoc.to<JsonObject>();
-
-  bool foundCorruption = false;
-
-  for (JsonPair kv : originalDoc.as<JsonObject>()) {
-    const char* keyPtr = kv.key().c_str();
-    String deviceId = String(keyPtr);
-
-    // Check if device ID is corrupt
-    if (deviceId.isEmpty() || deviceId == "{}" || deviceId.indexOf('{') != -1 || deviceId.length() < 3) {
-      Serial.printf("Found corrupt device ID: '%s' - generating new ID\n", deviceId.c_str());
-
-      // Generate new device ID
-      String newDeviceId = generateId("D");
-      JsonObject deviceObj = kv.value().as<JsonObject>();
-      deviceObj["device_id"] = newDeviceId;
-
-      fixedDevices[newDeviceId] = deviceObj;
-      foundCorruption = true;
-
+  MutexLock lock(writeMutex);
+  ConfigModel* next = stageModel();
+
+  int fixed = 0;
+  for (size_t i = 0; i < next->devices.size(); i++) {
+    const char* deviceId = next->devices[i]->deviceId;
+    if (isCorruptDeviceId(deviceId)) {
+      Serial.printf("Found corrupt device ID: '%s' - generating new ID\n", deviceId);
+      String newDeviceId = uniqueDeviceId(*next);
+      next->rename(i, next->strings->intern(newDeviceId.c_str()));
       Serial.printf("Replaced with new ID: %s\n", newDeviceId.c_str());
-    } else {
-      // Keep valid device ID
-      fixedDevices[deviceId] = kv.value();
-      Serial.printf("Kept valid device ID: %s\n", deviceId.c_str());
+      fixed++;
     }
   }
 
-  if (foundCorruption) {
-    Serial.println("Saving fixed devices file...");
-    if (saveJson(DEVICES_FILE, fixedDoc)) {
-      Serial.println("Fixed devices file saved successfully");
-      // Force invalidate cache to reload fixed data
-      invalidateDevicesCache();
-      devicesCacheValid = false;
-    } else {
-      Serial.println("Failed to save fixed devices file");
-    }
-  } else {
+  if (fixed == 0) {
     Serial.println("No corruption found in device IDs");
+    freeModel(next);
+  } else if (saveDevices(*next)) {
+    publishModel(next);
+    publishChange(CONFIG_RESYNC);
+    Serial.printf("Fixed %d device IDs and saved snapshot\n", fixed);
+  } else {
+    Serial.println("Failed to save fixed devices snapshot");
+    freeModel(next);
   }
 
-  // Always invalidate cache after this operation
-  invalidateDevicesCache();
-  devicesCacheValid = false;
-
   Serial.println("=== END FIXING ===");
 }
 
@@ -764,37 +1116,33 @@ void ConfigManager::removeCorruptKeys() {
     Serial.println("Failed to load cache for corrupt key removal");
     return;
   }
-
-  JsonObject devicesObj = devicesCache->as<JsonObject>();
-
-  // Find and remove corrupt keys
-  std::vector<String> keysToRemove;
-
-  for (JsonPair kv : devicesObj) {
-    const char* keyPtr = kv.key().c_str();
-    String deviceId = String(keyPtr);
-
-    if (deviceId.isEmpty() || deviceId == "{}" || deviceId.indexOf('{') != -1 || deviceId.length() < 3) {
-      keysToRemove.push_back(deviceId);
-      Serial.printf("Marking corrupt key for removal: '%s'\n", deviceId.c_str());
+  MutexLock lock(writeMutex);
+  ConfigModel* next = stageModel();
+
+  // Find and remove corrupt keys, last first so indexes stay valid
+  int removed = 0;
+  for (int i = (int)next->devices.size() - 1; i >= 0; i--) {
+    const char* deviceId = next->devices[i]->deviceId;
+    if (isCorruptDeviceId(deviceId)) {
+      Serial.printf("Removed corrupt key: '%s'\n", deviceId);
+      next->remove(i);
+      removed++;
     }
   }
 
-  // Remove corrupt keys
-  for (const String& key : keysToRemove) {
-    devicesCache->as<JsonObject>().remove(key);  // Perbaikan: Pastikan cast ke JsonObject
-    Serial.printf("Removed corrupt key: '%s'\n", key.c_str());
-  }
-
-  if (keysToRemove.size() > 0) {
+  if (removed > 0) {
     // Save cleaned cache
-    if (saveJson(DEVICES_FILE, *devicesCache)) {
-      Serial.printf("Removed %d corrupt keys and saved file\n", keysToRemove.size());
+    if (saveDevices(*next)) {
+      publishModel(next);
+      Serial.printf("Removed %d corrupt keys and saved file\n", removed);
+      publishChange(CONFIG_RESYNC);
     } else {
       Serial.println("Failed to save cleaned devices file");
+      freeModel(next);
     }
   } else {
     Serial.println("No corrupt keys found to remove");
+    freeModel(next);
   }
 
   Serial.println("=== END REMOVING ===");
@@ -808,9 +1156,14 @@ void ConfigManager::clearAllConfigurations() {
   StaticJsonDocument<64> emptyDoc;
   // --- AKHIR PERBAIKAN ---
   emptyDoc.to<JsonObject>();
-  saveJson(DEVICES_FILE, emptyDoc);
+  MutexLock lock(writeMutex);
+  LittleFS.remove(DEVICES_SNAPSHOT_FILE);
+  if (LittleFS.exists(DEVICES_FILE)) {
+    LittleFS.remove(DEVICES_FILE);
+  }
   saveJson(REGISTERS_FILE, emptyDoc);
+  journal.reset(0, 0);
   invalidateDevicesCache();
-  invalidateRegistersCache();
+  publishChange(CONFIG_RESYNC);
   Serial.println("All configurations cleared");
-}
\ No newline at end of file
+}
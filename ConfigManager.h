@@ -4,28 +4,109 @@
 #include <ArduinoJson.h>
 #include <LittleFS.h>
 #include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/queue.h>
+#include <vector>
+#include "ConfigModel.h"
+#include "ConfigJournal.h"
+#include "SnapshotPointer.h"
+
+#define CONFIG_CHANGE_ID_MAX 24       // Longer ids are announced as a resync
+#define CONFIG_CHANGE_QUEUE_LENGTH 32  // Events a listener can fall behind by
+
+enum ConfigChangeType : uint8_t {
+  CONFIG_DEVICE_ADDED,
+  CONFIG_DEVICE_REMOVED,
+  CONFIG_DEVICE_MODIFIED,
+  CONFIG_REGISTER_ADDED,
+  CONFIG_REGISTER_REMOVED,
+  CONFIG_REGISTER_MODIFIED,
+  CONFIG_RESYNC  // Anything may have changed; re-read every device
+};
+
+struct ConfigChange {
+  ConfigChangeType type;
+  char deviceId[CONFIG_CHANGE_ID_MAX];
+  char registerId[CONFIG_CHANGE_ID_MAX];  // Empty for device events
+};
 
 class ConfigManager {
+public:
+  // One page of a list. `after` is the id of the last entry of the previous
+  // page; when it is still present the page starts right behind it, so
+  // paging stays consistent while entries are added or removed, otherwise
+  // `offset` is used. total, next and lastId are filled in by the call.
+  struct Page {
+    size_t offset = 0;
+    size_t limit = SIZE_MAX;
+    String after;
+    size_t total = 0;
+    size_t next = 0;
+    String lastId;
+  };
+
 private:
-  static const char* DEVICES_FILE;
+  static const char* DEVICES_FILE;  // JSON import; replaced by the snapshot once loaded
+  static const char* DEVICES_SNAPSHOT_FILE;
+  static const char* DEVICES_TEMP_FILE;
+  static const char* JOURNAL_FILE;
   static const char* REGISTERS_FILE;
 
-  // --- PERBAIKAN: Kembalikan ke DynamicJsonDocument ---
-  // Ini diperlukan agar 'new (devicesCache) DynamicJsonDocument(8192)' di .cpp valid
-  DynamicJsonDocument* devicesCache;
-  DynamicJsonDocument* registersCache;
-  // --- AKHIR PERBAIKAN ---
+  // Typed devices and registers in PSRAM. JSON is only produced at the
+  // edges: the devices file and the read calls below. Readers pin the
+  // current model without locking; writers publish a new one.
+  typedef SnapshotPointer<ConfigModel>::Reader ModelReader;
+  SnapshotPointer<ConfigModel> snapshot;
+
+  volatile bool devicesCacheValid;
+  SemaphoreHandle_t cacheMutex;  // Serialises cache reloads from concurrent readers
+
+  // Mutations are appended to the journal; devices.bin is rewritten only
+  // when the background task compacts the journal into a new snapshot
+  ConfigJournal journal;
+  SemaphoreHandle_t writeMutex;  // Serialises mutations with compaction
+  TaskHandle_t compactionTask;
 
-  bool devicesCacheValid;
-  bool registersCacheValid;
+  // Queues of ConfigChange that every mutation is announced on
+  std::vector<QueueHandle_t> changeListeners;
+
+  // Cost of the typed model, reported in place of a host benchmark
+  uint32_t loadMs;
+  const char* loadFormat;  // "binary", "json" (an import) or "none"
+  uint32_t saveMs;
+  uint32_t reads;
+  uint64_t readMicros;
+  uint32_t mutations;
+  uint64_t mutationMicros;
 
   String generateId(const String& prefix);
+  String uniqueDeviceId(const DeviceSet& set);
+  String uniqueRegisterId(const DeviceConfig& device);
   bool saveJson(const String& filename, const JsonDocument& doc);
   bool loadJson(const String& filename, JsonDocument& doc);
+  static ConfigModel* newModel(const ConfigModel* from);
+  static void freeModel(ConfigModel* model);
+  ConfigModel* stageModel();
+  void publishModel(ConfigModel* next);
+  bool saveDevices(const ConfigModel& model);
+  bool commitMutation(JournalRecordType type, const JsonDocument& record, ConfigModel* next, unsigned long startedAt);
+  void applyRecord(ConfigModel& model, JournalRecordType type, JsonObjectConst record);
+  const char* stageCreateDevice(ConfigModel& set, JsonObjectConst config, DeviceConfig*& device);
+  const char* stageUpdateDevice(ConfigModel& set, const char* deviceId, JsonObjectConst config, DeviceConfig*& device);
+  const char* stageDeleteDevice(ConfigModel& set, const char* deviceId);
+  const char* stageCreateRegister(ConfigModel& set, const char* deviceId, JsonObjectConst config, RegisterConfig& reg);
+  const char* stageUpdateRegister(ConfigModel& set, const char* deviceId, const char* registerId, JsonObjectConst config,
+                                  RegisterConfig& reg);
+  const char* stageDeleteRegister(ConfigModel& set, const char* deviceId, const char* registerId);
+  void publishChange(ConfigChangeType type, const char* deviceId = "", const char* registerId = "");
+  void publishChanges(const std::vector<ConfigChange>& changes);
+  static void compactionTaskFn(void* parameter);
+  void compact();
   void invalidateDevicesCache();
-  void invalidateRegistersCache();
   bool loadDevicesCache();
-  bool loadRegistersCache();
+  static size_t pageStart(int afterIndex, const Page& page);
+  bool readDevicesFile();
 
 public:
   ConfigManager();
@@ -39,7 +120,15 @@ public:
   bool updateDevice(const String& deviceId, JsonObjectConst config);
   bool deleteDevice(const String& deviceId);
   void listDevices(JsonArray& devices);
-  void getDevicesSummary(JsonArray& summary);
+  void getDevicesSummary(JsonArray& summary, Page& page);
+  void getModelStats(JsonObject& stats);
+  void getJournalStats(JsonObject& stats);
+
+  // Change events. A listener that falls more than
+  // CONFIG_CHANGE_QUEUE_LENGTH events behind gets a single CONFIG_RESYNC.
+  // Register listeners before the first mutation.
+  void addChangeListener(QueueHandle_t queue);
+  void removeChangeListener(QueueHandle_t queue);
 
   // Clear all configurations
   void clearAllConfigurations();
@@ -53,9 +142,19 @@ public:
   // Register operations
   String createRegister(const String& deviceId, JsonObjectConst config);
   bool listRegisters(const String& deviceId, JsonArray& registers);
-  bool getRegistersSummary(const String& deviceId, JsonArray& summary);
+  bool listRegisters(const String& deviceId, JsonArray& registers, Page& page);
+  bool getRegistersSummary(const String& deviceId, JsonArray& summary, Page& page);
+  size_t getRegisterCount();
   bool updateRegister(const String& deviceId, const String& registerId, JsonObjectConst config);
   bool deleteRegister(const String& deviceId, const String& registerId);
+
+  // Bulk changes as one transaction. Each item is {"op", "type", "device_id"
+  // or "device_ref", "register_id", "config", "ref"} like a single CRUD
+  // command; "ref" names a created device for later items' "device_ref".
+  // Every item is checked against a staged copy first and results get one
+  // entry per item. Nothing is applied unless all items pass; then the
+  // staged model is saved once and published. Returns true if it was saved.
+  bool applyBatch(JsonArrayConst items, JsonArray& results, bool dryRun);
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,659 @@
+#include "ConfigModel.h"
+#include <esp_rom_crc.h>
+
+size_t CStrHash::operator()(const char* text) const {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  while (*text) {
+    hash ^= (uint8_t)*text++;
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// ---------------------------------------------------------------------------
+// StringPool
+
+StringPool::StringPool()
+  : chunks(nullptr), totalBytes(0) {}
+
+StringPool::~StringPool() {
+  clear();
+}
+
+char* StringPool::reserve(size_t length) {
+  if (!chunks || chunks->capacity - chunks->used < length) {
+    size_t capacity = length > STRING_POOL_CHUNK_SIZE ? length : STRING_POOL_CHUNK_SIZE;
+    size_t size = sizeof(Chunk) + capacity;
+    Chunk* chunk = (Chunk*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!chunk) {
+      chunk = (Chunk*)heap_caps_malloc(size, MALLOC_CAP_8BIT);
+      if (!chunk) return nullptr;
+    }
+    chunk->used = 0;
+    chunk->capacity = capacity;
+    // A large string gets a chunk of its own behind the current one, so the
+    // free space left in the current chunk is not abandoned
+    if (chunks && capacity == length) {
+      chunk->next = chunks->next;
+      chunks->next = chunk;
+    } else {
+      chunk->next = chunks;
+      chunks = chunk;
+    }
+    totalBytes += size;
+    char* text = chunk->data;
+    chunk->used = length;
+    return text;
+  }
+  char* text = chunks->data + chunks->used;
+  chunks->used += length;
+  return text;
+}
+
+const char* StringPool::intern(const char* text) {
+  if (!text) return nullptr;
+
+  auto it = strings.find(text);
+  if (it != strings.end()) return *it;
+
+  size_t length = strlen(text) + 1;
+  char* copy = reserve(length);
+  if (!copy) {
+    Serial.println("[CONFIG] ERROR: String pool allocation failed");
+    return "";
+  }
+  memcpy(copy, text, length);
+  strings.insert(copy);
+  return copy;
+}
+
+const char* StringPool::readTable(Stream& in, size_t length) {
+  if (length == 0) return "";
+  char* table = reserve(length);
+  if (!table || in.readBytes(table, length) != length || table[length - 1] != '\0') return nullptr;
+  for (const char* text = table; text < table + length; text += strlen(text) + 1) {
+    strings.insert(text);
+  }
+  return table;
+}
+
+void StringPool::clear() {
+  strings.clear();
+  while (chunks) {
+    Chunk* next = chunks->next;
+    heap_caps_free(chunks);
+    chunks = next;
+  }
+  totalBytes = 0;
+}
+
+// ---------------------------------------------------------------------------
+// JSON boundary helpers
+
+namespace {
+
+// Typed fields of one struct: integer keys and string keys, each with the
+// address of the member that stores them
+struct FieldTable {
+  const char* const* intKeys;
+  size_t intCount;
+  int32_t* ints[DEVICE_FIELD_COUNT];
+  const char* const* stringKeys;
+  size_t stringCount;
+  const char** strings[4];
+};
+
+const char* const REGISTER_INT_KEYS[] = { "address", "function_code", "refresh_rate_ms" };
+const char* const REGISTER_STRING_KEYS[] = { "register_id", "register_name", "data_type", "description" };
+
+// Same order as DeviceField
+const char* const DEVICE_INT_KEYS[] = { "slave_id", "port", "timeout", "retry_count", "refresh_rate_ms",
+                                        "baud_rate", "data_bits", "stop_bits", "serial_port" };
+const char* const DEVICE_STRING_KEYS[] = { "device_id", "device_name", "protocol", "ip" };
+
+int keyIndex(const char* key, const char* const* keys, size_t count) {
+  for (size_t i = 0; i < count; i++) {
+    if (strcmp(key, keys[i]) == 0) return i;
+  }
+  return -1;
+}
+
+// Numbers arrive from the app as strings as often as not
+int32_t toInt(JsonVariantConst value) {
+  if (value.is<const char*>()) {
+    return atoi(value.as<const char*>());
+  }
+  return value.as<int32_t>();
+}
+
+// A string key holding some other type is not typed; it stays in extras
+// with its original type
+bool isTyped(const FieldTable& table, const char* key, JsonVariantConst value) {
+  if (keyIndex(key, table.intKeys, table.intCount) >= 0) return true;
+  return keyIndex(key, table.stringKeys, table.stringCount) >= 0 && (value.isNull() || value.is<const char*>());
+}
+
+// Stores the typed fields of `json`; returns true if any key was left over
+bool applyFields(const FieldTable& table, JsonObjectConst json, const char* skipKey, StringPool& pool) {
+  bool untyped = false;
+  for (JsonPairConst kv : json) {
+    const char* key = kv.key().c_str();
+    if (skipKey && strcmp(key, skipKey) == 0) continue;
+
+    int index = keyIndex(key, table.intKeys, table.intCount);
+    if (index >= 0) {
+      *table.ints[index] = kv.value().isNull() ? CONFIG_UNSET : toInt(kv.value());
+      continue;
+    }
+    index = keyIndex(key, table.stringKeys, table.stringCount);
+    if (index >= 0 && (kv.value().isNull() || kv.value().is<const char*>())) {
+      *table.strings[index] = pool.intern(kv.value().as<const char*>());
+      continue;
+    }
+    untyped = true;
+  }
+  return untyped;
+}
+
+// Merges the untyped keys of `json` into the stored extras. Keys that are
+// now typed are dropped from extras, so a field is never stored twice.
+const char* mergeExtras(const char* extras, const FieldTable& table, JsonObjectConst json, const char* skipKey,
+                        StringPool& pool) {
+  JsonDocument doc(PsramAllocator::instance());
+  if (extras) {
+    deserializeJson(doc, extras);
+  }
+  JsonObject object = doc.is<JsonObject>() ? doc.as<JsonObject>() : doc.to<JsonObject>();
+
+  for (JsonPairConst kv : json) {
+    const char* key = kv.key().c_str();
+    if (skipKey && strcmp(key, skipKey) == 0) continue;
+    if (isTyped(table, key, kv.value())) {
+      object.remove(key);
+    } else {
+      object[key] = kv.value();
+    }
+  }
+
+  if (object.size() == 0) return nullptr;
+  String text;
+  serializeJson(doc, text);
+  return pool.intern(text.c_str());
+}
+
+void writeFields(const FieldTable& table, const char* extras, JsonObject out) {
+  for (size_t i = 0; i < table.intCount; i++) {
+    if (*table.ints[i] != CONFIG_UNSET) {
+      out[table.intKeys[i]] = *table.ints[i];
+    }
+  }
+  for (size_t i = 0; i < table.stringCount; i++) {
+    if (*table.strings[i]) {
+      out[table.stringKeys[i]] = *table.strings[i];
+    }
+  }
+  if (extras) {
+    JsonDocument doc(PsramAllocator::instance());
+    if (deserializeJson(doc, extras) == DeserializationError::Ok) {
+      for (JsonPairConst kv : doc.as<JsonObjectConst>()) {
+        out[kv.key()] = kv.value();
+      }
+    }
+  }
+}
+
+// The tables point into one struct. Readers build them on a const object;
+// writeFields only reads through the pointers.
+FieldTable registerTable(const RegisterConfig& source) {
+  RegisterConfig& reg = const_cast<RegisterConfig&>(source);
+  FieldTable table = {};
+  table.intKeys = REGISTER_INT_KEYS;
+  table.intCount = 3;
+  table.ints[0] = &reg.address;
+  table.ints[1] = &reg.functionCode;
+  table.ints[2] = &reg.refreshRateMs;
+  table.stringKeys = REGISTER_STRING_KEYS;
+  table.stringCount = 4;
+  table.strings[0] = &reg.registerId;
+  table.strings[1] = &reg.registerName;
+  table.strings[2] = &reg.dataType;
+  table.strings[3] = &reg.description;
+  return table;
+}
+
+FieldTable deviceTable(const DeviceConfig& source) {
+  DeviceConfig& device = const_cast<DeviceConfig&>(source);
+  FieldTable table = {};
+  table.intKeys = DEVICE_INT_KEYS;
+  table.intCount = DEVICE_FIELD_COUNT;
+  for (size_t i = 0; i < DEVICE_FIELD_COUNT; i++) {
+    table.ints[i] = &device.fields[i];
+  }
+  table.stringKeys = DEVICE_STRING_KEYS;
+  table.stringCount = 4;
+  table.strings[0] = &device.deviceId;
+  table.strings[1] = &device.deviceName;
+  table.strings[2] = &device.protocol;
+  table.strings[3] = &device.ip;
+  return table;
+}
+
+}  // namespace
+
+// ---------------------------------------------------------------------------
+// RegisterConfig
+
+void RegisterConfig::applyJson(JsonObjectConst json, StringPool& pool) {
+  FieldTable table = registerTable(*this);
+  if (applyFields(table, json, nullptr, pool) || extras) {
+    extras = mergeExtras(extras, table, json, nullptr, pool);
+  }
+}
+
+void RegisterConfig::toJson(JsonObject out) const {
+  writeFields(registerTable(*this), extras, out);
+}
+
+void RegisterConfig::repack(StringPool& pool) {
+  registerId = pool.intern(registerId);
+  registerName = pool.intern(registerName);
+  dataType = pool.intern(dataType);
+  description = pool.intern(description);
+  extras = pool.intern(extras);
+}
+
+// ---------------------------------------------------------------------------
+// DeviceConfig
+
+DeviceConfig::DeviceConfig() {
+  for (size_t i = 0; i < DEVICE_FIELD_COUNT; i++) {
+    fields[i] = CONFIG_UNSET;
+  }
+}
+
+void DeviceConfig::resetFields() {
+  deviceName = nullptr;
+  protocol = nullptr;
+  ip = nullptr;
+  extras = nullptr;
+  for (size_t i = 0; i < DEVICE_FIELD_COUNT; i++) {
+    fields[i] = CONFIG_UNSET;
+  }
+}
+
+int DeviceConfig::findRegister(const char* registerId) const {
+  auto it = byRegisterId.find(registerId);
+  return it == byRegisterId.end() ? -1 : (int)it->second;
+}
+
+int DeviceConfig::findAddress(int32_t address) const {
+  auto it = byAddress.find(address);
+  return it == byAddress.end() ? -1 : (int)it->second;
+}
+
+void DeviceConfig::addRegister(const RegisterConfig& reg) {
+  uint32_t index = registers.size();
+  registers.push_back(reg);
+  if (reg.registerId) {
+    byRegisterId.emplace(reg.registerId, index);
+  }
+  byAddress.emplace(reg.address, index);
+}
+
+void DeviceConfig::removeRegister(size_t index) {
+  registers.erase(registers.begin() + index);
+  reindexRegisters();
+}
+
+void DeviceConfig::reindexRegisters() {
+  byRegisterId.clear();
+  byAddress.clear();
+  for (uint32_t i = 0; i < registers.size(); i++) {
+    if (registers[i].registerId) {
+      byRegisterId.emplace(registers[i].registerId, i);
+    }
+    byAddress.emplace(registers[i].address, i);
+  }
+}
+
+void DeviceConfig::applyJson(JsonObjectConst json, StringPool& pool) {
+  FieldTable table = deviceTable(*this);
+  if (applyFields(table, json, "registers", pool) || extras) {
+    extras = mergeExtras(extras, table, json, "registers", pool);
+  }
+
+  if (json["registers"].is<JsonArrayConst>()) {
+    registers.clear();
+    for (JsonVariantConst item : json["registers"].as<JsonArrayConst>()) {
+      RegisterConfig reg;
+      reg.applyJson(item.as<JsonObjectConst>(), pool);
+      registers.push_back(reg);
+    }
+    reindexRegisters();
+  }
+}
+
+void DeviceConfig::toJson(JsonObject out, bool withRegisters) const {
+  writeFields(deviceTable(*this), extras, out);
+  if (withRegisters) {
+    JsonArray list = out["registers"].to<JsonArray>();
+    for (const RegisterConfig& reg : registers) {
+      reg.toJson(list.add<JsonObject>());
+    }
+  }
+}
+
+void DeviceConfig::repack(StringPool& pool) {
+  deviceId = pool.intern(deviceId);
+  deviceName = pool.intern(deviceName);
+  protocol = pool.intern(protocol);
+  ip = pool.intern(ip);
+  extras = pool.intern(extras);
+  for (RegisterConfig& reg : registers) {
+    reg.repack(pool);
+  }
+  reindexRegisters();  // The index is keyed by the old pointers
+}
+
+// ---------------------------------------------------------------------------
+// DeviceSet
+
+int DeviceSet::indexOf(const char* deviceId) const {
+  auto it = byDeviceId.find(deviceId);
+  return it == byDeviceId.end() ? -1 : (int)it->second;
+}
+
+DeviceConfig* DeviceSet::find(const char* deviceId) const {
+  int index = indexOf(deviceId);
+  return index < 0 ? nullptr : devices[index].get();
+}
+
+DeviceConfig* DeviceSet::edit(size_t index) {
+  if (devices[index].use_count() > 1) {
+    devices[index] = std::allocate_shared<DeviceConfig>(PsramStlAllocator<DeviceConfig>(), *devices[index]);
+  }
+  return devices[index].get();
+}
+
+DeviceConfig* DeviceSet::add(const char* internedId) {
+  DevicePtr device = std::allocate_shared<DeviceConfig>(PsramStlAllocator<DeviceConfig>());
+  device->deviceId = internedId;
+  byDeviceId.emplace(device->deviceId, (uint32_t)devices.size());
+  devices.push_back(device);
+  return device.get();
+}
+
+void DeviceSet::rename(size_t index, const char* internedId) {
+  byDeviceId.erase(devices[index]->deviceId);
+  edit(index)->deviceId = internedId;
+  byDeviceId.emplace(internedId, (uint32_t)index);
+}
+
+void DeviceSet::remove(size_t index) {
+  devices.erase(devices.begin() + index);
+  byDeviceId.clear();
+  for (uint32_t i = 0; i < devices.size(); i++) {
+    byDeviceId.emplace(devices[i]->deviceId, i);
+  }
+}
+
+size_t DeviceSet::registerCount() const {
+  size_t count = 0;
+  for (const DevicePtr& device : devices) {
+    count += device->registers.size();
+  }
+  return count;
+}
+
+// ---------------------------------------------------------------------------
+// ConfigModel
+
+ConfigModel::ConfigModel()
+  : strings(std::allocate_shared<StringPool>(PsramStlAllocator<StringPool>())), version(0) {}
+
+void ConfigModel::clear() {
+  byDeviceId.clear();
+  devices.clear();
+  strings = std::allocate_shared<StringPool>(PsramStlAllocator<StringPool>());
+}
+
+void ConfigModel::repack() {
+  std::shared_ptr<StringPool> pool = std::allocate_shared<StringPool>(PsramStlAllocator<StringPool>());
+  byDeviceId.clear();
+  for (uint32_t i = 0; i < devices.size(); i++) {
+    DeviceConfig* device = edit(i);
+    device->repack(*pool);
+    byDeviceId.emplace(device->deviceId, i);
+  }
+  strings = pool;
+}
+
+void ConfigModel::loadJson(JsonObjectConst root) {
+  clear();
+  for (JsonPairConst kv : root) {
+    if (!kv.value().is<JsonObjectConst>()) continue;
+    DeviceConfig* device = add(strings->intern(kv.key().c_str()));
+    const char* deviceId = device->deviceId;
+    device->applyJson(kv.value().as<JsonObjectConst>(), *strings);
+    device->deviceId = deviceId;  // The file key wins over a stale "device_id" field
+  }
+}
+
+void ConfigModel::writeJson(Print& out) const {
+  // One device at a time, so saving never holds the whole file as JSON
+  JsonDocument doc(PsramAllocator::instance());
+  out.print('{');
+  for (size_t i = 0; i < devices.size(); i++) {
+    if (i > 0) out.print(',');
+    doc.set(devices[i]->deviceId);
+    serializeJson(doc, out);
+    out.print(':');
+    doc.clear();
+    devices[i]->toJson(doc.to<JsonObject>(), true);
+    serializeJson(doc, out);
+  }
+  out.print('}');
+}
+
+// ---------------------------------------------------------------------------
+// Binary snapshot
+
+namespace {
+
+const uint32_t NO_STRING = 0xFFFFFFFF;
+
+struct SnapshotHeader {
+  uint32_t magic;
+  uint16_t format;
+  uint16_t deviceFields;  // DEVICE_FIELD_COUNT of the writer
+  uint32_t deviceRecordSize;
+  uint32_t registerRecordSize;
+  uint32_t deviceCount;
+  uint32_t registerCount;
+  uint32_t tableBytes;
+  uint32_t modelVersion;
+};
+
+struct DeviceRecord {
+  uint32_t strings[5];  // deviceId, deviceName, protocol, ip, extras
+  int32_t fields[DEVICE_FIELD_COUNT];
+  uint32_t registerCount;
+};
+
+struct RegisterRecord {
+  uint32_t strings[5];  // registerId, registerName, dataType, description, extras
+  int32_t address;
+  int32_t functionCode;
+  int32_t refreshRateMs;
+};
+
+// Assigns each distinct string its offset in the table, in first-use order
+class TableBuilder {
+public:
+  IdIndex<uint32_t> offsets;
+  PsramVector<const char*> order;
+  uint32_t bytes = 0;
+
+  void add(const char* text) {
+    if (text && offsets.emplace(text, bytes).second) {
+      order.push_back(text);
+      bytes += strlen(text) + 1;
+    }
+  }
+  uint32_t offsetOf(const char* text) const {
+    return text ? offsets.find(text)->second : NO_STRING;
+  }
+};
+
+// Writes to the output while keeping the running CRC
+class ChecksumWriter {
+public:
+  Print& out;
+  uint32_t crc = 0;
+  size_t written = 0;
+
+  explicit ChecksumWriter(Print& out)
+    : out(out) {}
+  void write(const void* data, size_t length) {
+    crc = esp_rom_crc32_le(crc, (const uint8_t*)data, length);
+    written += out.write((const uint8_t*)data, length);
+  }
+};
+
+}  // namespace
+
+bool ConfigModel::writeBinary(Print& out) const {
+  TableBuilder table;
+  for (const DevicePtr& device : devices) {
+    const char* deviceStrings[] = { device->deviceId, device->deviceName, device->protocol, device->ip, device->extras };
+    for (const char* text : deviceStrings) table.add(text);
+    for (const RegisterConfig& reg : device->registers) {
+      const char* registerStrings[] = { reg.registerId, reg.registerName, reg.dataType, reg.description, reg.extras };
+      for (const char* text : registerStrings) table.add(text);
+    }
+  }
+
+  SnapshotHeader header = { CONFIG_SNAPSHOT_MAGIC, CONFIG_SNAPSHOT_FORMAT, DEVICE_FIELD_COUNT,
+                            sizeof(DeviceRecord), sizeof(RegisterRecord), (uint32_t)devices.size(),
+                            (uint32_t)registerCount(), table.bytes, version };
+  ChecksumWriter writer(out);
+  writer.write(&header, sizeof(header));
+  for (const char* text : table.order) {
+    writer.write(text, strlen(text) + 1);
+  }
+
+  for (const DevicePtr& device : devices) {
+    DeviceRecord record;
+    const char* deviceStrings[] = { device->deviceId, device->deviceName, device->protocol, device->ip, device->extras };
+    for (size_t i = 0; i < 5; i++) record.strings[i] = table.offsetOf(deviceStrings[i]);
+    memcpy(record.fields, device->fields, sizeof(record.fields));
+    record.registerCount = device->registers.size();
+    writer.write(&record, sizeof(record));
+
+    for (const RegisterConfig& reg : device->registers) {
+      RegisterRecord regRecord;
+      const char* registerStrings[] = { reg.registerId, reg.registerName, reg.dataType, reg.description, reg.extras };
+      for (size_t i = 0; i < 5; i++) regRecord.strings[i] = table.offsetOf(registerStrings[i]);
+      regRecord.address = reg.address;
+      regRecord.functionCode = reg.functionCode;
+      regRecord.refreshRateMs = reg.refreshRateMs;
+      writer.write(&regRecord, sizeof(regRecord));
+    }
+  }
+
+  uint32_t crc = writer.crc;
+  size_t expected = writer.written + sizeof(crc);
+  writer.write(&crc, sizeof(crc));
+  return writer.written == expected;
+}
+
+bool ConfigModel::loadBinary(Stream& in, size_t fileSize) {
+  clear();
+
+  SnapshotHeader header;
+  if (in.readBytes((char*)&header, sizeof(header)) != sizeof(header) || header.magic != CONFIG_SNAPSHOT_MAGIC ||
+      header.format != CONFIG_SNAPSHOT_FORMAT || header.deviceFields != DEVICE_FIELD_COUNT ||
+      header.deviceRecordSize != sizeof(DeviceRecord) || header.registerRecordSize != sizeof(RegisterRecord)) {
+    Serial.println("[CONFIG] Snapshot header missing or of another format");
+    return false;
+  }
+  size_t recordBytes = (size_t)header.deviceCount * sizeof(DeviceRecord) + (size_t)header.registerCount * sizeof(RegisterRecord);
+  if (sizeof(header) + header.tableBytes + recordBytes + sizeof(uint32_t) != fileSize) {
+    Serial.println("[CONFIG] Snapshot size does not match its header");
+    return false;
+  }
+
+  const char* table = strings->readTable(in, header.tableBytes);
+  uint8_t* records = (uint8_t*)heap_caps_malloc(recordBytes + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!records) {
+    records = (uint8_t*)heap_caps_malloc(recordBytes + 1, MALLOC_CAP_8BIT);
+  }
+  uint32_t storedCrc = 0;
+  bool intact = table && records && in.readBytes((char*)records, recordBytes) == recordBytes &&
+                in.readBytes((char*)&storedCrc, sizeof(storedCrc)) == sizeof(storedCrc);
+  if (intact) {
+    uint32_t crc = esp_rom_crc32_le(0, (const uint8_t*)&header, sizeof(header));
+    crc = esp_rom_crc32_le(crc, (const uint8_t*)table, header.tableBytes);
+    crc = esp_rom_crc32_le(crc, records, recordBytes);
+    intact = crc == storedCrc;
+  }
+  if (!intact) {
+    heap_caps_free(records);
+    clear();
+    Serial.println("[CONFIG] Snapshot is truncated or fails its checksum");
+    return false;
+  }
+
+  auto text = [&](uint32_t offset) -> const char* {
+    return offset < header.tableBytes ? table + offset : nullptr;
+  };
+
+  const uint8_t* cursor = records;
+  const uint8_t* end = records + recordBytes;
+  bool valid = true;
+  devices.reserve(header.deviceCount);
+  for (uint32_t d = 0; d < header.deviceCount && valid; d++) {
+    DeviceRecord record;
+    memcpy(&record, cursor, sizeof(record));
+    cursor += sizeof(record);
+    const char* deviceId = text(record.strings[0]);
+    if (!deviceId || (size_t)(end - cursor) < (size_t)record.registerCount * sizeof(RegisterRecord)) {
+      valid = false;
+      break;
+    }
+
+    DeviceConfig* device = add(deviceId);
+    device->deviceName = text(record.strings[1]);
+    device->protocol = text(record.strings[2]);
+    device->ip = text(record.strings[3]);
+    device->extras = text(record.strings[4]);
+    memcpy(device->fields, record.fields, sizeof(device->fields));
+
+    device->registers.reserve(record.registerCount);
+    for (uint32_t r = 0; r < record.registerCount; r++) {
+      RegisterRecord regRecord;
+      memcpy(&regRecord, cursor, sizeof(regRecord));
+      cursor += sizeof(regRecord);
+      RegisterConfig reg;
+      reg.registerId = text(regRecord.strings[0]);
+      reg.registerName = text(regRecord.strings[1]);
+      reg.dataType = text(regRecord.strings[2]);
+      reg.description = text(regRecord.strings[3]);
+      reg.extras = text(regRecord.strings[4]);
+      reg.address = regRecord.address;
+      reg.functionCode = regRecord.functionCode;
+      reg.refreshRateMs = regRecord.refreshRateMs;
+      device->registers.push_back(reg);
+    }
+    device->reindexRegisters();
+  }
+  heap_caps_free(records);
+
+  if (!valid || cursor != end) {
+    clear();
+    Serial.println("[CONFIG] Snapshot records do not match their counts");
+    return false;
+  }
+  return true;
+}
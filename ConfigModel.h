@@ -0,0 +1,188 @@
+#ifndef CONFIG_MODEL_H
+#define CONFIG_MODEL_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <memory>
+#include <vector>
+#include <unordered_map>
+#include <unordered_set>
+#include "MemoryManager.h"
+
+#define STRING_POOL_CHUNK_SIZE 4096
+#define CONFIG_UNSET INT32_MIN  // Integer field absent from the stored config
+
+// Binary snapshot: header, string table, fixed-size device and register
+// records that refer to strings by table offset, then a CRC32 trailer
+#define CONFIG_SNAPSHOT_MAGIC 0x42474643  // "CFGB"
+#define CONFIG_SNAPSHOT_FORMAT 1
+
+// Hash and compare C strings by contents, so an index keyed by interned
+// pointers can be probed with any string
+struct CStrHash {
+  size_t operator()(const char* text) const;
+};
+
+struct CStrEqual {
+  bool operator()(const char* a, const char* b) const {
+    return strcmp(a, b) == 0;
+  }
+};
+
+template<typename T>
+using PsramVector = std::vector<T, PsramStlAllocator<T>>;
+
+template<typename V>
+using IdIndex = std::unordered_map<const char*, V, CStrHash, CStrEqual, PsramStlAllocator<std::pair<const char* const, V>>>;
+
+// Append-only string store in PSRAM chunks. Equal strings share one copy,
+// so ids, data types and descriptions repeated across registers cost a
+// pointer each. Strings live as long as the pool; edits leave superseded
+// strings behind until the model is repacked into a new one.
+class StringPool {
+private:
+  struct Chunk {
+    Chunk* next;
+    size_t used;
+    size_t capacity;
+    char data[1];
+  };
+  Chunk* chunks;
+  std::unordered_set<const char*, CStrHash, CStrEqual, PsramStlAllocator<const char*>> strings;
+  size_t totalBytes;
+
+  char* reserve(size_t length);
+
+public:
+  StringPool();
+  ~StringPool();
+  StringPool(const StringPool&) = delete;
+  StringPool& operator=(const StringPool&) = delete;
+
+  const char* intern(const char* text);  // nullptr stays nullptr
+  // Reads a block of NUL-terminated strings into a chunk of its own and
+  // indexes them where they lie. Returns the block, nullptr on a short read.
+  const char* readTable(Stream& in, size_t length);
+  void clear();
+  size_t count() const {
+    return strings.size();
+  }
+  size_t bytes() const {
+    return totalBytes;
+  }
+};
+
+// Register fields used by the pollers and summaries are typed. Anything
+// else the app sends (scale, unit, ...) is kept verbatim in `extras` and
+// only parsed again at the JSON boundary.
+struct RegisterConfig {
+  const char* registerId = nullptr;
+  const char* registerName = nullptr;
+  const char* dataType = nullptr;
+  const char* description = nullptr;
+  const char* extras = nullptr;  // JSON object text, nullptr when empty
+  int32_t address = 0;
+  int32_t functionCode = CONFIG_UNSET;
+  int32_t refreshRateMs = CONFIG_UNSET;
+
+  void applyJson(JsonObjectConst json, StringPool& pool);
+  void toJson(JsonObject out) const;
+  void repack(StringPool& pool);  // Re-interns every string into `pool`
+};
+
+enum DeviceField : uint8_t {
+  DEVICE_SLAVE_ID,
+  DEVICE_PORT,
+  DEVICE_TIMEOUT,
+  DEVICE_RETRY_COUNT,
+  DEVICE_REFRESH_RATE_MS,
+  DEVICE_BAUD_RATE,
+  DEVICE_DATA_BITS,
+  DEVICE_STOP_BITS,
+  DEVICE_SERIAL_PORT,
+  DEVICE_FIELD_COUNT
+};
+
+struct DeviceConfig {
+  const char* deviceId = nullptr;
+  const char* deviceName = nullptr;
+  const char* protocol = nullptr;
+  const char* ip = nullptr;
+  const char* extras = nullptr;
+  int32_t fields[DEVICE_FIELD_COUNT];  // Indexed by DeviceField, CONFIG_UNSET when absent
+
+  // Registers in the order they were added, indexed by id and by address
+  PsramVector<RegisterConfig> registers;
+  IdIndex<uint32_t> byRegisterId;
+  std::unordered_map<int32_t, uint32_t, std::hash<int32_t>, std::equal_to<int32_t>,
+                     PsramStlAllocator<std::pair<const int32_t, uint32_t>>>
+    byAddress;
+
+  DeviceConfig();
+
+  int32_t field(DeviceField index, int32_t fallback) const {
+    return fields[index] == CONFIG_UNSET ? fallback : fields[index];
+  }
+  void resetFields();  // Clears everything but the id and the registers
+  int findRegister(const char* registerId) const;  // -1 when absent
+  int findAddress(int32_t address) const;
+  void addRegister(const RegisterConfig& reg);
+  void removeRegister(size_t index);
+  void reindexRegisters();
+
+  // A "registers" array in `json` replaces the register list
+  void applyJson(JsonObjectConst json, StringPool& pool);
+  void toJson(JsonObject out, bool withRegisters) const;
+  void repack(StringPool& pool);  // Also re-interns the registers and rebuilds their index
+};
+
+typedef std::shared_ptr<DeviceConfig> DevicePtr;
+
+// Devices in the order they were created, with an index by id. Copying a
+// set shares its devices; edit() gives the set a private copy of a device
+// before it is changed, so a staged set never disturbs the one it came from.
+class DeviceSet {
+public:
+  PsramVector<DevicePtr> devices;
+  IdIndex<uint32_t> byDeviceId;
+
+  int indexOf(const char* deviceId) const;  // -1 when absent
+  DeviceConfig* find(const char* deviceId) const;
+  DeviceConfig* edit(size_t index);
+  DeviceConfig* add(const char* internedId);  // Id from the string pool
+  void rename(size_t index, const char* internedId);
+  void remove(size_t index);
+  size_t registerCount() const;
+};
+
+// One published version of the config: a device set plus the pool its
+// strings are interned in. A published model is never changed; a writer
+// copies it, which shares every device and the pool, edits the copy and
+// publishes that. Models loaded from file get a pool of their own, so the
+// pool of an older model lives until its last copy is gone.
+class ConfigModel : public DeviceSet {
+public:
+  std::shared_ptr<StringPool> strings;
+  uint32_t version;
+
+  ConfigModel();
+
+  void clear();  // Also starts a new string pool
+
+  // Copies every string still in use into a new pool of this model's own.
+  // Devices shared with other models are copied first, so those keep the
+  // old pool and the strings it holds.
+  void repack();
+
+  // Import/export: devices.json is an object keyed by device id
+  void loadJson(JsonObjectConst root);
+  void writeJson(Print& out) const;
+
+  // Snapshot file. Loading reads the string table straight into the pool
+  // and copies fixed-size records, with no parsing. Returns false, leaving
+  // the model empty, if the file is short, corrupt or of another format.
+  bool loadBinary(Stream& in, size_t fileSize);
+  bool writeBinary(Print& out) const;
+};
+
+#endif
@@ -0,0 +1,280 @@
+#include "DeflateStream.h"
+#include <esp_heap_caps.h>
+#include <esp_rom_crc.h>
+
+#define DEFLATE_MIN_MATCH 3
+#define DEFLATE_MAX_MATCH 258
+#define DEFLATE_HASH_BITS 12
+#define DEFLATE_HASH_SIZE (1 << DEFLATE_HASH_BITS)
+
+// RFC 1951 3.2.5 length and distance tables
+static const uint16_t LENGTH_BASE[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t LENGTH_EXTRA[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t DIST_BASE[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t DIST_EXTRA[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+
+static void* allocPsram(size_t size) {
+  void* p = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  return p ? p : malloc(size);  // Fallback to internal RAM
+}
+
+static uint32_t reverseBits(uint32_t code, uint8_t bits) {
+  uint32_t result = 0;
+  for (uint8_t i = 0; i < bits; i++) {
+    result = (result << 1) | (code & 1);
+    code >>= 1;
+  }
+  return result;
+}
+
+DeflateStream::DeflateStream(uint8_t windowBits)
+  : out(nullptr), wrapper(DeflateWrapper::RAW), window(nullptr), hashHead(nullptr),
+    fill(0), pos(0), base(0), bitBuffer(0), bitCount(0), stagingLen(0),
+    crc(0), adlerA(1), adlerB(0), totalIn(0), totalOut(0), started(false), failed(false) {
+  windowSize = (size_t)1 << constrain(windowBits, 10, 14);
+  window = (uint8_t*)allocPsram(windowSize * 2);
+  hashHead = (uint32_t*)allocPsram(DEFLATE_HASH_SIZE * sizeof(uint32_t));
+}
+
+DeflateStream::~DeflateStream() {
+  if (window) heap_caps_free(window);
+  if (hashHead) heap_caps_free(hashHead);
+}
+
+const char* DeflateStream::contentEncoding(DeflateWrapper format) {
+  switch (format) {
+    case DeflateWrapper::GZIP: return "gzip";
+    case DeflateWrapper::ZLIB: return "deflate";
+    default: return nullptr;
+  }
+}
+
+void DeflateStream::reset(Print& output, DeflateWrapper format) {
+  out = &output;
+  wrapper = format;
+  fill = 0;
+  pos = 0;
+  base = 0;
+  bitBuffer = 0;
+  bitCount = 0;
+  stagingLen = 0;
+  crc = 0;
+  adlerA = 1;
+  adlerB = 0;
+  totalIn = 0;
+  totalOut = 0;
+  started = false;
+  failed = !isReady();
+  if (hashHead) {
+    memset(hashHead, 0, DEFLATE_HASH_SIZE * sizeof(uint32_t));
+  }
+}
+
+void DeflateStream::flushStaging() {
+  if (stagingLen == 0) return;
+  if (out->write(staging, stagingLen) != stagingLen) {
+    failed = true;
+  }
+  totalOut += stagingLen;
+  stagingLen = 0;
+}
+
+void DeflateStream::putByte(uint8_t b) {
+  staging[stagingLen++] = b;
+  if (stagingLen == sizeof(staging)) {
+    flushStaging();
+  }
+}
+
+void DeflateStream::putBits(uint32_t value, uint8_t bits) {
+  bitBuffer |= value << bitCount;
+  bitCount += bits;
+  while (bitCount >= 8) {
+    putByte(bitBuffer & 0xFF);
+    bitBuffer >>= 8;
+    bitCount -= 8;
+  }
+}
+
+void DeflateStream::writeSymbol(uint16_t symbol) {
+  // Fixed Huffman literal/length code (RFC 1951 3.2.6), sent MSB first
+  if (symbol < 144) {
+    putBits(reverseBits(0x30 + symbol, 8), 8);
+  } else if (symbol < 256) {
+    putBits(reverseBits(0x190 + symbol - 144, 9), 9);
+  } else if (symbol < 280) {
+    putBits(reverseBits(symbol - 256, 7), 7);
+  } else {
+    putBits(reverseBits(0xC0 + symbol - 280, 8), 8);
+  }
+}
+
+void DeflateStream::writeLiteral(uint8_t literal) {
+  writeSymbol(literal);
+}
+
+void DeflateStream::writeMatch(size_t length, size_t distance) {
+  int l = 28;
+  while (LENGTH_BASE[l] > length) l--;
+  writeSymbol(257 + l);
+  if (LENGTH_EXTRA[l]) putBits(length - LENGTH_BASE[l], LENGTH_EXTRA[l]);
+
+  int d = 29;
+  while (DIST_BASE[d] > distance) d--;
+  putBits(reverseBits(d, 5), 5);
+  if (DIST_EXTRA[d]) putBits(distance - DIST_BASE[d], DIST_EXTRA[d]);
+}
+
+void DeflateStream::begin() {
+  started = true;
+  if (wrapper == DeflateWrapper::GZIP) {
+    static const uint8_t header[10] = { 0x1F, 0x8B, 8, 0, 0, 0, 0, 0, 0, 0xFF };
+    for (uint8_t b : header) putByte(b);
+  } else if (wrapper == DeflateWrapper::ZLIB) {
+    putByte(0x78);  // deflate, 32 KB window (our window is smaller, which is allowed)
+    putByte(0x01);
+  }
+  // BFINAL = 0, BTYPE = 01 (fixed Huffman); finish() appends an empty final block
+  putBits(0, 1);
+  putBits(1, 2);
+}
+
+void DeflateStream::insertHash(size_t index) {
+  uint32_t h = ((uint32_t)window[index] << 8) ^ ((uint32_t)window[index + 1] << 4) ^ window[index + 2];
+  h = (h * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+  hashHead[h] = base + index + 1;
+}
+
+void DeflateStream::compress(bool flush) {
+  size_t limit = flush ? fill : (fill > DEFLATE_MAX_MATCH ? fill - DEFLATE_MAX_MATCH : 0);
+  size_t maxDistance = windowSize;
+
+  while (pos < limit) {
+    size_t bestLen = 0;
+    size_t bestDist = 0;
+
+    if (pos + DEFLATE_MIN_MATCH <= fill) {
+      uint32_t h = ((uint32_t)window[pos] << 8) ^ ((uint32_t)window[pos + 1] << 4) ^ window[pos + 2];
+      h = (h * 2654435761u) >> (32 - DEFLATE_HASH_BITS);
+      uint32_t candidate = hashHead[h];
+      hashHead[h] = base + pos + 1;
+
+      // Single probe: only the most recent position with the same hash
+      if (candidate > base) {
+        size_t candIndex = candidate - 1 - base;
+        size_t distance = pos - candIndex;
+        if (distance > 0 && distance <= maxDistance) {
+          size_t maxLen = min((size_t)DEFLATE_MAX_MATCH, fill - pos);
+          size_t len = 0;
+          while (len < maxLen && window[candIndex + len] == window[pos + len]) len++;
+          if (len >= DEFLATE_MIN_MATCH) {
+            bestLen = len;
+            bestDist = distance;
+          }
+        }
+      }
+    }
+
+    if (bestLen) {
+      writeMatch(bestLen, bestDist);
+      // Index the covered positions so later repeats can find them
+      for (size_t i = 1; i < bestLen && pos + i + DEFLATE_MIN_MATCH <= fill; i++) {
+        insertHash(pos + i);
+      }
+      pos += bestLen;
+    } else {
+      writeLiteral(window[pos]);
+      pos++;
+    }
+  }
+}
+
+void DeflateStream::slide() {
+  // Keep windowSize bytes of history in front of pos
+  if (pos <= windowSize) return;
+  size_t shift = pos - windowSize;
+  memmove(window, window + shift, fill - shift);
+  base += shift;
+  pos -= shift;
+  fill -= shift;
+}
+
+size_t DeflateStream::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+size_t DeflateStream::write(const uint8_t* data, size_t len) {
+  if (failed || !out) return 0;
+  if (!started) begin();
+
+  if (wrapper == DeflateWrapper::GZIP) {
+    crc = esp_rom_crc32_le(crc, data, len);
+  } else if (wrapper == DeflateWrapper::ZLIB) {
+    for (size_t i = 0; i < len; i++) {
+      adlerA = (adlerA + data[i]) % 65521;
+      adlerB = (adlerB + adlerA) % 65521;
+    }
+  }
+  totalIn += len;
+
+  size_t remaining = len;
+  while (remaining > 0) {
+    size_t room = windowSize * 2 - fill;
+    if (room == 0) {
+      compress(false);
+      slide();
+      room = windowSize * 2 - fill;
+      if (room == 0) {
+        failed = true;
+        return 0;
+      }
+    }
+    size_t n = min(room, remaining);
+    memcpy(window + fill, data, n);
+    fill += n;
+    data += n;
+    remaining -= n;
+  }
+  return failed ? 0 : len;
+}
+
+bool DeflateStream::finish() {
+  if (!out) return false;
+  if (!started) begin();
+  if (failed) return false;
+
+  compress(true);
+  writeSymbol(256);  // End of the data block
+
+  // Final empty fixed-Huffman block
+  putBits(1, 1);
+  putBits(1, 2);
+  writeSymbol(256);
+  if (bitCount > 0) {
+    putByte(bitBuffer & 0xFF);
+    bitBuffer = 0;
+    bitCount = 0;
+  }
+
+  if (wrapper == DeflateWrapper::GZIP) {
+    for (int i = 0; i < 4; i++) putByte((crc >> (i * 8)) & 0xFF);
+    for (int i = 0; i < 4; i++) putByte((totalIn >> (i * 8)) & 0xFF);
+  } else if (wrapper == DeflateWrapper::ZLIB) {
+    uint32_t adler = (adlerB << 16) | adlerA;
+    for (int i = 3; i >= 0; i--) putByte((adler >> (i * 8)) & 0xFF);
+  }
+  flushStaging();
+  return !failed;
+}
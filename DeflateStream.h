@@ -0,0 +1,78 @@
+#ifndef DEFLATE_STREAM_H
+#define DEFLATE_STREAM_H
+
+#include <Arduino.h>
+
+enum class DeflateWrapper : uint8_t {
+  RAW,   // Bare RFC 1951 stream
+  ZLIB,  // RFC 1950, what HTTP calls "deflate"
+  GZIP   // RFC 1952
+};
+
+// Streaming deflate compressor that writes into any Print.
+// Uses LZ77 with a single-probe hash over a bounded window and the fixed
+// Huffman code, so memory stays at 2 * window + 16 KB (allocated in PSRAM)
+// and no code tables need to be built per stream. Typical JSON sample
+// batches shrink 3-6x.
+class DeflateStream : public Print {
+private:
+  Print* out;
+  DeflateWrapper wrapper;
+  size_t windowSize;
+  uint8_t* window;      // History plus pending input, 2 * windowSize bytes
+  uint32_t* hashHead;   // Absolute position + 1 of the last occurrence, 0 = empty
+  size_t fill;          // Bytes currently in window
+  size_t pos;           // Next byte to encode
+  uint32_t base;        // Absolute stream offset of window[0]
+
+  uint32_t bitBuffer;
+  uint8_t bitCount;
+  uint8_t staging[128];
+  size_t stagingLen;
+
+  uint32_t crc;
+  uint32_t adlerA;
+  uint32_t adlerB;
+  uint32_t totalIn;
+  uint32_t totalOut;
+  bool started;
+  bool failed;
+
+  void putBits(uint32_t value, uint8_t bits);
+  void putByte(uint8_t b);
+  void flushStaging();
+  void writeLiteral(uint8_t literal);
+  void writeMatch(size_t length, size_t distance);
+  void writeSymbol(uint16_t symbol);
+  void insertHash(size_t index);
+  void compress(bool flush);
+  void slide();
+  void begin();
+
+public:
+  // windowBits 10..14 (1 KB .. 16 KB history)
+  explicit DeflateStream(uint8_t windowBits = 12);
+  ~DeflateStream();
+
+  DeflateStream(const DeflateStream&) = delete;
+  DeflateStream& operator=(const DeflateStream&) = delete;
+
+  bool isReady() const { return window && hashHead; }
+
+  // Starts a new stream into output; the previous stream must be finished
+  void reset(Print& output, DeflateWrapper format);
+
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t* data, size_t len) override;
+
+  // Flushes remaining input, closes the final block and writes the trailer.
+  // Returns false if allocation failed or the output rejected bytes.
+  bool finish();
+
+  uint32_t bytesIn() const { return totalIn; }
+  uint32_t bytesOut() const { return totalOut; }
+
+  static const char* contentEncoding(DeflateWrapper format);
+};
+
+#endif
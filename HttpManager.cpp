@@ -1,11 +1,24 @@
 #include "HttpManager.h"
 #include "LEDManager.h"
+#include "MemoryManager.h"
+#include <esp_heap_caps.h>
 
 HttpManager* HttpManager::instance = nullptr;
 
 HttpManager::HttpManager(ConfigManager* config, ServerConfig* serverCfg, NetworkMgr* netMgr)
   : configManager(config), queueManager(nullptr), serverConfig(serverCfg), networkManager(netMgr),
-    running(false), taskHandle(nullptr), timeout(10000), retryCount(3), lastSendAttempt(0) {
+    consumerId(-1), running(false), taskHandle(nullptr), payloadFormat(PayloadFormat::JSON), encodeBuffer(nullptr),
+    timeout(10000), retryCount(3), batchFormat(BatchFormat::SINGLE), batchMaxSamples(50), batchMaxBytes(16384),
+    targetLatencyMs(2000), batchLimit(10), batchDoc(PsramAllocator::instance()),
+    batchesSent(0), samplesSent(0), bytesSent(0), requestMsTotal(0),
+    latencyCount(0), latencyTotalMs(0), latencyMaxMs(0), configRevision(0),
+    retryBaseMs(1000), retryMaxMs(60000), retryMaxPending(8), retryAttempts(0), droppedBatches(0), skippedSamples(0),
+    breakerState(BreakerState::CLOSED), breakerThreshold(5), breakerCooldownMs(30000), breakerOpenUntil(0),
+    consecutiveFailures(0), breakerTrips(0),
+    compressionEnabled(false), compression(DeflateWrapper::GZIP), compressMinBytes(1024), deflater(nullptr), compressWindowBits(0),
+    compressedCount(0), compressInBytes(0), compressOutBytes(0), compressMicros(0),
+    chunkedUpload(false), chunkedMaxSamples(1000), chunkedAttempts(0), chunkedPermanentFailures(0),
+    chunkedRetryAt(0), chunkedUploads(0), chunkedFailures(0) {
   queueManager = QueueManager::getInstance();
 }
 
@@ -24,6 +37,17 @@ bool HttpManager::init() {
     return false;
   }
 
+  if (!encodeBuffer) {
+    encodeBuffer = (uint8_t*)heap_caps_malloc(HTTP_ENCODE_BUFFER_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!encodeBuffer) {
+      encodeBuffer = (uint8_t*)malloc(HTTP_ENCODE_BUFFER_SIZE);  // Fallback to internal RAM
+    }
+    if (!encodeBuffer) {
+      Serial.println("Failed to allocate HTTP encode buffer");
+      return false;
+    }
+  }
+
   loadHttpConfig();
   Serial.println("HTTP Manager initialized successfully");
   return true;
@@ -36,6 +60,13 @@ void HttpManager::start() {
     return;
   }
 
+  // Own cursor over the sample queue, independent of other uplinks
+  consumerId = queueManager->addConsumer("http");
+  if (consumerId < 0) {
+    Serial.println("Failed to register HTTP queue consumer");
+    return;
+  }
+
   running = true;
   BaseType_t result = xTaskCreatePinnedToCore(
     httpTask,
@@ -52,6 +83,8 @@ void HttpManager::start() {
     Serial.println("Failed to create HTTP task");
     running = false;
     taskHandle = nullptr;
+    queueManager->removeConsumer(consumerId);
+    consumerId = -1;
   }
 }
 
@@ -62,6 +95,11 @@ void HttpManager::stop() {
     vTaskDelete(taskHandle);
     taskHandle = nullptr;
   }
+  session.close();
+  if (consumerId >= 0) {
+    queueManager->removeConsumer(consumerId);
+    consumerId = -1;
+  }
   Serial.println("HTTP Manager stopped");
 }
 
@@ -97,97 +135,51 @@ void HttpManager::httpLoop() {
       networkWasAvailable = true;
     }
 
-    // Process queue data
-    publishQueueData();
-
-    vTaskDelay(pdMS_TO_TICKS(1000));
+    // Process retries and queue data, then sleep until the next retry is due.
+    // Wake early on new data only if there is room to send another batch.
+    TickType_t wait = publishQueueData();
+    if (canAcceptBatch(millis())) {
+      queueManager->waitForData(consumerId, wait);
+    } else {
+      vTaskDelay(wait);
+    }
   }
 }
 
-bool HttpManager::sendHttpRequest(const JsonObject& data) {
-  if (endpointUrl.isEmpty()) {
+int HttpManager::sendHttpRequest(uint8_t* payload, size_t payloadLen, const char* contentType,
+                                 const char* contentEncoding) {
+  if (endpointUrl.isEmpty() || !session.isConfigured()) {
     Serial.println("[HTTP] No endpoint URL configured");
-    return false;
+    return HTTP_SESSION_ERROR_CONFIG;
   }
 
-  Serial.printf("[HTTP] Sending request to %s\n", endpointUrl.c_str());
-
-  Client* activeClient = networkManager->getActiveClient();
-  if (!activeClient) {
+  // The session owns its sockets; the network manager only says which
+  // interface is up, so HTTP never touches the client MQTT is using
+  if (!session.isSecure() && !networkManager->getActiveClient()) {
     Serial.println("[HTTP] No active network client available.");
-    return false;
-  }
-
-  HTTPClient httpClient;          // Create local instance
-  httpClient.begin(endpointUrl);  // Let HTTPClient manage the client internally
-  httpClient.setTimeout(timeout);
-
-  // Set headers from configuration
-  // --- PERUBAHAN DI SINI ---
-  StaticJsonDocument<1024> configDoc; // Mengganti DynamicJsonDocument(1024)
-  // --- AKHIR PERUBAHAN ---
-  JsonObject httpConfig = configDoc.to<JsonObject>();
-
-  if (serverConfig->getHttpConfig(httpConfig)) {
-    JsonObject configHeaders = httpConfig["headers"];
-    for (JsonPair header : configHeaders) {
-      httpClient.addHeader(header.key().c_str(), header.value().as<String>());
-      Serial.printf("[HTTP] Header: %s = %s\n", header.key().c_str(), header.value().as<String>().c_str());
-    }
+    return HTTP_SESSION_ERROR_CONNECT;
   }
 
-  // Default headers
-  httpClient.addHeader("Content-Type", "application/json");
-
-  // Prepare payload
-  String payload;
-  serializeJson(data, payload);
-
-  int httpResponseCode = -1;
-  int attempts = 0;
-
-  while (attempts < retryCount && httpResponseCode < 0) {
-    attempts++;
-
-    if (method == "POST") {
-      httpResponseCode = httpClient.POST(payload);
-    } else if (method == "PUT") {
-      httpResponseCode = httpClient.PUT(payload);
-    } else if (method == "PATCH") {
-      httpResponseCode = httpClient.PATCH(payload);
-    } else {
-      Serial.printf("[HTTP] Unsupported method: %s\n", method.c_str());
-      httpClient.end();
-      return false;
-    }
+  // Single attempt: failures are rescheduled by the retry engine, never slept on here
+  int httpResponseCode = session.send(networkManager->getCurrentMode(), payload, payloadLen, contentType, contentEncoding);
+  reportResponse(httpResponseCode);
+  return httpResponseCode;
+}
 
-    if (httpResponseCode > 0) {
-      Serial.printf("[HTTP] Response code: %d\n", httpResponseCode);
-
-      if (httpResponseCode >= 200 && httpResponseCode < 300) {
-        String response = httpClient.getString();
-        Serial.printf("[HTTP] Success: %s\n", response.c_str());
-        httpClient.end();
-        if (ledManager) {
-          ledManager->notifySuccess();
-        }
-        return true;
-      } else {
-        String response = httpClient.getString();
-        Serial.printf("[HTTP] Error response: %s\n", response.c_str());
+void HttpManager::reportResponse(int code) {
+  if (code > 0) {
+    Serial.printf("[HTTP] Response code: %d\n", code);
+    if (code >= 200 && code < 300) {
+      Serial.printf("[HTTP] Success: %s\n", session.getResponsePreview().c_str());
+      if (ledManager) {
+        ledManager->notifySuccess();
       }
     } else {
-      Serial.printf("[HTTP] Request failed, error: %s\n", httpClient.errorToString(httpResponseCode).c_str());
-    }
-
-    if (attempts < retryCount) {
-      Serial.printf("[HTTP] Retrying in 2 seconds... (attempt %d/%d)\n", attempts + 1, retryCount);
-      vTaskDelay(pdMS_TO_TICKS(2000));
+      Serial.printf("[HTTP] Error response: %s\n", session.getResponsePreview().c_str());
     }
+  } else {
+    Serial.printf("[HTTP] Request failed, error: %s\n", HttpSession::errorToString(code));
   }
-
-  httpClient.end();
-  return false;
 }
 
 void HttpManager::loadHttpConfig() {
@@ -197,23 +189,93 @@ void HttpManager::loadHttpConfig() {
   JsonObject httpConfig = configDoc.to<JsonObject>();
 
   Serial.println("[HTTP] Loading HTTP configuration...");
+  configRevision = serverConfig->getRevision();
 
   if (serverConfig->getHttpConfig(httpConfig)) {
     bool enabled = httpConfig["enabled"] | false;
     if (!enabled) {
       Serial.println("[HTTP] HTTP config disabled, clearing endpoint");
       endpointUrl = "";
+      session.close();
       return;
     }
 
     endpointUrl = httpConfig["endpoint_url"] | "";
     method = httpConfig["method"] | "POST";
     bodyFormat = httpConfig["body_format"] | "json";
+    batchFormat = BatchEncoder::parseFormat(bodyFormat);
+    payloadFormat = PayloadEncoder::parseFormat(bodyFormat);
+    if (payloadFormat == PayloadFormat::SPARKPLUG_B) {
+      Serial.println("[HTTP] Sparkplug B is MQTT-only, falling back to JSON");
+      payloadFormat = PayloadFormat::JSON;
+    }
     timeout = httpConfig["timeout"] | 10000;
     retryCount = httpConfig["retry"] | 3;
+    retryBaseMs = httpConfig["retry_base_ms"] | 1000;
+    retryMaxMs = httpConfig["retry_max_ms"] | 60000;
+    retryMaxPending = constrain(httpConfig["retry_max_pending"] | 8, 1, HTTP_MAX_PENDING_RETRIES);
+    breakerThreshold = max(1, (int)(httpConfig["breaker_threshold"] | 5));
+    breakerCooldownMs = httpConfig["breaker_cooldown_ms"] | 30000;
+
+    String compressionName = httpConfig["compression"] | "none";
+    compressionName.toLowerCase();
+    compressMinBytes = httpConfig["compress_min_bytes"] | 1024;
+    compressionEnabled = compressionName == "gzip" || compressionName == "deflate";
+    compression = (compressionName == "gzip") ? DeflateWrapper::GZIP : DeflateWrapper::ZLIB;
+    uint8_t windowBits = constrain(httpConfig["compress_window_bits"] | 12, 10, 14);
+    if (deflater && (!compressionEnabled || windowBits != compressWindowBits)) {
+      // Disabled or resized: release the old window before allocating another
+      delete deflater;
+      deflater = nullptr;
+    }
+    if (compressionEnabled && !deflater) {
+      // Compression window lives in PSRAM: 2 * 2^window_bits + 16 KB
+      deflater = new DeflateStream(windowBits);
+      compressWindowBits = windowBits;
+      if (!deflater->isReady()) {
+        Serial.println("[HTTP] Failed to allocate compression window, sending uncompressed");
+        delete deflater;
+        deflater = nullptr;
+        compressionEnabled = false;
+      }
+    }
+    batchMaxSamples = constrain(httpConfig["batch_max_samples"] | 50, 1, HTTP_MAX_BATCH_SAMPLES);
+    batchMaxBytes = constrain(httpConfig["batch_max_bytes"] | 16384, 512, HTTP_MAX_BATCH_BYTES);
+    compressedBody.setMaxSize(batchMaxBytes * 2);
+    targetLatencyMs = httpConfig["target_latency_ms"] | 2000;
+    measurement = httpConfig["measurement"] | "modbus";
+    batchLimit = min(batchLimit, batchMaxSamples);
+
+    String uploadMode = httpConfig["upload_mode"] | "batch";
+    uploadMode.toLowerCase();
+    chunkedUpload = uploadMode == "chunked";
+    chunkedMaxSamples = constrain(httpConfig["chunked_max_samples"] | 1000, 1, HTTP_MAX_CHUNKED_SAMPLES);
+    if (chunkedUpload && batchFormat == BatchFormat::SINGLE) {
+      Serial.println("[HTTP] Chunked upload needs a batch body format, using batch mode");
+      chunkedUpload = false;
+    }
+    body.setMaxSize(batchMaxBytes * 2);  // Estimate is JSON-based; leave room for CSV headers and escaping
+
+    // URL and headers are parsed once here and reused for every request
+    method.toUpperCase();
+    if (method != "POST" && method != "PUT" && method != "PATCH") {
+      Serial.printf("[HTTP] Unsupported method: %s, clearing endpoint\n", method.c_str());
+      endpointUrl = "";
+    } else if (!session.configure(endpointUrl, method, httpConfig["headers"].as<JsonObjectConst>())) {
+      Serial.printf("[HTTP] Invalid endpoint URL: %s\n", endpointUrl.c_str());
+      endpointUrl = "";
+    }
+    session.setTimeout(timeout);
 
     Serial.printf("[HTTP] Config loaded - URL: %s, Method: %s, Timeout: %d, Retry: %d\n",
                   endpointUrl.c_str(), method.c_str(), timeout, retryCount);
+    if (chunkedUpload) {
+      Serial.printf("[HTTP] Chunked upload %s - up to %d samples per request\n",
+                    BatchEncoder::formatName(batchFormat), chunkedMaxSamples);
+    } else if (batchFormat != BatchFormat::SINGLE) {
+      Serial.printf("[HTTP] Batching %s - up to %d samples / %u bytes, target latency %d ms\n",
+                    BatchEncoder::formatName(batchFormat), batchMaxSamples, (unsigned)batchMaxBytes, targetLatencyMs);
+    }
   } else {
     Serial.println("[HTTP] Failed to load HTTP config");
     endpointUrl = "";
@@ -223,42 +285,424 @@ void HttpManager::loadHttpConfig() {
   }
 }
 
-void HttpManager::publishQueueData() {
+TickType_t HttpManager::publishQueueData() {
+  if (configRevision != serverConfig->getRevision()) {
+    Serial.println("[HTTP] Server config changed, rebuilding session");
+    loadHttpConfig();
+  }
+
   if (endpointUrl.isEmpty()) {
-    return;
+    return pdMS_TO_TICKS(5000);
   }
 
-  // Check if enough time has passed since last attempt
-  unsigned long now = millis();
-  if (now - lastSendAttempt < 1000) {
-    return;
+  // Failed batches go first so the endpoint receives samples roughly in order
+  processRetries();
+
+  if (chunkedUpload) {
+    publishChunked();
+    return nextWakeDelay();
   }
-  lastSendAttempt = now;
 
-  // Process up to 5 items per loop to avoid blocking
-  for (int i = 0; i < 5; i++) {
-    // --- PERUBAHAN DI SINI ---
-    StaticJsonDocument<512> dataDoc; // Mengganti DynamicJsonDocument(512)
-    // --- AKHIR PERUBAHAN ---
-    JsonObject dataPoint = dataDoc.to<JsonObject>();
+  std::vector<unsigned long> enqueueTimes;
+  enqueueTimes.reserve(batchMaxSamples);
+
+  // Send up to 5 requests per wake, then let the loop check the network again
+  for (int request = 0; request < 5 && canAcceptBatch(millis()); request++) {
+    int limit = (batchFormat == BatchFormat::SINGLE) ? 1 : batchLimit;
+    JsonArray samples = batchDoc.to<JsonArray>();
+    enqueueTimes.clear();
+    size_t estimatedBytes = 0;
+    uint32_t seq = queueManager->cursor(consumerId);
+
+    while ((int)samples.size() < limit && estimatedBytes < batchMaxBytes) {
+      // --- PERUBAHAN DI SINI ---
+      StaticJsonDocument<512> dataDoc; // Mengganti DynamicJsonDocument(512)
+      // --- AKHIR PERUBAHAN ---
+      JsonObject dataPoint = dataDoc.to<JsonObject>();
+
+      unsigned long enqueuedAt = 0;
+      if (!queueManager->peekFrom(seq, dataPoint, &seq, &enqueuedAt)) {
+        break;  // No more data in queue
+      }
+      samples.add(dataPoint);
+      enqueueTimes.push_back(enqueuedAt);
+      estimatedBytes += measureJson(dataPoint) + 1;
+    }
 
-    if (!queueManager->dequeue(dataPoint)) {
-      break;  // No more data in queue
+    if (samples.size() == 0) {
+      break;
     }
 
-    // Send HTTP request
-    if (sendHttpRequest(dataPoint)) {
-      Serial.printf("[HTTP] Data sent successfully\n");
+    uint8_t* payload;
+    size_t payloadLen;
+    const char* contentType;
+    if (batchFormat == BatchFormat::SINGLE) {
+      payloadLen = PayloadEncoder::encode(payloadFormat, samples[0], encodeBuffer, HTTP_ENCODE_BUFFER_SIZE);
+      payload = encodeBuffer;
+      contentType = PayloadEncoder::contentType(payloadFormat);
     } else {
-      Serial.printf("[HTTP] Failed to send data, re-queuing\n");
-      queueManager->enqueue(dataPoint);
+      body.clear();
+      size_t skipped = 0;
+      BatchEncoder::encode(batchFormat, samples, body, measurement.c_str(), &skipped);
+      if (skipped == samples.size()) {
+        // Nothing in the batch can be written in this format
+        skippedSamples += skipped;
+        queueManager->commitThrough(consumerId, seq);
+        continue;
+      }
+      payloadLen = body.overflowed() ? 0 : body.size();
+      if (payloadLen > 0) {
+        skippedSamples += skipped;  // Counted once, not again for a shrunk retry
+      }
+      payload = body.data();
+      contentType = BatchEncoder::contentType(batchFormat);
+    }
+
+    if (payloadLen == 0) {
+      if (samples.size() == 1) {
+        Serial.println("[HTTP] Sample too large for encode buffer, dropped");
+        queueManager->commitThrough(consumerId, seq);
+        continue;
+      }
+      // Body did not fit: leave the samples uncommitted and try a smaller batch
+      Serial.printf("[HTTP] Batch of %u samples too large, shrinking\n", (unsigned)samples.size());
+      batchLimit = max(1, (int)samples.size() / 2);
+      continue;
+    }
+
+    const char* contentEncoding = compressBody(payload, payloadLen);
+
+    unsigned long start = millis();
+    int code = sendHttpRequest(payload, payloadLen, contentType, contentEncoding);
+    unsigned long elapsed = millis() - start;
+    bool sent = code >= 200 && code < 300;
+    recordResult(sent);
+
+    if (!sent) {
+      // Keep the encoded body and retry later; the task moves on meanwhile
+      batchLimit = max(1, batchLimit / 2);
+      if (isPermanentFailure(code) && retryCount <= 1) {
+        Serial.printf("[HTTP] Endpoint rejected %u samples (%d), dropped\n", (unsigned)samples.size(), code);
+        droppedBatches++;
+        queueManager->commitThrough(consumerId, seq);
+        continue;
+      }
+      PendingBatch pending;
+      pending.body = (uint8_t*)heap_caps_malloc(payloadLen, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+      if (!pending.body) {
+        Serial.println("[HTTP] No memory for retry, samples stay queued");
+        break;
+      }
+      memcpy(pending.body, payload, payloadLen);
+      pending.length = payloadLen;
+      pending.contentType = contentType;
+      pending.contentEncoding = contentEncoding;
+      pending.enqueueTimes = enqueueTimes;
+      pending.attempts = 1;
+      pending.permanentFailures = isPermanentFailure(code) ? 1 : 0;
+      unsigned long delayMs = backoffDelay(1);
+      pending.nextAttemptAt = millis() + delayMs;
+      retries.push_back(std::move(pending));
+      queueManager->commitThrough(consumerId, seq);  // The retry entry owns these samples now
+      Serial.printf("[HTTP] Batch of %u samples scheduled for retry in %lu ms (%u pending)\n",
+                    (unsigned)samples.size(), delayMs, (unsigned)retries.size());
+      continue;
+    }
+
+    Serial.printf("[HTTP] Sent %u samples (%u bytes) in %lu ms\n",
+                  (unsigned)samples.size(), (unsigned)payloadLen, elapsed);
+    recordDelivery(payloadLen, elapsed, enqueueTimes);
+    queueManager->commitThrough(consumerId, seq);
+
+    // AIMD: grow full batches by one while requests stay under the target
+    // latency, halve as soon as a request is slower than the target
+    if (batchFormat != BatchFormat::SINGLE) {
+      if ((int)elapsed > targetLatencyMs) {
+        batchLimit = max(1, batchLimit / 2);
+      } else if ((int)samples.size() >= batchLimit && batchLimit < batchMaxSamples) {
+        batchLimit++;
+      }
+    }
+
+    if (queueManager->pending(consumerId) == 0) {
       break;
     }
+  }
+
+  return nextWakeDelay();
+}
+
+void HttpManager::publishChunked() {
+  if (queueManager->pending(consumerId) == 0 || !canAcceptBatch(millis())) {
+    return;
+  }
+
+  if (!session.isSecure() && !networkManager->getActiveClient()) {
+    Serial.println("[HTTP] No active network client available.");
+    return;
+  }
+
+  // Body size is unknown up front, so compression applies to every upload
+  const char* contentEncoding = (compressionEnabled && deflater) ? DeflateStream::contentEncoding(compression) : nullptr;
+  unsigned long start = millis();
+  HttpChunkedBody* sink = session.beginChunked(networkManager->getCurrentMode(), BatchEncoder::contentType(batchFormat), contentEncoding);
+
+  uint32_t seq = queueManager->cursor(consumerId);
+  size_t count = 0;
+  size_t skipped = 0;     // Streamed past but not written, see BatchEncoder::add()
+  uint64_t ageTotal = 0;  // Sample age at start; latency = age + request time
+  uint32_t ageMax = 0;
+  int code = HTTP_SESSION_ERROR_CONNECT;
+
+  if (sink) {
+    Print* out = sink;
+    if (contentEncoding) {
+      deflater->reset(*sink, compression);
+      out = deflater;
+    }
+
+    // One sample in memory at a time; the queue keeps them until committed
+    BatchEncoder::begin(batchFormat, *out);
+    while ((int)count < chunkedMaxSamples && !sink->failed()) {
+      // --- PERUBAHAN DI SINI ---
+      StaticJsonDocument<512> dataDoc; // Mengganti DynamicJsonDocument(512)
+      // --- AKHIR PERUBAHAN ---
+      JsonObject dataPoint = dataDoc.to<JsonObject>();
+
+      unsigned long enqueuedAt = 0;
+      if (!queueManager->peekFrom(seq, dataPoint, &seq, &enqueuedAt)) {
+        break;
+      }
+      if (!BatchEncoder::add(batchFormat, dataPoint, *out, measurement.c_str(), count++)) {
+        skipped++;
+      }
+      uint32_t age = start - enqueuedAt;
+      ageTotal += age;
+      ageMax = max(ageMax, age);
+    }
+    BatchEncoder::end(batchFormat, *out);
+    if (contentEncoding) {
+      deflater->finish();
+    }
+
+    if (count == 0) {
+      // Only unreadable items were left; drop them without finishing the request
+      session.abortChunked();
+      queueManager->commitThrough(consumerId, seq);
+      return;
+    }
+    code = session.finishChunked();
+  }
+  reportResponse(code);
+
+  unsigned long elapsed = millis() - start;
+  bool sent = code >= 200 && code < 300;
+  recordResult(sent);
+  chunkedUploads++;
+
+  if (!sent) {
+    // Nothing was committed: the same samples are streamed again after the backoff
+    chunkedFailures++;
+    if (isPermanentFailure(code) && ++chunkedPermanentFailures >= retryCount) {
+      Serial.printf("[HTTP] Endpoint rejected chunked upload %u times (%d), dropped %u samples\n",
+                    chunkedPermanentFailures, code, (unsigned)count);
+      queueManager->commitThrough(consumerId, seq);
+      droppedBatches++;
+      chunkedAttempts = 0;
+      chunkedPermanentFailures = 0;
+      return;
+    }
+    chunkedAttempts = min(chunkedAttempts + 1, 255);
+    unsigned long delayMs = backoffDelay(chunkedAttempts);
+    chunkedRetryAt = millis() + delayMs;
+    Serial.printf("[HTTP] Chunked upload failed, retrying in %lu ms (%d samples queued)\n",
+                  delayMs, queueManager->pending(consumerId));
+    return;
+  }
+
+  queueManager->commitThrough(consumerId, seq);
+  chunkedAttempts = 0;
+  chunkedPermanentFailures = 0;
+  skippedSamples += skipped;  // Only once the samples are committed, not per attempt
+
+  uint32_t bodyBytes = sink->bytesWritten();
+  Serial.printf("[HTTP] Streamed %u samples (%u bytes) in %lu ms\n", (unsigned)count, bodyBytes, elapsed);
+  if (contentEncoding) {
+    compressedCount++;
+    compressInBytes += deflater->bytesIn();
+    compressOutBytes += deflater->bytesOut();
+  }
+  batchesSent++;
+  samplesSent += count;
+  bytesSent += bodyBytes;
+  requestMsTotal += elapsed;
+  latencyCount += count;
+  latencyTotalMs += ageTotal + (uint64_t)elapsed * count;
+  latencyMaxMs = max(latencyMaxMs, ageMax + (uint32_t)elapsed);
+}
+
+TickType_t HttpManager::nextWakeDelay() {
+  // Sleep until the earliest retry or the end of the breaker cool-down
+  unsigned long now = millis();
+  unsigned long waitMs = ULONG_MAX;
+  if (breakerState == BreakerState::OPEN) {
+    waitMs = (long)(breakerOpenUntil - now) > 0 ? breakerOpenUntil - now : 0;
+  }
+  if (chunkedAttempts > 0) {
+    waitMs = min(waitMs, (long)(chunkedRetryAt - now) > 0 ? chunkedRetryAt - now : 0UL);
+  }
+  for (const PendingBatch& pending : retries) {
+    unsigned long due = (long)(pending.nextAttemptAt - now) > 0 ? pending.nextAttemptAt - now : 0;
+    waitMs = min(waitMs, due);
+  }
+  if (waitMs == ULONG_MAX) {
+    return portMAX_DELAY;
+  }
+  return pdMS_TO_TICKS(max(waitMs, 10UL));
+}
+
+void HttpManager::processRetries() {
+  for (auto it = retries.begin(); it != retries.end();) {
+    unsigned long now = millis();
+    if (!breakerAllows(now)) {
+      return;
+    }
+    if ((long)(now - it->nextAttemptAt) < 0) {
+      ++it;
+      continue;
+    }
+
+    int code = sendHttpRequest(it->body, it->length, it->contentType, it->contentEncoding);
+    unsigned long elapsed = millis() - now;
+    bool sent = code >= 200 && code < 300;
+    recordResult(sent);
+    retryAttempts++;
+
+    if (sent) {
+      Serial.printf("[HTTP] Retry delivered %u samples after %u attempts\n",
+                    (unsigned)it->enqueueTimes.size(), it->attempts + 1);
+      recordDelivery(it->length, elapsed, it->enqueueTimes);
+      heap_caps_free(it->body);
+      it = retries.erase(it);
+      continue;
+    }
 
-    vTaskDelay(pdMS_TO_TICKS(100));  // Small delay between requests
+    it->attempts++;
+    if (isPermanentFailure(code) && ++it->permanentFailures >= retryCount) {
+      // The endpoint keeps rejecting this body; retrying cannot succeed
+      Serial.printf("[HTTP] Endpoint rejected batch %u times (%d), dropped %u samples\n",
+                    it->permanentFailures, code, (unsigned)it->enqueueTimes.size());
+      droppedBatches++;
+      heap_caps_free(it->body);
+      it = retries.erase(it);
+      continue;
+    }
+    it->nextAttemptAt = millis() + backoffDelay(it->attempts);
+    ++it;
   }
 }
 
+unsigned long HttpManager::backoffDelay(uint8_t attempts) {
+  // Exponential backoff with full jitter: uniform in [0, min(cap, base * 2^n)]
+  uint32_t shift = min((int)attempts - 1, 16);
+  uint64_t ceiling = min((uint64_t)retryMaxMs, (uint64_t)retryBaseMs << shift);
+  return ceiling ? esp_random() % (ceiling + 1) : 0;
+}
+
+bool HttpManager::isPermanentFailure(int code) {
+  // 4xx other than timeout and rate limiting will fail the same way again
+  return code >= 400 && code < 500 && code != 408 && code != 429;
+}
+
+bool HttpManager::breakerAllows(unsigned long now) {
+  if (breakerState == BreakerState::OPEN) {
+    if ((long)(now - breakerOpenUntil) < 0) {
+      return false;
+    }
+    breakerState = BreakerState::HALF_OPEN;
+    Serial.println("[HTTP] Circuit breaker half-open, sending probe request");
+  }
+  return true;
+}
+
+bool HttpManager::canAcceptBatch(unsigned long now) {
+  if (chunkedUpload && chunkedAttempts > 0 && (long)(now - chunkedRetryAt) < 0) {
+    return false;  // Failed chunked upload is backing off; its samples are still queued
+  }
+  return !endpointUrl.isEmpty() && (int)retries.size() < retryMaxPending && breakerAllows(now);
+}
+
+void HttpManager::recordResult(bool success) {
+  if (success) {
+    if (breakerState != BreakerState::CLOSED) {
+      Serial.println("[HTTP] Circuit breaker closed");
+    }
+    breakerState = BreakerState::CLOSED;
+    consecutiveFailures = 0;
+    return;
+  }
+
+  consecutiveFailures++;
+  if (breakerState == BreakerState::HALF_OPEN || consecutiveFailures >= breakerThreshold) {
+    if (breakerState != BreakerState::OPEN) {
+      breakerTrips++;
+    }
+    breakerState = BreakerState::OPEN;
+    breakerOpenUntil = millis() + breakerCooldownMs;
+    Serial.printf("[HTTP] Circuit breaker open for %lu ms after %d failures\n",
+                  breakerCooldownMs, consecutiveFailures);
+  }
+}
+
+void HttpManager::recordDelivery(size_t bytes, unsigned long elapsed, const std::vector<unsigned long>& enqueueTimes) {
+  batchesSent++;
+  samplesSent += enqueueTimes.size();
+  bytesSent += bytes;
+  requestMsTotal += elapsed;
+
+  unsigned long now = millis();
+  for (unsigned long enqueuedAt : enqueueTimes) {
+    uint32_t latency = now - enqueuedAt;
+    latencyTotalMs += latency;
+    latencyCount++;
+    if (latency > latencyMaxMs) {
+      latencyMaxMs = latency;
+    }
+  }
+}
+
+const char* HttpManager::compressBody(uint8_t*& payload, size_t& payloadLen) {
+  if (!compressionEnabled || !deflater || payloadLen < compressMinBytes) {
+    return nullptr;
+  }
+
+  unsigned long start = micros();
+  compressedBody.clear();
+  deflater->reset(compressedBody, compression);
+  deflater->write(payload, payloadLen);
+  bool ok = deflater->finish() && !compressedBody.overflowed();
+  compressMicros += micros() - start;
+
+  // Incompressible bodies go out as they are
+  if (!ok || compressedBody.size() >= payloadLen) {
+    return nullptr;
+  }
+
+  compressedCount++;
+  compressInBytes += payloadLen;
+  compressOutBytes += compressedBody.size();
+  payload = compressedBody.data();
+  payloadLen = compressedBody.size();
+  return DeflateStream::contentEncoding(compression);
+}
+
+void HttpManager::clearRetries() {
+  for (PendingBatch& pending : retries) {
+    heap_caps_free(pending.body);
+  }
+  retries.clear();
+}
+
 bool HttpManager::isNetworkAvailable() {
   if (!networkManager) return false;
 
@@ -302,9 +746,48 @@ void HttpManager::getStatus(JsonObject& status) {
   status["method"] = method;
   status["timeout"] = timeout;
   status["retry_count"] = retryCount;
-  status["queue_size"] = queueManager->size();
+  status["body_format"] = (batchFormat == BatchFormat::SINGLE) ? PayloadEncoder::formatName(payloadFormat)
+                                                             : BatchEncoder::formatName(batchFormat);
+  status["batch_limit"] = (batchFormat == BatchFormat::SINGLE) ? 1 : batchLimit;
+  status["batch_max_samples"] = batchMaxSamples;
+  status["upload_mode"] = chunkedUpload ? "chunked" : "batch";
+  if (chunkedUpload) {
+    status["chunked_max_samples"] = chunkedMaxSamples;
+    status["chunked_uploads"] = chunkedUploads;
+    status["chunked_failures"] = chunkedFailures;
+  }
+  status["requests_sent"] = batchesSent;
+  status["samples_sent"] = samplesSent;
+  status["avg_batch_samples"] = batchesSent ? (double)samplesSent / batchesSent : 0.0;
+  status["avg_body_bytes"] = batchesSent ? (double)bytesSent / batchesSent : 0.0;
+  status["avg_request_ms"] = batchesSent ? (double)requestMsTotal / batchesSent : 0.0;
+  status["retries_pending"] = retries.size();
+  status["retry_attempts"] = retryAttempts;
+  status["dropped_batches"] = droppedBatches;
+  status["skipped_samples"] = skippedSamples;
+  status["breaker_state"] = breakerState == BreakerState::OPEN ? "open"
+                            : breakerState == BreakerState::HALF_OPEN ? "half_open" : "closed";
+  status["breaker_trips"] = breakerTrips;
+  status["compression"] = compressionEnabled ? DeflateStream::contentEncoding(compression) : "none";
+  status["compressed_requests"] = compressedCount;
+  status["compression_ratio"] = compressOutBytes ? (double)compressInBytes / compressOutBytes : 0.0;
+  status["compress_us_per_kb"] = compressInBytes ? (double)compressMicros * 1024.0 / compressInBytes : 0.0;
+  status["connections_opened"] = session.getConnectCount();
+  status["connection_reuse_rate"] = session.getRequestCount()
+                                      ? (double)session.getReusedCount() / session.getRequestCount()
+                                      : 0.0;
+  status["queue_size"] = queueManager->pending(consumerId);
+  status["avg_latency_ms"] = latencyCount ? (double)latencyTotalMs / latencyCount : 0.0;
+  status["max_latency_ms"] = latencyMaxMs;
 }
 
 HttpManager::~HttpManager() {
   stop();
+  clearRetries();
+  if (deflater) {
+    delete deflater;
+  }
+  if (encodeBuffer) {
+    heap_caps_free(encodeBuffer);
+  }
 }
\ No newline at end of file
@@ -2,13 +2,25 @@
 #define HTTP_MANAGER_H
 
 #include <WiFi.h>
-#include <HTTPClient.h>
 #include <ArduinoJson.h>
 #include "ConfigManager.h"
 #include "ServerConfig.h"
 #include "QueueManager.h"
 #include "NetworkManager.h"
+#include "PayloadEncoder.h"
+#include "BatchEncoder.h"
+#include "PsramBuffer.h"
+#include "HttpSession.h"
+#include "DeflateStream.h"
 #include <Ethernet.h>
+#include <vector>
+#include <deque>
+
+#define HTTP_ENCODE_BUFFER_SIZE 512
+#define HTTP_MAX_BATCH_SAMPLES 500
+#define HTTP_MAX_BATCH_BYTES 131072
+#define HTTP_MAX_PENDING_RETRIES 64
+#define HTTP_MAX_CHUNKED_SAMPLES 10000
 
 class HttpManager {
 private:
@@ -17,6 +29,7 @@ private:
   QueueManager* queueManager;
   ServerConfig* serverConfig;
   NetworkMgr* networkManager;
+  int consumerId;  // Cursor over the shared sample queue
   bool running;
   TaskHandle_t taskHandle;
 
@@ -24,17 +37,104 @@ private:
   String method;
   JsonObject headers;
   String bodyFormat;
+  PayloadFormat payloadFormat;
+  uint8_t* encodeBuffer;
   int timeout;
   int retryCount;
-  unsigned long lastSendAttempt;
+
+  // Batch uploads: size adapts (AIMD) between 1 and batchMaxSamples
+  BatchFormat batchFormat;
+  String measurement;
+  int batchMaxSamples;
+  size_t batchMaxBytes;
+  int targetLatencyMs;
+  int batchLimit;
+  JsonDocument batchDoc;  // Samples of the batch being built, pool in PSRAM
+  PsramBuffer body;
+  uint32_t batchesSent;
+  uint32_t samplesSent;
+  uint64_t bytesSent;
+  uint64_t requestMsTotal;
+
+  // Time from enqueue (acquisition) to a successful response
+  uint32_t latencyCount;
+  uint64_t latencyTotalMs;
+  uint32_t latencyMaxMs;
+
+  // Keep-alive connection with the URL and headers pre-parsed
+  HttpSession session;
+  uint32_t configRevision;
+
+  // Failed batches waiting for their next attempt (encoded body kept in PSRAM)
+  struct PendingBatch {
+    uint8_t* body;
+    size_t length;
+    const char* contentType;
+    const char* contentEncoding;  // nullptr when sent uncompressed
+    std::vector<unsigned long> enqueueTimes;
+    uint8_t attempts;
+    uint8_t permanentFailures;  // 4xx responses; dropped after retryCount of them
+    unsigned long nextAttemptAt;
+  };
+  std::deque<PendingBatch> retries;
+  uint32_t retryBaseMs;
+  uint32_t retryMaxMs;
+  int retryMaxPending;
+  uint32_t retryAttempts;
+  uint32_t droppedBatches;
+  uint32_t skippedSamples;  // Samples the body format cannot represent, e.g. no finite value for line protocol
+
+  // Circuit breaker: opens after breakerThreshold consecutive failures,
+  // then lets a single probe through once the cool-down has passed
+  enum class BreakerState : uint8_t { CLOSED, OPEN, HALF_OPEN };
+  BreakerState breakerState;
+  int breakerThreshold;
+  unsigned long breakerCooldownMs;
+  unsigned long breakerOpenUntil;
+  int consecutiveFailures;
+  uint32_t breakerTrips;
+
+  // Optional gzip/deflate request bodies above compressMinBytes
+  bool compressionEnabled;
+  DeflateWrapper compression;
+  size_t compressMinBytes;
+  DeflateStream* deflater;
+  uint8_t compressWindowBits;  // Window the current deflater was built with
+  PsramBuffer compressedBody;
+  uint32_t compressedCount;
+  uint64_t compressInBytes;
+  uint64_t compressOutBytes;
+  uint64_t compressMicros;
+
+  // Chunked upload mode: samples are read from the queue without removing
+  // them and streamed into the socket; they are committed only after a 2xx
+  bool chunkedUpload;
+  int chunkedMaxSamples;
+  uint8_t chunkedAttempts;
+  uint8_t chunkedPermanentFailures;
+  unsigned long chunkedRetryAt;
+  uint32_t chunkedUploads;
+  uint32_t chunkedFailures;
 
   HttpManager(ConfigManager* config, ServerConfig* serverCfg, NetworkMgr* netMgr);
 
   static void httpTask(void* parameter);
   void httpLoop();
-  bool sendHttpRequest(const JsonObject& data);
+  int sendHttpRequest(uint8_t* payload, size_t payloadLen, const char* contentType, const char* contentEncoding);
+  const char* compressBody(uint8_t*& payload, size_t& payloadLen);
   void loadHttpConfig();
-  void publishQueueData();
+  TickType_t publishQueueData();
+  void publishChunked();
+  TickType_t nextWakeDelay();
+  void reportResponse(int code);
+  void processRetries();
+  unsigned long backoffDelay(uint8_t attempts);
+  static bool isPermanentFailure(int code);
+  bool breakerAllows(unsigned long now);
+  bool canAcceptBatch(unsigned long now);
+  void recordResult(bool success);
+  void recordDelivery(size_t bytes, unsigned long elapsed, const std::vector<unsigned long>& enqueueTimes);
+  void clearRetries();
   void debugNetworkConnectivity();
   bool isNetworkAvailable();
 
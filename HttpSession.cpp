@@ -0,0 +1,450 @@
+#include "HttpSession.h"
+
+HttpSession::HttpSession()
+  : transport(nullptr), secureClient(nullptr), wifiClient(nullptr), ethernetClient(nullptr), secure(false), port(80), timeoutMs(10000), keepOpen(false), statusReceived(false),
+    chunkedActive(false), chunkedReused(false), requestCount(0), reusedCount(0), connectCount(0) {}
+
+HttpSession::~HttpSession() {
+  close();
+  if (secureClient) {
+    delete secureClient;
+  }
+  if (wifiClient) {
+    delete wifiClient;
+  }
+  if (ethernetClient) {
+    delete ethernetClient;
+  }
+}
+
+bool HttpSession::configure(const String& url, const String& method, JsonObjectConst headers) {
+  close();
+  requestHead = "";
+
+  int schemeEnd = url.indexOf("://");
+  if (schemeEnd < 0) {
+    return false;
+  }
+  String scheme = url.substring(0, schemeEnd);
+  scheme.toLowerCase();
+  if (scheme != "http" && scheme != "https") {
+    return false;
+  }
+  secure = (scheme == "https");
+
+  int hostStart = schemeEnd + 3;
+  int pathStart = url.indexOf('/', hostStart);
+  String authority = (pathStart < 0) ? url.substring(hostStart) : url.substring(hostStart, pathStart);
+  String path = (pathStart < 0) ? String("/") : url.substring(pathStart);
+
+  int at = authority.indexOf('@');
+  if (at >= 0) {
+    authority = authority.substring(at + 1);  // Credentials in the URL are not supported
+  }
+
+  int colon = authority.indexOf(':');
+  if (colon >= 0) {
+    host = authority.substring(0, colon);
+    port = authority.substring(colon + 1).toInt();
+  } else {
+    host = authority;
+    port = secure ? 443 : 80;
+  }
+  if (host.isEmpty() || port == 0) {
+    return false;
+  }
+
+  requestHead.reserve(256);
+  requestHead = method + " " + path + " HTTP/1.1\r\n";
+  requestHead += "Host: " + authority + "\r\n";
+  requestHead += "Connection: keep-alive\r\n";
+  requestHead += "User-Agent: ESP32-MGATE\r\n";
+  for (JsonPairConst header : headers) {
+    const char* key = header.key().c_str();
+    if (strcasecmp(key, "Content-Type") == 0 || strcasecmp(key, "Content-Length") == 0 ||
+        strcasecmp(key, "Host") == 0 || strcasecmp(key, "Connection") == 0 ||
+        strcasecmp(key, "Transfer-Encoding") == 0) {
+      continue;
+    }
+    requestHead += String(key) + ": " + header.value().as<String>() + "\r\n";
+  }
+  return true;
+}
+
+void HttpSession::close() {
+  if (transport) {
+    transport->stop();
+    transport = nullptr;
+  }
+  keepOpen = false;
+}
+
+bool HttpSession::ensureConnected(const String& networkMode, bool* reused) {
+  Client* wanted = nullptr;
+  if (secure) {
+    if (!secureClient) {
+      secureClient = new WiFiClientSecure();
+      secureClient->setInsecure();  // Same as HTTPClient without a CA certificate
+    }
+    wanted = secureClient;
+  } else if (networkMode == "WIFI") {
+    if (!wifiClient) {
+      wifiClient = new WiFiClient();
+    }
+    wanted = wifiClient;
+  } else if (networkMode == "ETH") {
+    if (!ethernetClient) {
+      ethernetClient = new EthernetClient();
+    }
+    wanted = ethernetClient;
+  }
+  if (!wanted) {
+    return false;
+  }
+
+  if (transport == wanted && keepOpen && transport->connected()) {
+    *reused = true;
+    return true;
+  }
+
+  // Network failover or server-side close: start a fresh connection
+  close();
+  *reused = false;
+  if (!wanted->connect(host.c_str(), port)) {
+    return false;
+  }
+  transport = wanted;
+  keepOpen = true;
+  connectCount++;
+  return true;
+}
+
+bool HttpSession::readLine(String& line, unsigned long deadline) {
+  line = "";
+  while ((long)(millis() - deadline) < 0) {
+    if (!transport->available()) {
+      if (!transport->connected()) {
+        return false;
+      }
+      vTaskDelay(pdMS_TO_TICKS(1));
+      continue;
+    }
+    int c = transport->read();
+    if (c == '\n') {
+      if (line.endsWith("\r")) {
+        line.remove(line.length() - 1);
+      }
+      return true;
+    }
+    if (line.length() < 1024) {
+      line += (char)c;
+    }
+  }
+  return false;
+}
+
+bool HttpSession::readBytes(uint8_t* out, size_t len, unsigned long deadline) {
+  size_t got = 0;
+  while (got < len) {
+    if ((long)(millis() - deadline) >= 0) {
+      return false;
+    }
+    int avail = transport->available();
+    if (avail <= 0) {
+      if (!transport->connected()) {
+        return false;
+      }
+      vTaskDelay(pdMS_TO_TICKS(1));
+      continue;
+    }
+    int n = transport->read(out + got, min((size_t)avail, len - got));
+    if (n > 0) {
+      got += n;
+    }
+  }
+  return true;
+}
+
+bool HttpSession::drainBody(long contentLength, bool chunked, unsigned long deadline) {
+  uint8_t scratch[128];
+
+  auto consume = [&](size_t len) {
+    while (len > 0) {
+      size_t n = min(len, sizeof(scratch));
+      if (!readBytes(scratch, n, deadline)) {
+        return false;
+      }
+      size_t room = HTTP_SESSION_RESPONSE_PREVIEW - responsePreview.length();
+      if (room > 0) {
+        responsePreview.concat((const char*)scratch, min(n, room));
+      }
+      len -= n;
+    }
+    return true;
+  };
+
+  if (chunked) {
+    String line;
+    while (true) {
+      if (!readLine(line, deadline)) return false;
+      long chunkSize = strtol(line.c_str(), nullptr, 16);
+      if (chunkSize <= 0) {
+        // Skip trailers up to the terminating blank line
+        do {
+          if (!readLine(line, deadline)) return false;
+        } while (line.length() > 0);
+        return true;
+      }
+      if (!consume(chunkSize)) return false;
+      if (!readLine(line, deadline)) return false;  // CRLF after chunk data
+    }
+  }
+
+  if (contentLength >= 0) {
+    return consume(contentLength);
+  }
+
+  // No length: the body ends when the server closes the connection
+  keepOpen = false;
+  while (transport->connected() || transport->available()) {
+    if ((long)(millis() - deadline) >= 0) return false;
+    int avail = transport->available();
+    if (avail <= 0) {
+      vTaskDelay(pdMS_TO_TICKS(1));
+      continue;
+    }
+    if (!consume(min((size_t)avail, sizeof(scratch)))) return false;
+  }
+  return true;
+}
+
+int HttpSession::readResponse() {
+  unsigned long deadline = millis() + timeoutMs;
+
+  String line;
+  int status;
+  do {
+    if (!readLine(line, deadline)) {
+      return HTTP_SESSION_ERROR_TIMEOUT;
+    }
+    if (!line.startsWith("HTTP/1.")) {
+      return HTTP_SESSION_ERROR_PROTOCOL;
+    }
+    status = line.substring(9, 12).toInt();
+    statusReceived = true;
+    bool http10 = line.startsWith("HTTP/1.0");
+
+    long contentLength = -1;
+    bool chunked = false;
+    keepOpen = !http10;
+    while (true) {
+      if (!readLine(line, deadline)) {
+        return HTTP_SESSION_ERROR_TIMEOUT;
+      }
+      if (line.length() == 0) {
+        break;
+      }
+      int sep = line.indexOf(':');
+      if (sep <= 0) continue;
+      String name = line.substring(0, sep);
+      String value = line.substring(sep + 1);
+      value.trim();
+      if (name.equalsIgnoreCase("Content-Length")) {
+        contentLength = value.toInt();
+      } else if (name.equalsIgnoreCase("Transfer-Encoding")) {
+        chunked = value.equalsIgnoreCase("chunked");
+      } else if (name.equalsIgnoreCase("Connection")) {
+        keepOpen = value.equalsIgnoreCase("keep-alive") || (!http10 && !value.equalsIgnoreCase("close"));
+      }
+    }
+
+    // 1xx interim responses have no body
+    if (status >= 200 && status != 204 && status != 304) {
+      if (!drainBody(contentLength, chunked, deadline)) {
+        return HTTP_SESSION_ERROR_TIMEOUT;
+      }
+    }
+  } while (status >= 100 && status < 200);
+
+  return status;
+}
+
+bool HttpSession::writeHead(const char* contentType, const char* contentEncoding, const char* lengthHeader) {
+  char tail[192];
+  int tailLen = snprintf(tail, sizeof(tail), "Content-Type: %s\r\n%s%s%s%s\r\n\r\n",
+                         contentType,
+                         contentEncoding ? "Content-Encoding: " : "",
+                         contentEncoding ? contentEncoding : "",
+                         contentEncoding ? "\r\n" : "",
+                         lengthHeader);
+
+  return transport->write((const uint8_t*)requestHead.c_str(), requestHead.length()) == requestHead.length() &&
+         transport->write((const uint8_t*)tail, tailLen) == (size_t)tailLen;
+}
+
+int HttpSession::sendOnce(const String& networkMode, const uint8_t* body, size_t length,
+                          const char* contentType, const char* contentEncoding, bool* reused) {
+  responsePreview = "";
+  statusReceived = false;
+  if (!ensureConnected(networkMode, reused)) {
+    return HTTP_SESSION_ERROR_CONNECT;
+  }
+
+  char lengthHeader[32];
+  snprintf(lengthHeader, sizeof(lengthHeader), "Content-Length: %u", (unsigned)length);
+  if (!writeHead(contentType, contentEncoding, lengthHeader)) {
+    return HTTP_SESSION_ERROR_SEND;
+  }
+
+  size_t written = 0;
+  while (written < length) {
+    size_t n = transport->write(body + written, length - written);
+    if (n == 0) {
+      return HTTP_SESSION_ERROR_SEND;
+    }
+    written += n;
+  }
+
+  return readResponse();
+}
+
+void HttpSession::finishRequest(int result, bool reused) {
+  if (result < 0 || !keepOpen) {
+    close();
+  }
+
+  requestCount++;
+  if (reused) {
+    reusedCount++;
+  }
+}
+
+int HttpSession::send(const String& networkMode, const uint8_t* body, size_t length, const char* contentType,
+                      const char* contentEncoding) {
+  if (!isConfigured()) {
+    return HTTP_SESSION_ERROR_CONFIG;
+  }
+
+  bool reused = false;
+  int result = sendOnce(networkMode, body, length, contentType, contentEncoding, &reused);
+
+  // An idle keep-alive connection may have been closed by the server just
+  // before we wrote; retry once on a fresh connection in that case
+  if (result < 0 && reused && !statusReceived) {
+    close();
+    result = sendOnce(networkMode, body, length, contentType, contentEncoding, &reused);
+  }
+
+  finishRequest(result, reused);
+  return result;
+}
+
+HttpChunkedBody* HttpSession::beginChunked(const String& networkMode, const char* contentType, const char* contentEncoding) {
+  if (!isConfigured()) {
+    return nullptr;
+  }
+
+  responsePreview = "";
+  statusReceived = false;
+  chunkedReused = false;
+  if (!ensureConnected(networkMode, &chunkedReused) ||
+      !writeHead(contentType, contentEncoding, "Transfer-Encoding: chunked")) {
+    finishRequest(HTTP_SESSION_ERROR_SEND, chunkedReused);
+    return nullptr;
+  }
+
+  chunkedBody.begin(transport);
+  chunkedActive = true;
+  return &chunkedBody;
+}
+
+int HttpSession::finishChunked() {
+  if (!chunkedActive) {
+    return HTTP_SESSION_ERROR_CONFIG;
+  }
+  chunkedActive = false;
+
+  // The body was consumed while streaming, so a stale connection cannot be
+  // retried here; the caller keeps the samples and sends them again later
+  int result = chunkedBody.finish() ? readResponse() : HTTP_SESSION_ERROR_SEND;
+  finishRequest(result, chunkedReused);
+  return result;
+}
+
+void HttpSession::abortChunked() {
+  if (chunkedActive) {
+    chunkedActive = false;
+    finishRequest(HTTP_SESSION_ERROR_SEND, chunkedReused);
+  }
+}
+
+void HttpChunkedBody::begin(Client* client) {
+  out = client;
+  used = 0;
+  error = false;
+  total = 0;
+}
+
+bool HttpChunkedBody::writeChunk() {
+  if (used == 0 || error) {
+    return !error;
+  }
+
+  char sizeLine[12];
+  int sizeLen = snprintf(sizeLine, sizeof(sizeLine), "%X\r\n", (unsigned)used);
+  bool ok = out->write((const uint8_t*)sizeLine, sizeLen) == (size_t)sizeLen;
+
+  size_t written = 0;
+  while (ok && written < used) {
+    size_t n = out->write(buffer + written, used - written);
+    ok = n > 0;
+    written += n;
+  }
+  ok = ok && out->write((const uint8_t*)"\r\n", 2) == 2;
+
+  total += used;
+  used = 0;
+  error = !ok;
+  return ok;
+}
+
+size_t HttpChunkedBody::write(uint8_t byte) {
+  return write(&byte, 1);
+}
+
+size_t HttpChunkedBody::write(const uint8_t* data, size_t size) {
+  if (error || !out) {
+    return 0;
+  }
+  size_t remaining = size;
+  while (remaining > 0) {
+    size_t n = min(remaining, sizeof(buffer) - used);
+    memcpy(buffer + used, data, n);
+    used += n;
+    data += n;
+    remaining -= n;
+    if (used == sizeof(buffer) && !writeChunk()) {
+      return 0;
+    }
+  }
+  return size;
+}
+
+bool HttpChunkedBody::finish() {
+  if (!out || !writeChunk()) {
+    return false;
+  }
+  error = out->write((const uint8_t*)"0\r\n\r\n", 5) != 5;
+  return !error;
+}
+
+const char* HttpSession::errorToString(int error) {
+  switch (error) {
+    case HTTP_SESSION_ERROR_CONNECT: return "connection failed";
+    case HTTP_SESSION_ERROR_SEND: return "send failed";
+    case HTTP_SESSION_ERROR_TIMEOUT: return "read timeout";
+    case HTTP_SESSION_ERROR_PROTOCOL: return "invalid response";
+    case HTTP_SESSION_ERROR_CONFIG: return "endpoint not configured";
+    default: return "unknown error";
+  }
+}
@@ -0,0 +1,124 @@
+#ifndef HTTP_SESSION_H
+#define HTTP_SESSION_H
+
+#include <Arduino.h>
+#include <Client.h>
+#include <WiFiClient.h>
+#include <WiFiClientSecure.h>
+#include <Ethernet.h>
+#include <ArduinoJson.h>
+
+// Negative results from send()
+#define HTTP_SESSION_ERROR_CONNECT -1
+#define HTTP_SESSION_ERROR_SEND -2
+#define HTTP_SESSION_ERROR_TIMEOUT -3
+#define HTTP_SESSION_ERROR_PROTOCOL -4
+#define HTTP_SESSION_ERROR_CONFIG -5
+
+#define HTTP_SESSION_RESPONSE_PREVIEW 256
+#define HTTP_SESSION_CHUNK_SIZE 1024
+
+// Request body sink for Transfer-Encoding: chunked. Bytes are staged in a
+// fixed buffer and written to the socket one chunk at a time, so memory use
+// does not depend on the body size. After a socket error further writes are
+// discarded and failed() reports it.
+class HttpChunkedBody : public Print {
+private:
+  Client* out;
+  uint8_t buffer[HTTP_SESSION_CHUNK_SIZE];
+  size_t used;
+  bool error;
+  uint32_t total;
+
+  bool writeChunk();
+
+public:
+  HttpChunkedBody() : out(nullptr), used(0), error(false), total(0) {}
+
+  void begin(Client* client);
+  // Writes the last data chunk and the zero-length terminator
+  bool finish();
+  bool failed() const { return error; }
+  uint32_t bytesWritten() const { return total; }
+
+  size_t write(uint8_t byte) override;
+  size_t write(const uint8_t* data, size_t size) override;
+};
+
+// Minimal HTTP/1.1 client that keeps one connection open across requests.
+// The URL and static headers are parsed once by configure(); each request
+// only appends Content-Type and Content-Length (or chunked framing).
+// The session owns its sockets: a WiFiClient or EthernetClient for plain
+// http, picked by the network manager's active mode, and a WiFiClientSecure
+// for https, so the connection survives between requests and never shares
+// a socket with MQTT.
+class HttpSession {
+private:
+  Client* transport;
+  WiFiClientSecure* secureClient;
+  WiFiClient* wifiClient;
+  EthernetClient* ethernetClient;
+  bool secure;
+  String host;
+  uint16_t port;
+  String requestHead;  // Request line, Host and configured headers
+  uint32_t timeoutMs;
+  bool keepOpen;
+  bool statusReceived;
+
+  HttpChunkedBody chunkedBody;
+  bool chunkedActive;
+  bool chunkedReused;
+
+  String responsePreview;
+  uint32_t requestCount;
+  uint32_t reusedCount;
+  uint32_t connectCount;
+
+  bool ensureConnected(const String& networkMode, bool* reused);
+  bool writeHead(const char* contentType, const char* contentEncoding, const char* lengthHeader);
+  void finishRequest(int result, bool reused);
+  bool readLine(String& line, unsigned long deadline);
+  bool readBytes(uint8_t* out, size_t len, unsigned long deadline);
+  int readResponse();
+  bool drainBody(long contentLength, bool chunked, unsigned long deadline);
+  int sendOnce(const String& networkMode, const uint8_t* body, size_t length, const char* contentType,
+               const char* contentEncoding, bool* reused);
+
+public:
+  HttpSession();
+  ~HttpSession();
+
+  // Returns false if the URL cannot be parsed. Content-Type, Host,
+  // Connection, Content-Length and Transfer-Encoding entries in headers
+  // are ignored.
+  bool configure(const String& url, const String& method, JsonObjectConst headers);
+  void setTimeout(uint32_t ms) { timeoutMs = ms; }
+  bool isSecure() const { return secure; }
+  bool isConfigured() const { return requestHead.length() > 0; }
+
+  // Sends one request and reads the full response. Returns the HTTP status
+  // code or a negative HTTP_SESSION_ERROR_*. networkMode ("WIFI" or "ETH")
+  // picks the interface for plain http and is ignored for https.
+  // contentEncoding (e.g. "gzip") adds a Content-Encoding header when set.
+  int send(const String& networkMode, const uint8_t* body, size_t length, const char* contentType,
+           const char* contentEncoding = nullptr);
+  void close();
+
+  // Streaming upload: beginChunked() sends the request head and returns the
+  // body sink (nullptr if the connection failed). Write the body into it,
+  // then finishChunked() returns the status like send(). abortChunked()
+  // drops the connection without completing the request.
+  HttpChunkedBody* beginChunked(const String& networkMode, const char* contentType, const char* contentEncoding = nullptr);
+  int finishChunked();
+  void abortChunked();
+
+  const String& getResponsePreview() const { return responsePreview; }
+  uint32_t getRequestCount() const { return requestCount; }
+  uint32_t getReusedCount() const { return reusedCount; }
+  uint32_t getConnectCount() const { return connectCount; }
+
+  static const char* errorToString(int error);
+};
+
+#endif
@@ -4,6 +4,7 @@
 #include <memory>
 #include <esp_heap_caps.h>
 #include <new>  // Required for placement new
+#include <ArduinoJson.h>
 
 /*
  * @brief Custom deleter for std::unique_ptr to free PSRAM memory.
@@ -68,4 +69,70 @@ PsramUniquePtr<T> make_psram_unique(Args&&... args) {
   return PsramUniquePtr<T>(new (mem) T(std::forward<Args>(args)...));
 }
 
+/*
+ * @brief ArduinoJson allocator that places a JsonDocument's pool in PSRAM.
+ *
+ * A JsonDocument built on it grows as needed instead of having a fixed
+ * capacity, and falls back to internal RAM when PSRAM is exhausted:
+ *
+ *   JsonDocument doc(PsramAllocator::instance());
+ */
+class PsramAllocator : public ArduinoJson::Allocator {
+public:
+  void* allocate(size_t size) override {
+    void* ptr = heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return ptr ? ptr : heap_caps_malloc(size, MALLOC_CAP_8BIT);
+  }
+
+  void deallocate(void* ptr) override {
+    heap_caps_free(ptr);
+  }
+
+  void* reallocate(void* ptr, size_t newSize) override {
+    void* grown = heap_caps_realloc(ptr, newSize, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return grown ? grown : heap_caps_realloc(ptr, newSize, MALLOC_CAP_8BIT);
+  }
+
+  static PsramAllocator* instance() {
+    static PsramAllocator allocator;
+    return &allocator;
+  }
+};
+
+/*
+ * @brief STL allocator that places container storage in PSRAM.
+ *
+ * Falls back to operator new when PSRAM is exhausted. On ESP-IDF operator
+ * new is malloc based, so heap_caps_free releases either kind of block:
+ *
+ *   std::vector<int, PsramStlAllocator<int>> values;
+ */
+template<typename T>
+struct PsramStlAllocator {
+  typedef T value_type;
+
+  PsramStlAllocator() noexcept {}
+  template<typename U>
+  PsramStlAllocator(const PsramStlAllocator<U>&) noexcept {}
+
+  T* allocate(size_t count) {
+    void* ptr = heap_caps_malloc(count * sizeof(T), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    return static_cast<T*>(ptr ? ptr : ::operator new(count * sizeof(T)));
+  }
+
+  void deallocate(T* ptr, size_t) noexcept {
+    heap_caps_free(ptr);
+  }
+};
+
+template<typename T, typename U>
+bool operator==(const PsramStlAllocator<T>&, const PsramStlAllocator<U>&) {
+  return true;
+}
+
+template<typename T, typename U>
+bool operator!=(const PsramStlAllocator<T>&, const PsramStlAllocator<U>&) {
+  return false;
+}
+
 #endif  // MEMORY_MANAGER_H
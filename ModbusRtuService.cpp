@@ -1,13 +1,12 @@
 #include "ModbusRtuService.h"
 #include "QueueManager.h"
-#include "CRUDHandler.h"
+#include "StreamSubscriptions.h"
 #include "RTCManager.h"
 #include <byteswap.h>
 
-extern CRUDHandler* crudHandler;
 
 ModbusRtuService::ModbusRtuService(ConfigManager* config)
-  : configManager(config), running(false), rtuTaskHandle(nullptr),
+  : configManager(config), running(false), rtuTaskHandle(nullptr), changeQueue(nullptr), firstSampleLogged(false),
     serial1(nullptr), serial2(nullptr), modbus1(nullptr), modbus2(nullptr) {}
 
 bool ModbusRtuService::init() {
@@ -33,6 +32,16 @@ bool ModbusRtuService::init() {
   modbus2 = new ModbusMaster();
   modbus2->begin(1, *serial2);
 
+  // Config edits arrive as change events and patch the poll plan
+  if (!changeQueue) {
+    changeQueue = xQueueCreate(CONFIG_CHANGE_QUEUE_LENGTH, sizeof(ConfigChange));
+    if (!changeQueue) {
+      Serial.println("Failed to create config change queue");
+      return false;
+    }
+    configManager->addChangeListener(changeQueue);
+  }
+
   Serial.println("Modbus RTU service initialized successfully");
   return true;
 }
@@ -84,144 +93,133 @@ void ModbusRtuService::readRtuDevicesTask(void* parameter) {
   service->readRtuDevicesLoop();
 }
 
-void ModbusRtuService::refreshDeviceList() {
-  Serial.println("[RTU Task] Refreshing device list and schedule...");
-  rtuDevices.clear();
+int ModbusRtuService::findDevice(const String& deviceId) const {
+  for (size_t i = 0; i < rtuDevices.size(); i++) {
+    if (rtuDevices[i].deviceId == deviceId) return i;
+  }
+  return -1;
+}
 
-  // Clear the priority queue
-  std::priority_queue<PollingTask, std::vector<PollingTask>, std::greater<PollingTask>> emptyQueue;
-  pollingQueue.swap(emptyQueue);
+// Re-reads one device into the plan. It is added if it is an RTU device,
+// dropped if it no longer is, and keeps its place in the schedule
+// otherwise. A new device is due at once.
+void ModbusRtuService::reloadDevice(const String& deviceId) {
+  int index = findDevice(deviceId);
+  JsonDocument deviceDoc(PsramAllocator::instance());
+  JsonObject deviceObj = deviceDoc.to<JsonObject>();
+  bool isRtu = configManager->readDevice(deviceId, deviceObj) && strcmp(deviceObj["protocol"] | "", "RTU") == 0;
+
+  if (!isRtu) {
+    if (index >= 0) {
+      rtuDevices.erase(rtuDevices.begin() + index);
+      Serial.printf("[RTU Task] Device %s removed from schedule\n", deviceId.c_str());
+    }
+    return;
+  }
 
-  // --- PERUBAHAN DI SINI ---
-  StaticJsonDocument<2048> devicesIdList; // Ganti JsonDocument(2048)
-  // --- AKHIR PERUBAHAN ---
+  uint32_t refreshRate = deviceObj["refresh_rate_ms"] | 5000;
+  if (index < 0) {
+    RtuDeviceConfig newDeviceEntry;
+    newDeviceEntry.deviceId = deviceId;
+    newDeviceEntry.lastRead = millis() - refreshRate;
+    rtuDevices.push_back(std::move(newDeviceEntry));
+    index = rtuDevices.size() - 1;
+  }
+  rtuDevices[index].doc = std::move(deviceDoc);
+  rtuDevices[index].refreshRateMs = refreshRate;
+}
+
+// Full resync: drops devices that are gone and reloads the rest, keeping
+// the schedule of every device still present
+void ModbusRtuService::refreshDeviceList() {
+  Serial.println("[RTU Task] Resyncing device list and schedule...");
+
+  JsonDocument devicesIdList(PsramAllocator::instance());
   JsonArray deviceIds = devicesIdList.to<JsonArray>();
   configManager->listDevices(deviceIds);
 
-  unsigned long now = millis();
+  for (int i = (int)rtuDevices.size() - 1; i >= 0; i--) {
+    bool listed = false;
+    for (JsonVariant deviceIdVar : deviceIds) {
+      if (rtuDevices[i].deviceId == deviceIdVar.as<const char*>()) {
+        listed = true;
+        break;
+      }
+    }
+    if (!listed) {
+      rtuDevices.erase(rtuDevices.begin() + i);
+    }
+  }
 
   for (JsonVariant deviceIdVar : deviceIds) {
     String deviceId = deviceIdVar.as<String>();
     if (deviceId.isEmpty() || deviceId == "{}" || deviceId.length() < 3) {
       continue;
     }
+    reloadDevice(deviceId);
+  }
+  Serial.printf("[RTU Task] Found %d RTU devices. Schedule rebuilt.\n", rtuDevices.size());
+}
 
-    // --- PERUBAHAN DI SINI ---
-    StaticJsonDocument<2048> tempDeviceDoc; // Ganti JsonDocument(2048)
-    // --- AKHIR PERUBAHAN ---
-    JsonObject deviceObj = tempDeviceDoc.to<JsonObject>();
-    if (configManager->readDevice(deviceId, deviceObj)) {
-      String protocol = deviceObj["protocol"] | "";
-      if (protocol == "RTU") {
-        RtuDeviceConfig newDeviceEntry;
-        newDeviceEntry.deviceId = deviceId;
-        newDeviceEntry.doc.set(deviceObj); // doc sekarang adalah StaticJsonDocument
-        rtuDevices.push_back(std::move(newDeviceEntry));
-
-        // Add device to the polling schedule for an immediate first poll
-        pollingQueue.push({ deviceId, now });
-      }
+// Drains the change queue. A resync reads the current config, so it makes
+// every event queued with it redundant.
+void ModbusRtuService::applyConfigChanges() {
+  if (!changeQueue) return;
+
+  ConfigChange change;
+  bool resync = false;
+  while (xQueueReceive(changeQueue, &change, 0) == pdTRUE) {
+    if (resync) continue;
+    switch (change.type) {
+      case CONFIG_RESYNC:
+        resync = true;
+        break;
+      case CONFIG_DEVICE_REMOVED:
+        {
+          int index = findDevice(change.deviceId);
+          if (index >= 0) {
+            rtuDevices.erase(rtuDevices.begin() + index);
+            Serial.printf("[RTU Task] Device %s removed from schedule\n", change.deviceId);
+          }
+          break;
+        }
+      default:
+        // Register events carry their device; the device is re-read whole
+        reloadDevice(change.deviceId);
+        break;
     }
   }
-  Serial.printf("[RTU Task] Found %d RTU devices. Schedule rebuilt.\n", rtuDevices.size());
+  if (resync) {
+    refreshDeviceList();
+  }
 }
 
 void ModbusRtuService::readRtuDevicesLoop() {
-
-  DeviceTimer deviceTimers[10];
-
-  int timerCount = 0;
-
-
+  refreshDeviceList();
 
   while (running) {
+    applyConfigChanges();
 
-    // --- PERUBAHAN DI SINI ---
-    StaticJsonDocument<2048> devicesDoc; // Ganti JsonDocument(2048)
-    // --- AKHIR PERUBAHAN ---
-    JsonArray devices = devicesDoc.to<JsonArray>();
-    configManager->listDevices(devices);
-
-
-
-    unsigned long currentTime = millis();
-
-
-
-    for (JsonVariant deviceVar : devices) {
-
+    for (RtuDeviceConfig& entry : rtuDevices) {
       if (!running) break;
 
-
-
-      String deviceId = deviceVar.as<String>();
-
-
-
-      if (deviceId.isEmpty() || deviceId == "{}" || deviceId.length() < 3) {
-
-        continue;
-      }
-
-
-      // --- PERUBAHAN DI SINI ---
-      StaticJsonDocument<2048> deviceDoc; // Ganti JsonDocument(2048)
-      // --- AKHIR PERUBAHAN ---
-      JsonObject deviceObj = deviceDoc.to<JsonObject>();
-
-      if (configManager->readDevice(deviceId, deviceObj)) {
-
-        String protocol = deviceObj["protocol"] | "";
-
-
-
-        if (protocol == "RTU") {
-
-          int refreshRate = deviceObj["refresh_rate_ms"] | 5000;
-
-
-
-          int timerIndex = -1;
-
-          for (int i = 0; i < timerCount; i++) {
-
-            if (deviceTimers[i].deviceId == deviceId) {
-
-              timerIndex = i;
-
-              break;
-            }
-          }
-
-
-
-          if (timerIndex == -1 && timerCount < 10) {
-
-            timerIndex = timerCount++;
-
-            deviceTimers[timerIndex].deviceId = deviceId;
-
-            deviceTimers[timerIndex].lastRead = 0;
-          }
-
-
-
-          if (timerIndex >= 0) {
-
-            if (currentTime - deviceTimers[timerIndex].lastRead >= refreshRate) {
-
-              readRtuDeviceData(deviceObj);
-
-              deviceTimers[timerIndex].lastRead = currentTime;
-            }
-          }
-        }
+      unsigned long currentTime = millis();
+      if (currentTime - entry.lastRead >= entry.refreshRateMs) {
+        readRtuDeviceData(entry.doc.as<JsonObject>());
+        entry.lastRead = currentTime;
       }
     }
 
-
-
-    vTaskDelay(pdMS_TO_TICKS(2000));
+    // Sleep until the next device is due. notifyConfigChange() wakes the
+    // task early so edits are picked up at once.
+    uint32_t waitMs = RTU_IDLE_WAIT_MS;
+    unsigned long now = millis();
+    for (const RtuDeviceConfig& entry : rtuDevices) {
+      uint32_t elapsed = now - entry.lastRead;
+      uint32_t remaining = elapsed >= entry.refreshRateMs ? 0 : entry.refreshRateMs - elapsed;
+      if (remaining < waitMs) waitMs = remaining;
+    }
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs));
   }
 }
 
@@ -332,6 +330,11 @@ double ModbusRtuService::processRegisterValue(const JsonObject& reg, uint16_t ra
 }
 
 void ModbusRtuService::storeRegisterValue(const String& deviceId, const JsonObject& reg, double value) {
+  if (!firstSampleLogged) {
+    firstSampleLogged = true;
+    Serial.printf("[RTU] First sample %lu ms after boot\n", millis());
+  }
+
   QueueManager* queueMgr = QueueManager::getInstance();
 
   // Create data point in required format
@@ -359,30 +362,8 @@ void ModbusRtuService::storeRegisterValue(const String& deviceId, const JsonObje
     queueMgr->enqueue(dataPoint);
   }
 
-  // Check if this device is being streamed
-  String streamId = "";
-  bool crudHandlerAvailable = (crudHandler != nullptr);
-
-  if (crudHandler) {
-    streamId = crudHandler->getStreamDeviceId(); // Ini harusnya fungsi thread-safe
-  }
-  
-  // Komentari log spam
-  // Serial.printf("RTU: Device %s, CRUDHandler: %s, StreamID '%s', Match: %s\n",
-  //               deviceId.c_str(),
-  //               crudHandlerAvailable ? "OK" : "NULL",
-  //               streamId.c_str(),
-  //               (streamId == deviceId) ? "YES" : "NO");
-
-  if (!streamId.isEmpty() && streamId == deviceId && queueMgr) {
-    Serial.printf("[RTU] Streaming data for device %s to BLE\n", deviceId.c_str());
-    queueMgr->enqueueStream(dataPoint);
-  } 
-  // else if (!streamId.isEmpty() && streamId != deviceId) {
-  //   Serial.printf("[RTU] Device %s not streaming (StreamID: %s)\n", deviceId.c_str(), streamId.c_str());
-  // } else if (streamId.isEmpty()) {
-  //   Serial.printf("[RTU] No streaming active (StreamID empty)\n");
-  // }
+  // Forward to BLE if a client subscribed to this device or register
+  StreamSubscriptions::getInstance()->offer(deviceId.c_str(), dataPoint["register_id"] | "", dataPoint);
 }
 
 bool ModbusRtuService::readMultipleRegisters(ModbusMaster* modbus, uint8_t functionCode, uint16_t address, int count, uint16_t* values) {
@@ -483,6 +464,10 @@ void ModbusRtuService::getStatus(JsonObject& status) {
 
 ModbusRtuService::~ModbusRtuService() {
   stop();
+  if (changeQueue) {
+    configManager->removeChangeListener(changeQueue);
+    vQueueDelete(changeQueue);
+  }
   if (serial1) {
     delete serial1;
   }
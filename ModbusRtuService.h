@@ -7,8 +7,10 @@
 #include <freertos/task.h>
 #include <ModbusMaster.h>
 #include "ConfigManager.h"
+#include "MemoryManager.h"
 #include <vector>
-#include <queue>  // For std::priority_queue
+
+#define RTU_IDLE_WAIT_MS 2000  // Longest sleep between schedule checks
 
 class ModbusRtuService {
 private:
@@ -16,34 +18,21 @@ private:
   bool running;
   TaskHandle_t rtuTaskHandle;
 
-  // Device timers for refresh rate control
-  struct DeviceTimer {
+  // Poll plan: one entry per RTU device with its config and schedule.
+  // Built once at start and then patched from the ConfigManager change
+  // queue, so a change only re-reads the devices it touches.
+  struct RtuDeviceConfig {
     String deviceId;
+    JsonDocument doc;
+    uint32_t refreshRateMs;
     unsigned long lastRead;
-  };
 
-  struct RtuDeviceConfig {
-    String deviceId;
-    // --- PERUBAHAN DI SINI ---
-    // Ganti 'JsonDocument doc{ 2048 };' menjadi 'StaticJsonDocument<2048> doc;'
-    StaticJsonDocument<2048> doc;
-    // --- AKHIR PERUBAHAN ---
+    RtuDeviceConfig()
+      : doc(PsramAllocator::instance()), refreshRateMs(5000), lastRead(0) {}
   };
   std::vector<RtuDeviceConfig> rtuDevices;
-
-  // --- New Scheduler Structures ---
-  struct PollingTask {
-    String deviceId;
-    unsigned long nextPollTime;
-
-    // Overload > operator for the priority queue (min-heap)
-    bool operator>(const PollingTask& other) const {
-      return nextPollTime > other.nextPollTime;
-    }
-  };
-
-  std::priority_queue<PollingTask, std::vector<PollingTask>, std::greater<PollingTask>> pollingQueue;
-  // --------------------------------
+  QueueHandle_t changeQueue;
+  bool firstSampleLogged;  // Boot-to-first-sample time is logged once
 
   static const int RTU_RX1 = 15;
   static const int RTU_TX1 = 16;
@@ -65,6 +54,9 @@ private:
   ModbusMaster* getModbusForBus(int serialPort);
 
   void refreshDeviceList();
+  void reloadDevice(const String& deviceId);
+  void applyConfigChanges();
+  int findDevice(const String& deviceId) const;
 
 public:
   ModbusRtuService(ConfigManager* config);
@@ -1,15 +1,14 @@
 #include "ModbusTcpService.h"
 #include "QueueManager.h"
-#include "CRUDHandler.h"
+#include "StreamSubscriptions.h"
 #include "RTCManager.h"
 #include <byteswap.h>
 
-extern CRUDHandler* crudHandler;
 
 uint16_t ModbusTcpService::transactionCounter = 1;
 
 ModbusTcpService::ModbusTcpService(ConfigManager* config, EthernetManager* ethernet)
-  : configManager(config), ethernetManager(ethernet), running(false), tcpTaskHandle(nullptr) {}
+  : configManager(config), ethernetManager(ethernet), running(false), tcpTaskHandle(nullptr), changeQueue(nullptr), firstSampleLogged(false) {}
 
 bool ModbusTcpService::init() {
   Serial.println("Initializing custom Modbus TCP service...");
@@ -24,6 +23,16 @@ bool ModbusTcpService::init() {
     return false;
   }
 
+  // Config edits arrive as change events and patch the poll plan
+  if (!changeQueue) {
+    changeQueue = xQueueCreate(CONFIG_CHANGE_QUEUE_LENGTH, sizeof(ConfigChange));
+    if (!changeQueue) {
+      Serial.println("Failed to create config change queue");
+      return false;
+    }
+    configManager->addChangeListener(changeQueue);
+  }
+
   Serial.printf("Ethernet available: %s\n", ethernetManager->isAvailable() ? "YES" : "NO");
   Serial.println("Custom Modbus TCP service initialized successfully");
   return true;
@@ -72,162 +81,144 @@ void ModbusTcpService::notifyConfigChange() {
   }
 }
 
-void ModbusTcpService::refreshDeviceList() {
-  Serial.println("[TCP Task] Refreshing device list and schedule...");
-  tcpDevices.clear();
+void ModbusTcpService::readTcpDevicesTask(void* parameter) {
+  ModbusTcpService* service = static_cast<ModbusTcpService*>(parameter);
+  service->readTcpDevicesLoop();
+}
 
-  // Clear the priority queue
-  std::priority_queue<PollingTask, std::vector<PollingTask>, std::greater<PollingTask>> emptyQueue;
-  pollingQueue.swap(emptyQueue);
+int ModbusTcpService::findDevice(const String& deviceId) const {
+  for (size_t i = 0; i < tcpDevices.size(); i++) {
+    if (tcpDevices[i].deviceId == deviceId) return i;
+  }
+  return -1;
+}
 
-  // --- PERUBAHAN DI SINI ---
-  StaticJsonDocument<2048> devicesIdList; // Ganti JsonDocument(2048)
-  // --- AKHIR PERUBAHAN ---
+// Re-reads one device into the plan. It is added if it is a TCP device,
+// dropped if it no longer is, and keeps its place in the schedule
+// otherwise. A new device is due at once.
+void ModbusTcpService::reloadDevice(const String& deviceId) {
+  int index = findDevice(deviceId);
+  JsonDocument deviceDoc(PsramAllocator::instance());
+  JsonObject deviceObj = deviceDoc.to<JsonObject>();
+  bool isTcp = configManager->readDevice(deviceId, deviceObj) && strcmp(deviceObj["protocol"] | "", "TCP") == 0;
+
+  if (!isTcp) {
+    if (index >= 0) {
+      tcpDevices.erase(tcpDevices.begin() + index);
+      Serial.printf("[TCP Task] Device %s removed from schedule\n", deviceId.c_str());
+    }
+    return;
+  }
+
+  uint32_t refreshRate = deviceObj["refresh_rate_ms"] | 5000;
+  if (index < 0) {
+    TcpDeviceConfig newDeviceEntry;
+    newDeviceEntry.deviceId = deviceId;
+    newDeviceEntry.lastRead = millis() - refreshRate;
+    tcpDevices.push_back(std::move(newDeviceEntry));
+    index = tcpDevices.size() - 1;
+  }
+  tcpDevices[index].doc = std::move(deviceDoc);
+  tcpDevices[index].refreshRateMs = refreshRate;
+}
+
+// Full resync: drops devices that are gone and reloads the rest, keeping
+// the schedule of every device still present
+void ModbusTcpService::refreshDeviceList() {
+  Serial.println("[TCP Task] Resyncing device list and schedule...");
+
+  JsonDocument devicesIdList(PsramAllocator::instance());
   JsonArray deviceIds = devicesIdList.to<JsonArray>();
   configManager->listDevices(deviceIds);
 
-  unsigned long now = millis();
+  for (int i = (int)tcpDevices.size() - 1; i >= 0; i--) {
+    bool listed = false;
+    for (JsonVariant deviceIdVar : deviceIds) {
+      if (tcpDevices[i].deviceId == deviceIdVar.as<const char*>()) {
+        listed = true;
+        break;
+      }
+    }
+    if (!listed) {
+      tcpDevices.erase(tcpDevices.begin() + i);
+    }
+  }
 
   for (JsonVariant deviceIdVar : deviceIds) {
     String deviceId = deviceIdVar.as<String>();
     if (deviceId.isEmpty() || deviceId == "{}" || deviceId.length() < 3) {
       continue;
     }
-
-    // --- PERUBAHAN DI SINI ---
-    StaticJsonDocument<2048> tempDeviceDoc; // Ganti JsonDocument(2048)
-    // --- AKHIR PERUBAHAN ---
-    JsonObject deviceObj = tempDeviceDoc.to<JsonObject>();
-    if (configManager->readDevice(deviceId, deviceObj)) {
-      String protocol = deviceObj["protocol"] | "";
-      if (protocol == "TCP") {
-        TcpDeviceConfig newDeviceEntry;
-        newDeviceEntry.deviceId = deviceId;
-        newDeviceEntry.doc.set(deviceObj); // doc sekarang adalah StaticJsonDocument
-        tcpDevices.push_back(std::move(newDeviceEntry));
-
-        // Add device to the polling schedule for an immediate first poll
-        pollingQueue.push({ deviceId, now });
-      }
-    }
+    reloadDevice(deviceId);
   }
   Serial.printf("[TCP Task] Found %d TCP devices. Schedule rebuilt.\n", tcpDevices.size());
 }
 
-void ModbusTcpService::readTcpDevicesTask(void* parameter) {
-  ModbusTcpService* service = static_cast<ModbusTcpService*>(parameter);
-  service->readTcpDevicesLoop();
+// Drains the change queue. A resync reads the current config, so it makes
+// every event queued with it redundant.
+void ModbusTcpService::applyConfigChanges() {
+  if (!changeQueue) return;
+
+  ConfigChange change;
+  bool resync = false;
+  while (xQueueReceive(changeQueue, &change, 0) == pdTRUE) {
+    if (resync) continue;
+    switch (change.type) {
+      case CONFIG_RESYNC:
+        resync = true;
+        break;
+      case CONFIG_DEVICE_REMOVED:
+        {
+          int index = findDevice(change.deviceId);
+          if (index >= 0) {
+            tcpDevices.erase(tcpDevices.begin() + index);
+            Serial.printf("[TCP Task] Device %s removed from schedule\n", change.deviceId);
+          }
+          break;
+        }
+      default:
+        // Register events carry their device; the device is re-read whole
+        reloadDevice(change.deviceId);
+        break;
+    }
+  }
+  if (resync) {
+    refreshDeviceList();
+  }
 }
 
 void ModbusTcpService::readTcpDevicesLoop() {
-
-  DeviceTimer deviceTimers[10]; // Support up to 10 devices
-
-  int timerCount = 0;
-
-
+  refreshDeviceList();
 
   while (running) {
+    applyConfigChanges();
 
     if (!ethernetManager || !ethernetManager->isAvailable()) {
-
-      vTaskDelay(pdMS_TO_TICKS(5000)); // Wait for network
-
+      vTaskDelay(pdMS_TO_TICKS(5000));  // Wait for network
       continue;
-
     }
 
+    for (TcpDeviceConfig& entry : tcpDevices) {
+      if (!running) break;
 
-    // --- PERUBAHAN DI SINI ---
-    StaticJsonDocument<2048> devicesDoc; // Ganti JsonDocument(2048)
-    // --- AKHIR PERUBAHAN ---
-    JsonArray devices = devicesDoc.to<JsonArray>();
-    configManager->listDevices(devices);
-
-
-
-    unsigned long currentTime = millis();
-
-
-
-    for (JsonVariant deviceVar : devices) {
-
-      if (!running) break; // Exit if stopped
-
-
-
-      String deviceId = deviceVar.as<String>();
-
-
-      // --- PERUBAHAN DI SINI ---
-      StaticJsonDocument<2048> deviceDoc; // Ganti JsonDocument(2048)
-      // --- AKHIR PERUBAHAN ---
-      JsonObject deviceObj = deviceDoc.to<JsonObject>();
-
-      if (configManager->readDevice(deviceId, deviceObj)) {
-
-        String protocol = deviceObj["protocol"] | "";
-
-
-
-        if (protocol == "TCP") {
-
-          int refreshRate = deviceObj["refresh_rate_ms"] | 5000;
-
-
-
-          int timerIndex = -1;
-
-          for (int i = 0; i < timerCount; i++) {
-
-            if (deviceTimers[i].deviceId == deviceId) {
-
-              timerIndex = i;
-
-              break;
-
-            }
-
-          }
-
-
-
-          if (timerIndex == -1 && timerCount < 10) {
-
-            timerIndex = timerCount++;
-
-            deviceTimers[timerIndex].deviceId = deviceId;
-
-            deviceTimers[timerIndex].lastRead = 0;
-
-          }
-
-
-
-          if (timerIndex >= 0) {
-
-            if (currentTime - deviceTimers[timerIndex].lastRead >= refreshRate) {
-
-              readTcpDeviceData(deviceObj);
-
-              deviceTimers[timerIndex].lastRead = currentTime;
-
-            }
-
-          }
-
-        }
-
+      unsigned long currentTime = millis();
+      if (currentTime - entry.lastRead >= entry.refreshRateMs) {
+        readTcpDeviceData(entry.doc.as<JsonObject>());
+        entry.lastRead = currentTime;
       }
-
     }
 
-
-
-    vTaskDelay(pdMS_TO_TICKS(2000));
-
+    // Sleep until the next device is due. notifyConfigChange() wakes the
+    // task early so edits are picked up at once.
+    uint32_t waitMs = TCP_IDLE_WAIT_MS;
+    unsigned long now = millis();
+    for (const TcpDeviceConfig& entry : tcpDevices) {
+      uint32_t elapsed = now - entry.lastRead;
+      uint32_t remaining = elapsed >= entry.refreshRateMs ? 0 : entry.refreshRateMs - elapsed;
+      if (remaining < waitMs) waitMs = remaining;
+    }
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(waitMs));
   }
-
 }
 
 void ModbusTcpService::readTcpDeviceData(const JsonObject& deviceConfig) {
@@ -581,6 +572,11 @@ bool ModbusTcpService::parseModbusResponse(uint8_t* buffer, int length, uint8_t
 }
 
 void ModbusTcpService::storeRegisterValue(const String& deviceId, const JsonObject& reg, double value) {
+  if (!firstSampleLogged) {
+    firstSampleLogged = true;
+    Serial.printf("[TCP] First sample %lu ms after boot\n", millis());
+  }
+
   QueueManager* queueMgr = QueueManager::getInstance();
 
   // Create data point in required format
@@ -608,30 +604,8 @@ void ModbusTcpService::storeRegisterValue(const String& deviceId, const JsonObje
     queueMgr->enqueue(dataPoint);
   }
 
-  // Check if this device is being streamed
-  String streamId = "";
-  bool crudHandlerAvailable = (crudHandler != nullptr);
-
-  if (crudHandler) {
-    streamId = crudHandler->getStreamDeviceId(); // Ini harusnya fungsi thread-safe
-  }
-
-  // Komentari log spam
-  // Serial.printf("TCP: Device %s, CRUDHandler: %s, StreamID '%s', Match: %s\n",
-  //               deviceId.c_str(),
-  //               crudHandlerAvailable ? "OK" : "NULL",
-  //               streamId.c_str(),
-  //               (streamId == deviceId) ? "YES" : "NO");
-
-  if (!streamId.isEmpty() && streamId == deviceId && queueMgr) {
-    Serial.printf("[TCP] Streaming data for device %s to BLE\n", deviceId.c_str());
-    queueMgr->enqueueStream(dataPoint);
-  } 
-  // else if (!streamId.isEmpty() && streamId != deviceId) {
-  //   Serial.printf("[TCP] Device %s not streaming (StreamID: %s)\n", deviceId.c_str(), streamId.c_str());
-  // } else if (streamId.isEmpty()) {
-  //   Serial.printf("[TCP] No streaming active (StreamID empty)\n");
-  // }
+  // Forward to BLE if a client subscribed to this device or register
+  StreamSubscriptions::getInstance()->offer(deviceId.c_str(), dataPoint["register_id"] | "", dataPoint);
 }
 
 void ModbusTcpService::getStatus(JsonObject& status) {
@@ -642,4 +616,8 @@ void ModbusTcpService::getStatus(JsonObject& status) {
 
 ModbusTcpService::~ModbusTcpService() {
   stop();
+  if (changeQueue) {
+    configManager->removeChangeListener(changeQueue);
+    vQueueDelete(changeQueue);
+  }
 }
\ No newline at end of file
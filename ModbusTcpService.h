@@ -6,9 +6,11 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include "ConfigManager.h"
+#include "MemoryManager.h"
 #include "EthernetManager.h"
 #include <vector>
-#include <queue>  // For std::priority_queue
+
+#define TCP_IDLE_WAIT_MS 2000  // Longest sleep between schedule checks
 
 class ModbusTcpService {
 private:
@@ -17,34 +19,21 @@ private:
   bool running;
   TaskHandle_t tcpTaskHandle;
 
-  // Device timers for refresh rate control
-  struct DeviceTimer {
+  // Poll plan: one entry per TCP device with its config and schedule.
+  // Built once at start and then patched from the ConfigManager change
+  // queue, so a change only re-reads the devices it touches.
+  struct TcpDeviceConfig {
     String deviceId;
+    JsonDocument doc;
+    uint32_t refreshRateMs;
     unsigned long lastRead;
-  };
 
-  struct TcpDeviceConfig {
-    String deviceId;
-    // --- PERUBAHAN DI SINI ---
-    // Ganti 'JsonDocument doc{ 2048 };' menjadi 'StaticJsonDocument<2048> doc;'
-    StaticJsonDocument<2048> doc;
-    // --- AKHIR PERUBAHAN ---
+    TcpDeviceConfig()
+      : doc(PsramAllocator::instance()), refreshRateMs(5000), lastRead(0) {}
   };
   std::vector<TcpDeviceConfig> tcpDevices;
-
-  // --- New Scheduler Structures ---
-  struct PollingTask {
-    String deviceId;
-    unsigned long nextPollTime;
-
-    // Overload > operator for the priority queue (min-heap)
-    bool operator>(const PollingTask& other) const {
-      return nextPollTime > other.nextPollTime;
-    }
-  };
-
-  std::priority_queue<PollingTask, std::vector<PollingTask>, std::greater<PollingTask>> pollingQueue;
-  // --------------------------------
+  QueueHandle_t changeQueue;
+  bool firstSampleLogged;  // Boot-to-first-sample time is logged once
 
   static uint16_t transactionCounter;
 
@@ -60,6 +49,9 @@ private:
   bool parseModbusResponse(uint8_t* buffer, int length, uint8_t expectedFunc, uint16_t expectedQty, uint16_t* resultBuffer, bool* boolResult);
 
   void refreshDeviceList();
+  void reloadDevice(const String& deviceId);
+  void applyConfigChanges();
+  int findDevice(const String& deviceId) const;
 
 public:
   ModbusTcpService(ConfigManager* config, EthernetManager* ethernet);
@@ -0,0 +1,515 @@
+#include "MqttClient.h"
+#include <esp_heap_caps.h>
+
+// MQTT control packet types
+#define MQTT_CONNECT 0x10
+#define MQTT_CONNACK 0x20
+#define MQTT_PUBLISH 0x30
+#define MQTT_PUBACK 0x40
+#define MQTT_PINGREQ 0xC0
+#define MQTT_PINGRESP 0xD0
+#define MQTT_DISCONNECT 0xE0
+
+// MQTT 5 property identifiers used here
+#define MQTT_PROP_SESSION_EXPIRY 0x11
+#define MQTT_PROP_RECEIVE_MAXIMUM 0x21
+#define MQTT_PROP_TOPIC_ALIAS_MAXIMUM 0x22
+#define MQTT_PROP_TOPIC_ALIAS 0x23
+
+// Session kept by the broker after a drop when clean_session is false
+#define MQTT_SESSION_EXPIRY_SEC 3600
+
+MqttClient::MqttClient()
+  : client(nullptr), port(1883), keepAliveSec(60), socketTimeoutSec(5), protocolVersion(MQTT_PROTOCOL_V311),
+    connState(MQTT_DISCONNECTED), topicAliasMax(0), receiveMax(65535), publishBytes(0), publishCount(0),
+    willPayload(nullptr), willLength(0), willQos(0), willRetain(false),
+    lastPacketId(0), lastOutbound(0), lastInbound(0), pingOutstanding(false) {}
+
+MqttClient::~MqttClient() {
+  clearWill();
+}
+
+void MqttClient::setClient(Client& networkClient) {
+  client = &networkClient;
+}
+
+void MqttClient::setServer(const char* brokerHost, uint16_t brokerPort) {
+  host = brokerHost;
+  port = brokerPort;
+}
+
+void MqttClient::setKeepAlive(uint16_t seconds) {
+  keepAliveSec = seconds;
+}
+
+void MqttClient::setSocketTimeout(uint16_t seconds) {
+  socketTimeoutSec = seconds;
+}
+
+void MqttClient::setProtocolVersion(uint8_t version) {
+  protocolVersion = (version == MQTT_PROTOCOL_V5) ? MQTT_PROTOCOL_V5 : MQTT_PROTOCOL_V311;
+}
+
+void MqttClient::setWill(const char* topic, const uint8_t* payload, size_t length, uint8_t qos, bool retain) {
+  clearWill();
+  willPayload = (uint8_t*)heap_caps_malloc(length > 0 ? length : 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!willPayload) {
+    return;
+  }
+  memcpy(willPayload, payload, length);
+  willLength = length;
+  willTopic = topic;
+  willQos = qos;
+  willRetain = retain;
+}
+
+void MqttClient::clearWill() {
+  if (willPayload) {
+    heap_caps_free(willPayload);
+    willPayload = nullptr;
+  }
+  willLength = 0;
+  willTopic = "";
+}
+
+void MqttClient::onAck(AckCallback callback) {
+  ackCallback = callback;
+}
+
+size_t MqttClient::encodeRemainingLength(uint8_t* buf, size_t length) {
+  size_t pos = 0;
+  do {
+    uint8_t digit = length % 128;
+    length /= 128;
+    if (length > 0) {
+      digit |= 0x80;
+    }
+    buf[pos++] = digit;
+  } while (length > 0 && pos < 4);
+  return pos;
+}
+
+size_t MqttClient::writeString(uint8_t* buf, const char* str, size_t len) {
+  buf[0] = (len >> 8) & 0xFF;
+  buf[1] = len & 0xFF;
+  memcpy(buf + 2, str, len);
+  return len + 2;
+}
+
+size_t MqttClient::readVarInt(const uint8_t* buf, size_t length, uint32_t* value) {
+  uint32_t result = 0;
+  uint32_t multiplier = 1;
+  for (size_t i = 0; i < length && i < 4; i++) {
+    result += (buf[i] & 0x7F) * multiplier;
+    multiplier *= 128;
+    if (!(buf[i] & 0x80)) {
+      *value = result;
+      return i + 1;
+    }
+  }
+  return 0;
+}
+
+bool MqttClient::writeBytes(const uint8_t* data, size_t len) {
+  if (!client) return false;
+
+  size_t written = 0;
+  while (written < len) {
+    size_t n = client->write(data + written, len - written);
+    if (n == 0) {
+      return false;
+    }
+    written += n;
+  }
+  lastOutbound = millis();
+  return true;
+}
+
+bool MqttClient::readByte(uint8_t* out, unsigned long deadline) {
+  while (!client->available()) {
+    if (!client->connected() || (long)(millis() - deadline) >= 0) {
+      return false;
+    }
+    vTaskDelay(pdMS_TO_TICKS(1));
+  }
+  *out = client->read();
+  return true;
+}
+
+bool MqttClient::readPacket(uint8_t* header, size_t* length) {
+  unsigned long deadline = millis() + socketTimeoutSec * 1000UL;
+
+  if (!readByte(header, deadline)) {
+    return false;
+  }
+
+  size_t remaining = 0;
+  uint32_t multiplier = 1;
+  uint8_t digit;
+  int digits = 0;
+  do {
+    if (!readByte(&digit, deadline) || ++digits > 4) {
+      return false;
+    }
+    remaining += (digit & 0x7F) * multiplier;
+    multiplier *= 128;
+  } while (digit & 0x80);
+
+  // Keep what fits; anything larger (we never subscribe) is drained
+  size_t stored = 0;
+  for (size_t i = 0; i < remaining; i++) {
+    uint8_t b;
+    if (!readByte(&b, deadline)) {
+      return false;
+    }
+    if (stored < MQTT_RX_BUFFER_SIZE) {
+      rxBuffer[stored++] = b;
+    }
+  }
+
+  *length = stored;
+  lastInbound = millis();
+  return true;
+}
+
+void MqttClient::closeWithState(int newState) {
+  if (client) {
+    client->stop();
+  }
+  connState = newState;
+  pingOutstanding = false;
+}
+
+bool MqttClient::connect(const char* clientId, const char* user, const char* pass, bool cleanSession) {
+  if (!client) {
+    connState = MQTT_CONNECT_FAILED;
+    return false;
+  }
+
+  if (!client->connect(host.c_str(), port)) {
+    connState = MQTT_CONNECT_FAILED;
+    return false;
+  }
+
+  size_t idLen = strlen(clientId);
+  size_t userLen = user ? strlen(user) : 0;
+  size_t passLen = pass ? strlen(pass) : 0;
+  bool hasWill = willPayload != nullptr;
+  bool v5 = protocolVersion == MQTT_PROTOCOL_V5;
+
+  // MQTT 5 CONNECT properties: ask the broker to keep the session if requested
+  uint8_t props[8];
+  size_t propsLen = 0;
+  if (v5 && !cleanSession) {
+    props[propsLen++] = MQTT_PROP_SESSION_EXPIRY;
+    props[propsLen++] = (MQTT_SESSION_EXPIRY_SEC >> 24) & 0xFF;
+    props[propsLen++] = (MQTT_SESSION_EXPIRY_SEC >> 16) & 0xFF;
+    props[propsLen++] = (MQTT_SESSION_EXPIRY_SEC >> 8) & 0xFF;
+    props[propsLen++] = MQTT_SESSION_EXPIRY_SEC & 0xFF;
+  }
+
+  // Variable header (10 bytes) plus length-prefixed payload fields
+  size_t remaining = 10 + 2 + idLen;
+  if (v5) remaining += 1 + propsLen;
+  if (hasWill) remaining += (v5 ? 1 : 0) + 2 + willTopic.length() + 2 + willLength;
+  if (user) remaining += 2 + userLen;
+  if (pass) remaining += 2 + passLen;
+
+  uint8_t* packet = (uint8_t*)heap_caps_malloc(remaining + 5, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!packet) {
+    closeWithState(MQTT_CONNECT_FAILED);
+    return false;
+  }
+
+  size_t pos = 0;
+  packet[pos++] = MQTT_CONNECT;
+  pos += encodeRemainingLength(packet + pos, remaining);
+  pos += writeString(packet + pos, "MQTT", 4);
+  packet[pos++] = protocolVersion;
+
+  uint8_t flags = 0;
+  if (cleanSession) flags |= 0x02;
+  if (hasWill) flags |= 0x04 | ((willQos & 0x03) << 3) | (willRetain ? 0x20 : 0);
+  if (pass) flags |= 0x40;
+  if (user) flags |= 0x80;
+  packet[pos++] = flags;
+  packet[pos++] = (keepAliveSec >> 8) & 0xFF;
+  packet[pos++] = keepAliveSec & 0xFF;
+  if (v5) {
+    packet[pos++] = propsLen;
+    memcpy(packet + pos, props, propsLen);
+    pos += propsLen;
+  }
+
+  pos += writeString(packet + pos, clientId, idLen);
+  if (hasWill) {
+    if (v5) packet[pos++] = 0;  // No will properties
+    pos += writeString(packet + pos, willTopic.c_str(), willTopic.length());
+    pos += writeString(packet + pos, (const char*)willPayload, willLength);
+  }
+  if (user) pos += writeString(packet + pos, user, userLen);
+  if (pass) pos += writeString(packet + pos, pass, passLen);
+
+  bool sent = writeBytes(packet, pos);
+  heap_caps_free(packet);
+  if (!sent) {
+    closeWithState(MQTT_CONNECTION_LOST);
+    return false;
+  }
+
+  uint8_t header;
+  size_t length;
+  if (!readPacket(&header, &length)) {
+    closeWithState(MQTT_CONNECTION_TIMEOUT);
+    return false;
+  }
+
+  if ((header & 0xF0) != MQTT_CONNACK || length < 2) {
+    closeWithState(MQTT_CONNECT_FAILED);
+    return false;
+  }
+
+  if (rxBuffer[1] != 0) {
+    // Broker refused: return code 1..5 (3.1.1) or reason code >= 0x80 (5)
+    closeWithState(rxBuffer[1]);
+    return false;
+  }
+
+  // Aliases are per network connection, so start from a clean table
+  topicAliasMax = 0;
+  receiveMax = 65535;
+  if (v5 && length > 2) {
+    uint32_t propLength = 0;
+    size_t lenBytes = readVarInt(rxBuffer + 2, length - 2, &propLength);
+    if (lenBytes > 0 && 2 + lenBytes + propLength <= length) {
+      parseConnackProperties(rxBuffer + 2 + lenBytes, propLength);
+    }
+  }
+  aliasEstablished.assign(topicAliasMax + 1, false);
+
+  connState = MQTT_CONNECTED;
+  pingOutstanding = false;
+  lastInbound = millis();
+  return true;
+}
+
+void MqttClient::parseConnackProperties(const uint8_t* props, size_t length) {
+  size_t pos = 0;
+  while (pos < length) {
+    uint8_t id = props[pos++];
+    switch (id) {
+      case MQTT_PROP_TOPIC_ALIAS_MAXIMUM:
+        if (pos + 2 > length) return;
+        topicAliasMax = ((uint16_t)props[pos] << 8) | props[pos + 1];
+        pos += 2;
+        break;
+      case MQTT_PROP_RECEIVE_MAXIMUM:
+        if (pos + 2 > length) return;
+        receiveMax = ((uint16_t)props[pos] << 8) | props[pos + 1];
+        pos += 2;
+        break;
+      case 0x13:  // Server Keep Alive
+        if (pos + 2 > length) return;
+        keepAliveSec = ((uint16_t)props[pos] << 8) | props[pos + 1];
+        pos += 2;
+        break;
+      case 0x24: case 0x25: case 0x28: case 0x29: case 0x2A:  // Byte properties
+        pos += 1;
+        break;
+      case 0x11: case 0x27:  // Four byte integers
+        pos += 4;
+        break;
+      case 0x12: case 0x15: case 0x16: case 0x1A: case 0x1C: case 0x1F: {  // Strings / binary data
+        if (pos + 2 > length) return;
+        pos += 2 + (((uint16_t)props[pos] << 8) | props[pos + 1]);
+        break;
+      }
+      case 0x26: {  // User property: string pair
+        for (int i = 0; i < 2; i++) {
+          if (pos + 2 > length) return;
+          pos += 2 + (((uint16_t)props[pos] << 8) | props[pos + 1]);
+        }
+        break;
+      }
+      default:
+        return;  // Unknown property, stop parsing
+    }
+  }
+}
+
+void MqttClient::disconnect() {
+  if (connState == MQTT_CONNECTED) {
+    uint8_t packet[2] = { MQTT_DISCONNECT, 0 };
+    writeBytes(packet, sizeof(packet));
+  }
+  closeWithState(MQTT_DISCONNECTED);
+}
+
+bool MqttClient::connected() {
+  if (!client || connState != MQTT_CONNECTED) {
+    return false;
+  }
+  if (!client->connected()) {
+    closeWithState(MQTT_CONNECTION_LOST);
+    return false;
+  }
+  return true;
+}
+
+uint16_t MqttClient::nextPacketId() {
+  lastPacketId++;
+  if (lastPacketId == 0) {
+    lastPacketId = 1;  // Packet id 0 is not allowed
+  }
+  return lastPacketId;
+}
+
+void MqttClient::forgetTopicAlias(uint16_t topicAlias) {
+  if (topicAlias < aliasEstablished.size()) {
+    aliasEstablished[topicAlias] = false;
+  }
+}
+
+bool MqttClient::publish(const char* topic, const uint8_t* payload, size_t length,
+                         uint8_t qos, bool retain, uint16_t packetId, bool dup, uint16_t topicAlias) {
+  if (!connected()) {
+    return false;
+  }
+
+  bool v5 = protocolVersion == MQTT_PROTOCOL_V5;
+  bool useAlias = v5 && topicAlias > 0 && topicAlias <= topicAliasMax;
+  bool sendTopic = !useAlias || !aliasEstablished[topicAlias];
+
+  size_t topicLen = sendTopic ? strlen(topic) : 0;
+  if (topicLen + 13 > MQTT_TX_HEADER_SIZE) {
+    return false;
+  }
+
+  size_t propsLen = useAlias ? 3 : 0;
+  size_t remaining = 2 + topicLen + (qos > 0 ? 2 : 0) + (v5 ? 1 + propsLen : 0) + length;
+
+  // Header and topic are staged; the payload is written straight from the caller
+  uint8_t header[MQTT_TX_HEADER_SIZE];
+  size_t pos = 0;
+  header[pos++] = MQTT_PUBLISH | (dup ? 0x08 : 0) | ((qos & 0x03) << 1) | (retain ? 0x01 : 0);
+  pos += encodeRemainingLength(header + pos, remaining);
+  pos += writeString(header + pos, topic, topicLen);
+  if (qos > 0) {
+    header[pos++] = (packetId >> 8) & 0xFF;
+    header[pos++] = packetId & 0xFF;
+  }
+  if (v5) {
+    header[pos++] = propsLen;
+    if (useAlias) {
+      header[pos++] = MQTT_PROP_TOPIC_ALIAS;
+      header[pos++] = (topicAlias >> 8) & 0xFF;
+      header[pos++] = topicAlias & 0xFF;
+    }
+  }
+
+  if (!writeBytes(header, pos) || !writeBytes(payload, length)) {
+    closeWithState(MQTT_CONNECTION_LOST);
+    return false;
+  }
+
+  if (useAlias) {
+    aliasEstablished[topicAlias] = true;
+  }
+  publishBytes += pos + length;
+  publishCount++;
+  return true;
+}
+
+void MqttClient::handlePacket(uint8_t header, size_t length) {
+  switch (header & 0xF0) {
+    case MQTT_PUBACK:
+      if (length >= 2 && ackCallback) {
+        // MQTT 5 omits the reason code when it is 0x00 (success)
+        uint8_t reason = (length >= 3) ? rxBuffer[2] : 0;
+        ackCallback(((uint16_t)rxBuffer[0] << 8) | rxBuffer[1], reason);
+      }
+      break;
+
+    case MQTT_PINGRESP:
+      pingOutstanding = false;
+      break;
+
+    case MQTT_PUBLISH: {
+      // Not subscribed to anything, but acknowledge QoS 1 deliveries anyway.
+      // The packet id follows the topic in both protocol versions.
+      uint8_t qos = (header >> 1) & 0x03;
+      if (qos == 1 && length >= 2) {
+        uint16_t topicLen = ((uint16_t)rxBuffer[0] << 8) | rxBuffer[1];
+        if ((size_t)topicLen + 4 <= length) {
+          uint8_t ack[4] = { MQTT_PUBACK, 2, rxBuffer[2 + topicLen], rxBuffer[3 + topicLen] };
+          writeBytes(ack, sizeof(ack));
+        }
+      }
+      break;
+    }
+
+    case MQTT_DISCONNECT:
+      closeWithState(MQTT_CONNECTION_LOST);
+      break;
+
+    default:
+      break;
+  }
+}
+
+bool MqttClient::loop() {
+  if (!connected()) {
+    return false;
+  }
+
+  while (client->available()) {
+    uint8_t header;
+    size_t length;
+    if (!readPacket(&header, &length)) {
+      closeWithState(MQTT_CONNECTION_LOST);
+      return false;
+    }
+    handlePacket(header, length);
+    if (connState != MQTT_CONNECTED) {
+      return false;
+    }
+  }
+
+  unsigned long now = millis();
+  unsigned long keepAliveMs = keepAliveSec * 1000UL;
+  if (keepAliveMs > 0) {
+    if (pingOutstanding && now - lastInbound > keepAliveMs + keepAliveMs / 2) {
+      Serial.println("[MQTT] Keepalive timeout, broker not responding");
+      closeWithState(MQTT_CONNECTION_TIMEOUT);
+      return false;
+    }
+    if (!pingOutstanding && (now - lastOutbound >= keepAliveMs || now - lastInbound >= keepAliveMs)) {
+      uint8_t ping[2] = { MQTT_PINGREQ, 0 };
+      if (!writeBytes(ping, sizeof(ping))) {
+        closeWithState(MQTT_CONNECTION_LOST);
+        return false;
+      }
+      pingOutstanding = true;
+    }
+  }
+  return true;
+}
+
+unsigned long MqttClient::msUntilKeepalive() const {
+  unsigned long keepAliveMs = keepAliveSec * 1000UL;
+  if (keepAliveMs == 0) {
+    return ULONG_MAX;
+  }
+
+  unsigned long now = millis();
+  unsigned long elapsed;
+  unsigned long limit;
+  if (pingOutstanding) {
+    elapsed = now - lastInbound;
+    limit = keepAliveMs + keepAliveMs / 2 + 1;
+  } else {
+    elapsed = max(now - lastOutbound, now - lastInbound);
+    limit = keepAliveMs;
+  }
+  return elapsed >= limit ? 0 : limit - elapsed;
+}
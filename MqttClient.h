@@ -0,0 +1,120 @@
+#ifndef MQTT_CLIENT_H
+#define MQTT_CLIENT_H
+
+#include <Arduino.h>
+#include <Client.h>
+#include <functional>
+#include <vector>
+
+#define MQTT_RX_BUFFER_SIZE 512
+#define MQTT_TX_HEADER_SIZE 384
+
+// Connection states (same values as PubSubClient for log compatibility)
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_CONNECTION_LOST -3
+#define MQTT_CONNECT_FAILED -2
+#define MQTT_DISCONNECTED -1
+#define MQTT_CONNECTED 0
+
+#define MQTT_PROTOCOL_V311 4
+#define MQTT_PROTOCOL_V5 5
+
+// Minimal MQTT 3.1.1 / 5 client over any Arduino Client.
+// Unlike PubSubClient it can publish at QoS 1 with caller-chosen packet ids
+// and reports PUBACKs, so the caller can keep its own in-flight window.
+// In MQTT 5 mode it also handles client-to-broker topic aliases.
+class MqttClient {
+public:
+  // reasonCode is 0 for MQTT 3.1.1 and the PUBACK reason code for MQTT 5
+  using AckCallback = std::function<void(uint16_t packetId, uint8_t reasonCode)>;
+
+private:
+  Client* client;
+  String host;
+  uint16_t port;
+  uint16_t keepAliveSec;
+  uint16_t socketTimeoutSec;
+  uint8_t protocolVersion;
+  int connState;
+
+  // MQTT 5 limits announced by the broker in CONNACK
+  uint16_t topicAliasMax;
+  uint16_t receiveMax;
+  std::vector<bool> aliasEstablished;
+
+  // PUBLISH traffic (fixed header, topic, properties and payload)
+  uint32_t publishBytes;
+  uint32_t publishCount;
+
+  // Will message
+  String willTopic;
+  uint8_t* willPayload;
+  size_t willLength;
+  uint8_t willQos;
+  bool willRetain;
+
+  uint16_t lastPacketId;
+  unsigned long lastOutbound;
+  unsigned long lastInbound;
+  bool pingOutstanding;
+  AckCallback ackCallback;
+
+  uint8_t rxBuffer[MQTT_RX_BUFFER_SIZE];
+
+  bool writeBytes(const uint8_t* data, size_t len);
+  bool readByte(uint8_t* out, unsigned long deadline);
+  bool readPacket(uint8_t* header, size_t* length);
+  void handlePacket(uint8_t header, size_t length);
+  void closeWithState(int state);
+  void parseConnackProperties(const uint8_t* props, size_t length);
+
+  static size_t encodeRemainingLength(uint8_t* buf, size_t length);
+  static size_t writeString(uint8_t* buf, const char* str, size_t len);
+  static size_t readVarInt(const uint8_t* buf, size_t length, uint32_t* value);
+
+public:
+  MqttClient();
+  ~MqttClient();
+
+  void setClient(Client& networkClient);
+  void setServer(const char* brokerHost, uint16_t brokerPort);
+  void setKeepAlive(uint16_t seconds);
+  void setSocketTimeout(uint16_t seconds);
+  void setProtocolVersion(uint8_t version);
+  void setWill(const char* topic, const uint8_t* payload, size_t length, uint8_t qos, bool retain);
+  void clearWill();
+  void onAck(AckCallback callback);
+
+  bool connect(const char* clientId, const char* user, const char* pass, bool cleanSession);
+  void disconnect();
+  bool connected();
+  int state() const { return connState; }
+
+  uint8_t getProtocolVersion() const { return protocolVersion; }
+  uint16_t getTopicAliasMax() const { return topicAliasMax; }
+  uint16_t getReceiveMax() const { return receiveMax; }
+  uint32_t getPublishBytes() const { return publishBytes; }
+  uint32_t getPublishCount() const { return publishCount; }
+
+  uint16_t nextPacketId();
+
+  // The next publish with this alias sends its topic again, rebinding the
+  // alias on the broker
+  void forgetTopicAlias(uint16_t topicAlias);
+
+  // topicAlias (MQTT 5 only, 1-based): the first publish on a session sends
+  // the topic together with the alias, later ones send only the alias.
+  // Aliases above the broker's Topic Alias Maximum are ignored.
+  bool publish(const char* topic, const uint8_t* payload, size_t length,
+               uint8_t qos = 0, bool retain = false, uint16_t packetId = 0, bool dup = false,
+               uint16_t topicAlias = 0);
+
+  // Processes incoming packets and keepalive; returns false if the link dropped
+  bool loop();
+
+  // Milliseconds until loop() must run again to send PINGREQ or detect a
+  // missing PINGRESP; 0 if it is already due
+  unsigned long msUntilKeepalive() const;
+};
+
+#endif
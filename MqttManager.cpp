@@ -1,12 +1,22 @@
 #include "MqttManager.h"
 #include "LEDManager.h"
+#include "MemoryManager.h"
+#include <esp_heap_caps.h>
 
 MqttManager* MqttManager::instance = nullptr;
 
 MqttManager::MqttManager(ConfigManager* config, ServerConfig* serverCfg, NetworkMgr* netMgr)
-  : configManager(config), queueManager(nullptr), serverConfig(serverCfg), networkManager(netMgr), mqttClient(PubSubClient()),
-    running(false), taskHandle(nullptr), brokerPort(1883), lastReconnectAttempt(0) {
+  : configManager(config), queueManager(nullptr), serverConfig(serverCfg), networkManager(netMgr),
+    consumerId(-1), running(false), taskHandle(nullptr), brokerPort(1883), keepAlive(60), cleanSession(true), lastReconnectAttempt(0),
+    publishQos(1), inflightWindow(10), ackedCount(0), retransmitCount(0),
+    protocolVersion(MQTT_PROTOCOL_V311), lastPlanCompile(0), aliasClock(0), aliasRebinds(0), changeQueue(nullptr),
+    payloadFormat(PayloadFormat::JSON), encodeBuffer(nullptr), encodedCount(0), encodedBytes(0), encodeMicros(0),
+    rebirthForSample(false), rebirthSampleSeq(0), unknownMetricDrops(0), birthFailures(0), birthRetryAt(0),
+    latencyCount(0), latencyTotalMs(0), latencyMaxMs(0) {
   queueManager = QueueManager::getInstance();
+  mqttClient.onAck([this](uint16_t packetId, uint8_t reasonCode) {
+    handleAck(packetId, reasonCode);
+  });
 }
 
 MqttManager* MqttManager::getInstance(ConfigManager* config, ServerConfig* serverCfg, NetworkMgr* netMgr) {
@@ -24,6 +34,27 @@ bool MqttManager::init() {
     return false;
   }
 
+  if (!encodeBuffer) {
+    encodeBuffer = (uint8_t*)heap_caps_malloc(MQTT_ENCODE_BUFFER_SIZE, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+    if (!encodeBuffer) {
+      encodeBuffer = (uint8_t*)malloc(MQTT_ENCODE_BUFFER_SIZE);  // Fallback to internal RAM
+    }
+    if (!encodeBuffer) {
+      Serial.println("Failed to allocate MQTT encode buffer");
+      return false;
+    }
+  }
+
+  // Device and register edits arrive as change events and recompile the topic plan
+  if (!changeQueue) {
+    changeQueue = xQueueCreate(CONFIG_CHANGE_QUEUE_LENGTH, sizeof(ConfigChange));
+    if (!changeQueue) {
+      Serial.println("Failed to create MQTT config change queue");
+      return false;
+    }
+    configManager->addChangeListener(changeQueue);
+  }
+
   loadMqttConfig();
   Serial.println("MQTT Manager initialized successfully");
   return true;
@@ -36,6 +67,13 @@ void MqttManager::start() {
     return;
   }
 
+  // Own cursor over the sample queue, independent of other uplinks
+  consumerId = queueManager->addConsumer("mqtt");
+  if (consumerId < 0) {
+    Serial.println("Failed to register MQTT queue consumer");
+    return;
+  }
+
   running = true;
   BaseType_t result = xTaskCreatePinnedToCore(
     mqttTask,
@@ -52,6 +90,8 @@ void MqttManager::start() {
     Serial.println("Failed to create MQTT task");
     running = false;
     taskHandle = nullptr;
+    queueManager->removeConsumer(consumerId);
+    consumerId = -1;
   }
 }
 
@@ -65,6 +105,10 @@ void MqttManager::stop() {
   if (mqttClient.connected()) {
     mqttClient.disconnect();
   }
+  if (consumerId >= 0) {
+    queueManager->removeConsumer(consumerId);
+    consumerId = -1;
+  }
   Serial.println("MQTT Manager stopped");
 }
 
@@ -80,6 +124,9 @@ void MqttManager::mqttLoop() {
   Serial.println("[MQTT] Task started");
 
   while (running) {
+    // Drained even while offline so a reconnect starts from the current config
+    applyConfigChanges();
+
     // Check network availability
     bool networkAvailable = isNetworkAvailable();
 
@@ -130,6 +177,18 @@ void MqttManager::mqttLoop() {
       }
       mqttClient.loop();
       publishQueueData();
+
+      // Sleep until new data is queued or keepalive needs servicing. While
+      // QoS 1 messages are in flight, poll the socket briefly for PUBACKs.
+      if (publishQos > 0 && (int)outbox.size() >= effectiveWindow()) {
+        vTaskDelay(pdMS_TO_TICKS(MQTT_ACK_POLL_MS));
+        continue;
+      }
+      unsigned long waitMs = outbox.empty() ? mqttClient.msUntilKeepalive() : MQTT_ACK_POLL_MS;
+      if (waitMs > 0) {
+        queueManager->waitForData(consumerId, waitMs == ULONG_MAX ? portMAX_DELAY : pdMS_TO_TICKS(waitMs));
+      }
+      continue;
     }
 
     vTaskDelay(pdMS_TO_TICKS(1000));
@@ -154,24 +213,46 @@ bool MqttManager::connectToMqtt() {
 
   mqttClient.setClient(*activeClient);
 
-  // Set buffer sizes and timeouts
-  mqttClient.setBufferSize(512, 512);
-  mqttClient.setKeepAlive(60);
+  // Set timeouts
+  mqttClient.setKeepAlive(keepAlive);
   mqttClient.setSocketTimeout(5);
 
   mqttClient.setServer(brokerAddress.c_str(), brokerPort);
-
-  bool connected;
-  if (username.length() > 0 && password.length() > 0) {
-    Serial.println("[MQTT] Using authentication");
-    connected = mqttClient.connect(clientId.c_str(), username.c_str(), password.c_str());
+  mqttClient.setProtocolVersion(protocolVersion);
+
+  bool useAuth = username.length() > 0 && password.length() > 0;
+  Serial.println(useAuth ? "[MQTT] Using authentication" : "[MQTT] No authentication");
+
+  if (payloadFormat == PayloadFormat::SPARKPLUG_B) {
+    // Register the NDEATH certificate as the will so the host sees the node drop
+    sparkplug.beginSession();
+    birthRetryAt = millis();  // A new session births immediately
+    uint8_t death[32];
+    size_t deathLen = sparkplug.encodeDeath(death, sizeof(death));
+    mqttClient.setWill(sparkplug.topicFor("NDEATH").c_str(), death, deathLen, 0, false);
   } else {
-    Serial.println("[MQTT] No authentication");
-    connected = mqttClient.connect(clientId.c_str());
+    mqttClient.clearWill();
   }
 
+  bool connected = mqttClient.connect(clientId.c_str(),
+                                      useAuth ? username.c_str() : nullptr,
+                                      useAuth ? password.c_str() : nullptr,
+                                      cleanSession);
+
   if (connected) {
     Serial.printf("[MQTT] Connected to %s:%d\n", brokerAddress.c_str(), brokerPort);
+    if (protocolVersion == MQTT_PROTOCOL_V5) {
+      Serial.printf("[MQTT] MQTT 5 session - Topic alias max: %u, Receive max: %u\n",
+                    mqttClient.getTopicAliasMax(), mqttClient.getReceiveMax());
+    }
+    resetTopicAliases();  // The broker forgot every alias with the old connection
+    if (payloadFormat != PayloadFormat::SPARKPLUG_B) {
+      compileTopicPlan();
+    }
+    if (payloadFormat == PayloadFormat::SPARKPLUG_B) {
+      publishBirth();
+    }
+    retransmitOutbox();
   } else {
     Serial.printf("[MQTT] Connection failed, error: %d\n", mqttClient.state());
   }
@@ -194,16 +275,42 @@ void MqttManager::loadMqttConfig() {
     username = mqttConfig["username"] | "";
     password = mqttConfig["password"] | "";
     topicPublish = mqttConfig["topic_publish"] | "device/data";
-
-    Serial.printf("[MQTT] Config loaded - Broker: %s:%d, Client: %s, Topic: %s\n",
-                  brokerAddress.c_str(), brokerPort, clientId.c_str(), topicPublish.c_str());
-    Serial.printf("[MQTT] Auth: %s\n", (username.length() > 0) ? "YES" : "NO");
+    keepAlive = mqttConfig["keep_alive"] | 60;
+    cleanSession = mqttConfig["clean_session"] | true;
+    publishQos = (mqttConfig["qos"] | 1) > 0 ? 1 : 0;
+    inflightWindow = constrain(mqttConfig["inflight_window"] | 10, 1, MQTT_MAX_INFLIGHT_WINDOW);
+    protocolVersion = (mqttConfig["protocol_version"] | 4) == 5 ? MQTT_PROTOCOL_V5 : MQTT_PROTOCOL_V311;
+    topicTemplate = mqttConfig["topic_template"] | "";
+    payloadFormat = PayloadEncoder::parseFormat(mqttConfig["payload_format"] | "json");
+    if (payloadFormat == PayloadFormat::SPARKPLUG_B && publishQos > 0) {
+      Serial.println("[MQTT] Sparkplug B requires QoS 0 for NDATA, overriding qos");
+      publishQos = 0;
+    }
+    if (payloadFormat == PayloadFormat::SPARKPLUG_B && protocolVersion == MQTT_PROTOCOL_V5) {
+      Serial.println("[MQTT] Sparkplug B is defined for MQTT 3.1.1, overriding protocol_version");
+      protocolVersion = MQTT_PROTOCOL_V311;
+    }
+    sparkplug.configure(mqttConfig["sparkplug_group_id"] | "gateway",
+                        mqttConfig["sparkplug_edge_node_id"] | clientId.c_str());
+
+    Serial.printf("[MQTT] Config loaded - Broker: %s:%d, Client: %s, Topic: %s, Format: %s\n",
+                  brokerAddress.c_str(), brokerPort, clientId.c_str(), topicPublish.c_str(),
+                  PayloadEncoder::formatName(payloadFormat));
+    Serial.printf("[MQTT] Auth: %s, QoS: %d, In-flight window: %d, Protocol: %s\n",
+                  (username.length() > 0) ? "YES" : "NO", publishQos, inflightWindow,
+                  protocolVersion == MQTT_PROTOCOL_V5 ? "5" : "3.1.1");
+    if (topicTemplate.length() > 0) {
+      Serial.printf("[MQTT] Topic template: %s\n", topicTemplate.c_str());
+    }
   } else {
     Serial.println("[MQTT] Failed to load config, using public test broker");
     brokerAddress = "broker.hivemq.com";
     brokerPort = 1883;
     clientId = "esp32_gateway_" + String(random(1000, 9999));
     topicPublish = "device/data";
+    topicTemplate = "";
+    protocolVersion = MQTT_PROTOCOL_V311;
+    payloadFormat = PayloadFormat::JSON;
     Serial.printf("[MQTT] Default config - Broker: %s:%d, Client: %s\n",
                   brokerAddress.c_str(), brokerPort, clientId.c_str());
   }
@@ -214,32 +321,94 @@ void MqttManager::publishQueueData() {
     return;
   }
 
-  // Process up to 10 items per loop to avoid blocking
+  if (payloadFormat == PayloadFormat::SPARKPLUG_B && sparkplug.needsRebirth()) {
+    if ((long)(millis() - birthRetryAt) < 0) {
+      return;
+    }
+    if (!publishBirth()) {
+      birthFailures++;
+      birthRetryAt = millis() + MQTT_BIRTH_RETRY_MS;
+      Serial.printf("[MQTT] NBIRTH failed (%s), retrying in %d s\n",
+                    lastBirthError.c_str(), MQTT_BIRTH_RETRY_MS / 1000);
+      return;
+    }
+  }
+
+  bool sparkplugActive = payloadFormat == PayloadFormat::SPARKPLUG_B;
+  String sparkplugTopic = sparkplugActive ? sparkplug.topicFor("NDATA") : "";
+
+  int window = effectiveWindow();
+
+  // Process up to 10 items per loop to avoid blocking. At QoS 1 the loop
+  // also stops once the in-flight window is full and resumes on PUBACKs.
   for (int i = 0; i < 10; i++) {
+    if (publishQos > 0 && (int)outbox.size() >= window) {
+      break;
+    }
+
     // --- PERUBAHAN DI SINI ---
     StaticJsonDocument<512> dataDoc; // Mengganti DynamicJsonDocument(512)
     // --- AKHIR PERUBAHAN ---
     JsonObject dataPoint = dataDoc.to<JsonObject>();
 
-    if (!queueManager->dequeue(dataPoint)) {
+    // The sample is committed only once it is published or in the outbox
+    unsigned long enqueuedAt = 0;
+    uint32_t sampleSeq = queueManager->cursor(consumerId);
+    uint32_t nextSeq;
+    if (!queueManager->peekFrom(sampleSeq, dataPoint, &nextSeq, &enqueuedAt)) {
       break;  // No more data in queue
     }
 
-    // Create MQTT payload
-    String payload;
-    serializeJson(dataPoint, payload);
+    size_t payloadLen = encodeSample(dataPoint);
+    if (payloadLen == 0) {
+      if (payloadFormat == PayloadFormat::SPARKPLUG_B && sparkplug.needsRebirth()) {
+        if (!rebirthForSample || rebirthSampleSeq != sampleSeq) {
+          // Register is newer than the last NBIRTH; keep it queued and rebirth next loop
+          rebirthForSample = true;
+          rebirthSampleSeq = sampleSeq;
+          break;
+        }
+        // Still unknown after the NBIRTH it triggered (register deleted or
+        // not in the model): drop it instead of rebirthing again
+        Serial.printf("[MQTT] Register %s not in NBIRTH, sample dropped\n",
+                      (const char*)(dataPoint["register_id"] | ""));
+        sparkplug.cancelRebirth();
+        rebirthForSample = false;
+        unknownMetricDrops++;
+        queueManager->commitThrough(consumerId, nextSeq);
+        continue;
+      }
+      Serial.println("[MQTT] Sample too large for encode buffer, dropped");
+      queueManager->commitThrough(consumerId, nextSeq);
+      continue;
+    }
 
-    // Publish to MQTT
-    String topic = topicPublish;
+    const String* topic = sparkplugActive ? &sparkplugTopic : &routeFor(dataPoint);
 
-    if (mqttClient.publish(topic.c_str(), payload.c_str())) {
-      Serial.printf("[MQTT] Published: %s\n", topic.c_str());
+    if (publishQos > 0) {
+      // Once the sample lives in the outbox a failed write loses nothing,
+      // so it is committed even if the first transmission failed
+      size_t outboxBefore = outbox.size();
+      bool published = publishToOutbox(*topic, payloadLen);
+      if (outbox.size() > outboxBefore) {
+        queueManager->commitThrough(consumerId, nextSeq);
+      }
+      if (!published) {
+        break;
+      }
+      recordLatency(enqueuedAt);
+      continue;
+    }
+
+    if (mqttClient.publish(topic->c_str(), encodeBuffer, payloadLen, 0, false, 0, false, aliasFor(*topic))) {
+      Serial.printf("[MQTT] Published: %s (%u bytes)\n", topic->c_str(), (unsigned)payloadLen);
+      queueManager->commitThrough(consumerId, nextSeq);
+      recordLatency(enqueuedAt);
       if (ledManager) {
         ledManager->notifySuccess();
       }
     } else {
-      Serial.printf("[MQTT] Publish failed: %s\n", topic.c_str());
-      queueManager->enqueue(dataPoint);
+      Serial.printf("[MQTT] Publish failed: %s\n", topic->c_str());
       break;
     }
 
@@ -247,6 +416,294 @@ void MqttManager::publishQueueData() {
   }
 }
 
+bool MqttManager::publishToOutbox(const String& topic, size_t length) {
+  uint8_t* copy = (uint8_t*)heap_caps_malloc(length, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!copy) {
+    Serial.println("[MQTT] Failed to allocate outbox entry");
+    return false;
+  }
+  memcpy(copy, encodeBuffer, length);
+
+  OutboxEntry entry;
+  entry.packetId = mqttClient.nextPacketId();
+  entry.topic = topic;
+  entry.payload = copy;
+  entry.length = length;
+  entry.sent = mqttClient.publish(topic.c_str(), copy, length, 1, false, entry.packetId, false, aliasFor(topic));
+  outbox.push_back(entry);
+
+  if (!entry.sent) {
+    Serial.printf("[MQTT] Publish failed, packet %u kept for retransmission\n", entry.packetId);
+  }
+  return entry.sent;
+}
+
+int MqttManager::effectiveWindow() {
+  // An MQTT 5 broker may allow fewer unacknowledged publishes than configured
+  if (protocolVersion == MQTT_PROTOCOL_V5) {
+    return min(inflightWindow, (int)mqttClient.getReceiveMax());
+  }
+  return inflightWindow;
+}
+
+void MqttManager::retransmitOutbox() {
+  if (outbox.empty()) {
+    return;
+  }
+
+  Serial.printf("[MQTT] Retransmitting %u unacknowledged messages\n", (unsigned)outbox.size());
+  for (OutboxEntry& entry : outbox) {
+    // The alias is looked up at send time: it may have been rebound since
+    if (!mqttClient.publish(entry.topic.c_str(), entry.payload, entry.length, 1, false,
+                            entry.packetId, entry.sent, aliasFor(entry.topic))) {
+      Serial.println("[MQTT] Retransmission interrupted, will resume on reconnect");
+      return;
+    }
+    if (entry.sent) {
+      retransmitCount++;
+    }
+    entry.sent = true;
+  }
+}
+
+void MqttManager::handleAck(uint16_t packetId, uint8_t reasonCode) {
+  for (auto it = outbox.begin(); it != outbox.end(); ++it) {
+    if (it->packetId == packetId) {
+      if (reasonCode >= 0x80) {
+        // MQTT 5 rejection (e.g. not authorized, quota exceeded): retrying will not help
+        Serial.printf("[MQTT] Packet %u rejected by broker, reason 0x%02X: %s\n",
+                      packetId, reasonCode, it->topic.c_str());
+        heap_caps_free(it->payload);
+        outbox.erase(it);
+        return;
+      }
+      heap_caps_free(it->payload);
+      outbox.erase(it);
+      ackedCount++;
+      if (ledManager) {
+        ledManager->notifySuccess();
+      }
+      return;
+    }
+  }
+  Serial.printf("[MQTT] PUBACK for unknown packet %u\n", packetId);
+}
+
+void MqttManager::clearOutbox() {
+  for (OutboxEntry& entry : outbox) {
+    heap_caps_free(entry.payload);
+  }
+  outbox.clear();
+}
+
+String MqttManager::expandTopic(const String& deviceId, const String& deviceName,
+                                const String& registerId, const String& registerName) const {
+  // Placeholder values become single topic levels, so strip separators and wildcards
+  auto level = [](String value) {
+    value.replace("/", "_");
+    value.replace("+", "_");
+    value.replace("#", "_");
+    return value;
+  };
+
+  String topic = topicTemplate;
+  topic.replace("{prefix}", topicPublish);
+  topic.replace("{device}", level(deviceId));
+  topic.replace("{device_name}", level(deviceName));
+  topic.replace("{register}", level(registerId));
+  topic.replace("{register_name}", level(registerName));
+  return topic;
+}
+
+void MqttManager::compileTopicPlan() {
+  topicPlan.clear();
+  lastPlanCompile = millis();
+
+  if (topicTemplate.isEmpty()) {
+    topicPlan[""] = topicPublish;
+    return;
+  }
+
+  JsonDocument devicesDoc(PsramAllocator::instance());
+  JsonDocument deviceDoc(PsramAllocator::instance());
+  JsonArray devices = devicesDoc.to<JsonArray>();
+  configManager->listDevices(devices);
+  for (JsonVariant deviceVar : devices) {
+    String deviceId = deviceVar.as<String>();
+    JsonObject device = deviceDoc.to<JsonObject>();
+    if (!configManager->readDevice(deviceId, device)) {
+      continue;
+    }
+
+    String deviceName = device["device_name"] | deviceId.c_str();
+    for (JsonVariant reg : device["registers"].as<JsonArray>()) {
+      String registerId = reg["register_id"] | "";
+      if (registerId.isEmpty()) continue;
+      topicPlan[routeKey(deviceId.c_str(), registerId.c_str())] =
+        expandTopic(deviceId, deviceName, registerId, reg["register_name"] | registerId.c_str());
+    }
+  }
+
+  Serial.printf("[MQTT] Topic plan compiled: %u routes\n", (unsigned)topicPlan.size());
+}
+
+void MqttManager::applyConfigChanges() {
+  if (!changeQueue) return;
+
+  // Any number of queued events collapses into one recompile
+  ConfigChange change;
+  bool changed = false;
+  while (xQueueReceive(changeQueue, &change, 0) == pdTRUE) {
+    changed = true;
+  }
+  if (!changed) return;
+
+  if (payloadFormat == PayloadFormat::SPARKPLUG_B) {
+    sparkplug.requestRebirth();
+  } else if (!topicTemplate.isEmpty()) {
+    compileTopicPlan();
+  }
+}
+
+String MqttManager::routeKey(const char* deviceId, const char* registerId) {
+  String key = deviceId;
+  key += '/';
+  key += registerId;
+  return key;
+}
+
+const String& MqttManager::routeFor(JsonObjectConst dataPoint) {
+  const char* deviceId = dataPoint["device_id"] | "";
+  const char* registerId = dataPoint["register_id"] | "";
+  String key = topicTemplate.isEmpty() ? String() : routeKey(deviceId, registerId);
+  auto it = topicPlan.find(key);
+  if (it != topicPlan.end()) {
+    return it->second;
+  }
+
+  // Register added since the last compile; recompile at most every 5 s
+  if (millis() - lastPlanCompile > 5000) {
+    compileTopicPlan();
+    it = topicPlan.find(key);
+    if (it != topicPlan.end()) {
+      return it->second;
+    }
+  }
+
+  // Still unknown: derive the topic from the sample itself
+  String device = deviceId[0] ? deviceId : "unknown";
+  String& topic = topicPlan[key];
+  topic = topicTemplate.isEmpty()
+            ? topicPublish
+            : expandTopic(device, device, registerId, dataPoint["name"] | registerId);
+  return topic;
+}
+
+void MqttManager::resetTopicAliases() {
+  aliasSlots.clear();
+  aliasByTopic.clear();
+}
+
+uint16_t MqttManager::aliasFor(const String& topic) {
+  uint16_t aliasMax = protocolVersion == MQTT_PROTOCOL_V5 ? mqttClient.getTopicAliasMax() : 0;
+  if (aliasMax == 0) {
+    return 0;
+  }
+
+  aliasClock++;
+  auto it = aliasByTopic.find(topic);
+  if (it != aliasByTopic.end()) {
+    aliasSlots[it->second - 1].lastUsed = aliasClock;
+    return it->second;
+  }
+
+  uint16_t alias;
+  if (aliasSlots.size() < aliasMax) {
+    aliasSlots.push_back({ topic, aliasClock });
+    alias = aliasSlots.size();
+  } else {
+    size_t oldest = 0;
+    for (size_t i = 1; i < aliasSlots.size(); i++) {
+      if ((int32_t)(aliasSlots[i].lastUsed - aliasSlots[oldest].lastUsed) < 0) {
+        oldest = i;
+      }
+    }
+    alias = oldest + 1;
+    aliasByTopic.erase(aliasSlots[oldest].topic);
+    aliasSlots[oldest] = { topic, aliasClock };
+    mqttClient.forgetTopicAlias(alias);  // Resend the topic to rebind it
+    aliasRebinds++;
+  }
+  aliasByTopic[topic] = alias;
+  return alias;
+}
+
+size_t MqttManager::encodeSample(JsonObjectConst dataPoint) {
+  unsigned long start = micros();
+  size_t len;
+  if (payloadFormat == PayloadFormat::SPARKPLUG_B) {
+    len = sparkplug.encodeData(dataPoint, encodeBuffer, MQTT_ENCODE_BUFFER_SIZE);
+  } else {
+    len = PayloadEncoder::encode(payloadFormat, dataPoint, encodeBuffer, MQTT_ENCODE_BUFFER_SIZE);
+  }
+
+  if (len > 0) {
+    encodeMicros += micros() - start;
+    encodedBytes += len;
+    encodedCount++;
+  }
+  return len;
+}
+
+void MqttManager::recordLatency(unsigned long enqueuedAt) {
+  uint32_t latency = millis() - enqueuedAt;
+  latencyTotalMs += latency;
+  latencyCount++;
+  if (latency > latencyMaxMs) {
+    latencyMaxMs = latency;
+  }
+}
+
+bool MqttManager::publishBirth() {
+  // Sized for the current register count so large models still fit
+  size_t registers = configManager ? configManager->getRegisterCount() : 0;
+  size_t capacity = SparkplugEncoder::birthCapacity(registers);
+  if (capacity > MQTT_BIRTH_MAX_BUFFER_SIZE) {
+    lastBirthError = "NBIRTH for " + String(registers) + " registers exceeds " +
+                     String(MQTT_BIRTH_MAX_BUFFER_SIZE) + " bytes";
+    return false;
+  }
+
+  uint8_t* birth = (uint8_t*)heap_caps_malloc(capacity, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!birth) {
+    birth = (uint8_t*)malloc(capacity);
+  }
+  if (!birth) {
+    lastBirthError = "Failed to allocate " + String(capacity) + " byte NBIRTH buffer";
+    return false;
+  }
+
+  size_t len = sparkplug.encodeBirth(configManager, birth, capacity);
+  bool published = false;
+  if (len > 0) {
+    String topic = sparkplug.topicFor("NBIRTH");
+    published = mqttClient.publish(topic.c_str(), birth, len, 0, false);
+    Serial.printf("[MQTT] NBIRTH %s: %u metrics, %u bytes\n",
+                  published ? "published" : "failed", (unsigned)sparkplug.aliasCount(), (unsigned)len);
+    if (!published) {
+      lastBirthError = "Publish failed";
+    }
+  } else {
+    lastBirthError = "NBIRTH does not fit in " + String(capacity) + " byte buffer";
+  }
+
+  heap_caps_free(birth);
+  if (published) {
+    lastBirthError = "";
+  }
+  return published;
+}
+
 bool MqttManager::isNetworkAvailable() {
   if (!networkManager) return false;
 
@@ -291,9 +748,42 @@ void MqttManager::getStatus(JsonObject& status) {
   status["broker_port"] = brokerPort;
   status["client_id"] = clientId;
   status["topic_publish"] = topicPublish;
-  status["queue_size"] = queueManager->size();
+  status["queue_size"] = queueManager->pending(consumerId);
+  status["payload_format"] = PayloadEncoder::formatName(payloadFormat);
+  status["qos"] = publishQos;
+  status["inflight_window"] = inflightWindow;
+  status["inflight"] = outbox.size();
+  status["acked"] = ackedCount;
+  status["retransmitted"] = retransmitCount;
+  status["protocol_version"] = protocolVersion == MQTT_PROTOCOL_V5 ? 5 : 4;
+  status["topic_template"] = topicTemplate;
+  status["topic_routes"] = topicPlan.size();
+  status["topic_alias_max"] = mqttClient.getTopicAliasMax();
+  status["topic_aliases_bound"] = aliasSlots.size();
+  status["topic_alias_rebinds"] = aliasRebinds;
+  uint32_t publishes = mqttClient.getPublishCount();
+  status["avg_publish_wire_bytes"] = publishes ? (double)mqttClient.getPublishBytes() / publishes : 0.0;
+  status["avg_latency_ms"] = latencyCount ? (double)latencyTotalMs / latencyCount : 0.0;
+  status["max_latency_ms"] = latencyMaxMs;
+  status["encoded_samples"] = encodedCount;
+  status["avg_payload_bytes"] = encodedCount ? (double)encodedBytes / encodedCount : 0.0;
+  status["avg_encode_us"] = encodedCount ? (double)encodeMicros / encodedCount : 0.0;
+  if (payloadFormat == PayloadFormat::SPARKPLUG_B) {
+    status["sparkplug_aliases"] = sparkplug.aliasCount();
+    status["sparkplug_unknown_dropped"] = unknownMetricDrops;
+    status["sparkplug_birth_failures"] = birthFailures;
+    status["sparkplug_last_birth_error"] = lastBirthError;
+  }
 }
 
 MqttManager::~MqttManager() {
   stop();
+  if (changeQueue) {
+    configManager->removeChangeListener(changeQueue);
+    vQueueDelete(changeQueue);
+  }
+  clearOutbox();
+  if (encodeBuffer) {
+    heap_caps_free(encodeBuffer);
+  }
 }
\ No newline at end of file
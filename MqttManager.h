@@ -2,13 +2,24 @@
 #define MQTT_MANAGER_H
 
 #include <WiFi.h>
-#include <PubSubClient.h>
 #include <ArduinoJson.h>
 #include "ConfigManager.h"
 #include "ServerConfig.h"
 #include "QueueManager.h"
 #include "NetworkManager.h"
+#include "PayloadEncoder.h"
+#include "SparkplugEncoder.h"
+#include "MqttClient.h"
 #include <Ethernet.h>
+#include <deque>
+#include <map>
+#include <vector>
+
+#define MQTT_ENCODE_BUFFER_SIZE 512
+#define MQTT_BIRTH_MAX_BUFFER_SIZE 262144  // Upper bound for the register-sized NBIRTH buffer
+#define MQTT_BIRTH_RETRY_MS 30000          // Back-off after an NBIRTH could not be built or sent
+#define MQTT_MAX_INFLIGHT_WINDOW 64
+#define MQTT_ACK_POLL_MS 20  // Socket poll interval while QoS 1 messages await PUBACK
 
 class MqttManager {
 private:
@@ -17,7 +28,8 @@ private:
   QueueManager* queueManager;
   ServerConfig* serverConfig;
   NetworkMgr* networkManager;
-  PubSubClient mqttClient;
+  MqttClient mqttClient;
+  int consumerId;  // Cursor over the shared sample queue
 
   bool running;
   TaskHandle_t taskHandle;
@@ -28,8 +40,66 @@ private:
   String username;
   String password;
   String topicPublish;
+  int keepAlive;
+  bool cleanSession;
   unsigned long lastReconnectAttempt;
 
+  // QoS 1 outbox: encoded samples stay here until the broker PUBACKs them
+  struct OutboxEntry {
+    uint16_t packetId;
+    String topic;
+    uint8_t* payload;  // PSRAM copy of the encoded sample
+    size_t length;
+    bool sent;         // Written at least once (retransmits carry DUP)
+  };
+  std::deque<OutboxEntry> outbox;
+  uint8_t publishQos;
+  int inflightWindow;
+  uint32_t ackedCount;
+  uint32_t retransmitCount;
+
+  // Per-register topics compiled from topic_template. Register ids are only
+  // unique within a device, so routes are keyed by "device_id/register_id".
+  uint8_t protocolVersion;
+  String topicTemplate;
+  std::map<String, String> topicPlan;  // route key -> topic
+  unsigned long lastPlanCompile;
+
+  // MQTT 5 topic aliases of the current connection, 1..Topic Alias Maximum.
+  // When all are bound the least recently used one is rebound, and the
+  // topic is sent along with it again.
+  struct AliasSlot {
+    String topic;
+    uint32_t lastUsed;
+  };
+  std::vector<AliasSlot> aliasSlots;  // Index = alias - 1
+  std::map<String, uint16_t> aliasByTopic;
+  uint32_t aliasClock;
+  uint32_t aliasRebinds;
+  QueueHandle_t changeQueue;  // ConfigChange events; device/register edits recompile the plan
+
+  // Payload encoding
+  PayloadFormat payloadFormat;
+  SparkplugEncoder sparkplug;
+  uint8_t* encodeBuffer;
+  uint32_t encodedCount;
+  uint64_t encodedBytes;
+  uint64_t encodeMicros;
+
+  // Sparkplug rebirths: a sample whose register is still unknown after the
+  // NBIRTH it triggered is dropped rather than rebirthing again
+  bool rebirthForSample;
+  uint32_t rebirthSampleSeq;
+  uint32_t unknownMetricDrops;
+  uint32_t birthFailures;
+  unsigned long birthRetryAt;
+  String lastBirthError;
+
+  // Time from enqueue (acquisition) to the publish being written
+  uint32_t latencyCount;
+  uint64_t latencyTotalMs;
+  uint32_t latencyMaxMs;
+
   MqttManager(ConfigManager* config, ServerConfig* serverCfg, NetworkMgr* netMgr);
 
   static void mqttTask(void* parameter);
@@ -37,6 +107,22 @@ private:
   bool connectToMqtt();
   void loadMqttConfig();
   void publishQueueData();
+  size_t encodeSample(JsonObjectConst dataPoint);
+  bool publishBirth();
+  void recordLatency(unsigned long enqueuedAt);
+  void compileTopicPlan();
+  void applyConfigChanges();
+  String expandTopic(const String& deviceId, const String& deviceName,
+                     const String& registerId, const String& registerName) const;
+  static String routeKey(const char* deviceId, const char* registerId);
+  const String& routeFor(JsonObjectConst dataPoint);
+  void resetTopicAliases();
+  uint16_t aliasFor(const String& topic);
+  bool publishToOutbox(const String& topic, size_t length);
+  int effectiveWindow();
+  void retransmitOutbox();
+  void handleAck(uint16_t packetId, uint8_t reasonCode);
+  void clearOutbox();
   void debugNetworkConnectivity();
   bool isNetworkAvailable();
 
@@ -0,0 +1,167 @@
+#include "PayloadEncoder.h"
+#include <string.h>
+
+// Minimal bounded CBOR writer (RFC 8949), enough for sample objects
+class CborWriter {
+private:
+  uint8_t* buffer;
+  size_t capacity;
+  size_t length;
+  bool overflow;
+
+  void put(uint8_t b) {
+    if (length < capacity) {
+      buffer[length++] = b;
+    } else {
+      overflow = true;
+    }
+  }
+
+  void putBigEndian(uint64_t value, int bytes) {
+    for (int i = bytes - 1; i >= 0; i--) {
+      put((uint8_t)(value >> (i * 8)));
+    }
+  }
+
+public:
+  CborWriter(uint8_t* buf, size_t cap)
+    : buffer(buf), capacity(cap), length(0), overflow(false) {}
+
+  void writeHead(uint8_t major, uint64_t value) {
+    major <<= 5;
+    if (value < 24) {
+      put(major | (uint8_t)value);
+    } else if (value <= 0xFF) {
+      put(major | 24);
+      putBigEndian(value, 1);
+    } else if (value <= 0xFFFF) {
+      put(major | 25);
+      putBigEndian(value, 2);
+    } else if (value <= 0xFFFFFFFFULL) {
+      put(major | 26);
+      putBigEndian(value, 4);
+    } else {
+      put(major | 27);
+      putBigEndian(value, 8);
+    }
+  }
+
+  void writeInt(int64_t value) {
+    if (value >= 0) {
+      writeHead(0, (uint64_t)value);
+    } else {
+      writeHead(1, (uint64_t)(-1 - value));
+    }
+  }
+
+  void writeString(const char* str) {
+    size_t len = str ? strlen(str) : 0;
+    writeHead(3, len);
+    for (size_t i = 0; i < len; i++) {
+      put((uint8_t)str[i]);
+    }
+  }
+
+  void writeDouble(double value) {
+    // Use single precision whenever it round-trips exactly
+    float narrow = (float)value;
+    if ((double)narrow == value) {
+      uint32_t bits;
+      memcpy(&bits, &narrow, sizeof(bits));
+      put(0xFA);
+      putBigEndian(bits, 4);
+    } else {
+      uint64_t bits;
+      memcpy(&bits, &value, sizeof(bits));
+      put(0xFB);
+      putBigEndian(bits, 8);
+    }
+  }
+
+  void writeSimple(uint8_t value) {
+    put(0xE0 | value);
+  }
+
+  void writeVariant(JsonVariantConst v) {
+    if (v.is<JsonObjectConst>()) {
+      JsonObjectConst obj = v.as<JsonObjectConst>();
+      writeHead(5, obj.size());
+      for (JsonPairConst kv : obj) {
+        writeString(kv.key().c_str());
+        writeVariant(kv.value());
+      }
+    } else if (v.is<JsonArrayConst>()) {
+      JsonArrayConst arr = v.as<JsonArrayConst>();
+      writeHead(4, arr.size());
+      for (JsonVariantConst item : arr) {
+        writeVariant(item);
+      }
+    } else if (v.is<bool>()) {
+      writeSimple(v.as<bool>() ? 21 : 20);
+    } else if (v.is<long>()) {
+      writeInt(v.as<long>());
+    } else if (v.is<unsigned long>()) {
+      writeHead(0, v.as<unsigned long>());
+    } else if (v.is<double>()) {
+      writeDouble(v.as<double>());
+    } else if (v.is<const char*>()) {
+      writeString(v.as<const char*>());
+    } else {
+      writeSimple(22);  // null
+    }
+  }
+
+  size_t size() const {
+    return overflow ? 0 : length;
+  }
+};
+
+PayloadFormat PayloadEncoder::parseFormat(const String& name, PayloadFormat fallback) {
+  String lower = name;
+  lower.toLowerCase();
+  if (lower == "json") return PayloadFormat::JSON;
+  if (lower == "cbor") return PayloadFormat::CBOR;
+  if (lower == "msgpack" || lower == "messagepack") return PayloadFormat::MSGPACK;
+  if (lower == "sparkplug_b" || lower == "sparkplug") return PayloadFormat::SPARKPLUG_B;
+  return fallback;
+}
+
+const char* PayloadEncoder::formatName(PayloadFormat format) {
+  switch (format) {
+    case PayloadFormat::CBOR: return "cbor";
+    case PayloadFormat::MSGPACK: return "msgpack";
+    case PayloadFormat::SPARKPLUG_B: return "sparkplug_b";
+    default: return "json";
+  }
+}
+
+const char* PayloadEncoder::contentType(PayloadFormat format) {
+  switch (format) {
+    case PayloadFormat::CBOR: return "application/cbor";
+    case PayloadFormat::MSGPACK: return "application/msgpack";
+    case PayloadFormat::SPARKPLUG_B: return "application/x-protobuf";
+    default: return "application/json";
+  }
+}
+
+size_t PayloadEncoder::encode(PayloadFormat format, JsonVariantConst data, uint8_t* buffer, size_t capacity) {
+  switch (format) {
+    case PayloadFormat::CBOR:
+      return encodeCbor(data, buffer, capacity);
+    case PayloadFormat::MSGPACK:
+      if (measureMsgPack(data) > capacity) return 0;
+      return serializeMsgPack(data, buffer, capacity);
+    case PayloadFormat::JSON:
+      // serializeJson() null-terminates, so keep one spare byte
+      if (measureJson(data) >= capacity) return 0;
+      return serializeJson(data, (char*)buffer, capacity);
+    default:
+      return 0;
+  }
+}
+
+size_t PayloadEncoder::encodeCbor(JsonVariantConst data, uint8_t* buffer, size_t capacity) {
+  CborWriter writer(buffer, capacity);
+  writer.writeVariant(data);
+  return writer.size();
+}
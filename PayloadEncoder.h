@@ -0,0 +1,29 @@
+#ifndef PAYLOAD_ENCODER_H
+#define PAYLOAD_ENCODER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+// Wire encodings available for uplink samples
+enum class PayloadFormat : uint8_t {
+  JSON,
+  CBOR,
+  MSGPACK,
+  SPARKPLUG_B
+};
+
+class PayloadEncoder {
+public:
+  // Accepts "json", "cbor", "msgpack" and "sparkplug_b" (case-insensitive)
+  static PayloadFormat parseFormat(const String& name, PayloadFormat fallback = PayloadFormat::JSON);
+  static const char* formatName(PayloadFormat format);
+  static const char* contentType(PayloadFormat format);
+
+  // Encode one sample into buffer. Returns the number of bytes written,
+  // or 0 if the buffer is too small. SPARKPLUG_B is stateful and is
+  // handled by SparkplugEncoder instead.
+  static size_t encode(PayloadFormat format, JsonVariantConst data, uint8_t* buffer, size_t capacity);
+  static size_t encodeCbor(JsonVariantConst data, uint8_t* buffer, size_t capacity);
+};
+
+#endif
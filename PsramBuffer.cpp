@@ -0,0 +1,59 @@
+#include "PsramBuffer.h"
+#include <esp_heap_caps.h>
+
+PsramBuffer::PsramBuffer(size_t maxSize)
+  : buffer(nullptr), length(0), capacity(0), maxSize(maxSize), overflow(false) {}
+
+PsramBuffer::~PsramBuffer() {
+  if (buffer) {
+    heap_caps_free(buffer);
+  }
+}
+
+bool PsramBuffer::reserve(size_t needed) {
+  if (needed <= capacity) {
+    return true;
+  }
+  if (needed > maxSize) {
+    return false;
+  }
+
+  // Grow geometrically so a batch body costs only a few reallocations
+  size_t newCapacity = capacity ? capacity : 512;
+  while (newCapacity < needed) {
+    newCapacity *= 2;
+  }
+  newCapacity = min(newCapacity, maxSize);
+
+  uint8_t* grown = (uint8_t*)heap_caps_realloc(buffer, newCapacity, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (!grown) {
+    grown = (uint8_t*)heap_caps_realloc(buffer, newCapacity, MALLOC_CAP_8BIT);  // Fallback to internal RAM
+  }
+  if (!grown) {
+    return false;
+  }
+
+  buffer = grown;
+  capacity = newCapacity;
+  return true;
+}
+
+size_t PsramBuffer::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+size_t PsramBuffer::write(const uint8_t* data, size_t len) {
+  if (overflow || !reserve(length + len)) {
+    overflow = true;
+    return 0;
+  }
+  memcpy(buffer + length, data, len);
+  length += len;
+  return len;
+}
+
+void PsramBuffer::clear() {
+  // Keep the allocation for the next batch
+  length = 0;
+  overflow = false;
+}
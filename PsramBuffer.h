@@ -0,0 +1,37 @@
+#ifndef PSRAM_BUFFER_H
+#define PSRAM_BUFFER_H
+
+#include <Arduino.h>
+
+// Growable byte buffer in PSRAM that encoders can write into through Print.
+// Writes past maxSize are dropped and flag an overflow instead of growing.
+class PsramBuffer : public Print {
+private:
+  uint8_t* buffer;
+  size_t length;
+  size_t capacity;
+  size_t maxSize;
+  bool overflow;
+
+  bool reserve(size_t needed);
+
+public:
+  explicit PsramBuffer(size_t maxSize = 65536);
+  ~PsramBuffer();
+
+  PsramBuffer(const PsramBuffer&) = delete;
+  PsramBuffer& operator=(const PsramBuffer&) = delete;
+
+  size_t write(uint8_t b) override;
+  size_t write(const uint8_t* data, size_t len) override;
+
+  void clear();
+  void setMaxSize(size_t size) { maxSize = size; }
+
+  const uint8_t* data() const { return buffer; }
+  uint8_t* data() { return buffer; }
+  size_t size() const { return length; }
+  bool overflowed() const { return overflow; }
+};
+
+#endif
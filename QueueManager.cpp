@@ -4,7 +4,12 @@
 QueueManager* QueueManager::instance = nullptr;
 
 QueueManager::QueueManager()
-  : dataQueue(nullptr), streamQueue(nullptr), queueMutex(nullptr), streamMutex(nullptr) {}
+  : ring(nullptr), headSeq(0), tailSeq(0), droppedCount(0),
+    queueMutex(nullptr), queueEvents(nullptr) {
+  for (Consumer& consumer : consumers) {
+    consumer = { false, "", 0, 0 };
+  }
+}
 
 QueueManager* QueueManager::getInstance() {
   if (instance == nullptr) {
@@ -14,9 +19,12 @@ QueueManager* QueueManager::getInstance() {
 }
 
 bool QueueManager::init() {
-  // Create FreeRTOS queue for data points
-  dataQueue = xQueueCreate(MAX_QUEUE_SIZE, sizeof(char*));
-  if (dataQueue == nullptr) {
+  // Sequence-numbered ring for data points, slots in PSRAM
+  ring = (QueueItem*)heap_caps_calloc(MAX_QUEUE_SIZE, sizeof(QueueItem), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (ring == nullptr) {
+    ring = (QueueItem*)calloc(MAX_QUEUE_SIZE, sizeof(QueueItem));  // Fallback to internal RAM
+  }
+  if (ring == nullptr) {
     Serial.println("Failed to create data queue");
     return false;
   }
@@ -28,17 +36,10 @@ bool QueueManager::init() {
     return false;
   }
 
-  // Create streaming queue
-  streamQueue = xQueueCreate(MAX_STREAM_QUEUE_SIZE, sizeof(char*));
-  if (streamQueue == nullptr) {
-    Serial.println("Failed to create stream queue");
-    return false;
-  }
-
-  // Create streaming mutex
-  streamMutex = xSemaphoreCreateMutex();
-  if (streamMutex == nullptr) {
-    Serial.println("Failed to create stream mutex");
+  // Wakes uplink tasks when producers add data
+  queueEvents = xEventGroupCreate();
+  if (queueEvents == nullptr) {
+    Serial.println("Failed to create queue event group");
     return false;
   }
 
@@ -46,88 +47,172 @@ bool QueueManager::init() {
   return true;
 }
 
-bool QueueManager::enqueue(const JsonObject& dataPoint) {
-  // Serialize JSON to string first, outside the mutex
-  String jsonString;
-  serializeJson(dataPoint, jsonString);
+bool QueueManager::copyItem(const QueueItem& item, JsonObject& dataPoint) {
+  // --- PERUBAHAN DI SINI ---
+  StaticJsonDocument<512> doc; // Mengganti JsonDocument(512)
+  // --- AKHIR PERUBAHAN ---
 
-  if (xSemaphoreTake(queueMutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+  if (deserializeJson(doc, item.json) != DeserializationError::Ok) {
     return false;
   }
+  JsonObject obj = doc.as<JsonObject>();
+  for (JsonPair kv : obj) {
+    dataPoint[kv.key()] = kv.value();
+  }
+  return true;
+}
+
+void QueueManager::freeHead() {
+  QueueItem& item = ring[headSeq % MAX_QUEUE_SIZE];
+  heap_caps_free(item.json);  // Gunakan heap_caps_free jika dialokasikan di PSRAM/heap
+  item.json = nullptr;
+  headSeq++;
+}
 
-  // Check if queue is full
-  if (uxQueueMessagesWaiting(dataQueue) >= MAX_QUEUE_SIZE) {
-    // Remove oldest item to make space
-    char* oldItem;
-    if (xQueueReceive(dataQueue, &oldItem, 0) == pdTRUE) {
-      heap_caps_free(oldItem); // Gunakan heap_caps_free jika dialokasikan di PSRAM/heap
+void QueueManager::releaseConsumed() {
+  // Items stay in the ring until the slowest registered consumer has passed
+  // them; with no consumer at all they are kept for the next one to register
+  uint32_t oldest = tailSeq;
+  bool anyActive = false;
+  for (const Consumer& consumer : consumers) {
+    if (consumer.active) {
+      anyActive = true;
+      if ((int32_t)(consumer.cursor - oldest) < 0) {
+        oldest = consumer.cursor;
+      }
     }
   }
+  if (!anyActive) {
+    return;
+  }
+  while ((int32_t)(oldest - headSeq) > 0) {
+    freeHead();
+  }
+}
 
-  // Allocate memory for string in PSRAM
-  char* jsonCopy = (char*)heap_caps_malloc(jsonString.length() + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-  if (jsonCopy == nullptr) {
-    // Fallback to internal RAM
-    jsonCopy = (char*)malloc(jsonString.length() + 1);
-    if (jsonCopy == nullptr) {
-      xSemaphoreGive(queueMutex);
-      return false;
+EventBits_t QueueManager::consumerBits() {
+  EventBits_t bits = 0;
+  for (int i = 0; i < MAX_QUEUE_CONSUMERS; i++) {
+    if (consumers[i].active) {
+      bits |= QUEUE_EVENT_CONSUMER(i);
     }
   }
+  return bits;
+}
 
-  strcpy(jsonCopy, jsonString.c_str());
+int QueueManager::addConsumer(const char* name) {
+  if (queueMutex == nullptr || xSemaphoreTake(queueMutex, portMAX_DELAY) != pdTRUE) {
+    return -1;
+  }
 
-  // Add to queue
-  bool success = xQueueSend(dataQueue, &jsonCopy, 0) == pdTRUE;
+  int id = -1;
+  for (int i = 0; i < MAX_QUEUE_CONSUMERS; i++) {
+    if (consumers[i].active && strcmp(consumers[i].name, name) == 0) {
+      id = i;  // Already registered (service restarted)
+      break;
+    }
+    if (!consumers[i].active && id < 0) {
+      id = i;
+    }
+  }
+  if (id >= 0 && !consumers[id].active) {
+    // A new consumer starts with everything still retained in the ring
+    consumers[id].active = true;
+    consumers[id].name = name;
+    consumers[id].cursor = headSeq;
+    consumers[id].dropped = 0;
+  }
+
+  xSemaphoreGive(queueMutex);
 
-  if (success) {
-    // Serial.printf("Data queued: %s\n", dataPoint["name"].as<String>().c_str()); // Uncomment jika perlu debug
+  if (id < 0) {
+    Serial.printf("No free queue consumer slot for %s\n", name);
   } else {
-    heap_caps_free(jsonCopy); // free jika gagal enqueue
+    Serial.printf("Queue consumer %d registered: %s\n", id, name);
   }
+  return id;
+}
 
+void QueueManager::removeConsumer(int consumer) {
+  if (consumer < 0 || consumer >= MAX_QUEUE_CONSUMERS || queueMutex == nullptr) {
+    return;
+  }
+  if (xSemaphoreTake(queueMutex, portMAX_DELAY) != pdTRUE) {
+    return;
+  }
+  consumers[consumer].active = false;
+  releaseConsumed();
   xSemaphoreGive(queueMutex);
-  return success;
 }
 
-bool QueueManager::dequeue(JsonObject& dataPoint) {
-  if (dataQueue == nullptr || queueMutex == nullptr) {
+bool QueueManager::enqueue(const JsonObject& dataPoint, unsigned long enqueuedAt) {
+  if (ring == nullptr || queueMutex == nullptr) {
     return false;
   }
 
-  char* jsonString = nullptr;
-  if (xSemaphoreTake(queueMutex, pdMS_TO_TICKS(100)) == pdTRUE) {
-    if (xQueueReceive(dataQueue, &jsonString, 0) != pdTRUE) {
-      jsonString = nullptr;
+  // Serialize JSON to string first, outside the mutex
+  String jsonString;
+  serializeJson(dataPoint, jsonString);
+
+  // Allocate memory for string in PSRAM
+  char* jsonCopy = (char*)heap_caps_malloc(jsonString.length() + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (jsonCopy == nullptr) {
+    // Fallback to internal RAM
+    jsonCopy = (char*)malloc(jsonString.length() + 1);
+    if (jsonCopy == nullptr) {
+      return false;
     }
-    xSemaphoreGive(queueMutex);
   }
+  strcpy(jsonCopy, jsonString.c_str());
 
-  if (jsonString == nullptr) {
+  if (xSemaphoreTake(queueMutex, pdMS_TO_TICKS(100)) != pdTRUE) {
+    heap_caps_free(jsonCopy);
     return false;
   }
 
-  // --- PERUBAHAN DI SINI ---
-  StaticJsonDocument<512> doc; // Mengganti JsonDocument(512)
-  // --- AKHIR PERUBAHAN ---
+  // Check if queue is full: remove oldest item to make space. Consumers
+  // that had not read it yet skip ahead and count the loss.
+  if (tailSeq - headSeq >= (uint32_t)MAX_QUEUE_SIZE) {
+    freeHead();
+    droppedCount++;
+    for (Consumer& consumer : consumers) {
+      if (consumer.active && (int32_t)(consumer.cursor - headSeq) < 0) {
+        consumer.cursor = headSeq;
+        consumer.dropped++;
+      }
+    }
+  }
 
-  DeserializationError error = deserializeJson(doc, jsonString);
-  bool success = false;
+  // One stored copy is shared by every consumer
+  ring[tailSeq % MAX_QUEUE_SIZE] = { jsonCopy, enqueuedAt ? enqueuedAt : millis() };
+  tailSeq++;
+  // Serial.printf("Data queued: %s\n", dataPoint["name"].as<String>().c_str()); // Uncomment jika perlu debug
 
-  if (error == DeserializationError::Ok) {
-    JsonObject obj = doc.as<JsonObject>();
-    for (JsonPair kv : obj) {
-      dataPoint[kv.key()] = kv.value();
-    }
-    success = true;
+  EventBits_t bits = consumerBits();
+  xSemaphoreGive(queueMutex);
+
+  if (queueEvents && bits) {
+    xEventGroupSetBits(queueEvents, bits);
   }
+  return true;
+}
 
-  heap_caps_free(jsonString); // Selalu free string setelah di-deserialize
-  return success;
+bool QueueManager::dequeue(int consumer, JsonObject& dataPoint, unsigned long* enqueuedAt) {
+  uint32_t nextSeq;
+  if (!peekFrom(cursor(consumer), dataPoint, &nextSeq, enqueuedAt)) {
+    return false;
+  }
+  commitThrough(consumer, nextSeq);
+  return true;
+}
+
+bool QueueManager::peek(int consumer, JsonObject& dataPoint) {
+  uint32_t nextSeq;
+  return peekFrom(cursor(consumer), dataPoint, &nextSeq);
 }
 
-bool QueueManager::peek(JsonObject& dataPoint) {
-  if (dataQueue == nullptr || queueMutex == nullptr) {
+bool QueueManager::peekFrom(uint32_t sequence, JsonObject& dataPoint, uint32_t* nextSeq, unsigned long* enqueuedAt) {
+  if (ring == nullptr || queueMutex == nullptr) {
     return false;
   }
 
@@ -135,51 +220,78 @@ bool QueueManager::peek(JsonObject& dataPoint) {
     return false;
   }
 
-  char* jsonString;
-  bool success = false;
-
-  if (xQueuePeek(dataQueue, &jsonString, 0) == pdTRUE) {
-    // --- PERUBAHAN DI SINI ---
-    StaticJsonDocument<512> doc; // Mengganti JsonDocument(512)
-    // --- AKHIR PERUBAHAN ---
-    DeserializationError error = deserializeJson(doc, jsonString);
+  // Items older than the head were dropped on overflow; continue from the head
+  if ((int32_t)(sequence - headSeq) < 0) {
+    sequence = headSeq;
+  }
 
-    if (error == DeserializationError::Ok) {
-      JsonObject obj = doc.as<JsonObject>();
-      for (JsonPair kv : obj) {
-        dataPoint[kv.key()] = kv.value();
-      }
-      success = true;
+  bool success = false;
+  while (sequence != tailSeq && !success) {
+    const QueueItem& item = ring[sequence % MAX_QUEUE_SIZE];
+    success = item.json && copyItem(item, dataPoint);
+    if (success && enqueuedAt) {
+      *enqueuedAt = item.enqueuedAt;
     }
+    sequence++;  // Unparseable items are skipped
   }
+  *nextSeq = sequence;
 
   xSemaphoreGive(queueMutex);
   return success;
 }
 
-bool QueueManager::isEmpty() {
-  if (dataQueue == nullptr) {
-    return true;
+void QueueManager::commitThrough(int consumer, uint32_t sequence) {
+  if (ring == nullptr || queueMutex == nullptr || consumer < 0 || consumer >= MAX_QUEUE_CONSUMERS) {
+    return;
+  }
+
+  if (xSemaphoreTake(queueMutex, portMAX_DELAY) != pdTRUE) {
+    return;
   }
-  return uxQueueMessagesWaiting(dataQueue) == 0;
+  Consumer& entry = consumers[consumer];
+  if (entry.active && (int32_t)(sequence - entry.cursor) > 0 && (int32_t)(sequence - tailSeq) <= 0) {
+    entry.cursor = sequence;
+    releaseConsumed();
+  }
+  xSemaphoreGive(queueMutex);
 }
 
-bool QueueManager::isFull() {
-  if (dataQueue == nullptr) {
-    return false;
+uint32_t QueueManager::cursor(int consumer) {
+  if (consumer < 0 || consumer >= MAX_QUEUE_CONSUMERS) {
+    return tailSeq;
+  }
+  return consumers[consumer].cursor;
+}
+
+int QueueManager::pending(int consumer) {
+  if (ring == nullptr || consumer < 0 || consumer >= MAX_QUEUE_CONSUMERS || !consumers[consumer].active) {
+    return 0;
+  }
+  uint32_t from = consumers[consumer].cursor;
+  uint32_t head = headSeq;
+  if ((int32_t)(from - head) < 0) {
+    from = head;
   }
-  return uxQueueMessagesWaiting(dataQueue) >= MAX_QUEUE_SIZE;
+  return (int)(tailSeq - from);
+}
+
+bool QueueManager::isEmpty() {
+  return size() == 0;
+}
+
+bool QueueManager::isFull() {
+  return size() >= MAX_QUEUE_SIZE;
 }
 
 int QueueManager::size() {
-  if (dataQueue == nullptr) {
+  if (ring == nullptr) {
     return 0;
   }
-  return uxQueueMessagesWaiting(dataQueue);
+  return (int)(tailSeq - headSeq);
 }
 
 void QueueManager::clear() {
-  if (dataQueue == nullptr || queueMutex == nullptr) {
+  if (ring == nullptr || queueMutex == nullptr) {
     return;
   }
 
@@ -187,9 +299,11 @@ void QueueManager::clear() {
     return;
   }
 
-  char* jsonString;
-  while (xQueueReceive(dataQueue, &jsonString, 0) == pdTRUE) {
-    heap_caps_free(jsonString);
+  while (headSeq != tailSeq) {
+    freeHead();
+  }
+  for (Consumer& consumer : consumers) {
+    consumer.cursor = tailSeq;
   }
 
   xSemaphoreGive(queueMutex);
@@ -201,119 +315,45 @@ void QueueManager::getStats(JsonObject& stats) {
   stats["max_size"] = MAX_QUEUE_SIZE;
   stats["is_empty"] = isEmpty();
   stats["is_full"] = isFull();
-}
-
-bool QueueManager::enqueueStream(const JsonObject& dataPoint) {
-  if (streamQueue == nullptr || streamMutex == nullptr) {
-    return false;
-  }
-
-  if (xSemaphoreTake(streamMutex, pdMS_TO_TICKS(10)) != pdTRUE) {
-    return false;
-  }
-
-  // Remove oldest if full
-  if (uxQueueMessagesWaiting(streamQueue) >= MAX_STREAM_QUEUE_SIZE) {
-    char* oldItem;
-    if (xQueueReceive(streamQueue, &oldItem, 0) == pdTRUE) {
-      heap_caps_free(oldItem); // Gunakan heap_caps_free
-    }
-  }
-
-  String jsonString;
-  serializeJson(dataPoint, jsonString);
-
-  char* jsonCopy = (char*)heap_caps_malloc(jsonString.length() + 1, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-  if (jsonCopy == nullptr) {
-    jsonCopy = (char*)malloc(jsonString.length() + 1);
-    if (jsonCopy == nullptr) {
-      xSemaphoreGive(streamMutex);
-      return false;
-    }
-  }
-
-  strcpy(jsonCopy, jsonString.c_str());
-  bool success = xQueueSend(streamQueue, &jsonCopy, 0) == pdTRUE;
-
-  if (success) {
-    // Serial.printf("Stream queue: Added data, size now: %d\n", uxQueueMessagesWaiting(streamQueue)); // Uncomment jika perlu debug
-  } else {
-    Serial.println("Stream queue: Failed to add data");
-    heap_caps_free(jsonCopy); // free jika gagal enqueue
-  }
-
-  xSemaphoreGive(streamMutex);
-  return success;
-}
-
-bool QueueManager::dequeueStream(JsonObject& dataPoint) {
-  if (streamQueue == nullptr || streamMutex == nullptr) {
-    return false;
-  }
-
-  if (xSemaphoreTake(streamMutex, pdMS_TO_TICKS(10)) != pdTRUE) {
-    return false;
-  }
-
-  char* jsonString = nullptr;
-  bool success = false;
-
-  if (xQueueReceive(streamQueue, &jsonString, 0) == pdTRUE) {
-    // Serial.printf("Stream queue: Dequeued data, size now: %d\n", uxQueueMessagesWaiting(streamQueue)); // Uncomment jika perlu debug
-    
-    // --- PERUBAHAN DI SINI ---
-    StaticJsonDocument<512> doc; // Mengganti JsonDocument(512)
-    // --- AKHIR PERUBAHAN ---
-
-    if (deserializeJson(doc, jsonString) == DeserializationError::Ok) {
-      JsonObject obj = doc.as<JsonObject>();
-      for (JsonPair kv : obj) {
-        dataPoint[kv.key()] = kv.value();
-      }
-      success = true;
+  stats["dropped"] = droppedCount;
+  stats["head_seq"] = headSeq;
+  stats["tail_seq"] = tailSeq;
+
+  JsonArray list = stats["consumers"].to<JsonArray>();
+  for (int i = 0; i < MAX_QUEUE_CONSUMERS; i++) {
+    if (!consumers[i].active) {
+      continue;
     }
-    heap_caps_free(jsonString); // Selalu free string setelah di-deserialize
+    JsonObject entry = list.add<JsonObject>();
+    entry["name"] = consumers[i].name;
+    entry["pending"] = pending(i);
+    entry["dropped"] = consumers[i].dropped;
   }
-
-  xSemaphoreGive(streamMutex);
-  return success;
 }
 
-bool QueueManager::isStreamEmpty() {
-  if (streamQueue == nullptr) return true;
-  return uxQueueMessagesWaiting(streamQueue) == 0;
-}
-
-void QueueManager::clearStream() {
-  if (streamQueue == nullptr || streamMutex == nullptr) {
-    return;
-  }
-
-  if (xSemaphoreTake(streamMutex, pdMS_TO_TICKS(100)) != pdTRUE) {
-    return;
+bool QueueManager::waitForData(int consumer, TickType_t timeout) {
+  if (pending(consumer) > 0) {
+    return true;
   }
-
-  char* jsonString;
-  while (xQueueReceive(streamQueue, &jsonString, 0) == pdTRUE) {
-    heap_caps_free(jsonString);
+  if (queueEvents == nullptr || consumer < 0 || consumer >= MAX_QUEUE_CONSUMERS) {
+    vTaskDelay(timeout == portMAX_DELAY ? pdMS_TO_TICKS(1000) : timeout);
+    return pending(consumer) > 0;
   }
 
-  xSemaphoreGive(streamMutex);
+  // The bit is cleared on wake; an enqueue while the consumer drains sets it again
+  xEventGroupWaitBits(queueEvents, QUEUE_EVENT_CONSUMER(consumer), pdTRUE, pdFALSE, timeout);
+  return pending(consumer) > 0;
 }
 
 QueueManager::~QueueManager() {
   clear();
-  clearStream();
-  if (dataQueue) {
-    vQueueDelete(dataQueue);
-  }
-  if (streamQueue) {
-    vQueueDelete(streamQueue);
+  if (ring) {
+    heap_caps_free(ring);
   }
   if (queueMutex) {
     vSemaphoreDelete(queueMutex);
   }
-  if (streamMutex) {
-    vSemaphoreDelete(streamMutex);
+  if (queueEvents) {
+    vEventGroupDelete(queueEvents);
   }
-} 
\ No newline at end of file
+}
\ No newline at end of file
@@ -5,37 +5,83 @@
 #include <freertos/FreeRTOS.h>
 #include <freertos/queue.h>
 #include <freertos/semphr.h>
+#include <freertos/event_groups.h>
+
+// Event bits set by producers so consumer tasks can block instead of polling
+#define QUEUE_EVENT_CONSUMER(id) (BIT0 << (id))
+
+#define MAX_QUEUE_CONSUMERS 4
 
 class QueueManager {
 private:
   static QueueManager* instance;
-  QueueHandle_t dataQueue;
-  QueueHandle_t streamQueue;
   SemaphoreHandle_t queueMutex;
-  SemaphoreHandle_t streamMutex;
-  static const int MAX_QUEUE_SIZE = 100;
-  static const int MAX_STREAM_QUEUE_SIZE = 50;
+  EventGroupHandle_t queueEvents;
+  static const int MAX_QUEUE_SIZE = 1000;
+
+  // Queued sample with the time it was produced, for latency statistics
+  struct QueueItem {
+    char* json;
+    unsigned long enqueuedAt;
+  };
+
+  // Each uplink reads the shared ring through its own cursor
+  struct Consumer {
+    bool active;
+    const char* name;
+    uint32_t cursor;   // Next sequence this consumer has not committed
+    uint32_t dropped;  // Items lost to overflow before this consumer read them
+  };
+
+  // Data points live in a ring indexed by sequence number. headSeq is the
+  // oldest item some consumer still needs, tailSeq the next one to be
+  // written; both only grow (wrapping at 2^32), so readers can hold a
+  // position across calls.
+  QueueItem* ring;
+  volatile uint32_t headSeq;
+  volatile uint32_t tailSeq;
+  uint32_t droppedCount;
+  Consumer consumers[MAX_QUEUE_CONSUMERS];
 
   QueueManager();
+  bool copyItem(const QueueItem& item, JsonObject& dataPoint);
+  void freeHead();
+  void releaseConsumed();
+  EventBits_t consumerBits();
 
 public:
   static QueueManager* getInstance();
 
   bool init();
-  bool enqueue(const JsonObject& dataPoint);
-  bool dequeue(JsonObject& dataPoint);
-  bool peek(JsonObject& dataPoint);
+
+  // Every sample is stored once and delivered to each registered consumer.
+  // addConsumer() returns the id used below, or -1 if all slots are taken;
+  // registering an existing name returns its id and keeps its cursor.
+  int addConsumer(const char* name);
+  void removeConsumer(int consumer);
+
+  // enqueuedAt = 0 stamps the item with the current millis()
+  bool enqueue(const JsonObject& dataPoint, unsigned long enqueuedAt = 0);
+  bool dequeue(int consumer, JsonObject& dataPoint, unsigned long* enqueuedAt = nullptr);
+  bool peek(int consumer, JsonObject& dataPoint);
+
+  // Transactional reads: peekFrom() copies the first item at or after
+  // sequence without removing it and sets nextSeq past it; commitThrough()
+  // then moves the consumer's cursor to sequence once it was delivered.
+  bool peekFrom(uint32_t sequence, JsonObject& dataPoint, uint32_t* nextSeq, unsigned long* enqueuedAt = nullptr);
+  void commitThrough(int consumer, uint32_t sequence);
+  uint32_t cursor(int consumer);
+  int pending(int consumer);
+
   bool isEmpty();
   bool isFull();
   int size();
   void clear();
   void getStats(JsonObject& stats);
 
-  // Streaming queue methods
-  bool enqueueStream(const JsonObject& dataPoint);
-  bool dequeueStream(JsonObject& dataPoint);
-  bool isStreamEmpty();
-  void clearStream();
+  // Block until the consumer has unread data or the timeout expires
+  // (portMAX_DELAY = forever). Returns true if it has data.
+  bool waitForData(int consumer, TickType_t timeout);
 
   ~QueueManager();
 };
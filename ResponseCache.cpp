@@ -0,0 +1,106 @@
+#include "ResponseCache.h"
+#include <esp_heap_caps.h>
+
+CachedResponse::CachedResponse(const uint8_t* body, size_t size) : data(nullptr), length(0) {
+  data = (uint8_t*)heap_caps_malloc(size, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (data) {
+    memcpy(data, body, size);
+    length = size;
+  }
+}
+
+CachedResponse::~CachedResponse() {
+  if (data) {
+    heap_caps_free(data);
+  }
+}
+
+ResponseCache::ResponseCache() : bytes(0), hits(0), misses(0), evictions(0) {
+  mutex = xSemaphoreCreateMutex();
+  entries.reserve(RESPONSE_CACHE_MAX_ENTRIES);
+}
+
+ResponseCache::~ResponseCache() {
+  if (mutex) {
+    vSemaphoreDelete(mutex);
+  }
+}
+
+std::shared_ptr<CachedResponse> ResponseCache::get(const String& key, uint32_t version) {
+  std::shared_ptr<CachedResponse> found;
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  for (Entry& entry : entries) {
+    if (entry.version == version && entry.key == key) {
+      entry.lastUsed = millis();
+      found = entry.response;
+      break;
+    }
+  }
+  if (found) {
+    hits++;
+  } else {
+    misses++;
+  }
+  xSemaphoreGive(mutex);
+  return found;
+}
+
+void ResponseCache::evictOne() {
+  // Caller holds mutex; drops the least recently used entry
+  if (entries.empty()) {
+    return;
+  }
+  size_t victim = 0;
+  for (size_t i = 1; i < entries.size(); i++) {
+    if ((long)(entries[i].lastUsed - entries[victim].lastUsed) < 0) {
+      victim = i;
+    }
+  }
+  bytes -= entries[victim].response->length;
+  entries.erase(entries.begin() + victim);
+  evictions++;
+}
+
+void ResponseCache::put(const String& key, uint32_t version, const uint8_t* data, size_t length) {
+  if (length == 0 || length > RESPONSE_CACHE_MAX_BYTES / 2) {
+    return;  // A body this large would push out everything else
+  }
+  auto response = std::make_shared<CachedResponse>(data, length);
+  if (!response->data) {
+    return;
+  }
+
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  for (size_t i = 0; i < entries.size();) {
+    if (entries[i].key == key || entries[i].version != version) {
+      bytes -= entries[i].response->length;
+      entries.erase(entries.begin() + i);
+    } else {
+      i++;
+    }
+  }
+  while (!entries.empty() &&
+         (entries.size() >= RESPONSE_CACHE_MAX_ENTRIES || bytes + length > RESPONSE_CACHE_MAX_BYTES)) {
+    evictOne();
+  }
+  entries.push_back({ key, version, response, millis() });
+  bytes += length;
+  xSemaphoreGive(mutex);
+}
+
+void ResponseCache::invalidate() {
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  entries.clear();
+  bytes = 0;
+  xSemaphoreGive(mutex);
+}
+
+void ResponseCache::getStats(JsonObject& stats) {
+  xSemaphoreTake(mutex, portMAX_DELAY);
+  stats["entries"] = entries.size();
+  stats["bytes"] = bytes;
+  stats["hits"] = hits;
+  stats["misses"] = misses;
+  stats["evictions"] = evictions;
+  xSemaphoreGive(mutex);
+}
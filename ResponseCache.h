@@ -0,0 +1,55 @@
+#ifndef RESPONSE_CACHE_H
+#define RESPONSE_CACHE_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <memory>
+#include <vector>
+
+#define RESPONSE_CACHE_MAX_ENTRIES 16
+#define RESPONSE_CACHE_MAX_BYTES 65536
+
+// Serialised read response, shared with senders still transmitting it
+struct CachedResponse {
+  uint8_t* data;
+  size_t length;
+
+  CachedResponse(const uint8_t* body, size_t size);
+  ~CachedResponse();
+  CachedResponse(const CachedResponse&) = delete;
+  CachedResponse& operator=(const CachedResponse&) = delete;
+};
+
+// Small LRU of serialised read responses keyed by request (type, id, page,
+// encoding) and config version. Entries of an older version never match;
+// invalidate() drops everything after a mutation.
+class ResponseCache {
+private:
+  struct Entry {
+    String key;
+    uint32_t version;
+    std::shared_ptr<CachedResponse> response;
+    unsigned long lastUsed;
+  };
+  std::vector<Entry> entries;
+  SemaphoreHandle_t mutex;
+  size_t bytes;
+  uint32_t hits;
+  uint32_t misses;
+  uint32_t evictions;
+
+  void evictOne();
+
+public:
+  ResponseCache();
+  ~ResponseCache();
+
+  std::shared_ptr<CachedResponse> get(const String& key, uint32_t version);
+  void put(const String& key, uint32_t version, const uint8_t* data, size_t length);
+  void invalidate();
+  void getStats(JsonObject& stats);
+};
+
+#endif
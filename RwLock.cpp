@@ -0,0 +1,44 @@
+#include "RwLock.h"
+
+RwLock::RwLock() : readers(0) {
+  turnstile = xSemaphoreCreateMutex();
+  countLock = xSemaphoreCreateMutex();
+  // Binary rather than mutex: the last reader out may not be the first one in
+  resource = xSemaphoreCreateBinary();
+  xSemaphoreGive(resource);
+}
+
+RwLock::~RwLock() {
+  vSemaphoreDelete(turnstile);
+  vSemaphoreDelete(countLock);
+  vSemaphoreDelete(resource);
+}
+
+void RwLock::lockRead() {
+  xSemaphoreTake(turnstile, portMAX_DELAY);
+  xSemaphoreGive(turnstile);
+
+  xSemaphoreTake(countLock, portMAX_DELAY);
+  if (++readers == 1) {
+    xSemaphoreTake(resource, portMAX_DELAY);
+  }
+  xSemaphoreGive(countLock);
+}
+
+void RwLock::unlockRead() {
+  xSemaphoreTake(countLock, portMAX_DELAY);
+  if (--readers == 0) {
+    xSemaphoreGive(resource);
+  }
+  xSemaphoreGive(countLock);
+}
+
+void RwLock::lockWrite() {
+  xSemaphoreTake(turnstile, portMAX_DELAY);
+  xSemaphoreTake(resource, portMAX_DELAY);
+}
+
+void RwLock::unlockWrite() {
+  xSemaphoreGive(resource);
+  xSemaphoreGive(turnstile);
+}
@@ -0,0 +1,30 @@
+#ifndef RW_LOCK_H
+#define RW_LOCK_H
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
+// Readers-writer lock on FreeRTOS semaphores. Any number of readers may
+// hold it together; a writer waits for them to leave and then holds it
+// alone. Waiting writers block new readers, so writes are not starved.
+class RwLock {
+private:
+  SemaphoreHandle_t turnstile;  // Taken by writers while waiting/holding
+  SemaphoreHandle_t countLock;  // Protects readers
+  SemaphoreHandle_t resource;   // Binary: held by the reader group or a writer
+  int readers;
+
+public:
+  RwLock();
+  ~RwLock();
+
+  RwLock(const RwLock&) = delete;
+  RwLock& operator=(const RwLock&) = delete;
+
+  void lockRead();
+  void unlockRead();
+  void lockWrite();
+  void unlockWrite();
+};
+
+#endif
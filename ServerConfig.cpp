@@ -4,7 +4,7 @@
 
 const char* ServerConfig::CONFIG_FILE = "/server_config.json";
 
-ServerConfig::ServerConfig() {
+ServerConfig::ServerConfig() : revision(0) {
   // Allocate config in PSRAM
   config = (DynamicJsonDocument*)heap_caps_malloc(sizeof(DynamicJsonDocument), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
   if (config) {
@@ -71,7 +71,7 @@ void ServerConfig::createDefaultConfig() {
   ethernet["subnet"] = "255.255.255.0";
 
   // Protocol and data interval
-  root["protocol"] = "mqtt";
+  root["protocol"] = "mqtt";  // mqtt, http, or both as "mqtt,http"
 
   JsonObject dataInterval = root["data_interval"].to<JsonObject>();  // <-- PERUBAHAN
   dataInterval["value"] = 1000;
@@ -90,15 +90,36 @@ void ServerConfig::createDefaultConfig() {
   mqtt["keep_alive"] = 60;
   mqtt["clean_session"] = true;
   mqtt["use_tls"] = false;
+  mqtt["qos"] = 1;
+  mqtt["inflight_window"] = 10;  // Unacknowledged QoS 1 messages allowed at once
+  mqtt["protocol_version"] = 4;  // 4 = MQTT 3.1.1, 5 = MQTT 5 (topic aliases)
+  mqtt["topic_template"] = "";  // e.g. "{prefix}/{device}/{register}"; empty uses topic_publish
+  mqtt["payload_format"] = "json";  // json, cbor, msgpack or sparkplug_b
+  mqtt["sparkplug_group_id"] = "gateway";
+  mqtt["sparkplug_edge_node_id"] = "esp32_device";
 
   // HTTP config
   JsonObject http = root["http_config"].to<JsonObject>();  // <-- PERUBAHAN
   http["enabled"] = true;
   http["endpoint_url"] = "https://api.example.com/data";
   http["method"] = "POST";
-  http["body_format"] = "json";
+  http["body_format"] = "json";  // json, cbor, msgpack (one sample) or json_array, ndjson, csv, line_protocol (batched)
   http["timeout"] = 5000;
-  http["retry"] = 3;
+  http["retry"] = 3;  // Attempts for batches the endpoint rejects with 4xx
+  http["retry_base_ms"] = 1000;  // Exponential backoff with full jitter, capped at retry_max_ms
+  http["retry_max_ms"] = 60000;
+  http["retry_max_pending"] = 8;  // Failed batches held for retry before new samples wait in the queue
+  http["breaker_threshold"] = 5;  // Consecutive failures that open the circuit breaker
+  http["breaker_cooldown_ms"] = 30000;
+  http["compression"] = "none";  // none, gzip or deflate (Content-Encoding)
+  http["compress_min_bytes"] = 1024;  // Smaller bodies are sent uncompressed
+  http["compress_window_bits"] = 12;  // 10..14, history window of 1..16 KB
+  http["batch_max_samples"] = 50;
+  http["batch_max_bytes"] = 16384;
+  http["target_latency_ms"] = 2000;  // Batch size shrinks when requests take longer
+  http["measurement"] = "modbus";  // line_protocol measurement name
+  http["upload_mode"] = "batch";  // batch, or chunked to stream the queue backlog (batched formats only)
+  http["chunked_max_samples"] = 1000;  // Samples per chunked request
 
   JsonObject headers = http["headers"].to<JsonObject>();  // <-- PERUBAHAN
   headers["Authorization"] = "Bearer token";
@@ -154,6 +175,7 @@ bool ServerConfig::updateConfig(JsonObjectConst newConfig) {
 
   // Update main config
   config->set(newConfig);
+  revision++;
   if (saveConfig()) {
     Serial.println("Server configuration updated successfully");
     scheduleDeviceRestart();
@@ -174,7 +196,32 @@ bool ServerConfig::getCommunicationConfig(JsonObject& result) {
 }
 
 String ServerConfig::getProtocol() {
-  return (*config)["protocol"] | "mqtt";
+  JsonVariant protocol = (*config)["protocol"];
+  if (protocol.is<JsonArray>()) {
+    String joined;
+    for (JsonVariant entry : protocol.as<JsonArray>()) {
+      if (joined.length()) joined += ",";
+      joined += entry.as<String>();
+    }
+    return joined;
+  }
+  return protocol | "mqtt";
+}
+
+bool ServerConfig::isProtocolEnabled(const char* name) {
+  String protocol = getProtocol();
+  int start = 0;
+  while (start <= (int)protocol.length()) {
+    int end = protocol.indexOf(',', start);
+    if (end < 0) end = protocol.length();
+    String entry = protocol.substring(start, end);
+    entry.trim();
+    if (entry.equalsIgnoreCase(name)) {
+      return true;
+    }
+    start = end + 1;
+  }
+  return false;
 }
 
 bool ServerConfig::getDataIntervalConfig(JsonObject& result) {
@@ -9,6 +9,7 @@ class ServerConfig {
 private:
   static const char* CONFIG_FILE;
   DynamicJsonDocument* config;
+  uint32_t revision;  // Bumped on every successful update
 
   bool saveConfig();
   bool loadConfig();
@@ -26,10 +27,13 @@ public:
   // Configuration operations
   bool getConfig(JsonObject& result);
   bool updateConfig(JsonObjectConst newConfig);
+  uint32_t getRevision() const { return revision; }
 
   // Specific config getters
   bool getCommunicationConfig(JsonObject& result);
   String getProtocol();
+  // protocol may list several uplinks, e.g. "mqtt,http" (or a JSON array)
+  bool isProtocolEnabled(const char* name);
   bool getDataIntervalConfig(JsonObject& result);
   bool getMqttConfig(JsonObject& result);
   bool getHttpConfig(JsonObject& result);
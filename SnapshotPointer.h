@@ -0,0 +1,108 @@
+#ifndef SNAPSHOT_POINTER_H
+#define SNAPSHOT_POINTER_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+// Publishes immutable objects to concurrent readers, RCU style. Readers pin
+// the current object with two atomic increments and no lock; a writer swaps
+// in a new object and gets the old one back once no reader can still see
+// it, after a grace period in which every pinned reader has let go.
+//
+// Readers are counted in one of two slots picked by an epoch bit. A writer
+// flips the epoch and waits for the old slot to drain, twice, so a reader
+// that sampled the epoch just before a flip is waited for as well.
+//
+// Writers must be serialised by the caller and must not hold a Reader
+// themselves while calling exchange(), or they wait for their own pin.
+template<typename T>
+class SnapshotPointer {
+private:
+  std::atomic<T*> current;
+  std::atomic<uint32_t> epoch;
+  std::atomic<uint32_t> readers[2];
+
+  uint32_t exchanges;
+  uint32_t lastGraceMicros;
+  uint32_t maxGraceMicros;
+
+  void waitForReaders() {
+    for (int phase = 0; phase < 2; phase++) {
+      uint32_t slot = epoch.fetch_xor(1) & 1;
+      while (readers[slot].load() != 0) {
+        vTaskDelay(1);
+      }
+    }
+  }
+
+public:
+  class Reader {
+  private:
+    SnapshotPointer& owner;
+    uint32_t slot;
+    const T* object;
+
+  public:
+    explicit Reader(SnapshotPointer& owner)
+      : owner(owner) {
+      slot = owner.epoch.load() & 1;
+      owner.readers[slot].fetch_add(1);
+      object = owner.current.load();
+    }
+    ~Reader() {
+      owner.readers[slot].fetch_sub(1);
+    }
+    Reader(const Reader&) = delete;
+    Reader& operator=(const Reader&) = delete;
+
+    const T* get() const {
+      return object;
+    }
+    const T* operator->() const {
+      return object;
+    }
+    const T& operator*() const {
+      return *object;
+    }
+  };
+
+  explicit SnapshotPointer(T* initial)
+    : current(initial), epoch(0), exchanges(0), lastGraceMicros(0), maxGraceMicros(0) {
+    readers[0] = 0;
+    readers[1] = 0;
+  }
+
+  // The current object, for the serialised writer only
+  T* get() const {
+    return current.load();
+  }
+
+  // Publishes `next` and returns the previous object once it is
+  // unreachable; the caller frees it
+  T* exchange(T* next) {
+    T* previous = current.exchange(next);
+    unsigned long startedAt = micros();
+    waitForReaders();
+    lastGraceMicros = micros() - startedAt;
+    if (lastGraceMicros > maxGraceMicros) maxGraceMicros = lastGraceMicros;
+    exchanges++;
+    return previous;
+  }
+
+  uint32_t getExchanges() const {
+    return exchanges;
+  }
+  uint32_t getLastGraceMicros() const {
+    return lastGraceMicros;
+  }
+  uint32_t getMaxGraceMicros() const {
+    return maxGraceMicros;
+  }
+  uint32_t activeReaders() const {
+    return readers[0].load() + readers[1].load();
+  }
+};
+
+#endif
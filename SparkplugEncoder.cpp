@@ -0,0 +1,233 @@
+#include "SparkplugEncoder.h"
+#include "RTCManager.h"
+#include "MemoryManager.h"
+#include <string.h>
+
+// Sparkplug B protobuf field numbers and data types (sparkplug_b.proto)
+#define SPB_PAYLOAD_TIMESTAMP 1
+#define SPB_PAYLOAD_METRICS 2
+#define SPB_PAYLOAD_SEQ 3
+#define SPB_METRIC_NAME 1
+#define SPB_METRIC_ALIAS 2
+#define SPB_METRIC_TIMESTAMP 3
+#define SPB_METRIC_DATATYPE 4
+#define SPB_METRIC_LONG_VALUE 11
+#define SPB_METRIC_DOUBLE_VALUE 13
+#define SPB_TYPE_UINT64 8
+#define SPB_TYPE_DOUBLE 10
+
+#define SPB_BIRTH_METRIC_MAX 192  // Largest encoded register metric in an NBIRTH
+#define SPB_BIRTH_OVERHEAD 64     // Payload timestamp, bdSeq metric and seq
+
+#define SPB_WIRE_VARINT 0
+#define SPB_WIRE_FIXED64 1
+#define SPB_WIRE_LENGTH 2
+
+// Bounded protobuf writer
+class ProtoWriter {
+private:
+  uint8_t* buffer;
+  size_t capacity;
+  size_t length;
+  bool overflow;
+
+  void put(uint8_t b) {
+    if (length < capacity) {
+      buffer[length++] = b;
+    } else {
+      overflow = true;
+    }
+  }
+
+public:
+  ProtoWriter(uint8_t* buf, size_t cap)
+    : buffer(buf), capacity(cap), length(0), overflow(false) {}
+
+  void varint(uint64_t value) {
+    while (value >= 0x80) {
+      put((uint8_t)(value | 0x80));
+      value >>= 7;
+    }
+    put((uint8_t)value);
+  }
+
+  void tag(uint32_t field, uint8_t wireType) {
+    varint((field << 3) | wireType);
+  }
+
+  void varintField(uint32_t field, uint64_t value) {
+    tag(field, SPB_WIRE_VARINT);
+    varint(value);
+  }
+
+  void doubleField(uint32_t field, double value) {
+    uint64_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    tag(field, SPB_WIRE_FIXED64);
+    for (int i = 0; i < 8; i++) {
+      put((uint8_t)(bits >> (i * 8)));
+    }
+  }
+
+  void bytesField(uint32_t field, const uint8_t* data, size_t len) {
+    tag(field, SPB_WIRE_LENGTH);
+    varint(len);
+    for (size_t i = 0; i < len; i++) {
+      put(data[i]);
+    }
+  }
+
+  void stringField(uint32_t field, const char* str) {
+    bytesField(field, (const uint8_t*)str, strlen(str));
+  }
+
+  size_t size() const {
+    return overflow ? 0 : length;
+  }
+};
+
+static uint64_t currentTimeMs() {
+  RTCManager* rtc = RTCManager::getInstance();
+  if (rtc) {
+    return (uint64_t)rtc->getCurrentTime().unixtime() * 1000ULL;
+  }
+  return millis();
+}
+
+SparkplugEncoder::SparkplugEncoder()
+  : groupId("gateway"), edgeNodeId("mgate"), seq(0), bdSeq(255), rebirthRequired(true) {}
+
+void SparkplugEncoder::configure(const String& group, const String& edgeNode) {
+  groupId = group;
+  edgeNodeId = edgeNode;
+}
+
+String SparkplugEncoder::topicFor(const char* messageType) const {
+  return "spBv1.0/" + groupId + "/" + messageType + "/" + edgeNodeId;
+}
+
+void SparkplugEncoder::beginSession() {
+  // bdSeq starts at 0 for the first session and wraps after 255
+  bdSeq++;
+  seq = 0;
+  rebirthRequired = true;
+}
+
+uint8_t SparkplugEncoder::nextSeq() {
+  uint8_t current = seq;
+  seq = (seq == 255) ? 0 : seq + 1;
+  return current;
+}
+
+size_t SparkplugEncoder::encodeDeath(uint8_t* buffer, size_t capacity) {
+  uint8_t metric[32];
+  ProtoWriter m(metric, sizeof(metric));
+  m.stringField(SPB_METRIC_NAME, "bdSeq");
+  m.varintField(SPB_METRIC_DATATYPE, SPB_TYPE_UINT64);
+  m.varintField(SPB_METRIC_LONG_VALUE, bdSeq);
+
+  ProtoWriter w(buffer, capacity);
+  w.bytesField(SPB_PAYLOAD_METRICS, metric, m.size());
+  return w.size();
+}
+
+size_t SparkplugEncoder::encodeBirth(ConfigManager* configManager, uint8_t* buffer, size_t capacity) {
+  aliases.clear();
+  seq = 0;
+
+  ProtoWriter w(buffer, capacity);
+  uint64_t now = currentTimeMs();
+  w.varintField(SPB_PAYLOAD_TIMESTAMP, now);
+
+  uint8_t metric[SPB_BIRTH_METRIC_MAX];
+  {
+    ProtoWriter m(metric, sizeof(metric));
+    m.stringField(SPB_METRIC_NAME, "bdSeq");
+    m.varintField(SPB_METRIC_DATATYPE, SPB_TYPE_UINT64);
+    m.varintField(SPB_METRIC_LONG_VALUE, bdSeq);
+    w.bytesField(SPB_PAYLOAD_METRICS, metric, m.size());
+  }
+
+  if (configManager) {
+    JsonDocument devicesDoc(PsramAllocator::instance());
+    JsonDocument registersDoc(PsramAllocator::instance());
+    JsonArray devices = devicesDoc.to<JsonArray>();
+    configManager->listDevices(devices);
+
+    uint32_t nextAlias = 1;
+    for (JsonVariant deviceVar : devices) {
+      String deviceId = deviceVar.as<String>();
+      JsonArray registers = registersDoc.to<JsonArray>();
+      if (!configManager->listRegisters(deviceId, registers)) {
+        continue;
+      }
+
+      for (JsonVariant reg : registers) {
+        String registerId = reg["register_id"] | "";
+        if (registerId.isEmpty()) continue;
+
+        uint32_t alias = nextAlias;
+        String name = deviceId + "/" + (reg["register_name"] | registerId.c_str());
+        ProtoWriter m(metric, sizeof(metric));
+        m.stringField(SPB_METRIC_NAME, name.c_str());
+        m.varintField(SPB_METRIC_ALIAS, alias);
+        m.varintField(SPB_METRIC_TIMESTAMP, now);
+        m.varintField(SPB_METRIC_DATATYPE, SPB_TYPE_DOUBLE);
+        m.doubleField(SPB_METRIC_DOUBLE_VALUE, 0.0);
+        if (m.size() == 0) {
+          // No alias either: its samples are dropped instead of sending an
+          // alias the host never saw in a birth
+          Serial.printf("[SPB] Metric name too long, skipped: %s\n", name.c_str());
+          continue;
+        }
+        w.bytesField(SPB_PAYLOAD_METRICS, metric, m.size());
+        aliases[metricKey(deviceId.c_str(), registerId.c_str())] = alias;
+        nextAlias++;
+      }
+    }
+  }
+
+  w.varintField(SPB_PAYLOAD_SEQ, nextSeq());
+
+  size_t len = w.size();
+  if (len > 0) {
+    rebirthRequired = false;
+  }
+  return len;
+}
+
+size_t SparkplugEncoder::birthCapacity(size_t registerCount) {
+  // Each metric adds a one-byte tag and a two-byte length prefix
+  return SPB_BIRTH_OVERHEAD + registerCount * (SPB_BIRTH_METRIC_MAX + 3);
+}
+
+String SparkplugEncoder::metricKey(const char* deviceId, const char* registerId) {
+  String key = deviceId;
+  key += '/';
+  key += registerId;
+  return key;
+}
+
+size_t SparkplugEncoder::encodeData(JsonObjectConst sample, uint8_t* buffer, size_t capacity) {
+  auto it = aliases.find(metricKey(sample["device_id"] | "", sample["register_id"] | ""));
+  if (it == aliases.end()) {
+    rebirthRequired = true;
+    return 0;
+  }
+
+  uint64_t timestamp = sample["time"].is<unsigned long>()
+                         ? (uint64_t)sample["time"].as<unsigned long>() * 1000ULL
+                         : currentTimeMs();
+
+  uint8_t metric[48];
+  ProtoWriter m(metric, sizeof(metric));
+  m.varintField(SPB_METRIC_ALIAS, it->second);
+  m.varintField(SPB_METRIC_TIMESTAMP, timestamp);
+  m.doubleField(SPB_METRIC_DOUBLE_VALUE, sample["value"] | 0.0);
+
+  ProtoWriter w(buffer, capacity);
+  w.varintField(SPB_PAYLOAD_TIMESTAMP, timestamp);
+  w.bytesField(SPB_PAYLOAD_METRICS, metric, m.size());
+  w.varintField(SPB_PAYLOAD_SEQ, nextSeq());
+  return w.size();
+}
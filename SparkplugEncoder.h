@@ -0,0 +1,52 @@
+#ifndef SPARKPLUG_ENCODER_H
+#define SPARKPLUG_ENCODER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <map>
+#include "ConfigManager.h"
+
+// Sparkplug B (spBv1.0) payload encoder for the gateway edge node.
+// The protobuf wire format is written by hand so no nanopb/generated
+// code is needed; only the fields used by NBIRTH/NDEATH/NDATA are emitted.
+class SparkplugEncoder {
+private:
+  String groupId;
+  String edgeNodeId;
+  uint8_t seq;
+  uint8_t bdSeq;
+  bool rebirthRequired;
+
+  // "device_id/register_id" -> metric alias, rebuilt on every NBIRTH.
+  // Register ids are only unique within their device.
+  std::map<String, uint32_t> aliases;
+
+  uint8_t nextSeq();
+  static String metricKey(const char* deviceId, const char* registerId);
+
+public:
+  SparkplugEncoder();
+
+  void configure(const String& group, const String& edgeNode);
+  String topicFor(const char* messageType) const;
+
+  // Call before connecting: advances bdSeq and resets the message sequence
+  void beginSession();
+  bool needsRebirth() const { return rebirthRequired; }
+  // Metric names follow the config, so edits are announced with a new NBIRTH
+  void requestRebirth() { rebirthRequired = true; }
+  // Withdraws a rebirth flagged by a sample that is dropped instead
+  void cancelRebirth() { rebirthRequired = false; }
+  size_t aliasCount() const { return aliases.size(); }
+
+  size_t encodeDeath(uint8_t* buffer, size_t capacity);
+  size_t encodeBirth(ConfigManager* configManager, uint8_t* buffer, size_t capacity);
+  // Worst-case NBIRTH size for a given number of register metrics
+  static size_t birthCapacity(size_t registerCount);
+
+  // Encodes one sample as an NDATA metric referenced only by alias.
+  // Returns 0 and flags a rebirth if the register is not in the last birth.
+  size_t encodeData(JsonObjectConst sample, uint8_t* buffer, size_t capacity);
+};
+
+#endif
@@ -0,0 +1,350 @@
+#include "StreamSubscriptions.h"
+#include <esp_heap_caps.h>
+#include <math.h>
+
+StreamSubscriptions* StreamSubscriptions::instance = nullptr;
+
+StreamSubscriptions::StreamSubscriptions()
+  : version(0), subCount(0), slots(nullptr), nextSlot(0),
+    offered(0), delivered(0), coalesced(0), filtered(0), overflows(0) {
+  writeMutex = xSemaphoreCreateMutex();
+  slotMutex = xSemaphoreCreateMutex();
+  events = xEventGroupCreate();
+
+  slots = (RegisterSlot*)heap_caps_calloc(STREAM_MAX_REGISTERS, sizeof(RegisterSlot), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (slots == nullptr) {
+    slots = (RegisterSlot*)calloc(STREAM_MAX_REGISTERS, sizeof(RegisterSlot));  // Fallback to internal RAM
+  }
+  if (slots == nullptr) {
+    Serial.println("[STREAM] Failed to allocate register slots");
+  }
+}
+
+StreamSubscriptions* StreamSubscriptions::getInstance() {
+  if (instance == nullptr) {
+    instance = new StreamSubscriptions();
+  }
+  return instance;
+}
+
+uint32_t StreamSubscriptions::hashId(const char* text) {
+  // FNV-1a
+  uint32_t hash = 2166136261u;
+  while (*text) {
+    hash = (hash ^ (uint8_t)*text++) * 16777619u;
+  }
+  return hash;
+}
+
+bool StreamSubscriptions::makeId(const char* text, StreamId& id) {
+  size_t length = strlen(text);
+  if (length >= STREAM_ID_MAX) {
+    id = {};
+    return false;
+  }
+  memcpy(id.text, text, length + 1);
+  id.hash = hashId(text);
+  return true;
+}
+
+bool StreamSubscriptions::sameId(const StreamId& id, const StreamId& other) {
+  // Bounded compare: a subscription read inside the seqlock may be torn
+  return id.hash == other.hash && strncmp(id.text, other.text, STREAM_ID_MAX) == 0;
+}
+
+void StreamSubscriptions::beginChange() {
+  version.fetch_add(1, std::memory_order_acq_rel);
+}
+
+void StreamSubscriptions::endChange() {
+  version.fetch_add(1, std::memory_order_release);
+}
+
+bool StreamSubscriptions::match(const StreamId& device, const StreamId& reg, Subscription& result) const {
+  bool found;
+  uint32_t before;
+  do {
+    before = version.load(std::memory_order_acquire);
+    if (before & 1) {
+      continue;  // A change is in progress
+    }
+
+    found = false;
+    uint8_t count = subCount.load(std::memory_order_relaxed);
+    for (uint8_t i = 0; i < count; i++) {
+      const Subscription& sub = subs[i];
+      if (!sameId(sub.device, device)) {
+        continue;
+      }
+      if (sub.reg.text[0] == '\0') {
+        // Device-wide: matched by the device alone
+        result = sub;
+        found = true;
+      } else if (sameId(sub.reg, reg)) {
+        result = sub;  // A register subscription wins over its device's
+        found = true;
+        break;
+      }
+    }
+    std::atomic_thread_fence(std::memory_order_acquire);
+  } while ((before & 1) || version.load(std::memory_order_relaxed) != before);
+  return found;
+}
+
+bool StreamSubscriptions::subscribe(const String& deviceId, const String& registerId, uint32_t minIntervalMs,
+                                    bool changeOnly, double deadband) {
+  if (deviceId.isEmpty()) {
+    return false;
+  }
+
+  Subscription entry;
+  if (!makeId(deviceId.c_str(), entry.device) || !makeId(registerId.c_str(), entry.reg)) {
+    Serial.printf("[STREAM] Id longer than %d characters\n", STREAM_ID_MAX - 1);
+    return false;
+  }
+  entry.minIntervalMs = minIntervalMs;
+  entry.changeOnly = changeOnly;
+  entry.deadband = deadband;
+
+  xSemaphoreTake(writeMutex, portMAX_DELAY);
+  uint8_t count = subCount.load(std::memory_order_relaxed);
+  uint8_t index = count;
+  for (uint8_t i = 0; i < count; i++) {
+    if (sameId(subs[i].device, entry.device) && sameId(subs[i].reg, entry.reg)) {
+      index = i;
+      break;
+    }
+  }
+  if (index >= STREAM_MAX_SUBSCRIPTIONS) {
+    xSemaphoreGive(writeMutex);
+    return false;
+  }
+
+  beginChange();
+  subs[index] = entry;
+  if (index == count) {
+    subCount.store(count + 1, std::memory_order_relaxed);
+  }
+  endChange();
+  xSemaphoreGive(writeMutex);
+
+  Serial.printf("[STREAM] Subscribed %s/%s (interval %lu ms%s)\n", deviceId.c_str(),
+                registerId.isEmpty() ? "*" : registerId.c_str(), (unsigned long)minIntervalMs,
+                changeOnly ? ", change only" : "");
+  return true;
+}
+
+void StreamSubscriptions::unsubscribe(const String& deviceId, const String& registerId) {
+  StreamId device;
+  StreamId reg;
+  if (!makeId(deviceId.c_str(), device) || !makeId(registerId.c_str(), reg)) {
+    return;  // Too long to have been subscribed
+  }
+  bool wholeDevice = registerId.isEmpty();
+
+  xSemaphoreTake(writeMutex, portMAX_DELAY);
+  beginChange();
+  // Unsubscribing a device also removes its register subscriptions
+  uint8_t count = subCount.load(std::memory_order_relaxed);
+  uint8_t kept = 0;
+  for (uint8_t i = 0; i < count; i++) {
+    bool remove = sameId(subs[i].device, device) && (wholeDevice || sameId(subs[i].reg, reg));
+    if (!remove) {
+      subs[kept++] = subs[i];
+    }
+  }
+  subCount.store(kept, std::memory_order_relaxed);
+  endChange();
+  dropSlots(&device, wholeDevice ? nullptr : &reg);
+  xSemaphoreGive(writeMutex);
+}
+
+void StreamSubscriptions::clear() {
+  xSemaphoreTake(writeMutex, portMAX_DELAY);
+  beginChange();
+  subCount.store(0, std::memory_order_relaxed);
+  endChange();
+  dropSlots(nullptr, nullptr);
+  xSemaphoreGive(writeMutex);
+}
+
+void StreamSubscriptions::listSubscriptions(JsonArray& list) {
+  xSemaphoreTake(writeMutex, portMAX_DELAY);
+  uint8_t count = subCount.load(std::memory_order_relaxed);
+  for (uint8_t i = 0; i < count; i++) {
+    JsonObject entry = list.add<JsonObject>();
+    entry["device_id"] = subs[i].device.text;
+    if (subs[i].reg.text[0] != '\0') {
+      entry["register_id"] = subs[i].reg.text;
+    }
+    entry["min_interval_ms"] = subs[i].minIntervalMs;
+    entry["change_only"] = subs[i].changeOnly;
+    if (subs[i].changeOnly) {
+      entry["deadband"] = subs[i].deadband;
+    }
+  }
+  xSemaphoreGive(writeMutex);
+}
+
+StreamSubscriptions::RegisterSlot* StreamSubscriptions::slotFor(const StreamId& device, const StreamId& reg) {
+  // Caller holds slotMutex
+  RegisterSlot* freeSlot = nullptr;
+  for (int i = 0; i < STREAM_MAX_REGISTERS; i++) {
+    RegisterSlot& slot = slots[i];
+    if (slot.used && sameId(slot.reg, reg) && sameId(slot.device, device)) {
+      return &slot;
+    }
+    if (!slot.used && !freeSlot) {
+      freeSlot = &slot;
+    }
+  }
+  if (freeSlot) {
+    *freeSlot = {};
+    freeSlot->used = true;
+    freeSlot->device = device;
+    freeSlot->reg = reg;
+  }
+  return freeSlot;
+}
+
+void StreamSubscriptions::dropSlots(const StreamId* device, const StreamId* reg) {
+  // nullptr device = every slot, nullptr reg = every register of the device
+  if (!slots) {
+    return;
+  }
+  xSemaphoreTake(slotMutex, portMAX_DELAY);
+  for (int i = 0; i < STREAM_MAX_REGISTERS; i++) {
+    RegisterSlot& slot = slots[i];
+    bool matches = !device || (sameId(slot.device, *device) && (!reg || sameId(slot.reg, *reg)));
+    if (slot.used && matches) {
+      if (slot.json) {
+        heap_caps_free(slot.json);
+      }
+      slot = {};
+    }
+  }
+  xSemaphoreGive(slotMutex);
+}
+
+void StreamSubscriptions::offer(const char* deviceId, const char* registerId, const JsonObject& dataPoint) {
+  // Fast path: nothing to look up while no client is subscribed
+  if (subCount.load(std::memory_order_relaxed) == 0 || !slots) {
+    return;
+  }
+
+  StreamId device;
+  if (!makeId(deviceId, device)) {
+    return;  // Too long to be subscribed
+  }
+  StreamId reg;
+  bool regFits = makeId(registerId, reg);
+  Subscription sub;
+  if (!match(device, reg, sub)) {
+    return;
+  }
+  if (!regFits) {
+    // Device-wide match, but the register id cannot key a slot
+    overflows++;
+    return;
+  }
+
+  double value = dataPoint["value"] | 0.0;
+  size_t length = measureJson(dataPoint) + 1;
+  char* json = (char*)heap_caps_malloc(length, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+  if (json == nullptr) {
+    return;
+  }
+  serializeJson(dataPoint, json, length);
+
+  xSemaphoreTake(slotMutex, portMAX_DELAY);
+  offered++;
+  RegisterSlot* slot = slotFor(device, reg);
+  if (!slot) {
+    overflows++;
+    xSemaphoreGive(slotMutex);
+    heap_caps_free(json);
+    return;
+  }
+
+  if (slot->json) {
+    // Replace the undelivered sample instead of queueing behind it
+    heap_caps_free(slot->json);
+    slot->json = nullptr;
+    coalesced++;
+  }
+  if (sub.changeOnly && slot->hasSent && fabs(value - slot->lastValue) <= sub.deadband) {
+    filtered++;
+    xSemaphoreGive(slotMutex);
+    heap_caps_free(json);
+    return;
+  }
+  slot->json = json;
+  slot->pendingValue = value;
+  slot->minIntervalMs = sub.minIntervalMs;
+  xSemaphoreGive(slotMutex);
+
+  xEventGroupSetBits(events, BIT0);
+}
+
+char* StreamSubscriptions::takeDue(unsigned long now, uint32_t* waitMs) {
+  *waitMs = UINT32_MAX;
+  if (!slots) {
+    return nullptr;
+  }
+
+  xSemaphoreTake(slotMutex, portMAX_DELAY);
+  for (int n = 0; n < STREAM_MAX_REGISTERS; n++) {
+    int i = (nextSlot + n) % STREAM_MAX_REGISTERS;
+    RegisterSlot& slot = slots[i];
+    if (!slot.used || !slot.json) {
+      continue;
+    }
+
+    unsigned long elapsed = now - slot.lastSentAt;
+    if (slot.hasSent && elapsed < slot.minIntervalMs) {
+      *waitMs = min(*waitMs, (uint32_t)(slot.minIntervalMs - elapsed));
+      continue;
+    }
+
+    char* json = slot.json;
+    slot.json = nullptr;
+    slot.hasSent = true;
+    slot.lastValue = slot.pendingValue;
+    slot.lastSentAt = now;
+    nextSlot = (i + 1) % STREAM_MAX_REGISTERS;  // Fairness across registers
+    delivered++;
+    xSemaphoreGive(slotMutex);
+    *waitMs = 0;
+    return json;
+  }
+  xSemaphoreGive(slotMutex);
+  return nullptr;
+}
+
+bool StreamSubscriptions::waitForData(TickType_t timeout) {
+  // The bit is cleared on wake; an offer() while the task drains sets it again
+  return xEventGroupWaitBits(events, BIT0, pdTRUE, pdFALSE, timeout) & BIT0;
+}
+
+void StreamSubscriptions::getStats(JsonObject& stats) {
+  stats["subscriptions"] = subCount.load(std::memory_order_relaxed);
+  xSemaphoreTake(slotMutex, portMAX_DELAY);
+  int usedCount = 0;
+  int pendingCount = 0;
+  for (int i = 0; slots && i < STREAM_MAX_REGISTERS; i++) {
+    if (slots[i].used) {
+      usedCount++;
+      if (slots[i].json) {
+        pendingCount++;
+      }
+    }
+  }
+  stats["registers"] = usedCount;
+  stats["pending"] = pendingCount;
+  stats["offered"] = offered;
+  stats["delivered"] = delivered;
+  stats["coalesced"] = coalesced;
+  stats["filtered"] = filtered;
+  stats["overflows"] = overflows;
+  xSemaphoreGive(slotMutex);
+}
@@ -0,0 +1,101 @@
+#ifndef STREAM_SUBSCRIPTIONS_H
+#define STREAM_SUBSCRIPTIONS_H
+
+#include <ArduinoJson.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+#include <freertos/event_groups.h>
+#include <atomic>
+
+#define STREAM_ID_MAX 32             // Longest device or register id, with terminator
+#define STREAM_MAX_SUBSCRIPTIONS 16
+#define STREAM_MAX_REGISTERS 128     // Registers with a pending or sent sample
+
+// Live BLE streaming. A client subscribes to whole devices or single
+// registers, each with a minimum interval between updates and optional
+// change-only filtering. Pollers offer every sample; the lookup is
+// lock-free and costs nothing while no one is subscribed. Only the newest
+// undelivered sample per register is kept, so a fast poller cannot flood
+// the link.
+class StreamSubscriptions {
+private:
+  static StreamSubscriptions* instance;
+
+  // Ids are stored inline with their hash, so nothing outlives the
+  // subscription or slot that names it
+  struct StreamId {
+    uint32_t hash;
+    char text[STREAM_ID_MAX];
+  };
+
+  struct Subscription {
+    StreamId device;
+    StreamId reg;  // Empty = every register of the device
+    uint32_t minIntervalMs;
+    bool changeOnly;
+    double deadband;
+  };
+  // Changed under writeMutex inside a seqlock: version is odd while a
+  // change is in progress and readers retry when it moved
+  Subscription subs[STREAM_MAX_SUBSCRIPTIONS];
+  std::atomic<uint32_t> version;
+  std::atomic<uint8_t> subCount;
+  SemaphoreHandle_t writeMutex;
+
+  // Latest sample per register, waiting for the streaming task
+  struct RegisterSlot {
+    bool used;
+    StreamId device;
+    StreamId reg;
+    bool hasSent;
+    double lastValue;          // Last value delivered, for change-only
+    unsigned long lastSentAt;
+    uint32_t minIntervalMs;
+    double pendingValue;
+    char* json;                // Pending sample in PSRAM, nullptr if none
+  };
+  RegisterSlot* slots;
+  SemaphoreHandle_t slotMutex;
+  EventGroupHandle_t events;
+  int nextSlot;  // Round-robin start for takeDue()
+
+  uint32_t offered;
+  uint32_t delivered;
+  uint32_t coalesced;
+  uint32_t filtered;
+  uint32_t overflows;
+
+  StreamSubscriptions();
+  static uint32_t hashId(const char* text);
+  static bool makeId(const char* text, StreamId& id);
+  static bool sameId(const StreamId& id, const StreamId& other);
+  bool match(const StreamId& device, const StreamId& reg, Subscription& result) const;
+  RegisterSlot* slotFor(const StreamId& device, const StreamId& reg);
+  void dropSlots(const StreamId* device, const StreamId* reg);
+  void beginChange();
+  void endChange();
+
+public:
+  static StreamSubscriptions* getInstance();
+
+  // Client side. An empty registerId subscribes the whole device; adding
+  // an existing device/register pair replaces its settings.
+  bool subscribe(const String& deviceId, const String& registerId, uint32_t minIntervalMs, bool changeOnly,
+                 double deadband);
+  void unsubscribe(const String& deviceId, const String& registerId);
+  void clear();
+  void listSubscriptions(JsonArray& list);
+
+  // Producer side, called by the pollers for every sample
+  void offer(const char* deviceId, const char* registerId, const JsonObject& dataPoint);
+
+  // Streaming task: returns the next sample that is due (free it with
+  // heap_caps_free), or nullptr with waitMs set to the time until the next
+  // one is (UINT32_MAX if nothing is pending)
+  char* takeDue(unsigned long now, uint32_t* waitMs);
+  bool waitForData(TickType_t timeout);
+
+  void getStats(JsonObject& stats);
+};
+
+#endif
@@ -92,6 +92,7 @@ void setup() {
     }
   }
 
+  unsigned long configStartedAt = millis();
   if (!configManager->begin()) {
     Serial.println("Failed to initialize ConfigManager");
     cleanup();
@@ -112,7 +113,7 @@ void setup() {
   configManager->fixCorruptDeviceIds();
 
 
-  Serial.println("[MAIN] Configuration initialization completed.");
+  Serial.printf("[MAIN] Configuration initialization completed in %lu ms.\n", millis() - configStartedAt);
 
   // Initialize LED Manager
   ledManager = LEDManager::getInstance();
@@ -202,14 +203,15 @@ void setup() {
     Serial.println("Failed to initialize Modbus RTU service");
   }
 
-  // Initialize protocol managers based on server configuration
+  // Initialize protocol managers based on server configuration. Several
+  // uplinks may be active at once; each reads every sample from the queue.
   String protocol = serverConfig->getProtocol();
   Serial.printf("Selected protocol: %s\n", protocol.c_str());
 
   // Initialize MQTT Manager
   mqttManager = MqttManager::getInstance(configManager, serverConfig, networkManager);
   if (mqttManager && mqttManager->init()) {
-    if (protocol == "mqtt") {
+    if (serverConfig->isProtocolEnabled("mqtt")) {
       mqttManager->start();
       Serial.println("MQTT Manager started (active protocol)");
     } else {
@@ -222,7 +224,7 @@ void setup() {
   // Initialize HTTP Manager
   httpManager = HttpManager::getInstance(configManager, serverConfig, networkManager);
   if (httpManager && httpManager->init()) {
-    if (protocol == "http") {
+    if (serverConfig->isProtocolEnabled("http")) {
       httpManager->start();
       Serial.println("HTTP Manager started (active protocol)");
     } else {
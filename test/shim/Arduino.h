@@ -0,0 +1,63 @@
+#ifndef HOST_SHIM_ARDUINO_H
+#define HOST_SHIM_ARDUINO_H
+
+// Minimal Arduino core for compiling gateway sources on the host
+
+#include <algorithm>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+using std::max;
+using std::min;
+
+template<typename T, typename L, typename H>
+inline T constrain(T value, L low, H high) {
+  return value < (T)low ? (T)low : (value > (T)high ? (T)high : value);
+}
+
+inline unsigned long millis() {
+  using namespace std::chrono;
+  static const steady_clock::time_point start = steady_clock::now();
+  return (unsigned long)duration_cast<milliseconds>(steady_clock::now() - start).count();
+}
+
+inline unsigned long micros() {
+  using namespace std::chrono;
+  static const steady_clock::time_point start = steady_clock::now();
+  return (unsigned long)duration_cast<microseconds>(steady_clock::now() - start).count();
+}
+
+class Print {
+public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t b) = 0;
+  virtual size_t write(const uint8_t* data, size_t len) {
+    size_t n = 0;
+    while (len-- && write(*data++)) n++;
+    return n;
+  }
+  size_t print(const char* text) {
+    return write((const uint8_t*)text, strlen(text));
+  }
+  size_t print(char c) {
+    return write((uint8_t)c);
+  }
+};
+
+struct HostSerial {
+  template<typename... Args>
+  void printf(const char* format, Args... args) {
+    ::printf(format, args...);
+  }
+  void println(const char* text) {
+    ::printf("%s\n", text);
+  }
+};
+inline HostSerial Serial;
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef HOST_SHIM_ESP_HEAP_CAPS_H
+#define HOST_SHIM_ESP_HEAP_CAPS_H
+
+// Host heap: every capability maps to malloc
+
+#include <cstdlib>
+
+#define MALLOC_CAP_8BIT (1 << 2)
+#define MALLOC_CAP_SPIRAM (1 << 10)
+
+inline void* heap_caps_malloc(size_t size, uint32_t) {
+  return malloc(size);
+}
+inline void* heap_caps_calloc(size_t count, size_t size, uint32_t) {
+  return calloc(count, size);
+}
+inline void* heap_caps_realloc(void* p, size_t size, uint32_t) {
+  return realloc(p, size);
+}
+inline void heap_caps_free(void* p) {
+  free(p);
+}
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef HOST_SHIM_ESP_ROM_CRC_H
+#define HOST_SHIM_ESP_ROM_CRC_H
+
+// Same contract as the ROM routine: IEEE CRC-32 (reflected), with the
+// inversion on entry and exit done inside, so calls can be chained
+
+#include <cstddef>
+#include <cstdint>
+
+inline uint32_t esp_rom_crc32_le(uint32_t crc, const uint8_t* data, uint32_t len) {
+  crc = ~crc;
+  while (len--) {
+    crc ^= *data++;
+    for (int i = 0; i < 8; i++) {
+      crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    }
+  }
+  return ~crc;
+}
+
+#endif
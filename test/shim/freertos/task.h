@@ -0,0 +1,17 @@
+#ifndef HOST_SHIM_FREERTOS_TASK_H
+#define HOST_SHIM_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+#include <chrono>
+#include <thread>
+
+// One tick is 1 ms, as with the ESP32's default configTICK_RATE_HZ
+inline void vTaskDelay(TickType_t ticks) {
+  if (ticks == 0) {
+    std::this_thread::yield();
+  } else {
+    std::this_thread::sleep_for(std::chrono::milliseconds(ticks));
+  }
+}
+
+#endif
@@ -0,0 +1,418 @@
+// BleFlowControl under a lossy, reordering link: a simulated client
+// reassembles responses from framed notifications, acks with credits and
+// NAKs gaps, while both directions drop and delay packets. Runs past the
+// u16 sequence wrap and injects stale credits and NAKs for slots that were
+// acked and overwritten.
+
+#include "BleFlowControl.h"
+#include <cstdio>
+#include <deque>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(condition, ...)                     \
+  do {                                            \
+    if (!(condition)) {                           \
+      printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+      printf(__VA_ARGS__);                        \
+      printf("\n");                               \
+      failures++;                                 \
+    }                                             \
+  } while (0)
+
+typedef std::vector<uint8_t> Bytes;
+
+static Bytes credit(uint16_t ack, uint16_t window) {
+  return { BLE_FLOW_CREDIT, (uint8_t)(ack & 0xFF), (uint8_t)(ack >> 8), (uint8_t)(window & 0xFF), (uint8_t)(window >> 8) };
+}
+
+static Bytes nak(std::initializer_list<uint16_t> seqs) {
+  Bytes packet = { BLE_FLOW_NAK };
+  for (uint16_t seq : seqs) {
+    packet.push_back(seq & 0xFF);
+    packet.push_back(seq >> 8);
+  }
+  return packet;
+}
+
+static void write(BleFlowControl& flow, const Bytes& packet) {
+  flow.handleWrite(packet.data(), packet.size());
+}
+
+static uint16_t frameSeq(const uint8_t* frame) {
+  return frame[0] | (frame[1] << 8);
+}
+
+// Sends and acks count fragments, moving nextSeq forward
+static void advance(BleFlowControl& flow, uint32_t count, uint16_t window) {
+  size_t frameLength;
+  for (uint32_t i = 0; i < count; i++) {
+    const uint8_t* frame = flow.stage((const uint8_t*)"x", 1, 0, frameLength);
+    write(flow, credit(frameSeq(frame) + 1, window));
+  }
+}
+
+static void testCredits() {
+  BleFlowControl flow;
+  CHECK(flow.begin(), "ring allocation failed");
+  size_t frameLength;
+
+  CHECK(!flow.isEnabled(), "enabled before any credit");
+  write(flow, nak({ 0 }));
+  CHECK(!flow.isEnabled(), "a NAK must not enable flow control");
+  write(flow, Bytes{ BLE_FLOW_CREDIT, 0 });
+  CHECK(!flow.isEnabled(), "short write accepted");
+
+  write(flow, credit(0, 4));
+  CHECK(flow.isEnabled() && flow.window() == 4, "credit not applied");
+  for (int i = 0; i < 4; i++) {
+    CHECK(flow.hasWindow(), "window closed after %d of 4", i);
+    flow.stage((const uint8_t*)"abc", 3, 0, frameLength);
+  }
+  CHECK(!flow.hasWindow(), "sent past the window");
+  CHECK(!flow.drained(), "drained with four fragments unacked");
+
+  write(flow, credit(3, 4));
+  CHECK(flow.ack() == 3 && flow.hasWindow(), "ack did not open the window");
+  write(flow, credit(1, 100));
+  CHECK(flow.ack() == 3 && flow.window() == 4, "stale credit moved the ack back");
+  write(flow, credit(9, 4));
+  CHECK(flow.ack() == 3, "credit acked fragments never sent");
+  write(flow, credit(4, 1000));
+  CHECK(flow.drained(), "not drained after acking everything");
+  CHECK(flow.window() == BLE_RETX_SLOTS, "window not capped by the ring: %u", flow.window());
+
+  flow.reset();
+  CHECK(!flow.isEnabled() && flow.ack() == 0 && flow.drained(), "reset kept state");
+}
+
+static void testNaks() {
+  BleFlowControl flow;
+  flow.begin();
+  write(flow, credit(0, BLE_RETX_SLOTS));
+  size_t frameLength;
+
+  // Fill the ring twice over, so early slots are overwritten
+  advance(flow, BLE_RETX_SLOTS * 2, BLE_RETX_SLOTS);
+  uint16_t base = flow.ack();
+  for (int i = 0; i < 5; i++) {
+    uint8_t payload = 0xA0 + i;
+    flow.stage(&payload, 1, 0, frameLength);
+  }
+  write(flow, credit(base + 2, BLE_RETX_SLOTS));
+
+  // Acked, acked and overwritten, and never sent: all ignored
+  write(flow, nak({ (uint16_t)(base + 1), 3, (uint16_t)(base + 5), (uint16_t)(base - BLE_RETX_SLOTS + 2) }));
+  CHECK(flow.nextRetransmit(frameLength) == nullptr, "resent a fragment that is not held");
+
+  write(flow, nak({ (uint16_t)(base + 2), (uint16_t)(base + 4) }));
+  std::vector<uint16_t> resent;
+  const uint8_t* frame;
+  while ((frame = flow.nextRetransmit(frameLength)) != nullptr) {
+    CHECK(frameLength == BLE_FRAME_HEADER_SIZE + 1, "frame length %zu", frameLength);
+    CHECK(frame[BLE_FRAME_HEADER_SIZE] == 0xA0 + (uint16_t)(frameSeq(frame) - base), "resent the wrong payload");
+    resent.push_back(frameSeq(frame));
+  }
+  CHECK(resent.size() == 2, "resent %zu of 2 held fragments", resent.size());
+
+  // Pending NAKs are bounded; the excess is dropped, not overflowed
+  for (int i = 0; i < BLE_MAX_PENDING_NAKS + 8; i++) {
+    write(flow, nak({ (uint16_t)(base + 3) }));
+  }
+  int count = 0;
+  while (flow.nextRetransmit(frameLength)) count++;
+  CHECK(count == BLE_MAX_PENDING_NAKS, "%d NAKs queued, limit %d", count, BLE_MAX_PENDING_NAKS);
+}
+
+static void testWrap() {
+  BleFlowControl flow;
+  flow.begin();
+  write(flow, credit(0, 8));
+  size_t frameLength;
+
+  advance(flow, 65530, 8);
+  CHECK(flow.ack() == 65530 && flow.drained(), "ack %u before the wrap", flow.ack());
+  for (int i = 0; i < 8; i++) {
+    CHECK(flow.hasWindow(), "window closed at the wrap after %d", i);
+    flow.stage((const uint8_t*)"w", 1, 0, frameLength);
+  }
+  CHECK(!flow.hasWindow(), "window open across the wrap");
+
+  // 65533 is before the wrap, 1 after it; both are still held
+  write(flow, credit(65532, 8));
+  write(flow, nak({ 65531, 65533, 1, 2 }));
+  std::vector<uint16_t> resent;
+  const uint8_t* frame;
+  while ((frame = flow.nextRetransmit(frameLength)) != nullptr) resent.push_back(frameSeq(frame));
+  CHECK(resent.size() == 2, "resent %zu across the wrap, expected 2", resent.size());
+
+  write(flow, credit(1, 8));
+  CHECK(flow.ack() == 1, "ack did not cross the wrap");
+  write(flow, credit(65534, 8));
+  CHECK(flow.ack() == 1, "stale pre-wrap credit accepted");
+  write(flow, credit(2, 8));
+  CHECK(flow.drained(), "not drained after the wrap");
+}
+
+// Packets in flight with a random delay, so they also arrive out of order
+class LossyLink {
+private:
+  struct Packet {
+    uint64_t due;
+    Bytes bytes;
+  };
+  std::mt19937& rng;
+  double loss;
+  uint32_t maxDelay;
+  std::deque<Packet> inFlight;
+
+public:
+  uint32_t sent = 0;
+  uint32_t dropped = 0;
+
+  LossyLink(std::mt19937& random, double lossRate, uint32_t delay) : rng(random), loss(lossRate), maxDelay(delay) {}
+
+  void send(const uint8_t* data, size_t length, uint64_t now) {
+    sent++;
+    if (std::uniform_real_distribution<double>(0, 1)(rng) < loss) {
+      dropped++;
+      return;
+    }
+    inFlight.push_back({ now + 1 + rng() % maxDelay, Bytes(data, data + length) });
+  }
+
+  bool receive(Bytes& packet, uint64_t now) {
+    for (auto it = inFlight.begin(); it != inFlight.end(); ++it) {
+      if (it->due <= now) {
+        packet = std::move(it->bytes);
+        inFlight.erase(it);
+        return true;
+      }
+    }
+    return false;
+  }
+};
+
+struct SimConfig {
+  const char* name;
+  double loss;
+  uint32_t delay;
+  uint16_t clientWindow;
+  uint32_t fragments;  // Stop after the response that crosses this many
+};
+
+// The client: holds out-of-order frames within its window, delivers in
+// order, NAKs gaps, and on silence NAKs its next expected seq and repeats
+// its credit (either may have been lost)
+class Client {
+private:
+  LossyLink& uplink;
+  std::mt19937& rng;
+  uint16_t window;
+  uint16_t expect = 0;
+  std::map<uint16_t, Bytes> held;
+  std::string current;
+  uint64_t lastFrame = 0;
+  std::deque<uint16_t> ackHistory;
+
+  void sendPacket(const Bytes& packet, uint64_t now) {
+    uplink.send(packet.data(), packet.size(), now);
+  }
+
+public:
+  std::vector<std::string> responses;
+  uint32_t outsideWindow = 0;
+  uint32_t malformed = 0;
+  uint32_t duplicates = 0;
+
+  Client(LossyLink& link, std::mt19937& random, uint16_t clientWindow) : uplink(link), rng(random), window(clientWindow) {}
+
+  void start(uint64_t now) {
+    sendPacket(credit(expect, window), now);
+  }
+
+  void receive(const Bytes& frame, uint64_t now) {
+    lastFrame = now;
+    if (frame.size() < BLE_FRAME_HEADER_SIZE) {
+      malformed++;
+      return;
+    }
+    uint16_t seq = frameSeq(frame.data());
+    uint16_t ahead = seq - expect;
+    uint16_t effectiveWindow = window < BLE_RETX_SLOTS ? window : BLE_RETX_SLOTS;
+    if ((int16_t)ahead < 0) {
+      duplicates++;  // Already delivered; a retransmit that raced the ack
+      sendPacket(credit(expect, window), now);
+      return;
+    }
+    if (ahead >= effectiveWindow) {
+      outsideWindow++;
+      return;
+    }
+    auto existing = held.find(seq);
+    if (existing != held.end()) {
+      CHECK(existing->second == frame, "retransmit of %u differs from the original", seq);
+      duplicates++;
+    } else {
+      held[seq] = frame;
+    }
+
+    if (seq != expect) {
+      Bytes missing = { BLE_FLOW_NAK };
+      for (uint16_t s = expect; s != seq; s++) {
+        if (!held.count(s)) {
+          missing.push_back(s & 0xFF);
+          missing.push_back(s >> 8);
+        }
+      }
+      sendPacket(missing, now);
+    }
+
+    bool advanced = false;
+    for (auto it = held.find(expect); it != held.end(); it = held.find(expect)) {
+      const Bytes& f = it->second;
+      current.append((const char*)f.data() + BLE_FRAME_HEADER_SIZE, f.size() - BLE_FRAME_HEADER_SIZE);
+      if (f[2] & BLE_FRAME_FLAG_END) {
+        responses.push_back(current);
+        current.clear();
+      }
+      held.erase(it);
+      expect++;
+      advanced = true;
+    }
+    if (advanced) {
+      ackHistory.push_back(expect);
+      if (ackHistory.size() > 64) ackHistory.pop_front();
+      sendPacket(credit(expect, window), now);
+    }
+  }
+
+  void idle(uint64_t now) {
+    if (now - lastFrame > 20) {
+      lastFrame = now;
+      sendPacket(nak({ expect }), now);
+      sendPacket(credit(expect, window), now);
+    }
+    // Noise a real link produces: a replayed old credit, or a NAK for a
+    // long-acked fragment whose ring slot has been reused
+    if (!ackHistory.empty() && rng() % 50 == 0) {
+      sendPacket(credit(ackHistory[rng() % ackHistory.size()], window), now);
+    }
+    if (rng() % 50 == 0) {
+      sendPacket(nak({ (uint16_t)(expect - BLE_RETX_SLOTS - rng() % 200) }), now);
+    }
+  }
+};
+
+static std::string makeResponse(std::mt19937& rng, int index) {
+  std::string text = "{\"response\":" + std::to_string(index) + ",\"data\":\"";
+  size_t length = rng() % 300;
+  for (size_t i = 0; i < length; i++) text += (char)('a' + rng() % 26);
+  return text + "\"}";
+}
+
+static void simulate(const SimConfig& config) {
+  std::mt19937 rng(0x1210 + config.clientWindow);
+  LossyLink downlink(rng, config.loss, config.delay);
+  LossyLink uplink(rng, config.loss, config.delay);
+  BleFlowControl flow;
+  CHECK(flow.begin(), "ring allocation failed");
+  Client client(uplink, rng, config.clientWindow);
+
+  std::vector<std::string> sent;
+  std::string body;
+  size_t offset = 0;
+  bool endSent = true;  // Nothing in progress
+  uint32_t staged = 0;
+  uint32_t retransmits = 0;
+  uint64_t lastProgress = 0;
+  uint16_t lastAck = 0;
+  uint32_t stalls = 0;
+  bool wrapped = false;
+
+  client.start(0);
+  uint64_t now = 0;
+  for (; now < 50000000; now++) {
+    Bytes packet;
+    while (uplink.receive(packet, now)) flow.handleWrite(packet.data(), packet.size());
+    while (downlink.receive(packet, now)) client.receive(packet, now);
+    client.idle(now);
+
+    if (!flow.isEnabled()) continue;
+
+    // Sender, as BLEManager::waitForWindow/waitForDrain drive it
+    size_t frameLength;
+    const uint8_t* frame;
+    while ((frame = flow.nextRetransmit(frameLength)) != nullptr) {
+      downlink.send(frame, frameLength, now);
+      retransmits++;
+    }
+    if (flow.ack() != lastAck) {
+      if ((uint16_t)flow.ack() < lastAck) wrapped = true;
+      lastAck = flow.ack();
+      lastProgress = now;
+    } else if (now - lastProgress > 2000) {
+      stalls++;
+      lastProgress = now;
+    }
+
+    if (endSent) {
+      if (!flow.drained()) continue;
+      if (staged >= config.fragments) break;
+      sent.push_back(makeResponse(rng, (int)sent.size()));
+      body = sent.back();
+      offset = 0;
+      endSent = false;
+    }
+    while (!endSent && flow.hasWindow()) {
+      size_t chunk = min(body.size() - offset, (size_t)(1 + rng() % 40));
+      uint8_t flags = 0;
+      if (chunk == 0) flags = BLE_FRAME_FLAG_END;
+      frame = flow.stage((const uint8_t*)body.data() + offset, chunk, flags, frameLength);
+      downlink.send(frame, frameLength, now);
+      offset += chunk;
+      staged++;
+      endSent = flags & BLE_FRAME_FLAG_END;
+    }
+  }
+
+  CHECK(staged >= config.fragments, "%s: stuck after %u fragments", config.name, staged);
+  CHECK(wrapped || config.fragments < 65536, "%s: sequence never wrapped", config.name);
+  CHECK(client.outsideWindow == 0, "%s: %u frames beyond the client's window", config.name, client.outsideWindow);
+  CHECK(client.malformed == 0, "%s: %u frames without a header", config.name, client.malformed);
+  CHECK(stalls == 0, "%s: %u stalls without progress", config.name, stalls);
+  CHECK(client.responses.size() == sent.size(), "%s: client reassembled %zu of %zu responses", config.name,
+        client.responses.size(), sent.size());
+  size_t mismatched = 0;
+  for (size_t i = 0; i < client.responses.size() && i < sent.size(); i++) {
+    if (client.responses[i] != sent[i]) mismatched++;
+  }
+  CHECK(mismatched == 0, "%s: %zu responses differ", config.name, mismatched);
+
+  printf("%s: %zu responses, %u fragments, %u/%u down and %u/%u up dropped, %u retransmits, %u duplicates, %llu ticks\n",
+         config.name, sent.size(), staged, downlink.dropped, downlink.sent, uplink.dropped, uplink.sent, retransmits,
+         client.duplicates, (unsigned long long)now);
+}
+
+int main() {
+  testCredits();
+  testNaks();
+  testWrap();
+
+  const SimConfig configs[] = {
+    { "clean link", 0.0, 1, 32, 70000 },
+    { "5% loss, reordering", 0.05, 8, 16, 70000 },
+    { "20% loss, window above ring", 0.20, 12, 100, 70000 },
+    { "40% loss, window 4", 0.40, 4, 4, 20000 },
+  };
+  for (const SimConfig& config : configs) {
+    simulate(config);
+  }
+
+  printf("ble_flow_control: %d failures\n", failures);
+  return failures ? 1 : 0;
+}
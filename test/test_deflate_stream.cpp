@@ -0,0 +1,150 @@
+// Round trip of DeflateStream through zlib's inflate, for every wrapper and
+// window size, with inputs of at least three windows so slide() runs
+
+#include "DeflateStream.h"
+#include <zlib.h>
+#include <cstdio>
+#include <random>
+#include <string>
+#include <vector>
+
+static int failures = 0;
+
+#define CHECK(condition, ...)                   \
+  do {                                          \
+    if (!(condition)) {                         \
+      printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+      printf(__VA_ARGS__);                      \
+      printf("\n");                             \
+      failures++;                               \
+    }                                           \
+  } while (0)
+
+class VectorPrint : public Print {
+public:
+  std::vector<uint8_t> bytes;
+  size_t write(uint8_t b) override {
+    bytes.push_back(b);
+    return 1;
+  }
+  size_t write(const uint8_t* data, size_t len) override {
+    bytes.insert(bytes.end(), data, data + len);
+    return len;
+  }
+};
+
+static bool inflateAll(const std::vector<uint8_t>& in, DeflateWrapper wrapper, std::vector<uint8_t>& out) {
+  z_stream zs = {};
+  int windowBits = wrapper == DeflateWrapper::RAW ? -15 : wrapper == DeflateWrapper::ZLIB ? 15 : 16 + 15;
+  if (inflateInit2(&zs, windowBits) != Z_OK) return false;
+  zs.next_in = const_cast<uint8_t*>(in.data());
+  zs.avail_in = in.size();
+  uint8_t chunk[4096];
+  int result;
+  do {
+    zs.next_out = chunk;
+    zs.avail_out = sizeof(chunk);
+    result = inflate(&zs, Z_NO_FLUSH);
+    out.insert(out.end(), chunk, chunk + (sizeof(chunk) - zs.avail_out));
+  } while (result == Z_OK);
+  // Z_STREAM_END also means the CRC-32 / Adler-32 trailer matched
+  bool ok = result == Z_STREAM_END && zs.avail_in == 0;
+  inflateEnd(&zs);
+  return ok;
+}
+
+// JSON sample batch like the HTTP uploader sends
+static std::string sampleBatch(size_t minBytes, std::mt19937& rng) {
+  std::string text = "[";
+  for (int i = 0; text.size() < minBytes; i++) {
+    char sample[192];
+    snprintf(sample, sizeof(sample),
+             "%s{\"time\":%u,\"device_id\":\"D%04X\",\"register_id\":\"R%06X\",\"name\":\"temp_%d\","
+             "\"address\":%d,\"datatype\":\"FLOAT32\",\"value\":%.3f}",
+             i ? "," : "", 1760000000u + i, (unsigned)(rng() % 8), (unsigned)(rng() % 64), i % 50, 40001 + i % 50,
+             (rng() % 100000) / 1000.0);
+    text += sample;
+  }
+  return text + "]";
+}
+
+static std::string randomBytes(size_t size, std::mt19937& rng) {
+  std::string text(size, '\0');
+  for (char& c : text) c = (char)(rng() & 0xFF);
+  return text;
+}
+
+// A block repeated at a period just under the window, so matches reach
+// back the full distance and straddle every slide()
+static std::string farRepeats(size_t windowSize, size_t minBytes, std::mt19937& rng) {
+  std::string block = randomBytes(windowSize - 17, rng);
+  std::string text;
+  while (text.size() < minBytes) text += block;
+  return text;
+}
+
+static void roundTrip(const char* name, const std::string& input, uint8_t windowBits, DeflateWrapper wrapper,
+                      size_t chunkSize, bool expectSmaller) {
+  DeflateStream deflater(windowBits);
+  CHECK(deflater.isReady(), "%s: window not allocated", name);
+
+  // The same compressor is reused for two streams, as HttpManager does
+  for (int pass = 0; pass < 2; pass++) {
+    VectorPrint sink;
+    deflater.reset(sink, wrapper);
+    for (size_t offset = 0; offset < input.size(); offset += chunkSize) {
+      size_t n = min(chunkSize, input.size() - offset);
+      size_t written = deflater.write((const uint8_t*)input.data() + offset, n);
+      CHECK(written == n, "%s: write returned %zu of %zu", name, written, n);
+    }
+    CHECK(deflater.finish(), "%s: finish failed", name);
+    CHECK(deflater.bytesIn() == input.size(), "%s: bytesIn %u != %zu", name, deflater.bytesIn(), input.size());
+    CHECK(deflater.bytesOut() == sink.bytes.size(), "%s: bytesOut %u != %zu", name, deflater.bytesOut(),
+          sink.bytes.size());
+
+    std::vector<uint8_t> output;
+    bool ok = inflateAll(sink.bytes, wrapper, output);
+    CHECK(ok, "%s (bits %u, wrapper %d, chunk %zu, pass %d): inflate failed", name, windowBits, (int)wrapper,
+          chunkSize, pass);
+    CHECK(ok && output.size() == input.size() && (input.empty() || memcmp(output.data(), input.data(), input.size()) == 0),
+          "%s (bits %u, wrapper %d, chunk %zu, pass %d): output differs", name, windowBits, (int)wrapper, chunkSize,
+          pass);
+    if (expectSmaller) {
+      CHECK(sink.bytes.size() < input.size() / 2, "%s: %zu -> %zu bytes, expected at least 2x", name, input.size(),
+            sink.bytes.size());
+    }
+  }
+}
+
+int main() {
+  std::mt19937 rng(1210);
+  const DeflateWrapper wrappers[] = { DeflateWrapper::RAW, DeflateWrapper::ZLIB, DeflateWrapper::GZIP };
+  const size_t chunkSizes[] = { 1, 7, 512, 65536 };
+  int cases = 0;
+
+  for (uint8_t windowBits = 10; windowBits <= 14; windowBits += 2) {
+    size_t windowSize = (size_t)1 << windowBits;
+    size_t minBytes = windowSize * 3 + 123;  // At least three windows
+    std::string batch = sampleBatch(minBytes, rng);
+    std::string noise = randomBytes(minBytes, rng);
+    std::string repeats = farRepeats(windowSize, minBytes * 2, rng);
+
+    for (DeflateWrapper wrapper : wrappers) {
+      for (size_t chunkSize : chunkSizes) {
+        roundTrip("sample batch", batch, windowBits, wrapper, chunkSize, true);
+        roundTrip("random bytes", noise, windowBits, wrapper, chunkSize, false);
+        roundTrip("window-distance repeats", repeats, windowBits, wrapper, chunkSize, true);
+        cases += 3;
+      }
+    }
+  }
+
+  // Empty stream still carries a valid header and trailer
+  for (DeflateWrapper wrapper : wrappers) {
+    roundTrip("empty", "", 12, wrapper, 1, false);
+    cases++;
+  }
+
+  printf("deflate_stream: %d cases, %d failures\n", cases, failures);
+  return failures ? 1 : 0;
+}